@@ -10,6 +10,7 @@
 #include "tusb_option.h"
 #include "device/dcd.h"
 
+#include "dcd_no2usb.h"
 #include "dcd_no2usb_hw.h"
 
 #include <stdint.h>
@@ -17,6 +18,9 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifdef NO2USB_STATS_VENDOR_REQ
+#include "device/usbd.h"
+#endif
 
 
 /* ------------------------------------------------------------------------ */
@@ -75,20 +79,73 @@
 #endif
 
 
+/* ------------------------------------------------------------------------ */
+/* Statistics helpers                                                       */
+/* ------------------------------------------------------------------------ */
+
+#ifdef NO2USB_WITH_STATS
+
+# define USB_STATS_INC(field) do { \
+		g_stats.field++; \
+	} while (0)
+
+# define USB_STATS_EP(epnum, dir, field, val) do { \
+		g_stats.ep[epnum][dir].field += (val); \
+	} while (0)
+
+#else
+
+# define USB_STATS_INC(field)
+# define USB_STATS_EP(epnum, dir, field, val)
+
+#endif
+
+
 /* ------------------------------------------------------------------------ */
 /* Globals                                                                  */
 /* ------------------------------------------------------------------------ */
 
+/* Max number of BDs per EP */
+#ifdef NO2USB_WITH_BD_RING
+# if (NO2USB_WITH_BD_RING != 2) && (NO2USB_WITH_BD_RING != 4) && (NO2USB_WITH_BD_RING != 8)
+#  error "NO2USB_WITH_BD_RING must match the core BD_RING parameter (2, 4 or 8)"
+# endif
+# define BD_MAX NO2USB_WITH_BD_RING
+/* Slots in the pool (the core ignores 'rslot' bits past that) */
+# define RING_SLOTS ((NO2USB_WITH_BD_RING > 4) ? (128 / NO2USB_WITH_BD_RING) : 32)
+#else
+# define BD_MAX 2
+#endif
+
+/* BD triggered DMA copies */
+#if defined(NO2USB_DMA_BASE) && defined(NO2USB_DMA_SLOTS) && (NO2USB_DMA_SLOTS > 0)
+# if NO2USB_DMA_SLOTS > 4
+#  error "NO2USB_DMA_SLOTS must match the DMA SLOTS parameter (1 to 4)"
+# endif
+# define DMA_SLOTS NO2USB_DMA_SLOTS
+#endif
+
 /* EP state */
 struct dcd_ep {
 	/* EP state / config */
 	uint16_t mps;		/* Max Packet Size */
+	uint16_t bd_size;	/* Max bytes per BD (MPS, or chunk size in transfer mode) */
+#ifdef NO2USB_WITH_XFER
+	uint16_t bd_flags;	/* Extra BD flags (NO2USB_BD_XFER in transfer mode) */
+	uint16_t bd_base;	/* Buffer of BD 0 (next ones follow, bd_size apart) */
+	uint16_t bd_armed;	/* Length the OUT BD was armed with */
+#endif
+#ifdef NO2USB_WITH_AUTO_REARM
+	bool auto_rearm;	/* OUT BDs are re-armed by the core once cleared */
+#endif
 
 	bool busy;		/* xfer in progress */
-	bool dual;		/* dual bufferred */
+	uint8_t bd_msk;		/* BD index mask (0=single, 1=dual, n-1=ring) */
 	uint8_t bdi_fill;	/* Next buffer to fill */
 	uint8_t bdi_retire;	/* Next buffer to retire */
 
+	volatile struct no2usb_bd *bd;	/* BDs (in EP regs or in the pool) */
+
 	/* Current transfer */
 	struct {
 		uint8_t *buf;	/* Buffer (NULL for ZLP) */
@@ -96,6 +153,17 @@ struct dcd_ep {
 		uint16_t ofs;	/* Offset in the total transfer */
 		uint16_t plen;	/* Length of last queued packet */
 	} xfer;
+
+#ifdef NO2USB_WITH_STATS
+	uint16_t bd_len[BD_MAX];	/* Length queued in each BD (IN only) */
+#endif
+
+#ifdef DMA_SLOTS
+	uint8_t dma_slot;	/* DMA slot (1-based, 0=none) */
+	bool dma_busy;		/* Slot programmed for BD 'dma_bdi' */
+	uint8_t dma_bdi;
+	uint16_t dma_len;	/* Bytes copied (IN: packet length) */
+#endif
 };
 
 /* Global state */
@@ -103,6 +171,16 @@ static struct {
 	/* Memory allocator */
 	uint16_t mem[2];	/* [0]=OUT, [1]=IN */
 
+#ifdef NO2USB_WITH_BD_RING
+	/* BD pool allocator */
+	uint8_t ring_slot;
+#endif
+
+#ifdef DMA_SLOTS
+	/* EP address owning each DMA slot (0=free) */
+	uint8_t dma_ep[DMA_SLOTS];
+#endif
+
 	/* EP0 special */
 	bool ep0_stall;
 
@@ -110,6 +188,11 @@ static struct {
 	volatile struct dcd_ep ep[16][2];
 } g_usb;
 
+#ifdef NO2USB_WITH_STATS
+/* Counters (kept across bus resets) */
+static struct no2usb_stats g_stats;
+#endif
+
 
 /* ------------------------------------------------------------------------ */
 /* Internal functions                                                       */
@@ -130,6 +213,145 @@ _ep_state(uint8_t epnum, uint8_t dir)
 }
 
 
+#ifdef NO2USB_DMA_BASE
+#ifndef NO2USB_DMA_MIN_LEN
+# define NO2USB_DMA_MIN_LEN 16
+#endif
+
+static bool
+_usb_data_dma(uint32_t csr, unsigned int buf_ofs, const void *sys, int words)
+{
+	/* DMA only does aligned words, let the caller deal with the rest */
+	if ((((uintptr_t)sys) & 3) || ((words << 2) < NO2USB_DMA_MIN_LEN))
+		return false;
+
+	no2usb_dma->sys_addr = (uintptr_t)sys;
+	no2usb_dma->buf_addr = buf_ofs;
+	no2usb_dma->csr = NO2USB_DMA_CSR_START | NO2USB_DMA_CSR_DONE | csr | NO2USB_DMA_CSR_LEN(words);
+
+	/* Synchronous : callers expect the data in place on return */
+	while (no2usb_dma->csr & NO2USB_DMA_CSR_BUSY);
+
+	return true;
+}
+#endif
+
+#ifdef DMA_SLOTS
+static inline volatile struct no2usb_dma_slot *
+_usb_dma_slot(volatile struct dcd_ep *eps)
+{
+	return &no2usb_dma->slot[eps->dma_slot - 1];
+}
+
+static uint8_t
+_usb_dma_slot_alloc(uint8_t ep_addr)
+{
+	int i;
+
+	/* Keep the one we had (EP re-opened, disarm it), or take a free one */
+	for (i=0; i<DMA_SLOTS; i++)
+		if (g_usb.dma_ep[i] == ep_addr) {
+			no2usb_dma->slot[i].csr = NO2USB_DMA_SLOT_DONE;
+			return i + 1;
+		}
+
+	for (i=0; i<DMA_SLOTS; i++)
+		if (!g_usb.dma_ep[i]) {
+			g_usb.dma_ep[i] = ep_addr;
+			return i + 1;
+		}
+
+	return 0;
+}
+
+static bool
+_usb_dma_slot_start(volatile struct dcd_ep *eps, uint8_t epnum, uint8_t dir, int bdi,
+                    unsigned int buf_ofs, const void *sys, int len, bool now)
+{
+	volatile struct no2usb_dma_slot *slot;
+	int words;
+
+	if (!eps->dma_slot || eps->dma_busy)
+		return false;
+
+	/* IN packets are copied whole (like `_usb_data_write`), OUT ones only
+	 * up to the last full word, the CPU does the rest */
+	words = (dir == TUSB_DIR_IN) ? ((len + 3) >> 2) : (len >> 2);
+
+	if ((((uintptr_t)sys) & 3) || ((words << 2) < NO2USB_DMA_MIN_LEN))
+		return false;
+
+	/* Copy now, or as soon as the core is done with the BD */
+	slot = _usb_dma_slot(eps);
+	slot->sys_addr = (uintptr_t)sys;
+	slot->buf_addr = buf_ofs;
+	slot->csr =
+		(now ? NO2USB_DMA_SLOT_TRIG : NO2USB_DMA_SLOT_ARM) |
+		NO2USB_DMA_SLOT_DONE |
+		NO2USB_DMA_SLOT_BD(epnum, dir, bdi) |
+		NO2USB_DMA_SLOT_LEN(words);
+
+	eps->dma_busy = true;
+	eps->dma_bdi  = bdi;
+	eps->dma_len  = (dir == TUSB_DIR_IN) ? len : (words << 2);
+
+	return true;
+}
+
+static uint32_t
+_usb_dma_slot_release(volatile struct dcd_ep *eps)
+{
+	volatile struct no2usb_dma_slot *slot = _usb_dma_slot(eps);
+	uint32_t csr = slot->csr;
+
+	/* Can't while it's copying */
+	if (csr & NO2USB_DMA_SLOT_TRIG)
+		return csr;
+
+	/* Disarm / Ack completion */
+	slot->csr = NO2USB_DMA_SLOT_DONE;
+	eps->dma_busy = false;
+
+	return csr;
+}
+
+static int
+_usb_dma_slot_take(volatile struct dcd_ep *eps, int bdi)
+{
+	uint32_t csr;
+
+	/* OUT BD completed : bytes the DMA copied, 0 if it missed the trigger
+	 * (BD done before the slot was armed), -1 if it's still copying */
+	if (!eps->dma_busy || (eps->dma_bdi != bdi))
+		return 0;
+
+	csr = _usb_dma_slot_release(eps);
+
+	if (csr & NO2USB_DMA_SLOT_TRIG)
+		return -1;
+
+	return (csr & NO2USB_DMA_SLOT_DONE) ? eps->dma_len : 0;
+}
+
+static void
+_usb_dma_slot_kick(volatile struct dcd_ep *eps, int bdi)
+{
+	volatile struct no2usb_dma_slot *slot;
+	uint32_t csr;
+
+	/* IN BD retired while the slot still waits for it : it completed
+	 * before the slot was armed, so start the copy by hand */
+	if (!eps->dma_busy || (eps->dma_bdi != bdi))
+		return;
+
+	slot = _usb_dma_slot(eps);
+	csr  = slot->csr;
+
+	if (csr & NO2USB_DMA_SLOT_ARMED)
+		slot->csr = NO2USB_DMA_SLOT_TRIG | (csr & (NO2USB_DMA_SLOT_BD_MSK | NO2USB_DMA_SLOT_LEN(0xffff)));
+}
+#endif
+
 static void
 _usb_data_write(unsigned int dst_ofs, const void *src, int len)
 {
@@ -139,6 +361,12 @@ _usb_data_write(unsigned int dst_ofs, const void *src, int len)
 	volatile uint32_t *dst_u32 = (volatile uint32_t *)((NO2USB_DATA_TX_BASE) + dst_ofs);
 
 	len = (len + 3) >> 2;
+
+#ifdef NO2USB_DMA_BASE
+	if (_usb_data_dma(0, dst_ofs, src, len))
+		return;
+#endif
+
 	while (len--)
 		*dst_u32++ = *src_u32++;
 }
@@ -153,6 +381,14 @@ _usb_data_read (void *dst, unsigned int src_ofs, int len)
 
 	int i = len >> 2;
 
+#ifdef NO2USB_DMA_BASE
+	if (_usb_data_dma(NO2USB_DMA_CSR_DIR_RX, src_ofs, dst, i)) {
+		dst_u32 += i;
+		src_u32 += i;
+		i = 0;
+	}
+#endif
+
 	while (i--)
 		*dst_u32++ = *src_u32++;
 
@@ -186,6 +422,20 @@ _usb_hw_reset(bool pu)
 		_usb_hw_reset_ep(&no2usb_ep_regs[i].in);
 	}
 
+#ifdef NO2USB_WITH_BD_RING
+	/* Reset BD pool */
+	for (int i=0; i<128; i++) {
+		no2usb_bd_pool[i].csr = 0;
+		no2usb_bd_pool[i].ptr = 0;
+	}
+#endif
+
+#ifdef DMA_SLOTS
+	/* Disarm DMA slots (copies in progress just finish) */
+	for (int i=0; i<DMA_SLOTS; i++)
+		no2usb_dma->slot[i].csr = NO2USB_DMA_SLOT_DONE;
+#endif
+
 	/* Main control */
 	no2usb_regs->csr =
 		(pu ? NO2USB_CSR_PU_ENA : 0) |
@@ -208,34 +458,148 @@ _usb_hw_buf_alloc(uint8_t dir, int mps)
 }
 
 
+#ifdef NO2USB_WITH_WB32
+/* BD state, with the BD pointer in the upper half */
+# define _usb_bd_get(eps, bdi) (NO2USB_REGS_COMB(&(eps)->bd[bdi])->csr)
+# define _usb_bd_get_ptr(eps, bdi, bds) NO2USB_COMB_HI(bds)
+#else
+# define _usb_bd_get(eps, bdi) ((eps)->bd[bdi].csr)
+# define _usb_bd_get_ptr(eps, bdi, bds) ((eps)->bd[bdi].ptr)
+#endif
+
+#ifdef NO2USB_WITH_XFER
+# define _usb_bd_xfer(eps) ((eps)->bd_flags != 0)
+
+static inline unsigned int
+_usb_bd_ptr(volatile struct dcd_ep *eps, int bdi, uint32_t bds)
+{
+	/* In transfer mode, the pointer in the BD was advanced by the core */
+	if (eps->bd_flags)
+		return eps->bd_base + bdi * eps->bd_size;
+	else
+		return _usb_bd_get_ptr(eps, bdi, bds);
+}
+
+static inline void
+_usb_bd_arm(volatile struct dcd_ep *eps, int bdi, uint32_t csr)
+{
+	/* In transfer mode, the core advances the pointer, so reset it */
+	if (eps->bd_flags) {
+#ifdef NO2USB_WITH_WB32
+		NO2USB_REGS_COMB(&eps->bd[bdi])->csr = NO2USB_COMB(eps->bd_base + bdi * eps->bd_size, csr | eps->bd_flags);
+		return;
+#else
+		eps->bd[bdi].ptr = eps->bd_base + bdi * eps->bd_size;
+#endif
+	}
+
+	eps->bd[bdi].csr = csr | eps->bd_flags;
+}
+
+static int
+_usb_bd_out_len(volatile struct dcd_ep *eps)
+{
+	int len;
+
+	/* In transfer mode, don't accept more packets than the transfer needs */
+	if (!eps->bd_flags)
+		return eps->mps;
+
+	len = (eps->xfer.len - eps->xfer.ofs + eps->mps - 1) & ~(eps->mps - 1);
+
+	if (len < eps->mps)
+		len = eps->mps;
+	if (len > eps->bd_size)
+		len = eps->bd_size;
+
+	eps->bd_armed = len;
+
+	return len;
+}
+#else
+# define _usb_bd_xfer(eps) false
+# define _usb_bd_ptr(eps, bdi, bds) _usb_bd_get_ptr(eps, bdi, bds)
+# define _usb_bd_arm(eps, bdi, val) do { (eps)->bd[bdi].csr = (val); } while (0)
+# define _usb_bd_out_len(eps) ((eps)->mps)
+#endif
+
+#ifdef NO2USB_WITH_AUTO_REARM
+# define _usb_bd_auto(eps) ((eps)->auto_rearm)
+#else
+# define _usb_bd_auto(eps) false
+#endif
+
+static void
+_usb_ep_queue_in(const uint8_t epnum, volatile struct dcd_ep *eps)
+{
+	int len;
+
+	/* Submit packet loaded in the 'fill' BD */
+#ifdef NO2USB_WITH_STATS
+	eps->bd_len[eps->bdi_fill] = eps->xfer.plen;
+#endif
+	_usb_bd_arm(eps, eps->bdi_fill, NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->xfer.plen));
+
+	/* Next ! */
+	eps->bdi_fill = (eps->bdi_fill + 1) & eps->bd_msk;
+
+	/* Advance the transfer, and maybe finish it */
+	eps->xfer.ofs += eps->xfer.plen;
+
+	if (eps->xfer.ofs == eps->xfer.len)
+	{
+		len = eps->xfer.len;
+
+		eps->busy      = false;
+		eps->xfer.buf  = NULL;
+		eps->xfer.len  = 0;
+		eps->xfer.ofs  = 0;
+		eps->xfer.plen = 0;
+
+		USB_DEBUG(L_TRACE, "dcd_edpt_xfer_complete() EP%d IN  len %d", epnum, len);
+
+		dcd_event_xfer_complete(0, epnum | 0x80, len, XFER_RESULT_SUCCESS, true);
+	}
+}
+
 static void
 _usb_ep_advance_xfer_in(const uint8_t epnum)
 {
-	volatile struct no2usb_ep *epr = _ep_regs(epnum, TUSB_DIR_IN);
 	volatile struct dcd_ep *eps = _ep_state(epnum, TUSB_DIR_IN);
 
 	uint32_t bds;
-	int len;
+#ifdef NO2USB_WITH_STATS
+	bool retired = false;
+#endif
 
 	/* Retire done descriptors */
 	while (1)
 	{
 		/* Get BD status */
-		bds = epr->bd[eps->bdi_retire].csr;
+		bds = _usb_bd_get(eps, eps->bdi_retire);
 
 		/* Packet done ? */
 		if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_DONE_OK)
 		{
 			/* Reset the descriptor */
-			epr->bd[eps->bdi_retire].csr = 0;
+			eps->bd[eps->bdi_retire].csr = 0;
+
+#ifdef DMA_SLOTS
+			/* Refill queued too late for the trigger ? */
+			_usb_dma_slot_kick(eps, eps->bdi_retire);
+#endif
+
+			USB_STATS_EP(epnum, TUSB_DIR_IN, pkts, 1);
+			USB_STATS_EP(epnum, TUSB_DIR_IN, bytes, eps->bd_len[eps->bdi_retire]);
 		}
 
 		/* Errors are not valid for TX. The HW will auto retry and never report this */
 		else if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_DONE_ERR)
 		{
 			/* So if it happens ... reset things and hope for the best ? */
-			epr->bd[eps->bdi_retire].csr = 0;
+			eps->bd[eps->bdi_retire].csr = 0;
 
+			USB_STATS_EP(epnum, TUSB_DIR_IN, err, 1);
 			USB_DEBUG(L_ERROR, "NO2USB_BD_STATE_DONE_ERR on EP%d IN !", epnum);
 		}
 
@@ -246,18 +610,43 @@ _usb_ep_advance_xfer_in(const uint8_t epnum)
 		}
 
 		/* Next ! */
-		eps->bdi_retire ^= eps->dual;
+		eps->bdi_retire = (eps->bdi_retire + 1) & eps->bd_msk;
+#ifdef NO2USB_WITH_STATS
+		retired = true;
+#endif
 	}
 
 	/* If we don't have a transfer ... we have nothing to do ! */
 	if (!eps->busy)
 		return;
 
+#ifdef NO2USB_WITH_STATS
+	/* Did the hardware run out of queued data ? */
+	if (retired && ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_NONE))
+		USB_STATS_EP(epnum, TUSB_DIR_IN, starved, 1);
+#endif
+
 	/* Fill as many descriptors as possible */
 	while (eps->busy)
 	{
 		/* Get BD status */
-		bds = epr->bd[eps->bdi_fill].csr;
+		bds = _usb_bd_get(eps, eps->bdi_fill);
+
+#ifdef DMA_SLOTS
+		/* Packet being loaded by the DMA, submit it once done (its IRQ
+		 * brings us back here) */
+		if (eps->dma_busy)
+		{
+			if (((bds & NO2USB_BD_STATE_MSK) != NO2USB_BD_STATE_NONE) ||
+			    !(_usb_dma_slot(eps)->csr & NO2USB_DMA_SLOT_DONE))
+				break;
+
+			_usb_dma_slot_release(eps);
+			eps->xfer.plen = eps->dma_len;
+			_usb_ep_queue_in(epnum, eps);
+			continue;
+		}
+#endif
 
 		/* If BD is not used, then re-fill */
 		if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_NONE)
@@ -266,49 +655,48 @@ _usb_ep_advance_xfer_in(const uint8_t epnum)
 			if (eps->xfer.buf) {
 				/* Select packet size */
 				eps->xfer.plen = eps->xfer.len - eps->xfer.ofs;
-				if (eps->xfer.plen > eps->mps)
-					eps->xfer.plen = eps->mps;
+				if (eps->xfer.plen > eps->bd_size)
+					eps->xfer.plen = eps->bd_size;
+
+#ifdef DMA_SLOTS
+				/* Let the DMA load it */
+				if (_usb_dma_slot_start(eps, epnum, TUSB_DIR_IN, eps->bdi_fill,
+				                        _usb_bd_ptr(eps, eps->bdi_fill, bds),
+				                        &eps->xfer.buf[eps->xfer.ofs], eps->xfer.plen, true))
+					break;
+#endif
 
 				/* Fill data buffer */
-				_usb_data_write(epr->bd[eps->bdi_fill].ptr, &eps->xfer.buf[eps->xfer.ofs], eps->xfer.plen);
+				_usb_data_write(_usb_bd_ptr(eps, eps->bdi_fill, bds), &eps->xfer.buf[eps->xfer.ofs], eps->xfer.plen);
 			}
 
-			/* Submit packet */
-			epr->bd[eps->bdi_fill].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->xfer.plen);
-
-			/* Advance the transfer, and maybe finish it */
-			eps->xfer.ofs += eps->xfer.plen;
-
-			if (eps->xfer.ofs == eps->xfer.len)
-			{
-				len = eps->xfer.len;
-
-				eps->busy      = false;
-				eps->xfer.buf  = NULL;
-				eps->xfer.len  = 0;
-				eps->xfer.ofs  = 0;
-				eps->xfer.plen = 0;
-
-				USB_DEBUG(L_TRACE, "dcd_edpt_xfer_complete() EP%d IN  len %d", epnum, len);
+			_usb_ep_queue_in(epnum, eps);
+		}
+#ifdef DMA_SLOTS
+		/* All BDs queued : have the DMA reload this one as soon as it's sent */
+		else if (((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_RDY_DATA) && eps->xfer.buf)
+		{
+			int plen = eps->xfer.len - eps->xfer.ofs;
+			if (plen > eps->bd_size)
+				plen = eps->bd_size;
 
-				dcd_event_xfer_complete(0, epnum | 0x80, len, XFER_RESULT_SUCCESS, true);
-			}
+			_usb_dma_slot_start(eps, epnum, TUSB_DIR_IN, eps->bdi_fill,
+			                    _usb_bd_ptr(eps, eps->bdi_fill, bds),
+			                    &eps->xfer.buf[eps->xfer.ofs], plen, false);
+			break;
 		}
+#endif
 		else
 		{
 			/* No buffer ready to fill, we're done for now */
 			break;
 		}
-
-		/* Next ! */
-		eps->bdi_fill ^= eps->dual;
 	}
 }
 
 static void
 _usb_ep_advance_xfer_out(const uint8_t epnum)
 {
-	volatile struct no2usb_ep *epr = _ep_regs(epnum, TUSB_DIR_OUT);
 	volatile struct dcd_ep *eps = _ep_state(epnum, TUSB_DIR_OUT);
 
 	uint32_t bds;
@@ -318,31 +706,49 @@ _usb_ep_advance_xfer_out(const uint8_t epnum)
 	while (1)
 	{
 		/* Get BD status */
-		bds = epr->bd[eps->bdi_retire].csr;
+		bds = _usb_bd_get(eps, eps->bdi_retire);
 
 		/* Packet done ? */
 		if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_DONE_OK)
 		{
+			int dma_len = 0;
+
 			/* We have data ! And nowhere to put it ... abort */
 			if (!eps->busy)
 				break;
 
+#ifdef DMA_SLOTS
+			/* Still being copied, the DMA IRQ brings us back */
+			if ((dma_len = _usb_dma_slot_take(eps, eps->bdi_retire)) < 0)
+				break;
+#endif
+
 			/* Get packet length */
+#ifdef NO2USB_WITH_XFER
+			if (eps->bd_flags)
+				eps->xfer.plen = eps->bd_armed - (bds & NO2USB_BD_LEN_MSK);	/* BD has what's left */
+			else
+#endif
 			eps->xfer.plen = (bds & NO2USB_BD_LEN_MSK) - 2;
+
+			USB_STATS_EP(epnum, TUSB_DIR_OUT, pkts, 1);
+			USB_STATS_EP(epnum, TUSB_DIR_OUT, bytes, eps->xfer.plen);
+
 			if (eps->xfer.plen > (eps->xfer.len - eps->xfer.ofs))
 				eps->xfer.plen = eps->xfer.len - eps->xfer.ofs;
 
 			/* Reset the descriptor */
-			epr->bd[eps->bdi_retire].csr = 0;
+			eps->bd[eps->bdi_retire].csr = 0;
 
-			/* Grab data from buffer (if any) */
+			/* Grab data from buffer (if any, and not already copied by the DMA) */
 			if (eps->xfer.plen) {
-				_usb_data_read(&eps->xfer.buf[eps->xfer.ofs], epr->bd[eps->bdi_retire].ptr, eps->xfer.plen);
+				if (eps->xfer.plen > dma_len)
+					_usb_data_read(&eps->xfer.buf[eps->xfer.ofs + dma_len], _usb_bd_ptr(eps, eps->bdi_retire, bds) + dma_len, eps->xfer.plen - dma_len);
 				eps->xfer.ofs += eps->xfer.plen;
 			}
 
 			/* End of transfer when requested length is reached, or a short transfer from host */
-			if ((eps->xfer.plen < eps->mps) || (eps->xfer.len == eps->xfer.ofs))
+			if ((eps->xfer.plen < eps->bd_size) || (eps->xfer.len == eps->xfer.ofs))
 			{
 				len = eps->xfer.ofs;
 
@@ -361,8 +767,31 @@ _usb_ep_advance_xfer_out(const uint8_t epnum)
 		/* Or maybe an error ? */
 		else if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_DONE_ERR)
 		{
-			/* Just retry */
-			epr->bd[0].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->mps);
+#ifdef DMA_SLOTS
+			/* Drop the slot, it's set up again for the next BD below */
+			_usb_dma_slot_take(eps, eps->bdi_retire);
+#endif
+
+#ifdef NO2USB_WITH_XFER
+			/* In transfer mode, keep packets received before the error */
+			if (eps->bd_flags && eps->busy) {
+				eps->xfer.plen = eps->bd_armed - (bds & NO2USB_BD_LEN_MSK);
+				if (eps->xfer.plen > (eps->xfer.len - eps->xfer.ofs))
+					eps->xfer.plen = eps->xfer.len - eps->xfer.ofs;
+				if (eps->xfer.plen) {
+					_usb_data_read(&eps->xfer.buf[eps->xfer.ofs], _usb_bd_ptr(eps, eps->bdi_retire, bds), eps->xfer.plen);
+					eps->xfer.ofs += eps->xfer.plen;
+				}
+			}
+#endif
+
+			/* Just retry (clearing the BD is enough in auto-rearm mode) */
+			if (_usb_bd_auto(eps))
+				eps->bd[eps->bdi_retire].csr = 0;
+			else
+				_usb_bd_arm(eps, eps->bdi_retire, NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(_usb_bd_out_len(eps)));
+
+			USB_STATS_EP(epnum, TUSB_DIR_OUT, err, 1);
 		}
 
 		/* Ok, current BD was neither done or error, we stop here */
@@ -372,21 +801,23 @@ _usb_ep_advance_xfer_out(const uint8_t epnum)
 		}
 
 		/* Next ! */
-		eps->bdi_retire ^= eps->dual;
+		eps->bdi_retire = (eps->bdi_retire + 1) & eps->bd_msk;
 	}
 
 	/* Prepare any descriptors that's not ready */
 	while (1)
 	{
 		/* Get BD status */
-		bds = epr->bd[eps->bdi_fill].csr;
+		bds = _usb_bd_get(eps, eps->bdi_fill);
 
 		/* Refill only if not initialized. If there is something, we're done for now */
 		/* For EP0, we don't prefill, so only init if we have a transfer pending */
-		if (((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_NONE) &&
-		    (eps->busy || (epnum != 0)))
+		/* In transfer mode, the length depends on the transfer, so no prefill either */
+		/* In auto-rearm mode, the core considers empty BDs as armed already */
+		if (((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_NONE) && !_usb_bd_auto(eps) &&
+		    (eps->busy || ((epnum != 0) && !_usb_bd_xfer(eps))))
 		{
-			epr->bd[eps->bdi_fill].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->mps);
+			_usb_bd_arm(eps, eps->bdi_fill, NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(_usb_bd_out_len(eps)));
 		}
 		else
 		{
@@ -395,8 +826,28 @@ _usb_ep_advance_xfer_out(const uint8_t epnum)
 		}
 
 		/* Next ! */
-		eps->bdi_fill ^= eps->dual;
+		eps->bdi_fill = (eps->bdi_fill + 1) & eps->bd_msk;
 	}
+
+#ifdef DMA_SLOTS
+	/* Have the DMA grab the next packet as soon as it's received. A short
+	 * one may get more copied than it has, but never past the buffer */
+	if (eps->busy && eps->xfer.buf && !eps->dma_busy)
+	{
+		bds = _usb_bd_get(eps, eps->bdi_retire);
+
+		if ((bds & NO2USB_BD_STATE_MSK) == NO2USB_BD_STATE_RDY_DATA)
+		{
+			len = eps->xfer.len - eps->xfer.ofs;
+			if (len > eps->bd_size)
+				len = eps->bd_size;
+
+			_usb_dma_slot_start(eps, epnum, TUSB_DIR_OUT, eps->bdi_retire,
+			                    _usb_bd_ptr(eps, eps->bdi_retire, bds),
+			                    &eps->xfer.buf[eps->xfer.ofs], len, false);
+		}
+	}
+#endif
 }
 
 static void
@@ -423,6 +874,12 @@ _usb_ep0_configure(void)
 	/* EP DCD config */
 	g_usb.ep[0][TUSB_DIR_IN].mps  = mps;
 	g_usb.ep[0][TUSB_DIR_OUT].mps = mps;
+
+	g_usb.ep[0][TUSB_DIR_IN].bd_size  = mps;
+	g_usb.ep[0][TUSB_DIR_OUT].bd_size = mps;
+
+	g_usb.ep[0][TUSB_DIR_IN].bd  = ep0r->in.bd;
+	g_usb.ep[0][TUSB_DIR_OUT].bd = ep0r->out.bd;
 }
 
 static void
@@ -434,6 +891,9 @@ _usb_ep0_handle_setup(void)
 	{
 		uint8_t setup_pkt[8];
 
+		USB_STATS_EP(0, TUSB_DIR_OUT, pkts, 1);
+		USB_STATS_EP(0, TUSB_DIR_OUT, bytes, 8);
+
 		/* If there is still IN/OUT pending from before SETUP, make
 		 * sure to finish them */
 		if (g_usb.ep[0][TUSB_DIR_IN].busy)
@@ -467,6 +927,8 @@ _usb_ep0_handle_setup(void)
 	{
 		/* Just setup a new one ... */
 		no2usb_ep_regs[0].out.bd[1].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(8);
+
+		USB_STATS_EP(0, TUSB_DIR_OUT, err, 1);
 	}
 }
 
@@ -476,6 +938,8 @@ _usb_bus_reset(void)
 {
 	USB_DEBUG(L_TRACE, "_usb_bus_reset()");
 
+	USB_STATS_INC(bus_reset);
+
 	/* Reset hardware */
 	_usb_hw_reset(true);
 
@@ -504,6 +968,11 @@ dcd_init(uint8_t rhport)
 	/* Main state reset */
 	memset(&g_usb, 0x00, sizeof(g_usb));
 
+#ifdef NO2USB_RX_TIMEOUT
+	/* Custom host turnaround timeout */
+	no2usb_regs->rto = NO2USB_RX_TIMEOUT;
+#endif
+
 	/* Reset and enable the core */
 	_usb_hw_reset(true);
 }
@@ -521,6 +990,10 @@ dcd_int_enable(uint8_t rhport)
 #endif
 		NO2USB_IR_EVT_PENDING |
 		NO2USB_IR_BUS_RST_RELEASE;
+
+#ifdef DMA_SLOTS
+	no2usb_dma->slot_csr = NO2USB_DMA_SLOT_CSR_IRQ_ENA;
+#endif
 }
 
 void
@@ -531,14 +1004,51 @@ dcd_int_disable(uint8_t rhport)
 	USB_DEBUG(L_EXTRA, "dcd_int_disable()");
 
 	no2usb_regs->ir = 0;
+
+#ifdef DMA_SLOTS
+	no2usb_dma->slot_csr = 0;
+#endif
 }
 
-void
-dcd_int_handler(uint8_t rhport)
+#ifdef DMA_SLOTS
+static void
+_usb_dma_int_handler(void)
+{
+	uint32_t done = no2usb_dma->slot_csr & NO2USB_DMA_SLOT_CSR_DONE_MSK;
+
+	for (int i=0; i<DMA_SLOTS; i++)
+	{
+		uint8_t ep_addr = g_usb.dma_ep[i];
+
+		if (!(done & (1 << i)))
+			continue;
+
+		/* Leftover from before a bus reset, just ack it */
+		if (!ep_addr || !_ep_state(tu_edpt_number(ep_addr), tu_edpt_dir(ep_addr))->dma_busy) {
+			no2usb_dma->slot[i].csr = NO2USB_DMA_SLOT_DONE;
+			continue;
+		}
+
+		/* Advancing the transfer picks up the copied packet */
+		if (tu_edpt_dir(ep_addr) == TUSB_DIR_IN)
+			_usb_ep_advance_xfer_in(tu_edpt_number(ep_addr));
+		else
+			_usb_ep_advance_xfer_out(tu_edpt_number(ep_addr));
+	}
+}
+#endif
+
+static void
+_usb_int_handler(void)
 {
 	uint32_t csr = no2usb_regs->csr;
 	bool do_ep_poll = false;
 
+#ifdef DMA_SLOTS
+	/* BD triggered copies done (even during a bus reset, to ack them) */
+	_usb_dma_int_handler();
+#endif
+
 	/* Handle resets */
 	if (csr & NO2USB_CSR_BUS_RST_PENDING) {
 		if (csr & NO2USB_CSR_BUS_RST) {
@@ -576,6 +1086,7 @@ dcd_int_handler(uint8_t rhport)
 
 		/* If an overflow occured, we need to do a full poll */
 		if (evt & NO2USB_EVT_OVERFLOW) {
+			USB_STATS_INC(evt_overflow);
 			USB_DEBUG(L_ERROR, "Event FIFO overflow");
 			do_ep_poll = true;
 			continue;
@@ -628,6 +1139,27 @@ dcd_int_handler(uint8_t rhport)
 	}
 }
 
+void
+dcd_int_handler(uint8_t rhport)
+{
+	(void) rhport;
+
+#if defined(NO2USB_WITH_STATS) && defined(NO2USB_STATS_TIME)
+	uint32_t t0, dt;
+
+	t0 = NO2USB_STATS_TIME();
+	_usb_int_handler();
+	dt = NO2USB_STATS_TIME() - t0;
+
+	if (dt > g_stats.irq_max)
+		g_stats.irq_max = dt;
+#else
+	_usb_int_handler();
+#endif
+
+	USB_STATS_INC(irq_count);
+}
+
 void
 dcd_set_address(uint8_t rhport, uint8_t dev_addr)
 {
@@ -684,6 +1216,7 @@ dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_edpt)
 
 	volatile struct no2usb_ep *epr = _ep_regs(epnum, dir);
 	volatile struct dcd_ep *eps = _ep_state(epnum, dir);
+	uint32_t status;
 	int type = 0;
 	bool dual = false;
 
@@ -716,20 +1249,60 @@ dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_edpt)
 	/* Setup EP DCD state */
 	memset((void*)eps, 0x00, sizeof(*eps));
 	eps->mps = desc_edpt->wMaxPacketSize.size;
-	eps->dual = dual;
+	eps->bd_size = eps->mps;
+
+#ifdef NO2USB_WITH_XFER
+	/* Bulk EPs use transfer mode BDs, each covering several packets.
+	 * OUT is single buffered since BDs can only be armed once the
+	 * transfer length is known */
+	if (type == NO2USB_EP_TYPE_BULK) {
+		eps->bd_size  = NO2USB_WITH_XFER;
+		eps->bd_flags = NO2USB_BD_XFER;
+		eps->bd_base  = g_usb.mem[dir];
+
+		if (dir == TUSB_DIR_OUT)
+			dual = false;
+	}
+#endif
 
-	/* Setup the BDs */
-	epr->bd[0].ptr =        _usb_hw_buf_alloc(dir, eps->mps);
-	epr->bd[1].ptr = dual ? _usb_hw_buf_alloc(dir, eps->mps) : 0;
-	epr->bd[0].csr = 0;
-	epr->bd[1].csr = 0;
+	eps->bd_msk = dual ? 1 : 0;
+	eps->bd = epr->bd;
 
-	if (dir == TUSB_DIR_OUT) {
-		epr->bd[0].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->mps);
-		epr->bd[1].csr = NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->mps);
+	status = type | (dual ? NO2USB_EP_BD_DUAL : 0);
+
+#ifdef NO2USB_WITH_AUTO_REARM
+	/* Let the core re-arm OUT BDs by itself, we just clear them once read */
+	if ((dir == TUSB_DIR_OUT) && !_usb_bd_xfer(eps)) {
+		eps->auto_rearm = true;
+		status |= NO2USB_EP_AUTO_REARM;
 	}
+#endif
 
-	epr->status = type | (dual ? NO2USB_EP_BD_DUAL : 0);
+#ifdef NO2USB_WITH_BD_RING
+	/* Use a BD ring instead of double buffering if any are left */
+	if (dual && !_usb_bd_xfer(eps) && (g_usb.ring_slot < RING_SLOTS)) {
+		eps->bd_msk = NO2USB_WITH_BD_RING - 1;
+		eps->bd = &no2usb_bd_pool[g_usb.ring_slot * NO2USB_WITH_BD_RING];
+		status = type | NO2USB_EP_BD_RING | NO2USB_EP_RING_SLOT(g_usb.ring_slot);
+		g_usb.ring_slot++;
+	}
+#endif
+
+#ifdef DMA_SLOTS
+	/* BD triggered copies, only for plain BDs (the trigger only tells BD 0 from 1) */
+	if (!_usb_bd_xfer(eps) && !_usb_bd_auto(eps) && (eps->bd_msk <= 1))
+		eps->dma_slot = _usb_dma_slot_alloc(desc_edpt->bEndpointAddress);
+#endif
+
+	/* Setup the BDs */
+	for (int i=0; i<=eps->bd_msk; i++) {
+		eps->bd[i].ptr = _usb_hw_buf_alloc(dir, eps->bd_size);
+		eps->bd[i].csr = ((dir == TUSB_DIR_OUT) && !_usb_bd_xfer(eps) && !_usb_bd_auto(eps)) ?
+			(NO2USB_BD_STATE_RDY_DATA | NO2USB_BD_LEN(eps->mps)) : 0;
+	}
+
+	epr->cfg = NO2USB_EP_CFG_MPS(eps->mps);
+	epr->status = status;
 
 	return true;
 }
@@ -840,9 +1413,9 @@ dcd_edpt_debug(uint8_t rhport, uint8_t ep_addr)
 		(unsigned int)epr->status,
 		(unsigned int)epr->bd[0].csr,
 		(unsigned int)epr->bd[1].csr);
-	printf(" eps: busy=%d, dual=%d, bdi_fill=%d, bdi_retire=%d, buf=%08x, len=%d, ofs=%d, plen=%d\n",
+	printf(" eps: busy=%d, bd_msk=%d, bdi_fill=%d, bdi_retire=%d, buf=%08x, len=%d, ofs=%d, plen=%d\n",
 		eps->busy,
-		eps->dual,
+		eps->bd_msk,
 		eps->bdi_fill,
 		eps->bdi_retire,
 		(unsigned int)eps->xfer.buf,
@@ -850,3 +1423,57 @@ dcd_edpt_debug(uint8_t rhport, uint8_t ep_addr)
 		eps->xfer.ofs,
 		eps->xfer.plen);
 }
+
+
+/* ------------------------------------------------------------------------ */
+/* Statistics API                                                           */
+/* ------------------------------------------------------------------------ */
+
+#ifdef NO2USB_WITH_STATS
+
+void
+dcd_no2usb_stats_get(struct no2usb_stats *stats, bool clear)
+{
+	uint32_t ir;
+
+	/* Mask the core IRQ, restoring whatever the caller had */
+	ir = no2usb_regs->ir;
+	no2usb_regs->ir = 0;
+
+	if (stats)
+		memcpy(stats, &g_stats, sizeof(g_stats));
+
+	if (clear)
+		memset(&g_stats, 0x00, sizeof(g_stats));
+
+	no2usb_regs->ir = ir;
+}
+
+#ifdef NO2USB_STATS_VENDOR_REQ
+bool
+dcd_no2usb_stats_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+{
+	/* Snapshot buffer, must remain valid during the data stage */
+	static struct no2usb_stats stats;
+
+	/* Only handle our request */
+	if ((request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR) ||
+	    (request->bRequest != NO2USB_STATS_VENDOR_REQ))
+		return false;
+
+	/* Nothing to do past the SETUP stage */
+	if (stage != CONTROL_STAGE_SETUP)
+		return true;
+
+	/* Only device-to-host reads, wValue != 0 clears after snapshot */
+	if (request->bmRequestType_bit.direction != TUSB_DIR_IN)
+		return false;
+
+	dcd_no2usb_stats_get(&stats, request->wValue != 0);
+
+	return tud_control_xfer(rhport, request, &stats,
+		(request->wLength < sizeof(stats)) ? request->wLength : sizeof(stats));
+}
+#endif
+
+#endif /* NO2USB_WITH_STATS */
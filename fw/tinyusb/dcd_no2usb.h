@@ -0,0 +1,48 @@
+/*
+ * dcd_no2usb.h
+ *
+ * Driver specific API for the no2usb core driver
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dcd_no2usb_config.h"
+
+
+#ifdef NO2USB_WITH_STATS
+
+/* Per-endpoint counters */
+struct no2usb_ep_stats {
+	uint32_t pkts;		/* Packets successfully completed */
+	uint32_t bytes;		/* Payload bytes moved */
+	uint32_t err;		/* BDs retired with DONE_ERR (and retried) */
+	uint32_t starved;	/* IN queue ran dry while a transfer was pending */
+} __attribute__((packed,aligned(4)));
+
+/* Global counters */
+struct no2usb_stats {
+	uint32_t bus_reset;	/* Bus resets seen */
+	uint32_t evt_overflow;	/* Event FIFO overflows (forced full poll) */
+	uint32_t irq_count;	/* Interrupt handler calls */
+	uint32_t irq_max;	/* Longest handler run (NO2USB_STATS_TIME units) */
+	struct no2usb_ep_stats ep[16][2];	/* [0]=OUT, [1]=IN */
+} __attribute__((packed,aligned(4)));
+
+/* Get a snapshot of the counters, optionally clearing them.
+ * Leaves the core IRQ enables as they were on entry */
+void dcd_no2usb_stats_get(struct no2usb_stats *stats, bool clear);
+
+#ifdef NO2USB_STATS_VENDOR_REQ
+#include "common/tusb_types.h"
+
+/* To be called from the application tud_vendor_control_xfer_cb() */
+bool dcd_no2usb_stats_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request);
+#endif
+
+#endif /* NO2USB_WITH_STATS */
@@ -23,3 +23,51 @@
 	/* Only enable this if the core was configured with event FIFO
 	 * enabled with at least a depth of 4 */
 /* #define NO2USB_WITH_EVENT_FIFO 1 */
+
+/* Enable/Disable per-endpoint traffic and error counters */
+	/* Counters are read with dcd_no2usb_stats_get() (see dcd_no2usb.h).
+	 * Define NO2USB_STATS_TIME() to an expression returning a free running
+	 * 32 bits cycle counter to also track the longest interrupt handler
+	 * run. Define NO2USB_STATS_VENDOR_REQ to a bRequest value to allow
+	 * dcd_no2usb_stats_control_xfer_cb() to serve them to the host */
+/* #define NO2USB_WITH_STATS 1 */
+/* #define NO2USB_STATS_TIME() rdcycle() */
+/* #define NO2USB_STATS_VENDOR_REQ 0x4e */
+
+/* Enable/Disable usage of BD rings for bulk endpoints */
+	/* Only enable this if the core was configured with the BD_RING
+	 * option and set it to the same value (2, 4 or 8 BDs per ring) */
+/* #define NO2USB_WITH_BD_RING 8 */
+
+/* Enable/Disable usage of the optional DMA block for data copies */
+	/* Define to the base address of the `usb_dma` control registers if
+	 * the SoC includes it. Only aligned copies are offloaded, the rest
+	 * still uses CPU copies */
+/* #define NO2USB_DMA_BASE         0x???????? */
+/* #define NO2USB_DMA_MIN_LEN      16 */
+	/* Set to the SLOTS option of the DMA block to have copies of
+	 * non-control endpoints triggered by their BD completion instead
+	 * of waited for. The DMA interrupt must then also lead to
+	 * `dcd_int_handler()` (e.g. OR-ed with the core one) */
+/* #define NO2USB_DMA_SLOTS        4 */
+
+/* Enable/Disable multi-packet transfer mode BDs for bulk endpoints */
+	/* Only enable this if the core was configured with the XFER option.
+	 * Set it to the buffer size used for each BD, it must be a multiple
+	 * of the max packet size and less than 1024 */
+/* #define NO2USB_WITH_XFER 512 */
+
+/* Enable/Disable auto-rearm mode for OUT endpoints */
+	/* Only enable this if the core was configured with the AUTO_REARM
+	 * option. Empty OUT BDs are then re-armed by the core itself */
+/* #define NO2USB_WITH_AUTO_REARM 1 */
+
+/* Enable/Disable combined BD accesses */
+	/* Only enable this if the core was configured with a 32 bits bus
+	 * (WB_DW=32). BD state and pointer are then read / written at once */
+/* #define NO2USB_WITH_WB32 1 */
+
+/* Override the RX timeout (waiting for the host to answer) */
+	/* In core clock cycles, default is 70 at 48 MHz. Increase it if long cables,
+	 * hubs or isolators cause spurious retries */
+/* #define NO2USB_RX_TIMEOUT 70 */
@@ -19,6 +19,18 @@ struct no2usb_core {
 	uint32_t ar;
 	uint32_t evt;
 	uint32_t ir;
+	uint32_t evt_ts_frame;	/* Requires EVT_RAM core option */
+	uint32_t evt_ts_sub;	/* Requires EVT_RAM core option */
+	uint32_t sof_frame;
+	uint32_t sof_sub;
+	uint32_t sof_missed;
+	uint32_t rto;
+	uint32_t dsc;		/* Requires DESC core option */
+	uint32_t stats_ctl;	/* Requires STATS core option */
+	uint32_t stats_data;	/* Requires STATS core option */
+	uint32_t trace_ctl;	/* Requires TRACE core option */
+	uint32_t trace_flt;	/* Requires TRACE core option */
+	uint32_t trace_data;	/* Requires TRACE core option */
 } __attribute__((packed,aligned(4)));
 
 #define NO2USB_CSR_PU_ENA		(1 << 15)
@@ -45,6 +57,32 @@ struct no2usb_core {
 #define NO2USB_EVT_IS_SETUP		(1 <<  2)
 #define NO2USB_EVT_BD_IDX		(1 <<  1)
 
+#define NO2USB_SOF_FRAME_VALID		(1 << 15)
+#define NO2USB_SOF_FRAME_NUM(x)		((x) & 0x7ff)
+
+#define NO2USB_DSC_ENA			(1 << 15)
+#define NO2USB_DSC_MPS(n)		(((__builtin_ctz(n) - 3) & 3) << 11)
+#define NO2USB_DSC_BASE(x)		((x) & 0x7ff)
+
+#define NO2USB_STATS_SNAPSHOT		(1 << 15)
+#define NO2USB_STATS_CLEAR		(1 << 14)
+#define NO2USB_STATS_SEL_BS_ERR		0x00
+#define NO2USB_STATS_SEL_RX_ERR		0x01
+#define NO2USB_STATS_SEL_RX_TIMEOUT	0x02
+#define NO2USB_STATS_SEL_TX_NAK		0x03
+#define NO2USB_STATS_SEL_TX_STALL	0x04
+#define NO2USB_STATS_SEL_NO_EP		0x05
+#define NO2USB_STATS_SEL_EP_NAK(ep_addr)	(0x20 | (((ep_addr) & 0xf) << 1) | (((ep_addr) >> 7) & 1))
+
+#define NO2USB_TRACE_ENA		(1 << 15)
+#define NO2USB_TRACE_CLEAR		(1 << 14)	/* Write only */
+#define NO2USB_TRACE_TRIGGERED		(1 << 14)	/* Read only */
+#define NO2USB_TRACE_STOP_ERR		(1 << 13)	/* Write only */
+#define NO2USB_TRACE_OVERFLOW		(1 << 13)	/* Read only */
+#define NO2USB_TRACE_EP_FILTER(ep)	((1 << 12) | (((ep) & 0xf) << 8))
+#define NO2USB_TRACE_COUNT(x)		((x) & 0x1ff)
+#define NO2USB_TRACE_PID(pid)		(1 << (pid))
+
 #define NO2USB_IR_SOF_PENDING		(1 <<  5)
 #define NO2USB_IR_EVT_PENDING		(1 <<  4)
 #define NO2USB_IR_BUS_SUSPEND		(1 <<  3)
@@ -53,13 +91,16 @@ struct no2usb_core {
 #define NO2USB_IR_BUS_RST_PENDING	(1 <<  0)
 
 
+struct no2usb_bd {
+	uint32_t csr;
+	uint32_t ptr;
+} __attribute__((packed,aligned(4)));
+
 struct no2usb_ep {
 	uint32_t status;
-	uint32_t _rsvd[3];
-	struct {
-		uint32_t csr;
-		uint32_t ptr;
-	} bd[2];
+	uint32_t _rsvd[2];
+	uint32_t cfg;
+	struct no2usb_bd bd[2];
 } __attribute__((packed,aligned(4)));
 
 struct no2usb_ep_pair {
@@ -80,6 +121,17 @@ struct no2usb_ep_pair {
 #define NO2USB_EP_BD_IDX		0x0040
 #define NO2USB_EP_BD_CTRL		0x0020
 #define NO2USB_EP_BD_DUAL		0x0010
+#define NO2USB_EP_BD_RING		0x0030		/* Requires BD_RING core option */
+#define NO2USB_EP_RING_SLOT(x)		(((x) & 0x1f) << 11)
+#define NO2USB_EP_RING_IDX(x)		(((x) & 7) << 8)
+#define NO2USB_EP_GET_RING_IDX(x)	(((x) >> 8) & 7)
+#define NO2USB_EP_AUTO_REARM		0x0008		/* OUT only, requires AUTO_REARM core option */
+
+#define NO2USB_EP_CFG_MPS(x)		((x) & 0x3ff)		/* Max Packet Size, used by transfer mode BDs */
+#define NO2USB_EP_CFG_OVERWRITE		0x0400		/* Auto-rearm: reuse BDs not yet consumed */
+#define NO2USB_EP_CFG_NTF_MASK		0x0800		/* Notify control: no events for this EP */
+#define NO2USB_EP_CFG_NTF_SHORT		0x1000		/* Notify control: only on short packets */
+#define NO2USB_EP_CFG_NTF_DIV(n)	((((n)-1) & 7) << 13)	/* Notify control: one event every n */
 
 #define NO2USB_BD_STATE_MSK		0xe000
 #define NO2USB_BD_STATE_NONE		0x0000
@@ -88,10 +140,61 @@ struct no2usb_ep_pair {
 #define NO2USB_BD_STATE_DONE_OK		0x8000
 #define NO2USB_BD_STATE_DONE_ERR	0xa000
 #define NO2USB_BD_IS_SETUP		0x1000
+#define NO2USB_BD_XFER		0x0800		/* Multi-packet transfer (requires XFER core option) */
+#define NO2USB_BD_XFER_ZLP	0x0400		/* IN: end a MPS-aligned transfer (or full packet) with a ZLP (requires XFER core option) */
+#define NO2USB_BD_OVERRUN	0x0400		/* Auto-rearm: previous BD content was overwritten */
 
 #define NO2USB_BD_LEN(l)		((l) & 0x3ff)
 #define NO2USB_BD_LEN_MSK		0x03ff
 
 
+struct no2usb_dma_slot {
+	uint32_t csr;
+	uint32_t sys_addr;
+	uint32_t buf_addr;
+	uint32_t _rsvd;
+} __attribute__((packed,aligned(4)));
+
+struct no2usb_dma {
+	uint32_t csr;
+	uint32_t sys_addr;
+	uint32_t buf_addr;
+	uint32_t slot_csr;
+	struct no2usb_dma_slot slot[4];	/* Requires SLOTS option (0 to 4) */
+} __attribute__((packed,aligned(4)));
+
+#define NO2USB_DMA_CSR_START		(1 << 31)	/* Write */
+#define NO2USB_DMA_CSR_BUSY		(1 << 31)	/* Read */
+#define NO2USB_DMA_CSR_DIR_RX		(1 << 30)
+#define NO2USB_DMA_CSR_IRQ_ENA		(1 << 29)
+#define NO2USB_DMA_CSR_DONE		(1 << 28)
+#define NO2USB_DMA_CSR_LEN(x)		((x) & 0xffff)	/* In 32 bits words */
+
+#define NO2USB_DMA_SLOT_CSR_IRQ_ENA	(1 << 31)
+#define NO2USB_DMA_SLOT_CSR_DONE_MSK	0x0000000f	/* Read, one bit per slot */
+
+#define NO2USB_DMA_SLOT_ARM		(1 << 31)	/* Write: copy once the BD completes */
+#define NO2USB_DMA_SLOT_ARMED		(1 << 31)	/* Read */
+#define NO2USB_DMA_SLOT_TRIG		(1 << 30)	/* Write: copy now / Read: pending or copying */
+#define NO2USB_DMA_SLOT_DONE		(1 << 28)	/* Write 1 to clear */
+#define NO2USB_DMA_SLOT_BD(ep, dir, bdi)	(((((ep) & 0xf) << 2) | (((dir) & 1) << 1) | ((bdi) & 1)) << 16)
+#define NO2USB_DMA_SLOT_BD_MSK		0x003f0000
+#define NO2USB_DMA_SLOT_LEN(x)		((x) & 0xffff)	/* In 32 bits words */
+
+
 static volatile struct no2usb_core *    const no2usb_regs    = (void*) (NO2USB_CORE_BASE);
 static volatile struct no2usb_ep_pair * const no2usb_ep_regs = (void*)((NO2USB_CORE_BASE) + (1 << 13));
+static volatile struct no2usb_bd *      const no2usb_bd_pool = (void*)((NO2USB_CORE_BASE) + (1 << 13) + (1 << 10));
+
+#ifdef NO2USB_WITH_WB32
+/* Combined accesses (requires the WB_DW=32 core option). Same layout as the
+ * EP regs / BD pool, but `status` is { status, bd[0].csr } and `bd[i].csr`
+ * is { bd[i].ptr, bd[i].csr } */
+#define NO2USB_REGS_COMB(p)		((__typeof__(p))(((uintptr_t)(p)) + (1 << 12)))
+#define NO2USB_COMB(hi, lo)		((((uint32_t)(hi)) << 16) | ((lo) & 0xffff))
+#define NO2USB_COMB_HI(x)		(((x) >> 16) & 0xffff)
+#endif
+
+#ifdef NO2USB_DMA_BASE
+static volatile struct no2usb_dma *     const no2usb_dma     = (void*) (NO2USB_DMA_BASE);
+#endif
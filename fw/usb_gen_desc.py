@@ -0,0 +1,535 @@
+#!/usr/bin/env python3
+#
+# Generate USB descriptors, lookup tables and packet memory plan from a
+# declarative device spec (JSON, or YAML if PyYAML is available)
+#
+# The output is meant to be included by a single C file of the firmware.
+# It defines `<name>_stack_desc` (a `struct usb_stack_descriptors`) with :
+#  - The device, configuration and string descriptors, as typed `const`
+#    structures, validated here
+#  - For each configuration, the interface / alt setting / endpoint tables
+#    and the packet memory offset of each EP buffer (`conf_idx`), so that
+#    the stack does no descriptor parsing at SET_CONFIGURATION /
+#    SET_INTERFACE and `usb_ep_boot()` uses a fixed layout, reserved at
+#    bus reset for the largest configuration
+#
+# The generation fails if the spec is invalid or if the EP buffers of any
+# configuration don't fit in the core packet memory.
+#
+# Spec format (numbers can be given as "0x..." strings) :
+#
+#   name            C identifier prefix
+#   core            { "mem": 2048, "desc": false, "bos_size": 33 }  Packet
+#                   memory size (bytes, per direction), hardware descriptor
+#                   responder option and size of the BOS descriptor for it
+#   device          { "bcdUSB", "class": [cls, sub, proto], "mps0", "vid",
+#                     "pid", "bcdDevice", "manufacturer", "product", "serial" }
+#   bos             Name of an existing `struct usb_bos_desc` (optional)
+#   strings         Additional strings, appended after the referenced ones
+#   configurations  List of { "value", "attributes", "max_power" (mA),
+#                             "string", "interfaces" }
+#
+#   interface       { "alts": [ alt, ... ] } or directly an alt, numbered in
+#                   order of appearance
+#   alt             { "class": [cls, sub, proto], "string", "extra",
+#                     "endpoints": [ ep, ... ] }
+#   ep              { "addr", "type": "ctrl|iso|bulk|int", "mps", "interval",
+#                     "dual_bd": false, "attributes" (overrides type),
+#                     "extra" }
+#   extra           List of class specific descriptors, either hex strings
+#                   ("09 21 ...") or { "dfu": { "attributes", "detach_timeout",
+#                   "transfer_size", "version" } }
+#
+# Strings can also be dicts indexed by board name, with "" as the default,
+# like for usb_gen_strings.py.
+#
+# Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+# SPDX-License-Identifier: MIT
+#
+
+import json
+import os
+import re
+import sys
+
+
+# Core memory map (see usb_bus_reset() / _usb_hw_desc_load())
+EP0_RX_SIZE = 0x80	# EP0 OUT + SETUP
+EP0_TX_SIZE = 0x40	# EP0 IN
+BD_LEN_MAX  = 0x3ff
+
+EP_TYPES = { 'ctrl': 0, 'iso': 1, 'bulk': 2, 'int': 3 }
+EP_MPS_MAX = [ 64, 1023, 64, 64 ]	# Full speed
+
+
+class SpecError(Exception):
+	pass
+
+
+# Helpers
+# -------
+
+def num(v, what, lo=0, hi=0xffff):
+	try:
+		v = int(v, 0) if isinstance(v, str) else int(v)
+	except (TypeError, ValueError):
+		raise SpecError(f"{what}: invalid number {v!r}")
+	if not (lo <= v <= hi):
+		raise SpecError(f"{what}: {v} out of range [{lo}, {hi}]")
+	return v
+
+def hexbytes(s, what):
+	try:
+		d = bytes.fromhex(s)
+	except ValueError:
+		raise SpecError(f"{what}: invalid hex string")
+	if (len(d) < 2) or (d[0] != len(d)):
+		raise SpecError(f"{what}: bLength doesn't match the data length")
+	return d
+
+def align4(v):
+	return (v + 3) & ~3
+
+
+# Model
+# -----
+
+class Field:
+	"""One descriptor of a configuration: C type, field name, initializer"""
+
+	def __init__(self, ctype, name, size, init, array=None):
+		self.ctype = ctype
+		self.name  = name
+		self.size  = size
+		self.init  = init	# list of (member, value) or bytes
+		self.array = array
+
+	def decl(self):
+		if self.array:
+			return f"\t{self.ctype} {self.name}[{self.array}];"
+		return f"\t{self.ctype} {self.name};"
+
+	def initializer(self):
+		if isinstance(self.init, bytes):
+			d = ', '.join(f"0x{b:02x}" for b in self.init)
+			return f"\t.{self.name} = {{\n\t\t{d}\n\t}},"
+		m = '\n'.join(f"\t\t.{k:<23s} = {v}," for k, v in self.init)
+		return f"\t.{self.name} = {{\n{m}\n\t}},"
+
+
+class Strings:
+
+	def __init__(self, board):
+		self.board = board
+		self.lst = []
+
+	def ref(self, s, what):
+		if s is None:
+			return 0
+		if isinstance(s, dict):
+			s = s[self.board] if self.board in s else s['']
+		if not isinstance(s, str):
+			raise SpecError(f"{what}: invalid string")
+		if len(s) > 126:
+			raise SpecError(f"{what}: string too long")
+		if s not in self.lst:
+			if len(self.lst) == 255:
+				raise SpecError(f"{what}: too many strings")
+			self.lst.append(s)
+		return self.lst.index(s) + 1
+
+
+class Gen:
+
+	def __init__(self, spec, board):
+		self.spec = spec
+		self.str  = Strings(board)
+
+		self.name = spec.get('name')
+		if not isinstance(self.name, str) or not re.fullmatch(r'[A-Za-z_]\w*', self.name):
+			raise SpecError("name: must be a C identifier")
+
+		core = spec.get('core', {})
+		self.mem      = num(core.get('mem', 2048), 'core.mem', 256, 2048)
+		self.core_dsc = bool(core.get('desc', False))
+		self.bos_size = num(core.get('bos_size', 33), 'core.bos_size', 5)
+
+		self.uses_dfu = False
+
+		self.dev   = self._device(spec.get('device', {}))
+		self.confs = [ self._conf(i, c) for i, c in enumerate(spec.get('configurations', [])) ]
+
+		if not self.confs:
+			raise SpecError("configurations: at least one is required")
+
+		values = [ c['value'] for c in self.confs ]
+		if len(set(values)) != len(values):
+			raise SpecError("configurations: duplicate bConfigurationValue")
+
+		for i, s in enumerate(spec.get('strings', [])):
+			self.str.ref(s, f"strings[{i}]")
+
+		self.bos = spec.get('bos')
+		if (self.bos is not None) and not re.fullmatch(r'[A-Za-z_]\w*', str(self.bos)):
+			raise SpecError("bos: must be a C identifier")
+
+		self._plan()
+
+	# Parsing / validation
+
+	def _device(self, d):
+		cls = d.get('class', [0, 0, 0])
+		mps0 = num(d.get('mps0', 64), 'device.mps0')
+		if mps0 not in (8, 16, 32, 64):
+			raise SpecError("device.mps0: must be 8, 16, 32 or 64")
+		return [
+			('bLength',            'sizeof(struct usb_dev_desc)'),
+			('bDescriptorType',    'USB_DT_DEV'),
+			('bcdUSB',             f"0x{num(d.get('bcdUSB', 0x0200), 'device.bcdUSB'):04x}"),
+			('bDeviceClass',       f"0x{num(cls[0], 'device.class', 0, 255):02x}"),
+			('bDeviceSubClass',    f"0x{num(cls[1], 'device.class', 0, 255):02x}"),
+			('bDeviceProtocol',    f"0x{num(cls[2], 'device.class', 0, 255):02x}"),
+			('bMaxPacketSize0',    f"{mps0}"),
+			('idVendor',           f"0x{num(d.get('vid'), 'device.vid'):04x}"),
+			('idProduct',          f"0x{num(d.get('pid'), 'device.pid'):04x}"),
+			('bcdDevice',          f"0x{num(d.get('bcdDevice', 0), 'device.bcdDevice'):04x}"),
+			('iManufacturer',      f"{self.str.ref(d.get('manufacturer'), 'device.manufacturer')}"),
+			('iProduct',           f"{self.str.ref(d.get('product'), 'device.product')}"),
+			('iSerialNumber',      f"{self.str.ref(d.get('serial'), 'device.serial')}"),
+			('bNumConfigurations', f"{len(self.spec.get('configurations', []))}"),
+		]
+
+	def _extra(self, lst, prefix, what):
+		fields = []
+		for i, x in enumerate(lst):
+			w = f"{what}.extra[{i}]"
+			n = f"{prefix}_x{i}"
+			if isinstance(x, str):
+				d = hexbytes(x, w)
+				fields.append(Field('uint8_t', n, len(d), d, len(d)))
+			elif isinstance(x, dict) and ('dfu' in x):
+				f = x['dfu']
+				self.uses_dfu = True
+				fields.append(Field('struct usb_dfu_func_desc', n, 9, [
+					('bLength',        'sizeof(struct usb_dfu_func_desc)'),
+					('bDescriptorType', 'USB_DFU_DT_FUNC'),
+					('bmAttributes',   f"0x{num(f.get('attributes', 0x0d), w, 0, 255):02x}"),
+					('wDetachTimeOut', f"{num(f.get('detach_timeout', 1000), w)}"),
+					('wTransferSize',  f"{num(f.get('transfer_size', 1024), w)}"),
+					('bcdDFUVersion',  f"0x{num(f.get('version', 0x0101), w):04x}"),
+				]))
+			else:
+				raise SpecError(f"{w}: unknown descriptor")
+		return fields
+
+	def _conf(self, ci, c):
+		what = f"configurations[{ci}]"
+		conf = {
+			'value':  num(c.get('value', ci + 1), f"{what}.value", 1, 255),
+			'fields': [],
+			'intf':   [],	# [ [ (intf field, [ep fields]) per alt ] per intf ]
+			'eps':    {},	# addr -> { 'mps', 'n_bd', 'type', 'def' }
+		}
+
+		attr = num(c.get('attributes', 0x80), f"{what}.attributes", 0, 255)
+		if not (attr & 0x80):
+			raise SpecError(f"{what}.attributes: bit 7 must be set")
+
+		power = num(c.get('max_power', 100), f"{what}.max_power", 0, 500)
+
+		intfs = c.get('interfaces', [])
+		if len(intfs) > 32:
+			raise SpecError(f"{what}: more than 32 interfaces")
+
+		fields = []
+		ep_owner = {}
+
+		for ii, intf in enumerate(intfs):
+			alts = intf['alts'] if (isinstance(intf, dict) and 'alts' in intf) else [intf]
+			if not alts:
+				raise SpecError(f"{what}.interfaces[{ii}]: no alt setting")
+			if len(alts) > 255:
+				raise SpecError(f"{what}.interfaces[{ii}]: too many alt settings")
+
+			lst = []
+			for ai, alt in enumerate(alts):
+				w = f"{what}.interfaces[{ii}].alts[{ai}]"
+				n = f"if{ii}_alt{ai}"
+				cls = alt.get('class', [0xff, 0, 0])
+				eps = alt.get('endpoints', [])
+
+				if len(eps) > 30:
+					raise SpecError(f"{w}: too many endpoints")
+
+				f_intf = Field('struct usb_intf_desc', n, 9, [
+					('bLength',            'sizeof(struct usb_intf_desc)'),
+					('bDescriptorType',    'USB_DT_INTF'),
+					('bInterfaceNumber',   f"{ii}"),
+					('bAlternateSetting',  f"{ai}"),
+					('bNumEndpoints',      f"{len(eps)}"),
+					('bInterfaceClass',    f"0x{num(cls[0], w + '.class', 0, 255):02x}"),
+					('bInterfaceSubClass', f"0x{num(cls[1], w + '.class', 0, 255):02x}"),
+					('bInterfaceProtocol', f"0x{num(cls[2], w + '.class', 0, 255):02x}"),
+					('iInterface',         f"{self.str.ref(alt.get('string'), w + '.string')}"),
+				])
+				fields.append(f_intf)
+				fields.extend(self._extra(alt.get('extra', []), n, w))
+
+				ep_fields = []
+				seen = set()
+				for ei, ep in enumerate(eps):
+					we = f"{w}.endpoints[{ei}]"
+					addr = num(ep.get('addr'), we + '.addr', 0, 255)
+					if not (1 <= (addr & 0x7f) <= 15) or (addr & 0x70):
+						raise SpecError(f"{we}.addr: invalid endpoint address 0x{addr:02x}")
+					if addr in seen:
+						raise SpecError(f"{we}.addr: 0x{addr:02x} used twice in the same alt setting")
+					seen.add(addr)
+
+					if ep_owner.setdefault(addr, ii) != ii:
+						raise SpecError(f"{we}.addr: 0x{addr:02x} already used by interface {ep_owner[addr]}")
+
+					if 'attributes' in ep:
+						ep_attr = num(ep['attributes'], we + '.attributes', 0, 255)
+					elif ep.get('type') in EP_TYPES:
+						ep_attr = EP_TYPES[ep['type']]
+					else:
+						raise SpecError(f"{we}.type: must be one of {', '.join(EP_TYPES)}")
+
+					mps = num(ep.get('mps'), we + '.mps', 0, EP_MPS_MAX[ep_attr & 3])
+					interval = num(ep.get('interval', 0), we + '.interval', 0, 255)
+					n_bd = 2 if ep.get('dual_bd', False) else 1
+
+					ne = f"{n}_ep{addr:02x}"
+					f_ep = Field('struct usb_ep_desc', ne, 7, [
+						('bLength',          'sizeof(struct usb_ep_desc)'),
+						('bDescriptorType',  'USB_DT_EP'),
+						('bEndpointAddress', f"0x{addr:02x}"),
+						('bmAttributes',     f"0x{ep_attr:02x}"),
+						('wMaxPacketSize',   f"{mps}"),
+						('bInterval',        f"{interval}"),
+					])
+					fields.append(f_ep)
+					fields.extend(self._extra(ep.get('extra', []), ne, we))
+					ep_fields.append(f_ep)
+
+					e = conf['eps'].setdefault(addr, { 'mps': 0, 'n_bd': 1, 'def': None })
+					e['mps']  = max(e['mps'], mps)
+					e['n_bd'] = max(e['n_bd'], n_bd)
+					if ai == 0:
+						e['def'] = ne
+
+				lst.append((f_intf, ep_fields))
+
+			conf['intf'].append(lst)
+
+		conf['fields'] = [ Field('struct usb_conf_desc', 'conf', 9, [
+			('bLength',             'sizeof(struct usb_conf_desc)'),
+			('bDescriptorType',     'USB_DT_CONF'),
+			('wTotalLength',        None),	# Filled below
+			('bNumInterfaces',      f"{len(intfs)}"),
+			('bConfigurationValue', f"{conf['value']}"),
+			('iConfiguration',      f"{self.str.ref(c.get('string'), what + '.string')}"),
+			('bmAttributes',        f"0x{attr:02x}"),
+			('bMaxPower',           f"0x{(power + 1) // 2:02x}"),
+		]) ] + fields
+
+		conf['len'] = sum(f.size for f in conf['fields'])
+		if conf['len'] > 0xffff:
+			raise SpecError(f"{what}: wTotalLength too large")
+
+		return conf
+
+	# Packet memory plan
+
+	def _desc_resp_size(self):
+		# Same layout as _usb_hw_desc_load() : table with an end marker,
+		# then each descriptor short enough for the responder, aligned
+		descs = [ 18 ] + [ c['len'] for c in self.confs ] + \
+		        [ 4 ] + [ 2 + 2 * len(s) for s in self.str.lst ]
+		if self.bos is not None:
+			descs.append(self.bos_size)
+		sz = 4 * (len(descs) + 1)
+		for l in descs:
+			if l <= BD_LEN_MAX:
+				sz += align4(l)
+		return sz
+
+	def _plan(self):
+		self.rx_base = EP0_RX_SIZE
+		self.tx_base = EP0_TX_SIZE + (self._desc_resp_size() if self.core_dsc else 0)
+		self.rx_used = self.rx_base
+		self.tx_used = self.tx_base
+
+		for ci, c in enumerate(self.confs):
+			ofs = [ 0, 0 ]
+			for addr in sorted(c['eps'], key=lambda a: ((a & 0x80), a & 0xf)):
+				e = c['eps'][addr]
+				d = 1 if (addr & 0x80) else 0
+				e['ptr'] = []
+				for i in range(e['n_bd']):
+					e['ptr'].append(ofs[d])
+					ofs[d] += align4(e['mps'])
+
+			rx = self.rx_base + ofs[0]
+			tx = self.tx_base + ofs[1]
+			if (rx > self.mem) or (tx > self.mem):
+				raise SpecError(
+					f"configurations[{ci}]: EP buffers don't fit in packet memory "
+					f"(RX {rx} / TX {tx} bytes used, {self.mem} available)")
+
+			c['rx'] = rx
+			c['tx'] = tx
+			c['plan'] = ofs
+			self.rx_used = max(self.rx_used, rx)
+			self.tx_used = max(self.tx_used, tx)
+
+	# Output
+
+	def write(self, fh, src):
+		n = self.name
+		o = []
+
+		# Header
+		o.append(f"/*\n * Generated by usb_gen_desc.py from {os.path.basename(src)}, do not edit\n *")
+		o.append(f" * Packet memory plan ({self.mem} bytes per direction, offsets from the")
+		o.append(f" * end of the EP0{' and descriptor responder' if self.core_dsc else ''} area, RX 0x{self.rx_base:03x} / TX 0x{self.tx_base:03x}) :")
+		for c in self.confs:
+			o.append(f" *   Configuration {c['value']} : RX {c['rx']} / TX {c['tx']} bytes used")
+			for addr in sorted(c['eps'], key=lambda a: ((a & 0x80), a & 0xf)):
+				e = c['eps'][addr]
+				ptrs = ', '.join(f"0x{p:03x}" for p in e['ptr'])
+				o.append(f" *     EP 0x{addr:02x} {'IN ' if addr & 0x80 else 'OUT'} {e['mps']:4d} bytes x{e['n_bd']} : {ptrs}")
+		o.append(" */\n")
+
+		o.append("#include <no2usb/usb.h>")
+		if self.uses_dfu:
+			o.append("#include <no2usb/usb_dfu_proto.h>")
+		o.append("#include <no2usb/usb_proto.h>\n")
+
+		o.append(f"#define {n.upper()}_MEM_RX_USED\t{self.rx_used}")
+		o.append(f"#define {n.upper()}_MEM_TX_USED\t{self.tx_used}\n")
+
+		if self.bos is not None:
+			o.append(f"extern const struct usb_bos_desc {self.bos};\n")
+
+		# Strings
+		o.append(f"static const struct usb_str_desc _{n}_str0_desc = {{")
+		o.append("\t.bLength\t\t= 4,\n\t.bDescriptorType\t= USB_DT_STR,\n\t.wString\t\t= { 0x0409 },\n};\n")
+		for i, s in enumerate(self.str.lst):
+			d = ''
+			for j, ch in enumerate(s):
+				d += f"0x{ord(ch):04x},"
+				if j != len(s) - 1:
+					d += '\n\t\t' if (j & 7) == 7 else ' '
+			o.append(f"static const struct usb_str_desc _{n}_str{i+1}_desc = {{")
+			o.append(f"\t.bLength\t\t= {2 * len(s) + 2},\n\t.bDescriptorType\t= USB_DT_STR,\n\t.wString\t\t= {{\n\t\t{d}\n\t}},\n}};\n")
+
+		o.append(f"static const struct usb_str_desc * const _{n}_str_desc_array[] = {{")
+		for i in range(len(self.str.lst) + 1):
+			o.append(f"\t&_{n}_str{i}_desc,")
+		o.append("};\n")
+
+		# Device
+		o.append(f"static const struct usb_dev_desc _{n}_dev_desc = {{")
+		for k, v in self.dev:
+			o.append(f"\t.{k:<23s} = {v},")
+		o.append("};\n")
+
+		# Configurations
+		for ci, c in enumerate(self.confs):
+			pfx = f"_{n}_conf{ci}"
+			cd  = f"{pfx}_desc"
+
+			c['fields'][0].init[2] = ('wTotalLength', f"sizeof({cd})")
+
+			o.append("static const struct {")
+			o.extend(f.decl() for f in c['fields'])
+			o.append(f"}} __attribute__ ((packed, aligned(4))) {cd} = {{")
+			o.extend(f.initializer() for f in c['fields'])
+			o.append("};\n")
+
+			# Alt settings
+			for ii, alts in enumerate(c['intf']):
+				for ai, (fi, eps) in enumerate(alts):
+					if not eps:
+						continue
+					o.append(f"static const struct usb_ep_desc * const {pfx}_{fi.name}_ep[] = {{")
+					o.extend(f"\t&{cd}.{fe.name}," for fe in eps)
+					o.append("};\n")
+
+				o.append(f"static const struct usb_alt_index {pfx}_if{ii}_alt[] = {{")
+				for ai, (fi, eps) in enumerate(alts):
+					ep = f"{pfx}_{fi.name}_ep" if eps else "NULL"
+					o.append(f"\t{{ .intf = &{cd}.{fi.name}, .ep = {ep} }},")
+				o.append("};\n")
+
+			o.append(f"static const struct usb_intf_index {pfx}_intf[] = {{")
+			for ii, alts in enumerate(c['intf']):
+				o.append(f"\t{{ .alt = {pfx}_if{ii}_alt, .n_alt = {len(alts)} }},")
+			o.append("};\n")
+
+			# EP plan
+			if c['eps']:
+				o.append(f"static const struct usb_ep_plan {pfx}_ep[] = {{")
+				for addr in sorted(c['eps'], key=lambda a: ((a & 0x80), a & 0xf)):
+					e = c['eps'][addr]
+					idx = (addr & 0xf) | ((addr & 0x80) >> 3)
+					ptrs = ', '.join(f"0x{p:03x}" for p in e['ptr'])
+					d = f"&{cd}.{e['def']}" if e['def'] else "NULL"
+					o.append(f"\t[0x{idx:02x}] = {{ .addr = 0x{addr:02x}, .n_bd = {e['n_bd']}, .mps = {e['mps']}, .ptr = {{ {ptrs} }}, .def = {d} }},")
+				o.append("};\n")
+
+		# Arrays
+		o.append(f"static const struct usb_conf_desc * const _{n}_conf_desc_array[] = {{")
+		o.extend(f"\t&_{n}_conf{ci}_desc.conf," for ci in range(len(self.confs)))
+		o.append("};\n")
+
+		o.append(f"static const struct usb_conf_index _{n}_conf_idx_array[] = {{")
+		for ci, c in enumerate(self.confs):
+			pfx = f"_{n}_conf{ci}"
+			if c['eps']:
+				ep = f".ep = {pfx}_ep, .n_ep = num_elem({pfx}_ep)"
+			else:
+				ep = ".ep = NULL, .n_ep = 0"
+			o.append(f"\t{{ .intf = {pfx}_intf, .n_intf = num_elem({pfx}_intf), {ep}, .mem = {{ {c['plan'][0]}, {c['plan'][1]} }} }},")
+		o.append("};\n")
+
+		# Stack descriptors
+		o.append(f"static const struct usb_stack_descriptors {n}_stack_desc = {{")
+		o.append(f"\t.dev      = &_{n}_dev_desc,")
+		if self.bos is not None:
+			o.append(f"\t.bos      = &{self.bos},")
+		o.append(f"\t.conf     = _{n}_conf_desc_array,")
+		o.append(f"\t.n_conf   = num_elem(_{n}_conf_desc_array),")
+		o.append(f"\t.str      = _{n}_str_desc_array,")
+		o.append(f"\t.n_str    = num_elem(_{n}_str_desc_array),")
+		o.append(f"\t.conf_idx = _{n}_conf_idx_array,")
+		o.append("};")
+
+		fh.write('\n'.join(o) + '\n')
+
+
+def load(fn):
+	with open(fn, 'r') as fh:
+		if fn.endswith(('.yaml', '.yml')):
+			import yaml
+			return yaml.safe_load(fh)
+		return json.load(fh)
+
+
+def main(argv0, fn_in, fn_out, board=''):
+	try:
+		gen = Gen(load(fn_in), board)
+	except SpecError as e:
+		sys.stderr.write(f"{fn_in}: {e}\n")
+		sys.exit(1)
+	except (KeyError, IndexError, TypeError, AttributeError) as e:
+		sys.stderr.write(f"{fn_in}: malformed spec ({e!r})\n")
+		sys.exit(1)
+
+	with open(fn_out, 'w') as fh_out:
+		gen.write(fh_out, fn_in)
+
+if __name__ == '__main__':
+	main(*sys.argv)
@@ -28,3 +28,6 @@ SOURCES_no2usb=$(addprefix $(CORE_no2usb_DIR)/fw/v0/src/, \
 
 usb_str_%.gen.h: usb_str_%.txt
 	$(CORE_no2usb_DIR)/fw/usb_gen_strings.py $< $@ $(BOARD)
+
+usb_desc_%.gen.h: usb_desc_%.json
+	$(CORE_no2usb_DIR)/fw/usb_gen_desc.py $< $@ $(BOARD)
@@ -18,6 +18,35 @@
 
 struct usb_xfer;
 
+/* Pre-computed lookup tables, see fw/usb_gen_desc.py */
+struct usb_alt_index {
+	const struct usb_intf_desc *intf;
+	const struct usb_ep_desc * const *ep;	/* bNumEndpoints entries */
+};
+
+struct usb_intf_index {
+	const struct usb_alt_index *alt;	/* By bAlternateSetting */
+	int n_alt;
+};
+
+struct usb_ep_plan {
+	uint8_t  addr;		/* bEndpointAddress, 0 if unused */
+	uint8_t  n_bd;		/* Buffers allocated (1 or 2) */
+	uint16_t mps;		/* Max wMaxPacketSize across alt settings */
+	uint16_t ptr[2];	/* Buffer offsets, from the end of the EP0 area */
+	const struct usb_ep_desc *def;	/* In alt setting 0, or NULL */
+};
+
+#define USB_EP_PLAN_IDX(ep)	(((ep) & 0xf) | (((ep) & 0x80) >> 3))
+
+struct usb_conf_index {
+	const struct usb_intf_index *intf;	/* By bInterfaceNumber */
+	int n_intf;
+	const struct usb_ep_plan *ep;		/* By USB_EP_PLAN_IDX() */
+	int n_ep;
+	uint16_t mem[2];			/* Planned buffer bytes, RX / TX */
+};
+
 struct usb_stack_descriptors {
 	const struct usb_dev_desc *dev;
 	const struct usb_bos_desc *bos;
@@ -25,6 +54,7 @@ struct usb_stack_descriptors {
 	int n_conf;
 	const struct usb_str_desc * const *str;
 	int n_str;
+	const struct usb_conf_index *conf_idx;	/* Optional, one per conf */
 };
 
 enum usb_dev_state {
@@ -121,3 +151,5 @@ const struct usb_intf_desc *usb_desc_find_intf(const struct usb_conf_desc *conf,
 void usb_debug_print_ep(int ep, int dir);
 void usb_debug_print_data(int ofs, int len);
 void usb_debug_print(void);
+void usb_debug_print_stats(void);	/* Requires STATS core option */
+void usb_debug_dump_trace(void);	/* Requires TRACE core option */
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "config.h"
@@ -17,6 +18,18 @@ struct usb_core {
 	uint32_t ar;
 	uint32_t evt;
 	uint32_t ir;
+	uint32_t evt_ts_frame;	/* Requires EVT_RAM core option */
+	uint32_t evt_ts_sub;	/* Requires EVT_RAM core option */
+	uint32_t sof_frame;
+	uint32_t sof_sub;
+	uint32_t sof_missed;
+	uint32_t rto;
+	uint32_t dsc;		/* Requires DESC core option */
+	uint32_t stats_ctl;	/* Requires STATS core option */
+	uint32_t stats_data;	/* Requires STATS core option */
+	uint32_t trace_ctl;	/* Requires TRACE core option */
+	uint32_t trace_flt;	/* Requires TRACE core option */
+	uint32_t trace_data;	/* Requires TRACE core option */
 } __attribute__((packed,aligned(4)));
 
 #define USB_CSR_PU_ENA		(1 << 15)
@@ -43,6 +56,32 @@ struct usb_core {
 #define USB_EVT_IS_SETUP	(1 <<  2)
 #define USB_EVT_BD_IDX		(1 <<  1)
 
+#define USB_SOF_FRAME_VALID	(1 << 15)
+#define USB_SOF_FRAME_NUM(x)	((x) & 0x7ff)
+
+#define USB_DSC_ENA		(1 << 15)
+#define USB_DSC_MPS(n)		(((__builtin_ctz(n) - 3) & 3) << 11)	/* EP0 Max Packet Size: 8/16/32/64 */
+#define USB_DSC_BASE(x)		((x) & 0x7ff)
+
+#define USB_STATS_SNAPSHOT	(1 << 15)
+#define USB_STATS_CLEAR		(1 << 14)
+#define USB_STATS_SEL_BS_ERR	0x00
+#define USB_STATS_SEL_RX_ERR	0x01
+#define USB_STATS_SEL_RX_TIMEOUT	0x02
+#define USB_STATS_SEL_TX_NAK	0x03
+#define USB_STATS_SEL_TX_STALL	0x04
+#define USB_STATS_SEL_NO_EP	0x05
+#define USB_STATS_SEL_EP_NAK(ep_addr)	(0x20 | (((ep_addr) & 0xf) << 1) | (((ep_addr) >> 7) & 1))
+
+#define USB_TRACE_ENA		(1 << 15)
+#define USB_TRACE_CLEAR		(1 << 14)	/* Write only */
+#define USB_TRACE_TRIGGERED	(1 << 14)	/* Read only */
+#define USB_TRACE_STOP_ERR	(1 << 13)	/* Write only */
+#define USB_TRACE_OVERFLOW	(1 << 13)	/* Read only */
+#define USB_TRACE_EP_FILTER(ep)	((1 << 12) | (((ep) & 0xf) << 8))
+#define USB_TRACE_COUNT(x)	((x) & 0x1ff)
+#define USB_TRACE_PID(pid)	(1 << (pid))
+
 #define USB_IR_SOF_PENDING	(1 <<  5)
 #define USB_IR_EVT_PENDING	(1 <<  4)
 #define USB_IR_BUS_SUSPEND	(1 <<  3)
@@ -51,13 +90,16 @@ struct usb_core {
 #define USB_IR_BUS_RST_PENDING	(1 <<  0)
 
 
+struct usb_bd {
+	uint32_t csr;
+	uint32_t ptr;
+} __attribute__((packed,aligned(4)));
+
 struct usb_ep {
 	uint32_t status;
-	uint32_t _rsvd[3];
-	struct {
-		uint32_t csr;
-		uint32_t ptr;
-	} bd[2];
+	uint32_t _rsvd[2];
+	uint32_t cfg;
+	struct usb_bd bd[2];
 } __attribute__((packed,aligned(4)));
 
 struct usb_ep_pair {
@@ -79,6 +121,17 @@ struct usb_ep_pair {
 #define USB_EP_BD_IDX		0x0040
 #define USB_EP_BD_CTRL		0x0020
 #define USB_EP_BD_DUAL		0x0010
+#define USB_EP_BD_RING		0x0030		/* Requires BD_RING core option */
+#define USB_EP_RING_SLOT(x)	(((x) & 0x1f) << 11)
+#define USB_EP_RING_IDX(x)	(((x) & 7) << 8)
+#define USB_EP_GET_RING_IDX(x)	(((x) >> 8) & 7)
+#define USB_EP_AUTO_REARM	0x0008		/* OUT only, requires AUTO_REARM core option */
+
+#define USB_EP_CFG_MPS(x)	((x) & 0x3ff)		/* Max Packet Size, used by transfer mode BDs */
+#define USB_EP_CFG_OVERWRITE	0x0400		/* Auto-rearm: reuse BDs not yet consumed */
+#define USB_EP_CFG_NTF_MASK	0x0800		/* Notify control: no events for this EP */
+#define USB_EP_CFG_NTF_SHORT	0x1000		/* Notify control: only on short packets */
+#define USB_EP_CFG_NTF_DIV(n)	((((n)-1) & 7) << 13)	/* Notify control: one event every n */
 
 #define USB_BD_STATE_MSK	0xe000
 #define USB_BD_STATE_NONE	0x0000
@@ -87,10 +140,54 @@ struct usb_ep_pair {
 #define USB_BD_STATE_DONE_OK	0x8000
 #define USB_BD_STATE_DONE_ERR	0xa000
 #define USB_BD_IS_SETUP		0x1000
+#define USB_BD_XFER		0x0800		/* Multi-packet transfer (requires XFER core option) */
+#define USB_BD_XFER_ZLP		0x0400		/* IN: end a MPS-aligned transfer (or full packet) with a ZLP (requires XFER core option) */
+#define USB_BD_OVERRUN		0x0400		/* Auto-rearm: previous BD content was overwritten */
 
 #define USB_BD_LEN(l)		((l) & 0x3ff)
 #define USB_BD_LEN_MSK		0x03ff
 
 
+#ifdef USB_HW_MOCK
+/* Host builds (see fw/v0/test) : the core registers are routed to a model
+ * (they have side effects), the EP status / BDs and the packet memories
+ * are plain arrays it provides. Note TX and RX memories share the same
+ * offsets, writes go to TX and reads come from RX. */
+extern volatile struct usb_ep_pair usb_hw_mock_ep_regs[16];
+extern volatile struct usb_bd      usb_hw_mock_bd_pool[128];
+extern volatile uint32_t           usb_hw_mock_tx_mem[512];
+extern volatile uint32_t           usb_hw_mock_rx_mem[512];
+
+uint32_t usb_hw_mock_reg_read(unsigned int reg);
+void     usb_hw_mock_reg_write(unsigned int reg, uint32_t val);
+
+static volatile struct usb_ep_pair * const usb_ep_regs = usb_hw_mock_ep_regs;
+static volatile struct usb_bd *      const usb_bd_pool = usb_hw_mock_bd_pool;
+
+#define USB_REG_RD(r)		usb_hw_mock_reg_read(offsetof(struct usb_core, r) >> 2)
+#define USB_REG_WR(r, v)	usb_hw_mock_reg_write(offsetof(struct usb_core, r) >> 2, (v))
+#define USB_DATA_TX(ofs)	((volatile uint32_t *)(((uintptr_t)usb_hw_mock_tx_mem) + (ofs)))
+#define USB_DATA_RX(ofs)	((volatile uint32_t *)(((uintptr_t)usb_hw_mock_rx_mem) + (ofs)))
+
+#ifdef USB_CORE_WB32
+# error "Combined accesses are not supported by the register model"
+#endif
+#else
 static volatile struct usb_core *    const usb_regs    = (void*) (USB_CORE_BASE);
 static volatile struct usb_ep_pair * const usb_ep_regs = (void*)((USB_CORE_BASE) + (1 << 13));
+static volatile struct usb_bd *      const usb_bd_pool = (void*)((USB_CORE_BASE) + (1 << 13) + (1 << 10));
+
+#define USB_REG_RD(r)		(usb_regs->r)
+#define USB_REG_WR(r, v)	(usb_regs->r = (v))
+#define USB_DATA_TX(ofs)	((volatile uint32_t *)((USB_DATA_BASE) + (ofs)))
+#define USB_DATA_RX(ofs)	((volatile uint32_t *)((USB_DATA_BASE) + (ofs)))
+#endif
+
+#ifdef USB_CORE_WB32
+/* Combined accesses (requires the WB_DW=32 core option). Same layout as the
+ * EP regs / BD pool, but `status` is { status, bd[0].csr } and `bd[i].csr`
+ * is { bd[i].ptr, bd[i].csr } */
+#define USB_REGS_COMB(p)	((__typeof__(p))(((uintptr_t)(p)) + (1 << 12)))
+#define USB_COMB(hi, lo)	((((uint32_t)(hi)) << 16) | ((lo) & 0xffff))
+#define USB_COMB_HI(x)		(((x) >> 16) & 0xffff)
+#endif
@@ -40,14 +40,17 @@ struct usb_stack {
 	enum usb_dev_state state;
 
 	const struct usb_conf_desc *conf;
+	const struct usb_conf_index *conf_idx;
 	uint32_t intf_alt;
 
 	/* Timebase */
 	uint32_t tick;
+	uint32_t tick_frame;	/* Frame CSR value at last tick */
 
 	/* EP configuration */
 	struct {
 		unsigned int mem[2];
+		unsigned int plan[2];	/* Start of the planned EP buffers */
 	} ep_cfg;
 
 	/* EP0 control state */
@@ -73,6 +76,9 @@ struct usb_stack {
 
 extern struct usb_stack g_usb;
 
+/* Lookup tables of a configuration, NULL if not provided */
+const struct usb_conf_index *usb_desc_conf_index(const struct usb_conf_desc *conf);
+
 /* Helpers for data access */
 void usb_data_write(unsigned int dst_ofs, const void *src, int len);
 void usb_data_read(void *dst, unsigned int src_ofs, int len);
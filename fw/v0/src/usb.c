@@ -30,7 +30,7 @@ usb_data_write(unsigned int dst_ofs, const void *src, int len)
 {
 	/* FIXME unaligned ofs */
 	const uint32_t *src_u32 = __builtin_assume_aligned(src, 4);
-	volatile uint32_t *dst_u32 = (volatile uint32_t *)((USB_DATA_BASE) + dst_ofs);
+	volatile uint32_t *dst_u32 = USB_DATA_TX(dst_ofs);
 
 	while (len >= 4) {
 		*dst_u32++ = *src_u32++;
@@ -48,7 +48,7 @@ void
 usb_data_read (void *dst, unsigned int src_ofs, int len)
 {
 	/* FIXME unaligned ofs */
-	volatile uint32_t *src_u32 = (volatile uint32_t *)((USB_DATA_BASE) + src_ofs);
+	volatile uint32_t *src_u32 = USB_DATA_RX(src_ofs);
 	uint32_t *dst_u32 = __builtin_assume_aligned(dst, 4);
 
 	int i = len >> 2;
@@ -97,10 +97,28 @@ usb_desc_find_conf(uint8_t cfg_value)
 	return NULL;
 }
 
+const struct usb_conf_index *
+usb_desc_conf_index(const struct usb_conf_desc *conf)
+{
+	const struct usb_stack_descriptors *sd = g_usb.stack_desc;
+
+	if (!conf || !sd->conf_idx)
+		return NULL;
+	if (conf == g_usb.conf)
+		return g_usb.conf_idx;
+
+	for (int i=0; i<sd->n_conf; i++)
+		if (sd->conf[i] == conf)
+			return &sd->conf_idx[i];
+
+	return NULL;
+}
+
 const struct usb_intf_desc *
 usb_desc_find_intf(const struct usb_conf_desc *conf, uint8_t idx, uint8_t alt,
                    const struct usb_intf_desc **alt0)
 {
+	const struct usb_conf_index *ci;
 	const struct usb_intf_desc *intf = NULL;
 	const void *sod, *eod;
 
@@ -110,6 +128,16 @@ usb_desc_find_intf(const struct usb_conf_desc *conf, uint8_t idx, uint8_t alt,
 	if (!conf)
 		return NULL;
 
+	/* Direct lookup if we have the tables */
+	ci = usb_desc_conf_index(conf);
+	if (ci) {
+		if ((idx >= ci->n_intf) || (alt >= ci->intf[idx].n_alt))
+			return NULL;
+		if (alt0)
+			*alt0 = ci->intf[idx].alt[0].intf;
+		return ci->intf[idx].alt[alt].intf;
+	}
+
 	/* Bound the search */
 	sod = conf;
 	eod = sod + conf->wTotalLength;
@@ -278,7 +306,7 @@ usb_debug_print_ep(int ep, int dir)
 void
 usb_debug_print_data(int ofs, int len)
 {
-	volatile uint32_t *data = (volatile uint32_t *)((USB_DATA_BASE) + (ofs << 2));
+	volatile uint32_t *data = USB_DATA_RX(ofs << 2);
 	int i;
 
 	for (i=0; i<len; i++) {
@@ -294,7 +322,7 @@ usb_debug_print(void)
 	printf("Stack:\n");
 	printf("\tState: %d\n", g_usb.state);
 	printf("HW:\n");
-	printf("\tSR   : %04x\n", usb_regs->csr);
+	printf("\tSR   : %04x\n", USB_REG_RD(csr));
 	printf("\tTick : %04x\n", g_usb.tick);
 	printf("\n");
 
@@ -305,6 +333,60 @@ usb_debug_print(void)
 	usb_debug_print_data(0, 32);
 }
 
+#ifdef USB_CORE_STATS
+void
+usb_debug_print_stats(void)
+{
+	static const char * const names[] = {
+		"BS err", "RX err", "RX t/o", "NAK", "STALL", "No EP",
+	};
+	int i;
+
+	/* Global counters : snapshot & restart */
+	USB_REG_WR(stats_ctl, USB_STATS_SNAPSHOT);
+
+	printf("Stats:\n");
+	for (i=0; i<6; i++) {
+		USB_REG_WR(stats_ctl, i);
+		printf("\t%-7s: %d\n", names[i], USB_REG_RD(stats_data));
+	}
+
+	/* Per-EP NAKs : fetch & clear */
+	for (i=0; i<32; i++) {
+		uint32_t v;
+		USB_REG_WR(stats_ctl, USB_STATS_CLEAR | USB_STATS_SEL_EP_NAK(((i & 1) << 7) | (i >> 1)));
+		v = USB_REG_RD(stats_data);
+		if (v)
+			printf("\tNAK EP%d %s: %d\n", i >> 1, (i & 1) ? "IN " : "OUT", v);
+	}
+}
+#endif
+
+#ifdef USB_CORE_TRACE
+void
+usb_debug_dump_trace(void)
+{
+	uint32_t csr, w[4];
+	int n, i;
+
+	/* Stop recording and dump all entries (for utils/trace2pcap.py) */
+	csr = USB_REG_RD(trace_ctl);
+	USB_REG_WR(trace_ctl, 0);
+
+	printf("Trace: %d entries%s%s\n",
+		USB_TRACE_COUNT(csr),
+		(csr & USB_TRACE_TRIGGERED) ? ", triggered" : "",
+		(csr & USB_TRACE_OVERFLOW)  ? ", overflow"  : ""
+	);
+
+	for (n=USB_TRACE_COUNT(csr); n>0; n--) {
+		for (i=0; i<4; i++)
+			w[i] = USB_REG_RD(trace_data);
+		printf("%04x %04x %04x %04x\n", w[0], w[1], w[2], w[3]);
+	}
+}
+#endif
+
 
 /* Internal API */
 /* ------------ */
@@ -337,9 +419,66 @@ _usb_hw_reset(bool pu)
 	}
 
 	/* Main control */
-	usb_regs->csr = (pu ? USB_CSR_PU_ENA : 0) | USB_CSR_CEL_ENA | USB_CSR_ADDR_MATCH | USB_CSR_ADDR(0);
-	usb_regs->ar  = USB_AR_BUS_RST_CLEAR | USB_AR_SOF_CLEAR | USB_AR_CEL_RELEASE;
+	USB_REG_WR(csr, (pu ? USB_CSR_PU_ENA : 0) | USB_CSR_CEL_ENA | USB_CSR_ADDR_MATCH | USB_CSR_ADDR(0));
+	USB_REG_WR(ar,  USB_AR_BUS_RST_CLEAR | USB_AR_SOF_CLEAR | USB_AR_CEL_RELEASE);
+}
+
+#ifdef USB_CORE_DESC
+static void
+_usb_hw_desc_add(unsigned int *ent, unsigned int *ofs, uint8_t type, uint8_t idx, const void *desc, int len)
+{
+	uint32_t e;
+
+	/* Too long for the responder, software will handle it */
+	if (len > USB_BD_LEN_MSK)
+		return;
+
+	/* Table entry + Descriptor data */
+	e = type | (idx << 8) | (*ofs << 16);
+	usb_data_write(*ent, &e, 4);
+	usb_data_write(*ofs, desc, len);
+
+	*ent += 4;
+	*ofs += (len + 3) & ~3;
+}
+
+static void
+_usb_hw_desc_load(void)
+{
+	const struct usb_stack_descriptors *sd = g_usb.stack_desc;
+	unsigned int base, ofs, ent;
+	uint32_t z = 0;
+	int i, n;
+
+	/* Disable responder during the update */
+	USB_REG_WR(dsc, 0);
+
+	/* Table at the start of the free TX space, descriptors after it */
+	n = 1 + sd->n_conf + sd->n_str + (sd->bos ? 1 : 0);
+
+	base = ent = g_usb.ep_cfg.mem[1];
+	ofs = base + 4 * (n + 1);
+
+	_usb_hw_desc_add(&ent, &ofs, USB_DT_DEV, 0, sd->dev, sd->dev->bLength);
+
+	for (i=0; i<sd->n_conf; i++)
+		_usb_hw_desc_add(&ent, &ofs, USB_DT_CONF, i, sd->conf[i], sd->conf[i]->wTotalLength);
+
+	for (i=0; i<sd->n_str; i++)
+		_usb_hw_desc_add(&ent, &ofs, USB_DT_STR, i, sd->str[i], sd->str[i]->bLength);
+
+	if (sd->bos)
+		_usb_hw_desc_add(&ent, &ofs, USB_DT_BOS, 0, sd->bos, sd->bos->wTotalLength);
+
+	/* End marker */
+	usb_data_write(ent, &z, 4);
+
+	/* Reserve the space and enable */
+	g_usb.ep_cfg.mem[1] = ofs;
+
+	USB_REG_WR(dsc, USB_DSC_ENA | USB_DSC_MPS(sd->dev->bMaxPacketSize0) | USB_DSC_BASE(base));
 }
+#endif
 
 static void
 usb_bus_reset(void)
@@ -347,10 +486,34 @@ usb_bus_reset(void)
 	/* Reset hw */
 	_usb_hw_reset(true);
 
+	/* Resync tick on next SOF */
+	g_usb.tick_frame = 0;
+
 	/* Reset memory alloc */
 	g_usb.ep_cfg.mem[0] = 0x80;	// 2 * 64b for EP0 OUT/SETUP
 	g_usb.ep_cfg.mem[1] = 0x40;	// 1 * 64b for EP0 IN
 
+#ifdef USB_CORE_DESC
+	/* Descriptors for the hardware responder */
+	_usb_hw_desc_load();
+#endif
+
+	/* Planned EP buffers, reserved for the largest configuration */
+	g_usb.ep_cfg.plan[0] = g_usb.ep_cfg.mem[0];
+	g_usb.ep_cfg.plan[1] = g_usb.ep_cfg.mem[1];
+
+	if (g_usb.stack_desc->conf_idx) {
+		unsigned int rsv[2] = { 0, 0 };
+
+		for (int i=0; i<g_usb.stack_desc->n_conf; i++)
+			for (int d=0; d<2; d++)
+				if (g_usb.stack_desc->conf_idx[i].mem[d] > rsv[d])
+					rsv[d] = g_usb.stack_desc->conf_idx[i].mem[d];
+
+		g_usb.ep_cfg.mem[0] += rsv[0];
+		g_usb.ep_cfg.mem[1] += rsv[1];
+	}
+
 	/* Reset EP0 */
 	usb_ep0_reset();
 
@@ -391,7 +554,7 @@ usb_poll(void)
 		return;
 
 	/* Read CSR */
-	csr = usb_regs->csr;
+	csr = USB_REG_RD(csr);
 
 	/* Check for pending bus reset */
 	if (csr & USB_CSR_BUS_RST_PENDING) {
@@ -416,8 +579,17 @@ usb_poll(void)
 
 	/* SOF Tick */
 	if (csr & USB_CSR_SOF_PENDING) {
-		g_usb.tick++;
-		usb_regs->ar = USB_AR_SOF_CLEAR;
+		uint32_t frame = USB_REG_RD(sof_frame);
+
+		/* Advance by the frame number delta so missed polls don't drift */
+		if ((frame & g_usb.tick_frame) & USB_SOF_FRAME_VALID)
+			g_usb.tick += USB_SOF_FRAME_NUM(frame - g_usb.tick_frame);
+		else
+			g_usb.tick++;
+
+		g_usb.tick_frame = frame;
+
+		USB_REG_WR(ar, USB_AR_SOF_CLEAR);
 		usb_dispatch_sof();
 	}
 
@@ -426,8 +598,8 @@ usb_poll(void)
 		return;
 
 	do {
-		csr = usb_regs->evt;
-	} while (usb_regs->csr & USB_CSR_EVT_PENDING);
+		csr = USB_REG_RD(evt);
+	} while (USB_REG_RD(csr) & USB_CSR_EVT_PENDING);
 
 	/* Poll EP0 (control) */
 	usb_ep0_poll();
@@ -469,7 +641,7 @@ usb_connect(void)
 		return;
 
 	/* Turn-off pull-up */
-	usb_regs->csr |= USB_CSR_PU_ENA;
+	USB_REG_WR(csr, USB_REG_RD(csr) | USB_CSR_PU_ENA);
 
 	/* Stack update */
 	usb_set_state(USB_DS_CONNECTED);
@@ -483,7 +655,7 @@ usb_disconnect(void)
 		return;
 
 	/* Turn-off pull-up */
-	usb_regs->csr &= ~USB_CSR_PU_ENA;
+	USB_REG_WR(csr, USB_REG_RD(csr) & ~USB_CSR_PU_ENA);
 
 	/* Stack state */
 	usb_set_state(USB_DS_DISCONNECTED);
@@ -493,7 +665,7 @@ usb_disconnect(void)
 void
 usb_set_address(uint8_t addr)
 {
-	usb_regs->csr = USB_CSR_PU_ENA | USB_CSR_CEL_ENA | USB_CSR_ADDR_MATCH | USB_CSR_ADDR(addr);
+	USB_REG_WR(csr, USB_CSR_PU_ENA | USB_CSR_CEL_ENA | USB_CSR_ADDR_MATCH | USB_CSR_ADDR(addr));
 }
 
 
@@ -599,9 +771,14 @@ _usb_ep_conf(uint8_t ep_addr, const struct usb_ep_desc *ep)
 		ml   = ep->wMaxPacketSize;
 	}
 
+#ifdef USB_CORE_WB32
+	USB_REGS_COMB(ep_regs)->status = USB_COMB(csr, 0);
+	ep_regs->cfg = ml;
+#else
 	ep_regs->status = csr;
-	ep_regs->_rsvd[2] = ml;
+	ep_regs->cfg = ml;
 	ep_regs->bd[0].csr = 0;
+#endif
 	ep_regs->bd[1].csr = 0;
 
 	return true;
@@ -614,6 +791,23 @@ usb_ep_reconf(const struct usb_intf_desc *intf, uint8_t ep_addr)
 	const struct usb_ep_desc *ep;
 	const void *eod;
 
+	/* Direct lookup if we have the tables */
+	if (g_usb.conf_idx) {
+		const struct usb_alt_index *ai;
+
+		if ((intf->bInterfaceNumber >= g_usb.conf_idx->n_intf) ||
+		    (intf->bAlternateSetting >= g_usb.conf_idx->intf[intf->bInterfaceNumber].n_alt))
+			return false;
+
+		ai = &g_usb.conf_idx->intf[intf->bInterfaceNumber].alt[intf->bAlternateSetting];
+
+		for (int i=0; i<intf->bNumEndpoints; i++)
+			if (ai->ep[i]->bEndpointAddress == ep_addr)
+				return _usb_ep_conf(ep_addr, ai->ep[i]);
+
+		return false;
+	}
+
 	eod = ((uint8_t*)intf) + conf->wTotalLength;
 	ep = (void*) intf;
 
@@ -635,6 +829,27 @@ usb_ep_boot(const struct usb_intf_desc *intf, uint8_t ep_addr, bool dual_bd)
 	const void *eod;
 	volatile struct usb_ep *ep_regs;
 	uint16_t wMaxPacketSize = 0;
+	bool in = (ep_addr & 0x80) ? true : false;
+	uint32_t ptr[2];
+
+	/* Static plan if we have the tables */
+	if (g_usb.conf_idx) {
+		const struct usb_ep_plan *p;
+
+		if (USB_EP_PLAN_IDX(ep_addr) >= g_usb.conf_idx->n_ep)
+			return false;
+
+		p = &g_usb.conf_idx->ep[USB_EP_PLAN_IDX(ep_addr)];
+		if (!p->addr || (p->n_bd < (dual_bd ? 2 : 1)))
+			return false;
+
+		wMaxPacketSize = p->mps;
+		ep_def = p->def;
+		ptr[0] = g_usb.ep_cfg.plan[in] + p->ptr[0];
+		ptr[1] = g_usb.ep_cfg.plan[in] + p->ptr[1];
+
+		goto setup;
+	}
 
 	/* Scan all alt config to find the max packet size for that EP */
 	eod = ((uint8_t*)conf) + conf->wTotalLength;
@@ -659,15 +874,24 @@ usb_ep_boot(const struct usb_intf_desc *intf, uint8_t ep_addr, bool dual_bd)
 	if (!wMaxPacketSize)
 		return false;
 
-	/* Allocate and setup BDs */
+	/* Allocate */
+	for (int i=0; i<(dual_bd?2:1); i++)
+		ptr[i] = _usb_alloc_buf(wMaxPacketSize, in);
+
+	/* Setup BDs */
+setup:
 	ep_regs = _usb_hw_get_ep(ep_addr);
 
 	ep_regs->status = dual_bd ? USB_EP_BD_DUAL : 0;
-	ep_regs->_rsvd[2] = wMaxPacketSize;
+	ep_regs->cfg = wMaxPacketSize;
 
 	for (int i=0; i<(dual_bd?2:1); i++) {
+#ifdef USB_CORE_WB32
+		USB_REGS_COMB(&ep_regs->bd[i])->csr = USB_COMB(ptr[i], 0);
+#else
 		ep_regs->bd[i].csr = 0x0000;
-		ep_regs->bd[i].ptr = _usb_alloc_buf(wMaxPacketSize, (ep_addr & 0x80) ? true : false);
+		ep_regs->bd[i].ptr = ptr[i];
+#endif
 	}
 
 	/* Configure with the altsetting 0 config */
@@ -37,6 +37,14 @@ usb_ep0_in_queue_data(unsigned int len)
 	usb_ep_regs[0].in.bd[0].csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(len);
 }
 
+#ifdef USB_CORE_XFER
+static inline void
+usb_ep0_in_queue_xfer(unsigned int len, bool zlp)
+{
+	usb_ep_regs[0].in.bd[0].csr = USB_BD_STATE_RDY_DATA | (zlp ? USB_BD_XFER_ZLP : 0) | USB_BD_LEN(len);
+}
+#endif
+
 static inline void
 usb_ep0_in_queue_stall(void)
 {
@@ -100,16 +108,28 @@ usb_handle_control_data()
 		if (xflen > EP0_PKT_LEN)
 			xflen = EP0_PKT_LEN;
 
+		/* Last packet ? */
+#ifdef USB_CORE_XFER
+		/* The core sends the ZLP by itself after a full last packet */
+		bool done = (g_usb.ctrl.xfer.ofs + xflen) == g_usb.ctrl.xfer.len;
+#else
+		bool done = xflen < EP0_PKT_LEN;
+#endif
+
 		/* Setup descriptor for output */
 		if (xflen)
 			usb_data_write(0, &g_usb.ctrl.xfer.data[g_usb.ctrl.xfer.ofs], xflen);
+#ifdef USB_CORE_XFER
+		usb_ep0_in_queue_xfer(xflen, done && (g_usb.ctrl.xfer.len < g_usb.ctrl.req.wLength));
+#else
 		usb_ep0_in_queue_data(xflen);
+#endif
 
 		/* Move on */
 		g_usb.ctrl.xfer.ofs += xflen;
 
 		/* If we're done, setup the OUT ack */
-		if (xflen < EP0_PKT_LEN) {
+		if (done) {
 			usb_ep0_out_queue_data();
 			g_usb.ctrl.state = STATUS_DONE_OUT;
 		}
@@ -122,8 +142,13 @@ usb_handle_control_data()
 
 		if ((bds_out & USB_BD_STATE_MSK) == USB_BD_STATE_DONE_OK)
 		{
-			/* Read data from USB buffer */
+			/* Read data from USB buffer, never more than what's left
+			 * (the host controls the packet length) */
 			int xflen = (bds_out & USB_BD_LEN_MSK) - 2;
+			if (xflen > (g_usb.ctrl.xfer.len - g_usb.ctrl.xfer.ofs))
+				xflen = g_usb.ctrl.xfer.len - g_usb.ctrl.xfer.ofs;
+			if (xflen < 0)
+				xflen = 0;
 			usb_data_read(&g_usb.ctrl.xfer.data[g_usb.ctrl.xfer.ofs], 0, xflen);
 
 			/* Move on */
@@ -215,6 +240,7 @@ usb_ep0_reset(void)
 	/* Configure EP0 */
 	usb_ep_regs[0].out.status = USB_EP_TYPE_CTRL | USB_EP_BD_CTRL; /* Type=Control, control mode buffered */
 	usb_ep_regs[0].in.status  = USB_EP_TYPE_CTRL | USB_EP_DT_BIT;  /* Type=Control, single buffered, DT=1 */
+	usb_ep_regs[0].in.cfg     = USB_EP_CFG_MPS(EP0_PKT_LEN);
 
 	/* Setup the BD pointers */
 	usb_ep_regs[0].in.bd[0].ptr  = 0;
@@ -330,19 +356,21 @@ usb_ep0_poll(void)
 				USB_LOG_ERR("[!] Got SETUP while busy !??\n");
 			}
 
-			/* Clear descriptors */
+			/* Clear descriptors and make sure DT=1 for IN endpoint after a SETUP */
 			usb_ep0_out_clear();
+#ifdef USB_CORE_WB32
+			USB_REGS_COMB(&usb_ep_regs[0].in)->status = USB_COMB(USB_EP_TYPE_CTRL | USB_EP_DT_BIT, 0);
+#else
 			usb_ep0_in_clear();
-
-			/* Make sure DT=1 for IN endpoint after a SETUP */
 			usb_ep_regs[0].in.status = USB_EP_TYPE_CTRL | USB_EP_DT_BIT;  /* Type=Control, single buffered, DT=1 */
+#endif
 
 			/* We acked it, need to handle it */
 			usb_data_read(&g_usb.ctrl.req, EP0_PKT_LEN, sizeof(struct usb_ctrl_req));
 			usb_handle_control_request(&g_usb.ctrl.req);
 
 			/* Release the lockout and allow new SETUP */
-			usb_regs->ar = USB_AR_CEL_RELEASE;
+			USB_REG_WR(ar, USB_AR_CEL_RELEASE);
 			usb_ep0_setup_queue_data();
 
 			return;
@@ -30,7 +30,7 @@ static bool
 _get_status_intf(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 {
 	/* Check interface exits */
-	if (usb_desc_find_intf(NULL, req->wIndex, 0, NULL))
+	if (!usb_desc_find_intf(NULL, req->wIndex, 0, NULL))
 		return false;
 
 	/* Nothing to return really */
@@ -183,6 +183,7 @@ static bool
 _set_configuration(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 {
 	const struct usb_conf_desc *conf = NULL;
+	const struct usb_conf_index *conf_idx = NULL;
 	enum usb_dev_state new_state;
 
 	const struct usb_intf_desc *intf;
@@ -196,6 +197,8 @@ _set_configuration(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		for (int i=0; i<g_usb.stack_desc->n_conf; i++)
 			if (g_usb.stack_desc->conf[i]->bConfigurationValue == req->wValue) {
 				conf = g_usb.stack_desc->conf[i];
+				if (g_usb.stack_desc->conf_idx)
+					conf_idx = &g_usb.stack_desc->conf_idx[i];
 				break;
 			}
 
@@ -208,11 +211,22 @@ _set_configuration(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 	/* Update state */
 		/* FIXME: configure all endpoint */
 	g_usb.conf = conf;
+	g_usb.conf_idx = conf_idx;
 	g_usb.intf_alt = 0;
 	usb_set_state(new_state);
 	usb_dispatch_set_conf(g_usb.conf);
 
+	/* Unconfigured, no interfaces */
+	if (!conf)
+		return true;
+
 	/* Dispatch implicit set_interface alt 0 */
+	if (conf_idx) {
+		for (int i=0; i<conf_idx->n_intf; i++)
+			usb_dispatch_set_intf(conf_idx->intf[i].alt[0].intf, conf_idx->intf[i].alt[0].intf);
+		return true;
+	}
+
 	sod = conf;
 	eod = sod + conf->wTotalLength;
 
@@ -244,8 +258,8 @@ _get_interface(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 	if (intf == NULL)
 		return false;
 
-	/* Fast path */
-	if (!(g_usb.intf_alt & (1 << idx))) {
+	/* Fast path (only tracked for the first 32 interfaces) */
+	if ((idx < 32) && !(g_usb.intf_alt & (1U << idx))) {
 		xfer->data[0] = 0x00;
 		xfer->len = 1;
 		return true;
@@ -282,8 +296,8 @@ _set_interface(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		return false;
 
 	/* Disable fast path if (alt != 0) & success */
-	if (alt != 0)
-		g_usb.intf_alt |= (1 << idx);
+	if ((alt != 0) && (idx < 32))
+		g_usb.intf_alt |= (1U << idx);
 
 	return true;
 }
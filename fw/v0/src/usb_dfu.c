@@ -218,7 +218,7 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		return USB_FND_CONTINUE;
 
 	/* Check if this request is allowed in this state */
-	if ((dfu_valid_req[g_dfu.state] & (1 << req->bRequest)) == 0)
+	if ((req->bRequest >= 32) || (dfu_valid_req[g_dfu.state] & (1U << req->bRequest)) == 0)
 		goto error;
 
 	/* Handle request */
@@ -233,8 +233,10 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 	case USB_RT_DFU_DNLOAD:
 		/* Check for last block */
 		if (req->wLength) {
-			/* Check length doesn't overflow */
-			if ((g_dfu.flash.addr_erase + req->wLength) > g_dfu.flash.addr_end)
+			/* Check length doesn't overflow the buffer or the zone */
+			if (req->wLength > sizeof(g_dfu.buf))
+				goto error;
+			if ((g_dfu.flash.addr_prog + req->wLength) > g_dfu.flash.addr_end)
 				goto error;
 
 			/* Setup buffer for data */
@@ -257,6 +259,10 @@ _dfu_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
 		 * flash synchronously here, not a big deal since we have
 		 * nothing better to do anyway */
 
+		/* Check length doesn't overflow the buffer */
+		if (req->wLength > sizeof(g_dfu.buf))
+			goto error;
+
 		/* Setup buffer for data */
 		xfer->len  = req->wLength;
 		xfer->data = g_dfu.buf;
@@ -0,0 +1,426 @@
+/*
+ * bench.c
+ *
+ * Micro-benchmarks of the v0 stack hot paths against the register model
+ *
+ * Only the time spent inside the firmware (`usb_poll()` and everything it
+ * calls, including the register accesses) is accounted. Reported per
+ * operation:
+ *  - instr: user space instructions retired (needs `perf_event_open`)
+ *  - ns   : wall clock time, noisy, mostly for relative comparisons
+ *  - regs : core register accesses, deterministic
+ *  - polls: `usb_poll()` calls
+ *
+ * A reference file (`-w` to write it, `-c` to check against it) can be
+ * used to catch regressions of the deterministic counts.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_dfu_proto.h>
+#include <no2usb/usb_proto.h>
+
+#include "test_dev.h"
+#include "usb_hw_mock.h"
+
+
+#define TEST_ADDR	0x2a
+
+
+/* Measurement */
+/* ----------- */
+
+struct meas {
+	uint64_t instr;
+	uint64_t ns;
+	uint64_t regs;
+	uint64_t polls;
+};
+
+static struct {
+	int perf_fd;
+	struct meas acc;
+	uint64_t t0;
+} g_meas = {
+	.perf_fd = -1,
+};
+
+static uint64_t
+_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+meas_init(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0x00, sizeof(pe));
+	pe.type           = PERF_TYPE_HARDWARE;
+	pe.size           = sizeof(pe);
+	pe.config         = PERF_COUNT_HW_INSTRUCTIONS;
+	pe.disabled       = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv     = 1;
+
+	g_meas.perf_fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static void
+_meas_enter(void)
+{
+	if (g_meas.perf_fd >= 0)
+		ioctl(g_meas.perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	g_meas.t0 = _now_ns();
+}
+
+static void
+_meas_leave(void)
+{
+	g_meas.acc.ns += _now_ns() - g_meas.t0;
+	if (g_meas.perf_fd >= 0)
+		ioctl(g_meas.perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+static void
+meas_start(void)
+{
+	struct mock_stats *s = mock_stats();
+
+	memset(&g_meas.acc, 0x00, sizeof(g_meas.acc));
+	g_meas.acc.regs  = -(s->reg_rd + s->reg_wr);
+	g_meas.acc.polls = -s->polls;
+
+	if (g_meas.perf_fd >= 0)
+		ioctl(g_meas.perf_fd, PERF_EVENT_IOC_RESET, 0);
+
+	mock_set_fw_hooks(_meas_enter, _meas_leave);
+}
+
+static struct meas
+meas_stop(void)
+{
+	struct mock_stats *s = mock_stats();
+
+	mock_set_fw_hooks(NULL, NULL);
+
+	g_meas.acc.regs  += s->reg_rd + s->reg_wr;
+	g_meas.acc.polls += s->polls;
+
+	if ((g_meas.perf_fd < 0) ||
+	    (read(g_meas.perf_fd, &g_meas.acc.instr, sizeof(uint64_t)) != sizeof(uint64_t)))
+		g_meas.acc.instr = 0;
+
+	return g_meas.acc;
+}
+
+
+/* Helpers */
+/* ------- */
+
+static int g_errors;
+
+static void
+ctrl_addr(uint8_t addr, uint8_t type, uint8_t req, uint16_t val, uint16_t idx, uint16_t len, void *data)
+{
+	struct usb_ctrl_req r = {
+		.bmRequestType = type,
+		.bRequest      = req,
+		.wValue        = val,
+		.wIndex        = idx,
+		.wLength       = len,
+	};
+	int l;
+
+	if (mock_ctrl(addr, &r, data, &l) != MOCK_ACK)
+		g_errors++;
+}
+
+#define ctrl(...) ctrl_addr(TEST_ADDR, __VA_ARGS__)
+
+static void
+dev_enumerate(void)
+{
+	uint8_t buf[256];
+
+	mock_reset();
+	test_dev_init(false);
+	mock_bus_reset();
+
+	ctrl_addr(0, 0x00, 5, TEST_ADDR, 0, 0, NULL);
+	ctrl(0x80, 6, 0x0200, 0, sizeof(buf), buf);
+	ctrl(0x00, 9, 1, 0, 0, NULL);
+}
+
+
+/* Operations */
+/* ---------- */
+
+static uint8_t g_buf[TEST_DFU_XFER_SIZE];
+
+static void
+op_poll_idle(void)
+{
+	mock_fw_poll();
+}
+
+static void
+op_sof(void)
+{
+	mock_sof(1);
+}
+
+static void
+op_ctrl_nodata(void)
+{
+	/* CLEAR_FEATURE(ENDPOINT_HALT) */
+	ctrl(0x02, 1, 0, TEST_EP_BULK_IN, 0, NULL);
+}
+
+static void
+op_ctrl_get_status(void)
+{
+	ctrl(0x80, 0, 0, 0, 2, g_buf);
+}
+
+static void
+op_desc_dev(void)
+{
+	ctrl(0x80, 6, 0x0100, 0, 18, g_buf);
+}
+
+static void
+op_desc_conf(void)
+{
+	ctrl(0x80, 6, 0x0200, 0, 255, g_buf);
+}
+
+static void
+op_desc_str(void)
+{
+	ctrl(0x80, 6, 0x0302, 0x0409, 255, g_buf);
+}
+
+static void
+op_desc_bos(void)
+{
+	ctrl(0x80, 6, 0x0f00, 0, 255, g_buf);
+}
+
+static void
+op_dfu_block(void)
+{
+	static int blk = 0;
+	uint8_t st[6];
+
+	/* Restart at the zone start before running out of space */
+	if (blk == (TEST_FLASH_ZONE_SIZE / TEST_DFU_XFER_SIZE)) {
+		ctrl(0x01, 11, 0, TEST_INTF_DFU, 0, NULL);
+		blk = 0;
+	}
+
+	ctrl(0x21, USB_REQ_DFU_DNLOAD, blk++, TEST_INTF_DFU, TEST_DFU_XFER_SIZE, g_buf);
+
+	do {
+		mock_sof(1);
+		ctrl(0xa1, USB_REQ_DFU_GETSTATUS, 0, TEST_INTF_DFU, 6, st);
+	} while ((st[4] != dfuDNLOAD_IDLE) && !g_errors);
+}
+
+static const struct bench_op {
+	const char *name;
+	void (*fn)(void);
+	int iters;	/* Relative to the base count */
+} g_ops[] = {
+	{ "poll_idle",       op_poll_idle,       10 },
+	{ "sof",             op_sof,             10 },
+	{ "ctrl_nodata",     op_ctrl_nodata,      1 },
+	{ "ctrl_get_status", op_ctrl_get_status,  1 },
+	{ "desc_dev",        op_desc_dev,         1 },
+	{ "desc_conf",       op_desc_conf,        1 },
+	{ "desc_str",        op_desc_str,         1 },
+	{ "desc_bos",        op_desc_bos,         1 },
+	{ "dfu_block",       op_dfu_block,        1 },
+};
+
+
+/* Reference */
+/* --------- */
+
+struct ref {
+	char name[32];
+	double instr;
+	double regs;
+	double polls;
+};
+
+static int
+ref_load(const char *fn, struct ref *refs, int max)
+{
+	char line[256];
+	FILE *fh;
+	int n = 0;
+
+	fh = fopen(fn, "r");
+	if (!fh) {
+		perror(fn);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fh) && (n < max)) {
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		if (sscanf(line, "%31s %lf %lf %lf", refs[n].name, &refs[n].instr, &refs[n].regs, &refs[n].polls) == 4)
+			n++;
+	}
+
+	fclose(fh);
+
+	return n;
+}
+
+static const struct ref *
+ref_find(const struct ref *refs, int n, const char *name)
+{
+	for (int i=0; i<n; i++)
+		if (!strcmp(refs[i].name, name))
+			return &refs[i];
+	return NULL;
+}
+
+static bool
+ref_over(double val, double ref, double tol)
+{
+	/* Missing reference or measurement: not checked */
+	if ((ref <= 0.0) || (val <= 0.0))
+		return false;
+	return val > (ref * (1.0 + tol / 100.0));
+}
+
+
+/* Main */
+/* ---- */
+
+int
+main(int argc, char *argv[])
+{
+	struct ref refs[32];
+	const char *fn_check = NULL, *fn_write = NULL;
+	FILE *fh_write = NULL;
+	double tol = 2.0;
+	int iters = 1000;
+	int n_refs = 0, n_regress = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:c:w:t:")) != -1) {
+		switch (opt) {
+		case 'n': iters    = atoi(optarg); break;
+		case 'c': fn_check = optarg; break;
+		case 'w': fn_write = optarg; break;
+		case 't': tol      = atof(optarg); break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n iters] [-c ref_file [-t tol_pct]] [-w ref_file]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (fn_check) {
+		n_refs = ref_load(fn_check, refs, num_elem(refs));
+		if (n_refs < 0)
+			return 1;
+	}
+
+	if (fn_write) {
+		fh_write = fopen(fn_write, "w");
+		if (!fh_write) {
+			perror(fn_write);
+			return 1;
+		}
+		fprintf(fh_write, "# name instr regs polls (per operation, instr 0 = not measured)\n");
+	}
+
+	meas_init();
+	if (g_meas.perf_fd < 0)
+		fprintf(stderr, "[!] Instruction counter unavailable, only reporting time / accesses\n");
+
+	for (int i=0; i<TEST_DFU_XFER_SIZE; i++)
+		g_buf[i] = i;
+
+	printf("%-16s %10s %10s %8s %8s\n", "op", "instr", "ns", "regs", "polls");
+
+	for (unsigned i=0; i<num_elem(g_ops); i++)
+	{
+		const struct bench_op *op = &g_ops[i];
+		const struct ref *ref;
+		int n = iters * op->iters;
+		struct meas m;
+		double instr, regs, polls;
+		bool regress;
+
+		/* Fresh, configured, device. One warm up run */
+		dev_enumerate();
+		op->fn();
+
+		meas_start();
+		for (int j=0; j<n; j++)
+			op->fn();
+		m = meas_stop();
+
+		if (g_errors) {
+			fprintf(stderr, "[!] %s: transfer errors\n", op->name);
+			return 1;
+		}
+
+		instr = (double)m.instr / n;
+		regs  = (double)m.regs  / n;
+		polls = (double)m.polls / n;
+
+		/* Compare */
+		ref = ref_find(refs, n_refs, op->name);
+		regress = ref && (
+			ref_over(instr, ref->instr, tol) ||
+			ref_over(regs,  ref->regs,  tol) ||
+			ref_over(polls, ref->polls, tol)
+		);
+		n_regress += regress;
+
+		if (g_meas.perf_fd >= 0)
+			printf("%-16s %10.1f", op->name, instr);
+		else
+			printf("%-16s %10s", op->name, "-");
+
+		printf(" %10.1f %8.1f %8.1f%s\n",
+			(double)m.ns / n, regs, polls,
+			regress ? "  REGRESSION" : "");
+
+		if (fh_write)
+			fprintf(fh_write, "%s %.1f %.1f %.1f\n", op->name, instr, regs, polls);
+	}
+
+	if (fh_write)
+		fclose(fh_write);
+
+	if (fn_check)
+		printf("%s\n", n_regress ? "FAIL" : "PASS");
+
+	return n_regress ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+/*
+ * config.h
+ *
+ * Host builds of the v0 stack : no memory map, all hardware accesses go
+ * through the register model (USB_HW_MOCK, see usb_hw_mock.c)
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
@@ -0,0 +1,10 @@
+/*
+ * console.h
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdio.h>
@@ -0,0 +1,815 @@
+/*
+ * fuzz.c
+ *
+ * Coverage guided fuzzer of the v0 stack control path against the
+ * register model
+ *
+ * Each input is a sequence of host operations (full control transfers
+ * built from fuzzed SETUP packets and data stages, lone SETUP / OUT / IN
+ * transactions, bus resets, SOFs, suspend, idle polls) played against a
+ * freshly initialized (and by default enumerated) test device. The stack is
+ * built with ASan / UBSan, so out-of-bounds accesses, bad shifts and such
+ * abort the run. On top of that, each `usb_poll()` call has a latency
+ * budget (core register accesses, and basic blocks for the built-in engine)
+ * to catch unbounded or runaway loops.
+ *
+ * Two ways to drive it:
+ *  - Built-in engine (any gcc / clang): the stack objects are built with
+ *    `-fsanitize-coverage=trace-pc` and this file collects the edges.
+ *    Simple mutational loop, AFL style hit count buckets.
+ *  - libFuzzer (clang, `FUZZ_LIBFUZZER`): only provides
+ *    `LLVMFuzzerTestOneInput()`.
+ *
+ * Input format:
+ *  - 1 byte prologue: bit 0 selects the DFU runtime variant, bit 1 skips
+ *    the enumeration (bus reset, SET_ADDRESS, SET_CONFIGURATION)
+ *  - Then operations, opcode byte followed by its arguments. Opcode bits
+ *    [2:0] select the operation, bit 3 targets address 0 instead of the
+ *    current device address, bits [7:4] are the EP number for OUT / IN.
+ *      0,1: control transfer, 8 bytes SETUP, then OUT data (zero padded)
+ *      2  : SETUP only, 8 bytes
+ *      3  : OUT, 1 byte length, 1 byte fill value
+ *      4  : IN
+ *      5  : bus reset
+ *      6  : 1 byte, SOF with bit 0 clear (bits [7:1] frames), suspend
+ *           toggle with bit 0 set
+ *      7  : 1 byte, (bits [3:0] + 1) idle polls
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_dfu_proto.h>
+#include <no2usb/usb_msos20_proto.h>
+#include <no2usb/usb_proto.h>
+
+#include "test_dev.h"
+#include "usb_hw_mock.h"
+
+
+#define FUZZ_ADDR		0x2a
+#define FUZZ_MAX_LEN		4096
+#define FUZZ_MAX_OPS		256
+
+	/* Per `usb_poll()` budget, ~4x the worst case seen (7 / 300) */
+#define FUZZ_POLL_REGS_MAX	32
+#define FUZZ_POLL_BB_MAX	1024
+
+#define FUZZ_MAP_SIZE		(1 << 16)
+#define FUZZ_CORPUS_MAX		4096
+
+
+/* Latency budget */
+/* -------------- */
+
+static struct {
+	uint64_t regs;
+	uint64_t bb;
+	unsigned int max_regs;
+	unsigned int max_bb;
+} g_budget;
+
+static uint64_t g_bb_cnt;	/* Stays 0 without the built-in engine */
+
+static void fuzz_artifact(const char *kind);
+
+static void
+_budget_enter(void)
+{
+	struct mock_stats *s = mock_stats();
+
+	g_budget.regs = s->reg_rd + s->reg_wr;
+	g_budget.bb   = g_bb_cnt;
+}
+
+static void
+_budget_leave(void)
+{
+	struct mock_stats *s = mock_stats();
+	unsigned int regs = s->reg_rd + s->reg_wr - g_budget.regs;
+	unsigned int bb   = g_bb_cnt - g_budget.bb;
+
+	if (regs > g_budget.max_regs)
+		g_budget.max_regs = regs;
+	if (bb > g_budget.max_bb)
+		g_budget.max_bb = bb;
+
+	if ((regs > FUZZ_POLL_REGS_MAX) || (bb > FUZZ_POLL_BB_MAX)) {
+		fprintf(stderr, "[!] usb_poll() over budget: %u register accesses (max %d), %u blocks (max %d)\n",
+			regs, FUZZ_POLL_REGS_MAX, bb, FUZZ_POLL_BB_MAX);
+		fuzz_artifact("slow");
+		abort();
+	}
+}
+
+
+/* Input interpretation */
+/* -------------------- */
+
+struct fuzz_in {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+static uint8_t g_xfer_buf[65536];
+
+static bool
+fi_more(struct fuzz_in *fi)
+{
+	return fi->p < fi->end;
+}
+
+static uint8_t
+fi_u8(struct fuzz_in *fi)
+{
+	return (fi->p < fi->end) ? *fi->p++ : 0x00;
+}
+
+static void
+fi_data(struct fuzz_in *fi, void *dst, int len)
+{
+	int l = fi->end - fi->p;
+
+	if (l > len)
+		l = len;
+
+	memcpy(dst, fi->p, l);
+	memset((uint8_t *)dst + l, 0x00, len - l);
+	fi->p += l;
+}
+
+static void
+fi_req(struct fuzz_in *fi, struct usb_ctrl_req *req)
+{
+	uint8_t raw[8];
+
+	fi_data(fi, raw, sizeof(raw));
+
+	req->bmRequestType = raw[0];
+	req->bRequest      = raw[1];
+	req->wValue        = raw[2] | (raw[3] << 8);
+	req->wIndex        = raw[4] | (raw[5] << 8);
+	req->wLength       = raw[6] | (raw[7] << 8);
+}
+
+static void
+fuzz_enumerate(void)
+{
+	struct usb_ctrl_req req = {
+		.bmRequestType = 0x00,
+		.bRequest      = 5,	/* SET_ADDRESS */
+		.wValue        = FUZZ_ADDR,
+	};
+
+	mock_bus_reset();
+	mock_ctrl(0, &req, NULL, NULL);
+
+	req.bRequest = 9;	/* SET_CONFIGURATION */
+	req.wValue   = 1;
+	mock_ctrl(FUZZ_ADDR, &req, NULL, NULL);
+}
+
+static void
+fuzz_one(const uint8_t *data, size_t size)
+{
+	struct fuzz_in fi = { .p = data, .end = data + size };
+	struct usb_ctrl_req req;
+	uint8_t prologue, op, addr, ep, v;
+	int len;
+	bool dt;
+
+	/* Fresh device */
+	prologue = fi_u8(&fi);
+
+	mock_reset();
+	mock_set_fw_hooks(_budget_enter, _budget_leave);
+	test_dev_init(prologue & 1);
+
+	if (!(prologue & 2))
+		fuzz_enumerate();
+
+	/* Play operations */
+	for (int i=0; (i<FUZZ_MAX_OPS) && fi_more(&fi); i++)
+	{
+		op   = fi_u8(&fi);
+		addr = (op & 8) ? 0 : mock_address();
+		ep   = op >> 4;
+
+		switch (op & 7) {
+		case 0:
+		case 1:
+			fi_req(&fi, &req);
+			if (!(req.bmRequestType & USB_REQ_READ))
+				fi_data(&fi, g_xfer_buf, req.wLength);
+			mock_ctrl(addr, &req, g_xfer_buf, &len);
+			break;
+
+		case 2:
+			fi_req(&fi, &req);
+			mock_setup(addr, &req);
+			mock_fw_poll();
+			break;
+
+		case 3:
+			len = fi_u8(&fi);
+			memset(g_xfer_buf, fi_u8(&fi), len);
+			mock_out(addr, ep, g_xfer_buf, len);
+			mock_fw_poll();
+			break;
+
+		case 4:
+			mock_in(addr, ep, g_xfer_buf, &len, 1023, &dt);
+			mock_fw_poll();
+			break;
+
+		case 5:
+			mock_bus_reset();
+			break;
+
+		case 6:
+			v = fi_u8(&fi);
+			if (v & 1)
+				mock_suspend(!(usb_get_state() & USB_DS_SUSPENDED));
+			else
+				mock_sof(v >> 1);
+			break;
+
+		case 7:
+			v = fi_u8(&fi);
+			for (int j=0; j<=(v & 15); j++)
+				mock_fw_poll();
+			break;
+		}
+	}
+
+	mock_set_fw_hooks(NULL, NULL);
+}
+
+
+#ifdef FUZZ_LIBFUZZER
+
+/* libFuzzer entry point */
+/* --------------------- */
+
+static void
+fuzz_artifact(const char *kind)
+{
+	/* libFuzzer saves the input itself on abort() */
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size <= FUZZ_MAX_LEN)
+		fuzz_one(data, size);
+	return 0;
+}
+
+#else
+
+/* Coverage */
+/* -------- */
+
+static uint8_t  g_cov_map[FUZZ_MAP_SIZE];
+static uint8_t  g_cov_virgin[FUZZ_MAP_SIZE];
+static uintptr_t g_cov_prev;
+
+/* Called by every basic block of the `-fsanitize-coverage=trace-pc` objects */
+void
+__sanitizer_cov_trace_pc(void)
+{
+	uintptr_t cur = (uintptr_t)__builtin_return_address(0);
+
+	cur = (cur ^ (cur >> 16)) & (FUZZ_MAP_SIZE - 1);
+	g_cov_map[cur ^ g_cov_prev]++;
+	g_cov_prev = cur >> 1;
+	g_bb_cnt++;
+}
+
+static inline uint8_t
+cov_bucket(uint8_t n)
+{
+	if (n <= 2)   return n;
+	if (n == 3)   return 4;
+	if (n <= 7)   return 8;
+	if (n <= 15)  return 16;
+	if (n <= 31)  return 32;
+	if (n <= 127) return 64;
+	return 128;
+}
+
+static void
+cov_reset(void)
+{
+	memset(g_cov_map, 0x00, sizeof(g_cov_map));
+	g_cov_prev = 0;
+}
+
+static bool
+cov_update(int *edges)
+{
+	bool new = false;
+
+	for (int i=0; i<FUZZ_MAP_SIZE; i++) {
+		uint8_t b;
+
+		if (!g_cov_map[i])
+			continue;
+
+		b = cov_bucket(g_cov_map[i]);
+		if (b & ~g_cov_virgin[i]) {
+			if (!g_cov_virgin[i])
+				(*edges)++;
+			g_cov_virgin[i] |= b;
+			new = true;
+		}
+	}
+
+	return new;
+}
+
+
+/* Corpus */
+/* ------ */
+
+struct fuzz_entry {
+	uint8_t *data;
+	int len;
+};
+
+static struct {
+	struct fuzz_entry e[FUZZ_CORPUS_MAX];
+	int n;
+	int edges;
+	const char *dir;
+} g_corpus;
+
+static uint64_t
+_hash(const uint8_t *data, int len)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (int i=0; i<len; i++)
+		h = (h ^ data[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static void
+_save(const char *prefix, const char *kind, const uint8_t *data, int len, bool report)
+{
+	/* Only async-signal-safe calls, this runs from signal handlers */
+	static const char hex[] = "0123456789abcdef";
+	char fn[512];
+	uint64_t h = _hash(data, len);
+	int l = 0, fd;
+
+	for (const char *s=prefix; *s && (l < 400); s++)
+		fn[l++] = *s;
+	for (const char *s=kind; *s && (l < 480); s++)
+		fn[l++] = *s;
+	fn[l++] = '-';
+	for (int i=60; i>=0; i-=4)
+		fn[l++] = hex[(h >> i) & 0xf];
+	fn[l] = 0;
+
+	fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	if (write(fd, data, len) != len)
+		write(STDERR_FILENO, "[!] Short write\n", 16);
+	close(fd);
+
+	if (!report)
+		return;
+
+	write(STDERR_FILENO, "[!] Input saved to ", 19);
+	write(STDERR_FILENO, fn, l);
+	write(STDERR_FILENO, "\n", 1);
+}
+
+static bool
+corpus_add(const uint8_t *data, int len)
+{
+	struct fuzz_entry *e;
+	char prefix[400];
+
+	if (g_corpus.n == FUZZ_CORPUS_MAX)
+		return false;
+
+	e = &g_corpus.e[g_corpus.n++];
+	e->data = malloc(len ? len : 1);
+	e->len  = len;
+	memcpy(e->data, data, len);
+
+	if (g_corpus.dir) {
+		snprintf(prefix, sizeof(prefix), "%s/", g_corpus.dir);
+		_save(prefix, "id", data, len, false);
+	}
+
+	return true;
+}
+
+
+/* Run control */
+/* ----------- */
+
+static struct {
+	const uint8_t *data;
+	int len;
+	const char *prefix;
+	int timeout;
+} g_run = {
+	.prefix  = "",
+	.timeout = 1,
+};
+
+static void
+fuzz_artifact(const char *kind)
+{
+	if (g_run.data)
+		_save(g_run.prefix, kind, g_run.data, g_run.len, true);
+	g_run.data = NULL;
+}
+
+static void
+_on_abort(int sig)
+{
+	fuzz_artifact("crash");
+	signal(SIGABRT, SIG_DFL);
+	raise(SIGABRT);
+}
+
+static void
+_on_alarm(int sig)
+{
+	write(STDERR_FILENO, "[!] Input timed out\n", 20);
+	fuzz_artifact("timeout");
+	_exit(1);
+}
+
+/* Sanitizers report then abort(), which saves the input */
+const char *
+__asan_default_options(void)
+{
+	return "abort_on_error=1";
+}
+
+const char *
+__ubsan_default_options(void)
+{
+	return "abort_on_error=1:print_stacktrace=1";
+}
+
+static bool
+fuzz_run(const uint8_t *data, int len)
+{
+	cov_reset();
+
+	g_run.data = data;
+	g_run.len  = len;
+
+	alarm(g_run.timeout);
+	fuzz_one(data, len);
+	alarm(0);
+
+	g_run.data = NULL;
+
+	return cov_update(&g_corpus.edges);
+}
+
+
+/* Mutations */
+/* --------- */
+
+static uint64_t g_rng;
+
+static uint32_t
+rnd(uint32_t n)
+{
+	/* xorshift64* */
+	g_rng ^= g_rng >> 12;
+	g_rng ^= g_rng << 25;
+	g_rng ^= g_rng >> 27;
+	return ((g_rng * 0x2545f4914f6cdd1dULL) >> 32) % n;
+}
+
+	/* SETUP packets worth trying as a whole */
+#define REQ(t, r, v, i, l) { (t), (r), (v) & 0xff, (v) >> 8, (i) & 0xff, (i) >> 8, (l) & 0xff, (l) >> 8 }
+
+static const uint8_t g_dict_req[][8] = {
+	/* Standard */
+	REQ(0x80,  0, 0x0000, 0x0000, 2),		/* GET_STATUS */
+	REQ(0x81,  0, 0x0000, TEST_INTF_BULK, 2),
+	REQ(0x82,  0, 0x0000, 0x0081, 2),
+	REQ(0x02,  1, 0x0000, 0x0001, 0),		/* CLEAR_FEATURE */
+	REQ(0x02,  3, 0x0000, 0x0081, 0),		/* SET_FEATURE */
+	REQ(0x00,  5, FUZZ_ADDR, 0x0000, 0),		/* SET_ADDRESS */
+	REQ(0x80,  6, 0x0100, 0x0000, 18),		/* GET_DESCRIPTOR */
+	REQ(0x80,  6, 0x0200, 0x0000, 0xffff),
+	REQ(0x80,  6, 0x0300, 0x0000, 255),
+	REQ(0x80,  6, 0x0302, 0x0409, 255),
+	REQ(0x80,  6, 0x0f00, 0x0000, 0xffff),
+	REQ(0x80,  8, 0x0000, 0x0000, 1),		/* GET_CONFIGURATION */
+	REQ(0x00,  9, 0x0001, 0x0000, 0),		/* SET_CONFIGURATION */
+	REQ(0x00,  9, 0x0000, 0x0000, 0),
+	REQ(0x81, 10, 0x0000, TEST_INTF_DFU, 1),	/* GET_INTERFACE */
+	REQ(0x01, 11, 0x0001, TEST_INTF_DFU, 0),	/* SET_INTERFACE */
+	REQ(0x01, 11, 0x0000, TEST_INTF_BULK, 0),
+
+	/* DFU */
+	REQ(0x21, USB_REQ_DFU_DETACH,    0x0000, TEST_INTF_DFU, 0),
+	REQ(0x21, USB_REQ_DFU_DNLOAD,    0x0000, TEST_INTF_DFU, TEST_DFU_XFER_SIZE),
+	REQ(0x21, USB_REQ_DFU_DNLOAD,    0x0001, TEST_INTF_DFU, 0),
+	REQ(0xa1, USB_REQ_DFU_UPLOAD,    0x0000, TEST_INTF_DFU, TEST_DFU_XFER_SIZE),
+	REQ(0xa1, USB_REQ_DFU_GETSTATUS, 0x0000, TEST_INTF_DFU, 6),
+	REQ(0x21, USB_REQ_DFU_CLRSTATUS, 0x0000, TEST_INTF_DFU, 0),
+	REQ(0xa1, USB_REQ_DFU_GETSTATE,  0x0000, TEST_INTF_DFU, 1),
+	REQ(0x21, USB_REQ_DFU_ABORT,     0x0000, TEST_INTF_DFU, 0),
+
+	/* MS OS 2.0 */
+	REQ(0xc0, MSOS20_MS_VENDOR_CODE, 0x0000, MSOS20_DESCRIPTOR_INDEX, 0xffff),
+};
+
+#undef REQ
+
+static const uint16_t g_dict_u16[] = {
+	0x0000, 0x0001, 0x0002, 0x0006, 0x0007, 0x0008, 0x001f, 0x0020,
+	0x003f, 0x0040, 0x0041, 0x007f, 0x0080, 0x00ff, 0x0100, 0x03ff,
+	0x0400, 0x0401, 0x0fff, 0x1000, 0x1001, 0x7fff, 0x8000, 0xffff,
+};
+
+static int
+mutate_one(uint8_t *d, int len)
+{
+	int pos = len ? rnd(len) : 0;
+	int l;
+
+	switch (rnd(10)) {
+	case 0:	/* Bit flip */
+		if (len)
+			d[pos] ^= 1 << rnd(8);
+		break;
+
+	case 1:	/* Random byte */
+		if (len)
+			d[pos] = rnd(256);
+		break;
+
+	case 2:	/* Small add / sub */
+		if (len)
+			d[pos] += rnd(33) - 16;
+		break;
+
+	case 3:	/* Interesting 16 bit value */
+		if (len >= 2) {
+			uint16_t v = g_dict_u16[rnd(num_elem(g_dict_u16))];
+			pos = rnd(len - 1);
+			d[pos+0] = v & 0xff;
+			d[pos+1] = v >> 8;
+		}
+		break;
+
+	case 4:	/* Delete */
+		if (len > 1) {
+			l = 1 + rnd(len - pos < 16 ? len - pos : 16);
+			memmove(&d[pos], &d[pos+l], len - pos - l);
+			len -= l;
+		}
+		break;
+
+	case 5:	/* Duplicate a chunk */
+		if (len) {
+			l = 1 + rnd(len - pos < 32 ? len - pos : 32);
+			if (len + l <= FUZZ_MAX_LEN) {
+				int dst = rnd(len + 1);
+				uint8_t tmp[32];
+				memcpy(tmp, &d[pos], l);
+				memmove(&d[dst+l], &d[dst], len - dst);
+				memcpy(&d[dst], tmp, l);
+				len += l;
+			}
+		}
+		break;
+
+	case 6:	/* Insert a dictionary control transfer / SETUP */
+	case 7:
+		if (len + 9 <= FUZZ_MAX_LEN) {
+			const uint8_t *r = g_dict_req[rnd(num_elem(g_dict_req))];
+			pos = 1 + rnd(len ? len : 1);
+			if (pos > len)
+				pos = len;
+			memmove(&d[pos+9], &d[pos], len - pos);
+			d[pos] = rnd(4) ? 0x00 : 0x02;
+			memcpy(&d[pos+1], r, 8);
+			len += 9;
+		}
+		break;
+
+	case 8:	/* Insert a random short operation */
+		if (len + 2 <= FUZZ_MAX_LEN) {
+			memmove(&d[pos+2], &d[pos], len - pos);
+			d[pos+0] = rnd(256);
+			d[pos+1] = rnd(256);
+			len += 2;
+		}
+		break;
+
+	case 9:	/* Splice with another corpus entry */
+		if (g_corpus.n) {
+			const struct fuzz_entry *o = &g_corpus.e[rnd(g_corpus.n)];
+			int ofs = o->len ? rnd(o->len) : 0;
+			l = o->len - ofs;
+			if (pos + l > FUZZ_MAX_LEN)
+				l = FUZZ_MAX_LEN - pos;
+			memcpy(&d[pos], &o->data[ofs], l);
+			if (pos + l > len)
+				len = pos + l;
+		}
+		break;
+	}
+
+	return len;
+}
+
+static int
+mutate(uint8_t *d, int len)
+{
+	int n = 1 << rnd(5);
+
+	while (n--)
+		len = mutate_one(d, len);
+
+	return len;
+}
+
+
+/* Seeds */
+/* ----- */
+
+static void
+seed_builtin(void)
+{
+	uint8_t d[1 + 9];
+
+	/* Empty (enumeration only), and each dictionary request alone */
+	d[0] = 0x00;
+	fuzz_run(d, 1);
+	corpus_add(d, 1);
+
+	for (unsigned i=0; i<num_elem(g_dict_req); i++) {
+		d[0] = 0x00;
+		d[1] = 0x00;
+		memcpy(&d[2], g_dict_req[i], 8);
+		if (fuzz_run(d, 10))
+			corpus_add(d, 10);
+	}
+}
+
+static int
+seed_file(const char *fn)
+{
+	uint8_t d[FUZZ_MAX_LEN];
+	FILE *fh;
+	int len;
+
+	fh = fopen(fn, "rb");
+	if (!fh) {
+		perror(fn);
+		return -1;
+	}
+
+	len = fread(d, 1, sizeof(d), fh);
+	fclose(fh);
+
+	if (fuzz_run(d, len))
+		corpus_add(d, len);
+
+	return 0;
+}
+
+static int
+seed_path(const char *path)
+{
+	struct dirent *de;
+	struct stat st;
+	char fn[1024];
+	DIR *dir;
+	int rv = 0;
+
+	if (stat(path, &st)) {
+		perror(path);
+		return -1;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return seed_file(path);
+
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		return -1;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(fn, sizeof(fn), "%s/%s", path, de->d_name);
+		if (!stat(fn, &st) && S_ISREG(st.st_mode))
+			rv |= seed_file(fn);
+	}
+
+	closedir(dir);
+
+	return rv;
+}
+
+
+/* Main */
+/* ---- */
+
+static void
+print_stats(long iter, time_t t0)
+{
+	printf("#%-9ld %4lds  corpus %4d  edges %5d  poll max: %3u regs %5u blocks\n",
+		iter, (long)(time(NULL) - t0), g_corpus.n, g_corpus.edges,
+		g_budget.max_regs, g_budget.max_bb);
+	fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static uint8_t d[FUZZ_MAX_LEN];
+	long iters = 100000;
+	time_t t0 = time(NULL);
+	int opt, len;
+
+	g_rng = 1;
+
+	while ((opt = getopt(argc, argv, "n:s:t:o:a:")) != -1) {
+		switch (opt) {
+		case 'n': iters          = atol(optarg); break;
+		case 's': g_rng          = strtoull(optarg, NULL, 0) | 1; break;
+		case 't': g_run.timeout  = atoi(optarg); break;
+		case 'o': g_corpus.dir   = optarg; break;
+		case 'a': g_run.prefix   = optarg; break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n iters] [-s seed] [-t timeout_s] [-o corpus_dir] [-a artifact_prefix] [file|dir ...]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	/* Crash / hang reporting */
+	signal(SIGABRT, _on_abort);
+	signal(SIGALRM, _on_alarm);
+
+	/* Initial corpus (that's a replay of all of them) */
+	for (int i=optind; i<argc; i++)
+		if (seed_path(argv[i]))
+			return 1;
+
+	if (!iters) {
+		print_stats(0, t0);
+		return 0;
+	}
+
+	seed_builtin();
+	print_stats(0, t0);
+
+	/* Fuzz */
+	for (long i=1; i<=iters; i++)
+	{
+		const struct fuzz_entry *e = &g_corpus.e[rnd(g_corpus.n)];
+
+		memcpy(d, e->data, e->len);
+		len = mutate(d, e->len);
+
+		if (fuzz_run(d, len))
+			corpus_add(d, len);
+
+		if (!(i & (i - 1)) || !(i % 100000))
+			print_stats(i, t0);
+	}
+
+	print_stats(iters, t0);
+
+	return 0;
+}
+
+#endif /* FUZZ_LIBFUZZER */
@@ -0,0 +1,795 @@
+/*
+ * test.c
+ *
+ * Scenario runner for host builds of the v0 stack against the register
+ * model. Each scenario starts from a freshly initialized core and stack.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_hw.h>
+#include <no2usb/usb_priv.h>
+#include <no2usb/usb_dfu_proto.h>
+#include <no2usb/usb_msos20.h>
+#include <no2usb/usb_msos20_proto.h>
+#include <no2usb/usb_proto.h>
+
+#include "test_dev.h"
+#include "usb_hw_mock.h"
+
+
+#define TEST_ADDR	0x2a
+
+static int g_verbose;
+static int g_fail;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "  [!] %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		g_fail++; \
+	} \
+} while (0)
+
+#define CHECK_RES(expr, exp) do { \
+	enum mock_res _r = (expr); \
+	if (_r != (exp)) { \
+		fprintf(stderr, "  [!] %s:%d: %s -> %s (expected %s)\n", __FILE__, __LINE__, \
+			#expr, mock_res_str(_r), mock_res_str(exp)); \
+		g_fail++; \
+	} \
+} while (0)
+
+
+/* Helpers */
+/* ------- */
+
+static enum mock_res
+ctrl(uint8_t addr, uint8_t type, uint8_t req, uint16_t val, uint16_t idx,
+     uint16_t len, void *data, int *xlen)
+{
+	struct usb_ctrl_req r = {
+		.bmRequestType = type,
+		.bRequest      = req,
+		.wValue        = val,
+		.wIndex        = idx,
+		.wLength       = len,
+	};
+	enum mock_res res;
+
+	res = mock_ctrl(addr, &r, data, xlen);
+
+	if (g_verbose)
+		printf("    ctrl %02x %02x %04x %04x %04x -> %s (%d)\n",
+			type, req, val, idx, len, mock_res_str(res), xlen ? *xlen : 0);
+
+	return res;
+}
+
+static enum mock_res
+get_desc(uint8_t addr, uint8_t type, uint8_t idx, void *buf, int len, int *xlen)
+{
+	return ctrl(addr, 0x80, 6, (type << 8) | idx, 0, len, buf, xlen);
+}
+
+static void
+dev_setup(bool dfu_rt)
+{
+	mock_reset();
+	test_dev_init(dfu_rt);
+}
+
+static void
+dev_enumerate(bool dfu_rt)
+{
+	uint8_t buf[256];
+	int l;
+
+	dev_setup(dfu_rt);
+	mock_bus_reset();
+
+	CHECK_RES(ctrl(0, 0x00, 5, TEST_ADDR, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_CONF, 0, buf, sizeof(buf), &l), MOCK_ACK);
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(usb_get_state() == USB_DS_CONFIGURED);
+}
+
+static uint8_t
+dfu_get_status(uint8_t *status)
+{
+	uint8_t buf[6] = { 0 };
+	int l;
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_GETSTATUS, 0, TEST_INTF_DFU, 6, buf, &l), MOCK_ACK);
+	CHECK(l == 6);
+
+	if (status)
+		*status = buf[0];
+
+	return buf[4];
+}
+
+static uint8_t
+pattern(int i)
+{
+	return (i * 13 + (i >> 8)) & 0xff;
+}
+
+
+/* Scenarios */
+/* --------- */
+
+static void
+t_connect(void)
+{
+	struct usb_ctrl_req req = { .bmRequestType = 0x80, .bRequest = 6, .wValue = 0x0100, .wLength = 8 };
+
+	mock_reset();
+	CHECK(!mock_pullup());
+
+	test_dev_init(false);
+	CHECK(mock_pullup());
+	CHECK(usb_get_state() == USB_DS_CONNECTED);
+
+	/* Nothing answers until the first bus reset */
+	mock_fw_poll();
+	CHECK_RES(mock_setup(0, &req), MOCK_TIMEOUT);
+
+	/* Reset: firmware must wait for the release */
+	mock_bus_reset();
+	CHECK(usb_get_state() == USB_DS_DEFAULT);
+	CHECK(mock_address() == 0);
+
+	usb_disconnect();
+	CHECK(!mock_pullup());
+	CHECK(usb_get_state() == USB_DS_DISCONNECTED);
+}
+
+static void
+t_enumerate(void)
+{
+	uint8_t buf[256];
+	int l;
+
+	dev_setup(false);
+	mock_bus_reset();
+
+	/* Device descriptor, short then full */
+	CHECK_RES(get_desc(0, USB_DT_DEV, 0, buf, 8, &l), MOCK_ACK);
+	CHECK(l == 8);
+	CHECK(!memcmp(buf, test_stack_desc.dev, 8));
+
+	CHECK_RES(get_desc(0, USB_DT_DEV, 0, buf, 64, &l), MOCK_ACK);
+	CHECK(l == sizeof(struct usb_dev_desc));
+	CHECK(!memcmp(buf, test_stack_desc.dev, l));
+
+	/* Address, only applied after the status stage */
+	CHECK_RES(ctrl(0, 0x00, 5, TEST_ADDR, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(mock_address() == TEST_ADDR);
+	CHECK_RES(get_desc(0, USB_DT_DEV, 0, buf, 8, &l), MOCK_TIMEOUT);
+
+	/* Configuration, header then full (multi packet) */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_CONF, 0, buf, 9, &l), MOCK_ACK);
+	CHECK(l == 9);
+
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_CONF, 0, buf, sizeof(buf), &l), MOCK_ACK);
+	CHECK(l == test_stack_desc.conf[0]->wTotalLength);
+	CHECK(l > 64);
+	CHECK(!memcmp(buf, test_stack_desc.conf[0], l));
+
+	/* Invalid index */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_CONF, 1, buf, sizeof(buf), &l), MOCK_STALL);
+
+	/* Strings */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, 0, buf, 255, &l), MOCK_ACK);
+	CHECK((l == 4) && (buf[2] == 0x09) && (buf[3] == 0x04));
+
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, 2, buf, 255, &l), MOCK_ACK);
+	CHECK(l == test_stack_desc.str[2]->bLength);
+	CHECK(!memcmp(buf, test_stack_desc.str[2], l));
+
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, 42, buf, 255, &l), MOCK_STALL);
+
+	/* Configure */
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(usb_get_state() == USB_DS_CONFIGURED);
+	CHECK(g_test_dev.set_conf == 1);
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x80, 8, 0, 0, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == 1));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 2, 0, 0, NULL, NULL), MOCK_STALL);
+}
+
+static void
+t_desc_zlp(void)
+{
+	uint8_t buf[256];
+	int l;
+
+	dev_enumerate(false);
+
+	/* Exactly one full packet, shorter than requested: needs a ZLP */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, TEST_STR_LONG, buf, 255, &l), MOCK_ACK);
+	CHECK(l == 64);
+	CHECK(!memcmp(buf, test_stack_desc.str[TEST_STR_LONG], l));
+
+	/* Same but requested length matches: no ZLP */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, TEST_STR_LONG, buf, 64, &l), MOCK_ACK);
+	CHECK(l == 64);
+
+	/* Truncated */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_STR, TEST_STR_LONG, buf, 10, &l), MOCK_ACK);
+	CHECK(l == 10);
+}
+
+static void
+t_std_requests(void)
+{
+	uint8_t buf[64];
+	int l;
+
+	dev_enumerate(false);
+
+	/* GET_STATUS */
+	CHECK_RES(ctrl(TEST_ADDR, 0x80, 0, 0, 0, 2, buf, &l), MOCK_ACK);
+	CHECK((l == 2) && (buf[0] == 0) && (buf[1] == 0));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x82, 0, 0, TEST_EP_BULK_IN, 2, buf, &l), MOCK_ACK);
+	CHECK((l == 2) && (buf[0] == 0));
+	CHECK_RES(ctrl(TEST_ADDR, 0x82, 0, 0, 0x85, 2, buf, &l), MOCK_STALL);
+
+	/* Halt / resume */
+	CHECK_RES(ctrl(TEST_ADDR, 0x02, 3, 0, TEST_EP_BULK_IN, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(ctrl(TEST_ADDR, 0x82, 0, 0, TEST_EP_BULK_IN, 2, buf, &l), MOCK_ACK);
+	CHECK(buf[0] == 1);
+
+	{
+		bool dt;
+		CHECK_RES(mock_in(TEST_ADDR, TEST_EP_BULK_IN, buf, &l, sizeof(buf), &dt), MOCK_STALL);
+		CHECK_RES(mock_out(TEST_ADDR, TEST_EP_BULK_OUT, buf, 8), MOCK_NAK);
+
+		CHECK_RES(ctrl(TEST_ADDR, 0x02, 1, 0, TEST_EP_BULK_IN, 0, NULL, NULL), MOCK_ACK);
+		CHECK_RES(mock_in(TEST_ADDR, TEST_EP_BULK_IN, buf, &l, sizeof(buf), &dt), MOCK_NAK);
+	}
+
+	/* Not for EP0, not for unknown features */
+	CHECK_RES(ctrl(TEST_ADDR, 0x02, 3, 0, 0x00, 0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x02, 3, 1, TEST_EP_BULK_IN, 0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 3, 1, 0, 0, NULL, NULL), MOCK_STALL);
+
+	/* Interfaces */
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == 0));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 1, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == 1));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 2, TEST_INTF_DFU,  0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 1, TEST_INTF_BULK, 0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 0, TEST_INTF_BULK, 0, NULL, NULL), MOCK_ACK);
+
+	/* Unknown request is STALLed, next SETUP recovers */
+	CHECK_RES(ctrl(TEST_ADDR, 0xc0, 0x99, 0, 0, 4, buf, &l), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x80, 0, 0, 0, 2, buf, &l), MOCK_ACK);
+}
+
+static void
+t_get_status_intf(void)
+{
+	uint8_t buf[4];
+	int l;
+
+	dev_enumerate(false);
+
+	/* Every existing interface answers with two zero bytes */
+	memset(buf, 0xaa, sizeof(buf));
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 0, 0, TEST_INTF_DFU, 2, buf, &l), MOCK_ACK);
+	CHECK((l == 2) && (buf[0] == 0) && (buf[1] == 0));
+
+	memset(buf, 0xaa, sizeof(buf));
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 0, 0, TEST_INTF_BULK, 2, buf, &l), MOCK_ACK);
+	CHECK((l == 2) && (buf[0] == 0) && (buf[1] == 0));
+
+	/* Unknown ones are STALLed */
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 0, 0, TEST_INTF_BULK + 1, 2, buf, &l), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 0, 0, 7, 2, buf, &l), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 0, 0, 0xff, 2, buf, &l), MOCK_STALL);
+}
+
+static void
+t_set_conf_0(void)
+{
+	uint8_t buf[64];
+	int l;
+	bool dt;
+
+	/* Both with the hand-written descriptors and the generated index */
+	for (int gen=0; gen<2; gen++)
+	{
+		if (gen) {
+			mock_reset();
+			test_dev_init_gen();
+			mock_bus_reset();
+			CHECK_RES(ctrl(0, 0x00, 5, TEST_ADDR, 0, 0, NULL, NULL), MOCK_ACK);
+			CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+		} else {
+			dev_enumerate(false);
+		}
+
+		/* Unconfigure from the configured state */
+		CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 0, 0, 0, NULL, NULL), MOCK_ACK);
+		CHECK(usb_get_state() == USB_DS_DEFAULT);
+		CHECK(g_test_dev.set_conf == 2);
+		CHECK_RES(ctrl(TEST_ADDR, 0x80, 8, 0, 0, 1, buf, &l), MOCK_ACK);
+		CHECK((l == 1) && (buf[0] == 0));
+
+		/* Again, while already unconfigured */
+		CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 0, 0, 0, NULL, NULL), MOCK_ACK);
+		CHECK(usb_get_state() == USB_DS_DEFAULT);
+
+		/* And back, interfaces and endpoints work again */
+		CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+		CHECK(usb_get_state() == USB_DS_CONFIGURED);
+		CHECK_RES(ctrl(TEST_ADDR, 0x80, 8, 0, 0, 1, buf, &l), MOCK_ACK);
+		CHECK((l == 1) && (buf[0] == 1));
+		CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+		CHECK((l == 1) && (buf[0] == 0));
+		CHECK_RES(mock_in(TEST_ADDR, TEST_EP_BULK_IN, buf, &l, sizeof(buf), &dt), MOCK_NAK);
+	}
+}
+
+static void
+t_sof_suspend(void)
+{
+	uint32_t t0;
+
+	dev_enumerate(false);
+
+	/* Ticks */
+	t0 = usb_get_tick();
+	for (int i=0; i<10; i++)
+		mock_sof(1);
+	CHECK((usb_get_tick() - t0) == 10);
+
+	/* Missed frames are accounted for */
+	t0 = usb_get_tick();
+	mock_sof(5);
+	CHECK((usb_get_tick() - t0) == 5);
+
+	/* Suspend / resume */
+	mock_suspend(true);
+	CHECK(usb_get_state() == USB_DS_SUSPENDED);
+	mock_suspend(false);
+	CHECK(usb_get_state() == USB_DS_CONFIGURED);
+}
+
+static void
+t_msos20(void)
+{
+	const struct usb_bos_msos20_desc_set *ds;
+	uint8_t buf[256];
+	uint8_t vc;
+	int l, tl;
+
+	dev_enumerate(false);
+
+	/* BOS */
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_BOS, 0, buf, 5, &l), MOCK_ACK);
+	CHECK((l == 5) && (buf[1] == USB_DT_BOS));
+
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_BOS, 0, buf, buf[2] | (buf[3] << 8), &l), MOCK_ACK);
+	CHECK(l == sizeof(struct usb_bos_desc) + sizeof(struct usb_bos_plat_cap_hdr) + sizeof(struct usb_bos_msos20_desc_set));
+	CHECK(!memcmp(buf, &msos20_winusb_bos, l));
+
+	ds = (void *)&buf[sizeof(struct usb_bos_desc) + sizeof(struct usb_bos_plat_cap_hdr)];
+	vc = ds->bMS_VendorCode;
+	tl = ds->wMSOSDescriptorSetTotalLength;
+
+	/* Descriptor set through the vendor request */
+	CHECK_RES(ctrl(TEST_ADDR, 0xc0, vc, 0, MSOS20_DESCRIPTOR_INDEX, tl, buf, &l), MOCK_ACK);
+	CHECK(l == tl);
+	CHECK(!memcmp(buf, &msos20_winusb_desc, l));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xc0, MSOS20_MS_VENDOR_CODE, 0, 0x42, 16, buf, &l), MOCK_STALL);
+}
+
+static void
+t_dfu(void)
+{
+	uint8_t buf[TEST_DFU_XFER_SIZE];
+	const int n_blk = 5;
+	int l, n;
+
+	g_test_dev.flash_busy_cycles = 2;
+	dev_enumerate(false);
+
+	/* Select the second zone */
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 1, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	CHECK(dfu_get_status(NULL) == dfuIDLE);
+
+	/* Download */
+	for (int b=0; b<n_blk; b++)
+	{
+		for (int i=0; i<TEST_DFU_XFER_SIZE; i++)
+			buf[i] = pattern(b * TEST_DFU_XFER_SIZE + i);
+
+		CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DNLOAD, b, TEST_INTF_DFU, TEST_DFU_XFER_SIZE, buf, &l), MOCK_ACK);
+		CHECK(l == TEST_DFU_XFER_SIZE);
+
+		/* Flash work is done on SOF */
+		for (n=0; n<64; n++) {
+			mock_sof(1);
+			if (dfu_get_status(NULL) == dfuDNLOAD_IDLE)
+				break;
+		}
+		CHECK(n < 64);
+	}
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DNLOAD, n_blk, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	CHECK(dfu_get_status(NULL) == dfuIDLE);
+
+	/* 4k erase granularity, 256 bytes pages */
+	CHECK(g_test_dev.flash_erase == (n_blk * TEST_DFU_XFER_SIZE + 4095) / 4096);
+	CHECK(g_test_dev.flash_prog  == (n_blk * TEST_DFU_XFER_SIZE) / 256);
+
+	for (int i=0; i<n_blk*TEST_DFU_XFER_SIZE; i++)
+		if (g_test_dev.flash[TEST_FLASH_ZONE_SIZE + i] != pattern(i)) {
+			CHECK(g_test_dev.flash[TEST_FLASH_ZONE_SIZE + i] == pattern(i));
+			break;
+		}
+
+	/* First zone untouched */
+	CHECK(g_test_dev.flash[0] == 0xff);
+
+	/* Upload back */
+	for (int b=0; b<n_blk; b++)
+	{
+		CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_UPLOAD, b, TEST_INTF_DFU, TEST_DFU_XFER_SIZE, buf, &l), MOCK_ACK);
+		CHECK(l == TEST_DFU_XFER_SIZE);
+		for (int i=0; i<TEST_DFU_XFER_SIZE; i++)
+			if (buf[i] != pattern(b * TEST_DFU_XFER_SIZE + i)) {
+				CHECK(buf[i] == pattern(b * TEST_DFU_XFER_SIZE + i));
+				break;
+			}
+	}
+
+	/* Reboot on bus reset once something was written */
+	CHECK(g_test_dev.reboot == 0);
+	mock_bus_reset();
+	CHECK(g_test_dev.reboot == 1);
+
+	g_test_dev.flash_busy_cycles = 0;
+}
+
+static void
+t_dfu_errors(void)
+{
+	uint8_t buf[64];
+	uint8_t status;
+	int l;
+
+	dev_enumerate(false);
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_GETSTATE, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == dfuIDLE));
+
+	/* Request not valid in that state */
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_CLRSTATUS, 0, TEST_INTF_DFU, 0, NULL, NULL), MOCK_STALL);
+	CHECK(dfu_get_status(&status) == dfuERROR);
+	CHECK(status == errUNKNOWN);
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_CLRSTATUS, 0, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	CHECK(dfu_get_status(&status) == dfuIDLE);
+	CHECK(status == 0);
+
+	/* Vendor protocol on the DFU interface */
+	CHECK_RES(ctrl(TEST_ADDR, 0xc1, 0, 0, TEST_INTF_DFU, 2, buf, &l), MOCK_ACK);
+	CHECK((l == 2) && (buf[0] == 0x01) && (buf[1] == 0x00));
+
+	for (int i=0; i<16; i++)
+		buf[i] = i;
+	CHECK_RES(ctrl(TEST_ADDR, 0x41, 1, 0, TEST_INTF_DFU, 16, buf, &l), MOCK_ACK);
+	CHECK(g_test_dev.spi_raw_len == 16);
+	CHECK((g_test_dev.spi_raw[0] == 0) && (g_test_dev.spi_raw[15] == 15));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xc1, 2, 0, TEST_INTF_DFU, 16, buf, &l), MOCK_ACK);
+	CHECK((l == 16) && (buf[0] == 0xff) && (buf[15] == 0xf0));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xc1, 0x42, 0, TEST_INTF_DFU, 2, buf, &l), MOCK_STALL);
+}
+
+static void
+t_dfu_zone_end(void)
+{
+	uint8_t buf[TEST_DFU_XFER_SIZE];
+	int l;
+
+	dev_enumerate(false);
+	memset(buf, 0x55, sizeof(buf));
+
+	/* Fill the whole first zone, one more block must fail */
+	for (int b=0; b<TEST_FLASH_ZONE_SIZE/TEST_DFU_XFER_SIZE; b++) {
+		CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DNLOAD, b, TEST_INTF_DFU, TEST_DFU_XFER_SIZE, buf, &l), MOCK_ACK);
+		for (int n=0; (n<64) && (dfu_get_status(NULL) != dfuDNLOAD_IDLE); n++)
+			mock_sof(1);
+	}
+
+	/* The last block landed, up to the very last byte of the zone */
+	CHECK(dfu_get_status(NULL) == dfuDNLOAD_IDLE);
+	CHECK(g_test_dev.flash[TEST_FLASH_ZONE_SIZE - TEST_DFU_XFER_SIZE] == 0x55);
+	CHECK(g_test_dev.flash[TEST_FLASH_ZONE_SIZE - 1] == 0x55);
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DNLOAD, 0, TEST_INTF_DFU, TEST_DFU_XFER_SIZE, buf, &l), MOCK_STALL);
+	CHECK(dfu_get_status(NULL) == dfuERROR);
+	CHECK(g_test_dev.flash[TEST_FLASH_ZONE_SIZE] == 0xff);
+}
+
+static void
+t_dfu_big_req(void)
+{
+	static uint8_t buf[4097];
+	int l;
+
+	dev_enumerate(false);
+	memset(buf, 0x55, sizeof(buf));
+
+	/* Requests larger than the 4 kiB DFU buffer, even if the zone has room */
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_UPLOAD, 0, TEST_INTF_DFU, 4097, buf, &l), MOCK_STALL);
+	CHECK(dfu_get_status(NULL) == dfuERROR);
+
+	/* Nothing may reach flash either */
+	dev_enumerate(false);
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DNLOAD, 0, TEST_INTF_DFU, 4097, buf, &l), MOCK_STALL);
+	CHECK(dfu_get_status(NULL) == dfuERROR);
+	CHECK(g_test_dev.flash[0] == 0xff);
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_CLRSTATUS, 0, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+
+	/* A buffer full is fine */
+	dev_enumerate(false);
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_UPLOAD, 0, TEST_INTF_DFU, 4096, buf, &l), MOCK_ACK);
+	CHECK((l == 4096) && (buf[0] == 0xff) && (buf[4095] == 0xff));
+	CHECK(dfu_get_status(NULL) != dfuERROR);
+}
+
+static void
+t_ep0_out_overflow(void)
+{
+	struct usb_ctrl_req req = {
+		.bmRequestType = 0x21,
+		.bRequest      = USB_REQ_DFU_DNLOAD,
+		.wIndex        = TEST_INTF_DFU,
+		.wLength       = 16,
+	};
+	uint8_t buf[256];
+	int l;
+	bool dt;
+
+	dev_enumerate(false);
+
+	/* Data stage packet larger than what's left of the transfer */
+	for (int i=0; i<(int)sizeof(buf); i++)
+		buf[i] = pattern(i);
+
+	CHECK_RES(mock_setup(TEST_ADDR, &req), MOCK_ACK);
+	mock_fw_poll();
+	CHECK_RES(mock_out(TEST_ADDR, 0, buf, 200), MOCK_ACK);
+	mock_fw_poll();
+
+	/* Only what was asked for is taken, and the status stage follows */
+	CHECK_RES(mock_in(TEST_ADDR, 0, buf, &l, 64, &dt), MOCK_ACK);
+	mock_fw_poll();
+	CHECK((l == 0) && dt);
+
+	for (int n=0; (n<64) && (dfu_get_status(NULL) != dfuDNLOAD_IDLE); n++)
+		mock_sof(1);
+	CHECK(dfu_get_status(NULL) == dfuDNLOAD_IDLE);
+	CHECK((g_test_dev.flash[0] == pattern(0)) && (g_test_dev.flash[15] == pattern(15)));
+	CHECK(g_test_dev.flash[16] == 0xff);
+}
+
+static void
+t_req_shift(void)
+{
+	static const uint8_t reqs[] = { 0x20, 0x23, 0x40, 0xff };
+	uint8_t buf[4];
+	int l;
+
+	dev_enumerate(false);
+
+	/* DFU request numbers past the valid request bitmaps */
+	for (int i=0; i<(int)sizeof(reqs); i++) {
+		CHECK_RES(ctrl(TEST_ADDR, 0x21, reqs[i], 0, TEST_INTF_DFU, 0, NULL, NULL), MOCK_STALL);
+		CHECK(dfu_get_status(NULL) == dfuERROR);
+		CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_CLRSTATUS, 0, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	}
+
+	/* Interface numbers past the alt setting fast path bitmap */
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, 32, 1, buf, &l), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, 40, 1, buf, &l), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 1, 40, 0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == 0));
+}
+
+static void
+t_gen_desc(void)
+{
+	const struct usb_stack_descriptors *sd = test_stack_desc_gen;
+	uint8_t buf[256];
+	int l;
+
+	/* Generated descriptors are identical to the hand-written ones */
+	CHECK(!memcmp(sd->dev, test_stack_desc.dev, sizeof(struct usb_dev_desc)));
+	CHECK(sd->n_conf == test_stack_desc.n_conf);
+	CHECK(sd->conf[0]->wTotalLength == test_stack_desc.conf[0]->wTotalLength);
+	CHECK(!memcmp(sd->conf[0], test_stack_desc.conf[0], test_stack_desc.conf[0]->wTotalLength));
+	CHECK(sd->n_str == test_stack_desc.n_str);
+	for (int i=0; i<sd->n_str && i<test_stack_desc.n_str; i++)
+		CHECK(!memcmp(sd->str[i], test_stack_desc.str[i], test_stack_desc.str[i]->bLength));
+	CHECK(sd->bos == test_stack_desc.bos);
+
+	/* Enumerate */
+	mock_reset();
+	test_dev_init_gen();
+	mock_bus_reset();
+
+	CHECK_RES(ctrl(0, 0x00, 5, TEST_ADDR, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(get_desc(TEST_ADDR, USB_DT_CONF, 0, buf, sizeof(buf), &l), MOCK_ACK);
+	CHECK((l == sd->conf[0]->wTotalLength) && !memcmp(buf, sd->conf[0], l));
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(usb_get_state() == USB_DS_CONFIGURED);
+	CHECK(g_test_dev.set_conf == 1);
+
+	/* Bulk buffers right after EP0, as planned */
+	CHECK(usb_ep_regs[TEST_EP_BULK_OUT & 0xf].out.bd[0].ptr == 0x80);
+	CHECK(usb_ep_regs[TEST_EP_BULK_IN  & 0xf].in.bd[0].ptr  == 0x40);
+
+	/* Interfaces */
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 1, TEST_INTF_DFU, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(ctrl(TEST_ADDR, 0x81, 10, 0, TEST_INTF_DFU, 1, buf, &l), MOCK_ACK);
+	CHECK((l == 1) && (buf[0] == 1));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 2, TEST_INTF_DFU,  0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 0, 7, 0, NULL, NULL), MOCK_STALL);
+	CHECK_RES(ctrl(TEST_ADDR, 0x01, 11, 0, TEST_INTF_BULK, 0, NULL, NULL), MOCK_ACK);
+
+	/* Data path */
+	{
+		bool dt;
+		CHECK_RES(mock_in(TEST_ADDR, TEST_EP_BULK_IN, buf, &l, sizeof(buf), &dt), MOCK_NAK);
+	}
+
+	/* Reconfiguring doesn't move the buffers */
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK_RES(ctrl(TEST_ADDR, 0x00, 9, 1, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(g_test_dev.set_conf == 3);
+	CHECK(usb_ep_regs[TEST_EP_BULK_OUT & 0xf].out.bd[0].ptr == 0x80);
+	CHECK(usb_ep_regs[TEST_EP_BULK_IN  & 0xf].in.bd[0].ptr  == 0x40);
+
+	/* They stay reserved, later allocations go after them */
+	CHECK(g_usb.ep_cfg.mem[0] == 0x80U + sd->conf_idx[0].mem[0]);
+	CHECK(g_usb.ep_cfg.mem[1] == 0x40U + sd->conf_idx[0].mem[1]);
+
+	/* EP reconf only for interfaces / alt settings in the tables */
+	{
+		struct usb_intf_desc intf = *usb_desc_find_intf(NULL, TEST_INTF_BULK, 0, NULL);
+
+		CHECK(usb_ep_reconf(&intf, TEST_EP_BULK_IN));
+		intf.bAlternateSetting = 5;
+		CHECK(!usb_ep_reconf(&intf, TEST_EP_BULK_IN));
+		intf.bAlternateSetting = 0;
+		intf.bInterfaceNumber = 7;
+		CHECK(!usb_ep_reconf(&intf, TEST_EP_BULK_IN));
+	}
+
+	/* DFU still works on top of it */
+	CHECK(dfu_get_status(NULL) == dfuIDLE);
+}
+
+static void
+t_dfu_rt(void)
+{
+	uint8_t buf[8];
+	int l;
+
+	dev_enumerate(true);
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_GETSTATUS, 0, 0, 6, buf, &l), MOCK_ACK);
+	CHECK((l == 6) && (buf[0] == 0) && (buf[4] == appIDLE));
+
+	CHECK_RES(ctrl(TEST_ADDR, 0xa1, USB_REQ_DFU_GETSTATE, 0, 1, 1, buf, &l), MOCK_STALL);
+
+	/* Reboot only once the request completed */
+	CHECK_RES(ctrl(TEST_ADDR, 0x21, USB_REQ_DFU_DETACH, 1000, 0, 0, NULL, NULL), MOCK_ACK);
+	CHECK(g_test_dev.rt_reboot == 1);
+}
+
+
+/* Main */
+/* ---- */
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} g_scenarios[] = {
+	{ "connect",           t_connect },
+	{ "enumerate",         t_enumerate },
+	{ "desc_zlp",          t_desc_zlp },
+	{ "std_requests",      t_std_requests },
+	{ "get_status_intf",   t_get_status_intf },
+	{ "set_conf_0",        t_set_conf_0 },
+	{ "sof_suspend",       t_sof_suspend },
+	{ "msos20",            t_msos20 },
+	{ "dfu",               t_dfu },
+	{ "dfu_errors",        t_dfu_errors },
+	{ "dfu_zone_end",      t_dfu_zone_end },
+	{ "dfu_big_req",       t_dfu_big_req },
+	{ "ep0_out_overflow",  t_ep0_out_overflow },
+	{ "req_shift",         t_req_shift },
+	{ "gen_desc",          t_gen_desc },
+	{ "dfu_rt",            t_dfu_rt },
+};
+
+static bool
+selected(const char *name, int argc, char *argv[])
+{
+	if (argc == 0)
+		return true;
+	for (int i=0; i<argc; i++)
+		if (!strcmp(name, argv[i]))
+			return true;
+	return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n_run = 0, n_fail = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "lv")) != -1) {
+		switch (opt) {
+		case 'l':
+			for (unsigned i=0; i<num_elem(g_scenarios); i++)
+				printf("%s\n", g_scenarios[i].name);
+			return 0;
+		case 'v':
+			g_verbose++;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-l] [-v] [scenario ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	for (unsigned i=0; i<num_elem(g_scenarios); i++)
+	{
+		if (!selected(g_scenarios[i].name, argc - optind, &argv[optind]))
+			continue;
+
+		printf("[+] %s\n", g_scenarios[i].name);
+
+		g_fail = 0;
+		g_scenarios[i].fn();
+
+		n_run++;
+		if (g_fail) {
+			printf("[!] %s: FAIL (%d)\n", g_scenarios[i].name, g_fail);
+			n_fail++;
+		}
+	}
+
+	printf("%d/%d scenarios passed\n", n_run - n_fail, n_run);
+
+	return n_fail ? 1 : 0;
+}
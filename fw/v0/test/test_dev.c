@@ -0,0 +1,366 @@
+/*
+ * test_dev.c
+ *
+ * Test device for the host builds of the v0 stack
+ *
+ *  - Interface 0: DFU mode, alt 0 / 1 for two flash zones
+ *  - Interface 1: Vendor, bulk OUT / IN endpoints (no data path, only
+ *                 used for the EP configuration / halt handling)
+ *  - BOS with the generic MS OS 2.0 WinUSB descriptors
+ *
+ * and a DFU runtime only variant.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_dfu.h>
+#include <no2usb/usb_dfu_proto.h>
+#include <no2usb/usb_dfu_rt.h>
+#include <no2usb/usb_msos20.h>
+#include <no2usb/usb_proto.h>
+
+#include "test_dev.h"
+
+
+struct test_dev_state g_test_dev;
+
+
+/* Descriptors */
+/* ----------- */
+
+#include "usb_str_test.gen.h"
+
+static const struct usb_dev_desc _test_dev_desc = {
+	.bLength		= sizeof(struct usb_dev_desc),
+	.bDescriptorType	= USB_DT_DEV,
+	.bcdUSB			= 0x0201,
+	.bDeviceClass		= 0,
+	.bDeviceSubClass	= 0,
+	.bDeviceProtocol	= 0,
+	.bMaxPacketSize0	= 64,
+	.idVendor		= 0x1209,
+	.idProduct		= 0x0001,
+	.bcdDevice		= 0x0001,
+	.iManufacturer		= 1,
+	.iProduct		= 2,
+	.iSerialNumber		= 0,
+	.bNumConfigurations	= 1,
+};
+
+static const struct {
+	struct usb_conf_desc conf;
+	struct usb_intf_desc if_dfu_0;
+	struct usb_dfu_func_desc dfu_func_0;
+	struct usb_intf_desc if_dfu_1;
+	struct usb_dfu_func_desc dfu_func_1;
+	struct usb_intf_desc if_bulk;
+	struct usb_ep_desc ep_bulk_out;
+	struct usb_ep_desc ep_bulk_in;
+} __attribute__ ((packed)) _test_conf_desc = {
+	.conf = {
+		.bLength                = sizeof(struct usb_conf_desc),
+		.bDescriptorType        = USB_DT_CONF,
+		.wTotalLength           = sizeof(_test_conf_desc),
+		.bNumInterfaces         = 2,
+		.bConfigurationValue    = 1,
+		.iConfiguration         = 0,
+		.bmAttributes           = 0x80,
+		.bMaxPower              = 0x32,
+	},
+	.if_dfu_0 = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= TEST_INTF_DFU,
+		.bAlternateSetting	= 0,
+		.bNumEndpoints		= 0,
+		.bInterfaceClass	= 0xfe,
+		.bInterfaceSubClass	= 0x01,
+		.bInterfaceProtocol	= 0x02,
+		.iInterface		= 3,
+	},
+	.dfu_func_0 = {
+		.bLength		= sizeof(struct usb_dfu_func_desc),
+		.bDescriptorType	= USB_DFU_DT_FUNC,
+		.bmAttributes		= 0x0d,
+		.wDetachTimeOut		= 1000,
+		.wTransferSize		= TEST_DFU_XFER_SIZE,
+		.bcdDFUVersion		= 0x0101,
+	},
+	.if_dfu_1 = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= TEST_INTF_DFU,
+		.bAlternateSetting	= 1,
+		.bNumEndpoints		= 0,
+		.bInterfaceClass	= 0xfe,
+		.bInterfaceSubClass	= 0x01,
+		.bInterfaceProtocol	= 0x02,
+		.iInterface		= 4,
+	},
+	.dfu_func_1 = {
+		.bLength		= sizeof(struct usb_dfu_func_desc),
+		.bDescriptorType	= USB_DFU_DT_FUNC,
+		.bmAttributes		= 0x0d,
+		.wDetachTimeOut		= 1000,
+		.wTransferSize		= TEST_DFU_XFER_SIZE,
+		.bcdDFUVersion		= 0x0101,
+	},
+	.if_bulk = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= TEST_INTF_BULK,
+		.bAlternateSetting	= 0,
+		.bNumEndpoints		= 2,
+		.bInterfaceClass	= 0xff,
+		.bInterfaceSubClass	= 0x00,
+		.bInterfaceProtocol	= 0x00,
+		.iInterface		= 0,
+	},
+	.ep_bulk_out = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= TEST_EP_BULK_OUT,
+		.bmAttributes		= 0x02,
+		.wMaxPacketSize		= TEST_BULK_MPS,
+		.bInterval		= 0x00,
+	},
+	.ep_bulk_in = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= TEST_EP_BULK_IN,
+		.bmAttributes		= 0x02,
+		.wMaxPacketSize		= TEST_BULK_MPS,
+		.bInterval		= 0x00,
+	},
+};
+
+static const struct {
+	struct usb_conf_desc conf;
+	struct usb_intf_desc if_dfu_rt;
+	struct usb_dfu_func_desc dfu_func;
+} __attribute__ ((packed)) _test_conf_desc_rt = {
+	.conf = {
+		.bLength                = sizeof(struct usb_conf_desc),
+		.bDescriptorType        = USB_DT_CONF,
+		.wTotalLength           = sizeof(_test_conf_desc_rt),
+		.bNumInterfaces         = 1,
+		.bConfigurationValue    = 1,
+		.iConfiguration         = 0,
+		.bmAttributes           = 0x80,
+		.bMaxPower              = 0x32,
+	},
+	.if_dfu_rt = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= 0,
+		.bAlternateSetting	= 0,
+		.bNumEndpoints		= 0,
+		.bInterfaceClass	= 0xfe,
+		.bInterfaceSubClass	= 0x01,
+		.bInterfaceProtocol	= 0x01,
+		.iInterface		= 0,
+	},
+	.dfu_func = {
+		.bLength		= sizeof(struct usb_dfu_func_desc),
+		.bDescriptorType	= USB_DFU_DT_FUNC,
+		.bmAttributes		= 0x0d,
+		.wDetachTimeOut		= 1000,
+		.wTransferSize		= TEST_DFU_XFER_SIZE,
+		.bcdDFUVersion		= 0x0101,
+	},
+};
+
+static const struct usb_conf_desc * const _test_conf_desc_array[] = {
+	&_test_conf_desc.conf,
+};
+
+static const struct usb_conf_desc * const _test_conf_desc_rt_array[] = {
+	&_test_conf_desc_rt.conf,
+};
+
+const struct usb_stack_descriptors test_stack_desc = {
+	.dev    = &_test_dev_desc,
+	.bos    = &msos20_winusb_bos,
+	.conf   = _test_conf_desc_array,
+	.n_conf = num_elem(_test_conf_desc_array),
+	.str    = _str_desc_array,
+	.n_str  = num_elem(_str_desc_array),
+};
+
+/* Same device, from the declarative spec (usb_desc_test.json) */
+#include "usb_desc_test.gen.h"
+
+const struct usb_stack_descriptors test_stack_desc_rt = {
+	.dev    = &_test_dev_desc,
+	.conf   = _test_conf_desc_rt_array,
+	.n_conf = num_elem(_test_conf_desc_rt_array),
+	.str    = _str_desc_array,
+	.n_str  = num_elem(_str_desc_array),
+};
+
+
+/* DFU callbacks / flash model */
+/* --------------------------- */
+
+static const struct usb_dfu_zone _test_dfu_zones[] = {
+	{ 0x00000, TEST_FLASH_ZONE_SIZE,     0 },
+	{ TEST_FLASH_ZONE_SIZE, TEST_FLASH_SIZE, 0 },
+};
+
+void
+usb_dfu_cb_reboot(void)
+{
+	g_test_dev.reboot++;
+}
+
+void
+usb_dfu_rt_cb_reboot(void)
+{
+	g_test_dev.rt_reboot++;
+}
+
+bool
+usb_dfu_cb_flash_busy(void)
+{
+	if (g_test_dev.flash_busy) {
+		g_test_dev.flash_busy--;
+		return true;
+	}
+	return false;
+}
+
+void
+usb_dfu_cb_flash_erase(uint32_t addr, unsigned size)
+{
+	g_test_dev.flash_erase++;
+	g_test_dev.flash_busy = g_test_dev.flash_busy_cycles;
+
+	addr &= ~(size - 1);
+	if ((addr + size) <= TEST_FLASH_SIZE)
+		memset(&g_test_dev.flash[addr], 0xff, size);
+}
+
+void
+usb_dfu_cb_flash_program(const void *data, uint32_t addr, unsigned size)
+{
+	const uint8_t *d = data;
+
+	g_test_dev.flash_prog++;
+	g_test_dev.flash_busy = g_test_dev.flash_busy_cycles;
+
+	/* NOR flash: only clears bits */
+	for (unsigned i=0; (i<size) && ((addr+i) < TEST_FLASH_SIZE); i++)
+		g_test_dev.flash[addr+i] &= d[i];
+}
+
+void
+usb_dfu_cb_flash_read(void *data, uint32_t addr, unsigned size)
+{
+	memcpy(data, &g_test_dev.flash[addr], size);
+}
+
+void
+usb_dfu_cb_flash_raw(void *data, unsigned len)
+{
+	if (len > sizeof(g_test_dev.spi_raw))
+		len = sizeof(g_test_dev.spi_raw);
+
+	memcpy(g_test_dev.spi_raw, data, len);
+	g_test_dev.spi_raw_len = len;
+
+	/* 'Response' is the bitwise complement, returned in the same buffer */
+	for (unsigned i=0; i<len; i++)
+		((uint8_t *)data)[i] ^= 0xff;
+}
+
+
+/* Bulk interface */
+/* -------------- */
+
+static enum usb_fnd_resp
+_test_set_conf(const struct usb_conf_desc *conf)
+{
+	const struct usb_intf_desc *intf;
+
+	g_test_dev.set_conf++;
+
+	if (!conf)
+		return USB_FND_SUCCESS;
+
+	intf = usb_desc_find_intf(conf, TEST_INTF_BULK, 0, NULL);
+	if (!intf)
+		return USB_FND_SUCCESS;
+
+	usb_ep_boot(intf, TEST_EP_BULK_OUT, false);
+	usb_ep_boot(intf, TEST_EP_BULK_IN,  false);
+
+	return USB_FND_SUCCESS;
+}
+
+static enum usb_fnd_resp
+_test_set_intf(const struct usb_intf_desc *base, const struct usb_intf_desc *sel)
+{
+	if (base->bInterfaceNumber != TEST_INTF_BULK)
+		return USB_FND_CONTINUE;
+
+	return (sel->bAlternateSetting == 0) ? USB_FND_SUCCESS : USB_FND_ERROR;
+}
+
+static struct usb_fn_drv _test_drv = {
+	.set_conf	= _test_set_conf,
+	.set_intf	= _test_set_intf,
+};
+
+
+/* Exposed API */
+/* ----------- */
+
+const struct usb_stack_descriptors * const test_stack_desc_gen = &test_gen_stack_desc;
+
+static void
+_test_dev_reset(void)
+{
+	int busy_cycles = g_test_dev.flash_busy_cycles;
+
+	memset(&g_test_dev, 0x00, sizeof(g_test_dev));
+	memset(g_test_dev.flash, 0xff, sizeof(g_test_dev.flash));
+	g_test_dev.flash_busy_cycles = busy_cycles;
+}
+
+static void
+_test_dev_init_full(const struct usb_stack_descriptors *stack_desc)
+{
+	usb_init(stack_desc);
+	usb_register_function_driver(&_test_drv);
+	usb_dfu_init(_test_dfu_zones, num_elem(_test_dfu_zones));
+	usb_msos20_init(NULL);
+}
+
+void
+test_dev_init(bool dfu_rt)
+{
+	_test_dev_reset();
+
+	if (dfu_rt) {
+		usb_init(&test_stack_desc_rt);
+		usb_dfu_rt_init();
+	} else {
+		_test_dev_init_full(&test_stack_desc);
+	}
+
+	usb_connect();
+}
+
+void
+test_dev_init_gen(void)
+{
+	_test_dev_reset();
+	_test_dev_init_full(&test_gen_stack_desc);
+	usb_connect();
+}
@@ -0,0 +1,53 @@
+/*
+ * test_dev.h
+ *
+ * Test device for the host builds of the v0 stack
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define TEST_EP_BULK_OUT	0x01
+#define TEST_EP_BULK_IN		0x81
+#define TEST_BULK_MPS		64
+
+#define TEST_INTF_DFU		0
+#define TEST_INTF_BULK		1
+
+#define TEST_STR_LONG		5	/* Exactly 64 bytes */
+
+#define TEST_DFU_XFER_SIZE	1024
+#define TEST_FLASH_ZONE_SIZE	(64 * 1024)
+#define TEST_FLASH_SIZE		(2 * TEST_FLASH_ZONE_SIZE)
+
+struct test_dev_state {
+	/* Callbacks */
+	int reboot;
+	int rt_reboot;
+	int set_conf;
+
+	/* Flash model */
+	int flash_erase;
+	int flash_prog;
+	int flash_busy_cycles;	/* 'busy' polls after each erase / program */
+	int flash_busy;
+	uint8_t flash[TEST_FLASH_SIZE];
+
+	uint8_t spi_raw[64];
+	int spi_raw_len;
+};
+
+extern struct test_dev_state g_test_dev;
+
+extern const struct usb_stack_descriptors test_stack_desc;
+extern const struct usb_stack_descriptors test_stack_desc_rt;
+extern const struct usb_stack_descriptors * const test_stack_desc_gen;	/* usb_desc_test.json */
+
+void test_dev_init(bool dfu_rt);
+void test_dev_init_gen(void);
@@ -0,0 +1,528 @@
+/*
+ * usb_hw_mock.c
+ *
+ * Register / packet memory model of the core for host builds of the v0
+ * stack (`USB_HW_MOCK`), along with a minimal host side to drive it.
+ *
+ * This models what the microcode does with the EP status and BDs for
+ * SETUP / IN / OUT transactions, as seen by the firmware, and nothing
+ * more. Simplifications:
+ *  - No transfer mode BDs, BD rings or auto-rearm
+ *  - OUT data toggles are not checked (IN ones are)
+ *  - Events are in 'count' mode (EVT_DEPTH = 0)
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_hw.h>
+
+#include "usb_hw_mock.h"
+
+#ifndef USB_HW_MOCK
+# error "Must be built with USB_HW_MOCK"
+#endif
+
+#if defined(USB_CORE_XFER) || defined(USB_CORE_DESC)
+# error "Core option not supported by the register model"
+#endif
+
+
+#define MOCK_NAK_RETRY	64
+#define MOCK_EP0_MPS	64
+
+#define CSR_CTRL_MSK	(USB_CSR_PU_ENA | USB_CSR_CEL_ENA | USB_CSR_ADDR_MATCH | USB_CSR_ADDR(0x7f))
+
+#define REG_CSR		0
+#define REG_AR		1
+#define REG_EVT		2
+#define REG_SOF_FRAME	6
+
+
+/* Memories accessed directly by the firmware (see usb_hw.h) */
+volatile struct usb_ep_pair usb_hw_mock_ep_regs[16];
+volatile struct usb_bd      usb_hw_mock_bd_pool[128];
+volatile uint32_t           usb_hw_mock_tx_mem[512];
+volatile uint32_t           usb_hw_mock_rx_mem[512];
+
+static struct {
+	/* Global CSRs */
+	uint32_t csr_ctrl;	/* As written by firmware */
+	uint32_t csr_stat;	/* Owned by the 'core' */
+	uint32_t evt;
+	unsigned int evt_cnt;
+	uint16_t frame;
+	uint32_t regs[16];	/* Everything else, just storage */
+
+	/* Firmware hooks */
+	mock_fw_hook fw_enter;
+	mock_fw_hook fw_leave;
+
+	struct mock_stats stats;
+} g_mock;
+
+
+/* Register model */
+/* -------------- */
+
+uint32_t
+usb_hw_mock_reg_read(unsigned int reg)
+{
+	uint32_t v;
+
+	g_mock.stats.reg_rd++;
+
+	switch (reg) {
+	case REG_CSR:
+		return g_mock.csr_ctrl | g_mock.csr_stat;
+
+	case REG_AR:
+		return 0;
+
+	case REG_EVT:
+		v = ((g_mock.evt_cnt > 15 ? 15 : g_mock.evt_cnt) << 12) | g_mock.evt;
+		g_mock.evt_cnt = 0;
+		g_mock.csr_stat &= ~USB_CSR_EVT_PENDING;
+		return v;
+
+	case REG_SOF_FRAME:
+		return USB_SOF_FRAME_VALID | USB_SOF_FRAME_NUM(g_mock.frame);
+
+	default:
+		return g_mock.regs[reg & 15];
+	}
+}
+
+void
+usb_hw_mock_reg_write(unsigned int reg, uint32_t val)
+{
+	g_mock.stats.reg_wr++;
+
+	switch (reg) {
+	case REG_CSR:
+		g_mock.csr_ctrl = val & CSR_CTRL_MSK;
+		break;
+
+	case REG_AR:
+		if (val & USB_AR_CEL_RELEASE)
+			g_mock.csr_stat &= ~USB_CSR_CEL_ACTIVE;
+		if (val & USB_AR_BUS_RST_CLEAR)
+			g_mock.csr_stat &= ~USB_CSR_BUS_RST_PENDING;
+		if (val & USB_AR_SOF_CLEAR)
+			g_mock.csr_stat &= ~USB_CSR_SOF_PENDING;
+		break;
+
+	default:
+		g_mock.regs[reg & 15] = val;
+	}
+}
+
+
+/* Helpers */
+/* ------- */
+
+static void
+_mock_mem_write(unsigned int ofs, const void *data, int len)
+{
+	/* Core writes to the RX memory */
+	memcpy((uint8_t *)usb_hw_mock_rx_mem + (ofs & 0x7ff), data, len);
+}
+
+static void
+_mock_mem_read(void *data, unsigned int ofs, int len)
+{
+	/* Core reads from the TX memory */
+	memcpy(data, (const uint8_t *)usb_hw_mock_tx_mem + (ofs & 0x7ff), len);
+}
+
+static void
+_mock_notify(uint8_t ep, bool dir_in, bool setup, int bdi)
+{
+	g_mock.evt = ((ep & 0xf) << 4) | (dir_in ? USB_EVT_DIR_IN : 0) |
+	             (setup ? USB_EVT_IS_SETUP : 0) | (bdi ? USB_EVT_BD_IDX : 0);
+	g_mock.evt_cnt++;
+	g_mock.csr_stat |= USB_CSR_EVT_PENDING;
+}
+
+static bool
+_mock_addr_match(uint8_t addr)
+{
+	if (!(g_mock.csr_ctrl & USB_CSR_PU_ENA))
+		return false;
+	if (!(g_mock.csr_ctrl & USB_CSR_ADDR_MATCH))
+		return true;
+	return USB_CSR_ADDR(g_mock.csr_ctrl) == addr;
+}
+
+static bool
+_mock_cel_active(uint32_t ep_status)
+{
+	return (USB_EP_TYPE(ep_status) == USB_EP_TYPE_CTRL) &&
+	       (g_mock.csr_stat & USB_CSR_CEL_ACTIVE);
+}
+
+static int
+_mock_bd_idx(uint32_t ep_status, bool setup)
+{
+	switch (ep_status & USB_EP_BD_RING) {
+	case USB_EP_BD_CTRL:
+		return setup ? 1 : 0;
+	case USB_EP_BD_DUAL:
+		return (ep_status & USB_EP_BD_IDX) ? 1 : 0;
+	case USB_EP_BD_RING:
+		fprintf(stderr, "[!] Mock: BD ring mode not supported\n");
+		abort();
+	default:
+		return 0;
+	}
+}
+
+static void
+_mock_ep_done(volatile struct usb_ep *ep, uint32_t status)
+{
+	/* Toggle DT, and the active BD in dual mode */
+	status ^= USB_EP_DT_BIT;
+	if ((status & USB_EP_BD_RING) == USB_EP_BD_DUAL)
+		status ^= USB_EP_BD_IDX;
+	ep->status = status;
+}
+
+
+/* Exposed API */
+/* ----------- */
+
+void
+mock_reset(void)
+{
+	memset(&g_mock, 0x00, sizeof(g_mock));
+	memset((void *)usb_hw_mock_ep_regs, 0x00, sizeof(usb_hw_mock_ep_regs));
+	memset((void *)usb_hw_mock_bd_pool, 0x00, sizeof(usb_hw_mock_bd_pool));
+	memset((void *)usb_hw_mock_tx_mem,  0x00, sizeof(usb_hw_mock_tx_mem));
+	memset((void *)usb_hw_mock_rx_mem,  0x00, sizeof(usb_hw_mock_rx_mem));
+
+	/* Out of reset, the core reports a pending bus reset */
+	g_mock.csr_stat = USB_CSR_BUS_RST_PENDING;
+}
+
+void
+mock_set_fw_hooks(mock_fw_hook enter, mock_fw_hook leave)
+{
+	g_mock.fw_enter = enter;
+	g_mock.fw_leave = leave;
+}
+
+void
+mock_fw_poll(void)
+{
+	g_mock.stats.polls++;
+
+	if (g_mock.fw_enter)
+		g_mock.fw_enter();
+
+	usb_poll();
+
+	if (g_mock.fw_leave)
+		g_mock.fw_leave();
+}
+
+const char *
+mock_res_str(enum mock_res res)
+{
+	static const char * const names[] = {
+		[MOCK_ACK]     = "ACK",
+		[MOCK_NAK]     = "NAK",
+		[MOCK_STALL]   = "STALL",
+		[MOCK_TIMEOUT] = "TIMEOUT",
+		[MOCK_ERROR]   = "ERROR",
+	};
+	return names[res];
+}
+
+struct mock_stats *
+mock_stats(void)
+{
+	return &g_mock.stats;
+}
+
+bool
+mock_pullup(void)
+{
+	return !!(g_mock.csr_ctrl & USB_CSR_PU_ENA);
+}
+
+uint8_t
+mock_address(void)
+{
+	return USB_CSR_ADDR(g_mock.csr_ctrl);
+}
+
+
+	/* Bus events */
+
+void
+mock_bus_reset(void)
+{
+	/* Asserted, firmware must wait for the release */
+	g_mock.csr_stat |= USB_CSR_BUS_RST | USB_CSR_BUS_RST_PENDING;
+	g_mock.csr_stat &= ~(USB_CSR_BUS_SUSPEND | USB_CSR_CEL_ACTIVE);
+	mock_fw_poll();
+
+	/* Released */
+	g_mock.csr_stat &= ~USB_CSR_BUS_RST;
+	mock_fw_poll();
+}
+
+void
+mock_sof(int frames)
+{
+	g_mock.frame = (g_mock.frame + frames) & 0x7ff;
+	g_mock.csr_stat |= USB_CSR_SOF_PENDING;
+	mock_fw_poll();
+}
+
+void
+mock_suspend(bool suspend)
+{
+	if (suspend)
+		g_mock.csr_stat |= USB_CSR_BUS_SUSPEND;
+	else
+		g_mock.csr_stat &= ~USB_CSR_BUS_SUSPEND;
+	mock_fw_poll();
+}
+
+
+	/* Transactions */
+
+enum mock_res
+mock_setup(uint8_t addr, const struct usb_ctrl_req *req)
+{
+	volatile struct usb_ep *ep = &usb_hw_mock_ep_regs[0].out;
+	uint32_t status = ep->status;
+	uint8_t pkt[10];
+	int bdi;
+
+	g_mock.stats.xact++;
+
+	/* SETUP is never NAKed, just ignored */
+	if (!_mock_addr_match(addr) ||
+	    (USB_EP_TYPE(status) != USB_EP_TYPE_CTRL) ||
+	    _mock_cel_active(status))
+		return MOCK_TIMEOUT;
+
+	bdi = _mock_bd_idx(status, true);
+	if ((ep->bd[bdi].csr & USB_BD_STATE_MSK) != USB_BD_STATE_RDY_DATA)
+		return MOCK_TIMEOUT;
+
+	/* Store packet (CRC included, value doesn't matter) */
+	memcpy(pkt, req, 8);
+	pkt[8] = pkt[9] = 0x00;
+	_mock_mem_write(ep->bd[bdi].ptr, pkt, sizeof(pkt));
+
+	ep->bd[bdi].csr = USB_BD_STATE_DONE_OK | USB_BD_IS_SETUP | USB_BD_LEN(sizeof(pkt));
+	_mock_ep_done(ep, status);
+
+	/* Lockout */
+	if (g_mock.csr_ctrl & USB_CSR_CEL_ENA)
+		g_mock.csr_stat |= USB_CSR_CEL_ACTIVE;
+
+	_mock_notify(0, false, true, bdi);
+
+	return MOCK_ACK;
+}
+
+enum mock_res
+mock_out(uint8_t addr, uint8_t ep_num, const void *data, int len)
+{
+	volatile struct usb_ep *ep = &usb_hw_mock_ep_regs[ep_num & 0xf].out;
+	uint32_t status = ep->status;
+	uint32_t csr;
+	uint8_t pkt[1026];
+	int bdi, bl;
+
+	g_mock.stats.xact++;
+
+	if (!_mock_addr_match(addr) || (USB_EP_TYPE(status) == USB_EP_TYPE_NONE))
+		return MOCK_TIMEOUT;
+
+	if (USB_EP_TYPE_IS_BCI(status)) {
+		if (status & USB_EP_TYPE_HALTED)
+			return MOCK_STALL;
+		if (_mock_cel_active(status))
+			goto nak;
+	}
+
+	bdi = _mock_bd_idx(status, false);
+	csr = ep->bd[bdi].csr;
+
+	if ((csr & USB_BD_STATE_MSK) == USB_BD_STATE_RDY_STALL)
+		return MOCK_STALL;
+	if ((csr & USB_BD_STATE_MSK) != USB_BD_STATE_RDY_DATA)
+		goto nak;
+
+	/* Writes beyond the BD length (CRC included) are dropped but the
+	 * reported length is still the full one */
+	if (len)
+		memcpy(pkt, data, len);
+	pkt[len] = pkt[len+1] = 0x00;
+
+	bl = csr & USB_BD_LEN_MSK;
+	_mock_mem_write(ep->bd[bdi].ptr, pkt, ((len + 2) < bl) ? (len + 2) : bl);
+
+	ep->bd[bdi].csr = USB_BD_STATE_DONE_OK | USB_BD_LEN(len + 2);
+	_mock_ep_done(ep, status);
+	_mock_notify(ep_num, false, false, bdi);
+
+	return MOCK_ACK;
+
+nak:
+	g_mock.stats.nak++;
+	return (USB_EP_TYPE(status) == USB_EP_TYPE_ISOC) ? MOCK_TIMEOUT : MOCK_NAK;
+}
+
+enum mock_res
+mock_in(uint8_t addr, uint8_t ep_num, void *data, int *len, int max_len, bool *dt)
+{
+	volatile struct usb_ep *ep = &usb_hw_mock_ep_regs[ep_num & 0xf].in;
+	uint32_t status = ep->status;
+	uint32_t csr;
+	int bdi, l;
+
+	g_mock.stats.xact++;
+
+	if (!_mock_addr_match(addr) || (USB_EP_TYPE(status) == USB_EP_TYPE_NONE))
+		return MOCK_TIMEOUT;
+
+	if (USB_EP_TYPE_IS_BCI(status)) {
+		if (status & USB_EP_TYPE_HALTED)
+			return MOCK_STALL;
+		if (_mock_cel_active(status))
+			goto nak;
+	}
+
+	bdi = _mock_bd_idx(status, false);
+	csr = ep->bd[bdi].csr;
+
+	if ((csr & USB_BD_STATE_MSK) == USB_BD_STATE_RDY_STALL)
+		return MOCK_STALL;
+	if ((csr & USB_BD_STATE_MSK) != USB_BD_STATE_RDY_DATA)
+		goto nak;
+
+	/* Packet */
+	l = csr & USB_BD_LEN_MSK;
+	if (l > max_len)
+		return MOCK_ERROR;
+
+	_mock_mem_read(data, ep->bd[bdi].ptr, l);
+	*len = l;
+	*dt  = !!(status & USB_EP_DT_BIT);
+
+	/* Host ACKed it */
+	ep->bd[bdi].csr = USB_BD_STATE_DONE_OK | USB_BD_LEN(l);
+	_mock_ep_done(ep, status);
+	_mock_notify(ep_num, true, false, bdi);
+
+	return MOCK_ACK;
+
+nak:
+	g_mock.stats.nak++;
+	return (USB_EP_TYPE(status) == USB_EP_TYPE_ISOC) ? MOCK_TIMEOUT : MOCK_NAK;
+}
+
+
+	/* Control transfers */
+
+static enum mock_res
+_mock_ctrl_out(uint8_t addr, const void *data, int len)
+{
+	enum mock_res res = MOCK_NAK;
+
+	for (int i=0; (i<MOCK_NAK_RETRY) && (res == MOCK_NAK); i++) {
+		res = mock_out(addr, 0, data, len);
+		mock_fw_poll();
+	}
+
+	return res;
+}
+
+static enum mock_res
+_mock_ctrl_in(uint8_t addr, void *data, int *len, int max_len, bool dt_exp)
+{
+	enum mock_res res = MOCK_NAK;
+	bool dt = false;
+
+	for (int i=0; (i<MOCK_NAK_RETRY) && (res == MOCK_NAK); i++) {
+		res = mock_in(addr, 0, data, len, max_len, &dt);
+		mock_fw_poll();
+	}
+
+	if ((res == MOCK_ACK) && (dt != dt_exp))
+		return MOCK_ERROR;
+
+	return res;
+}
+
+enum mock_res
+mock_ctrl(uint8_t addr, const struct usb_ctrl_req *req, void *data, int *len)
+{
+	uint8_t *p = data;
+	uint8_t zlp[MOCK_EP0_MPS];
+	enum mock_res res;
+	int ofs, l, zl;
+	bool dt;
+
+	/* Setup stage */
+	res = mock_setup(addr, req);
+	if (res != MOCK_ACK)
+		return res;
+
+	mock_fw_poll();
+
+	/* Data stage */
+	ofs = 0;
+	dt  = true;
+
+	if (req->wLength && (req->bmRequestType & USB_REQ_READ)) {
+		/* Buffer must hold wLength */
+		do {
+			l = 0;
+			res = _mock_ctrl_in(addr, p + ofs, &l, req->wLength - ofs, dt);
+			if (res != MOCK_ACK)
+				return res;
+			ofs += l;
+			dt = !dt;
+		} while ((l == MOCK_EP0_MPS) && (ofs < req->wLength));
+	} else if (req->wLength) {
+		while (ofs < req->wLength) {
+			l = req->wLength - ofs;
+			if (l > MOCK_EP0_MPS)
+				l = MOCK_EP0_MPS;
+
+			res = _mock_ctrl_out(addr, p + ofs, l);
+			if (res != MOCK_ACK)
+				return res;
+
+			ofs += l;
+			dt = !dt;
+		}
+	}
+
+	if (len)
+		*len = ofs;
+
+	/* Status stage, always DATA1 */
+	if (req->bmRequestType & USB_REQ_READ)
+		return _mock_ctrl_out(addr, NULL, 0);
+
+	res = _mock_ctrl_in(addr, zlp, &zl, sizeof(zlp), true);
+	if ((res == MOCK_ACK) && zl)
+		return MOCK_ERROR;
+
+	return res;
+}
@@ -0,0 +1,65 @@
+/*
+ * usb_hw_mock.h
+ *
+ * Register / packet memory model of the core for host builds of the v0
+ * stack (`USB_HW_MOCK`), along with a minimal host side to drive it.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <no2usb/usb_proto.h>
+
+
+enum mock_res {
+	MOCK_ACK = 0,
+	MOCK_NAK,
+	MOCK_STALL,
+	MOCK_TIMEOUT,	/* No answer at all (no EP, wrong address, ...) */
+	MOCK_ERROR,	/* Protocol violation (toggle, length, ...) */
+};
+
+struct mock_stats {
+	/* Core register accesses done by the firmware */
+	uint64_t reg_rd;
+	uint64_t reg_wr;
+
+	/* Firmware poll calls */
+	uint64_t polls;
+
+	/* Bus transactions */
+	uint64_t xact;
+	uint64_t nak;
+};
+
+typedef void (*mock_fw_hook)(void);
+
+
+/* Model */
+void mock_reset(void);
+void mock_set_fw_hooks(mock_fw_hook enter, mock_fw_hook leave);
+void mock_fw_poll(void);
+
+const char *mock_res_str(enum mock_res res);
+struct mock_stats *mock_stats(void);
+
+bool mock_pullup(void);
+uint8_t mock_address(void);
+
+	/* Bus events, those run the firmware as needed */
+void mock_bus_reset(void);
+void mock_sof(int frames);	/* Firmware only sees the last one */
+void mock_suspend(bool suspend);
+
+	/* Single transactions, the firmware is not run */
+enum mock_res mock_setup(uint8_t addr, const struct usb_ctrl_req *req);
+enum mock_res mock_out(uint8_t addr, uint8_t ep, const void *data, int len);
+enum mock_res mock_in(uint8_t addr, uint8_t ep, void *data, int *len, int max_len, bool *dt);
+
+	/* Transfers, retry NAKed transactions while running the firmware */
+enum mock_res mock_ctrl(uint8_t addr, const struct usb_ctrl_req *req, void *data, int *len);
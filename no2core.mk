@@ -5,11 +5,14 @@ DEPS_no2usb := no2misc
 RTL_SRCS_no2usb := $(addprefix rtl/, \
 	usb.v \
 	usb_crc.v \
+	usb_dma.v \
 	usb_ep_buf.v \
 	usb_ep_status.v \
 	usb_phy.v \
 	usb_rx_ll.v \
 	usb_rx_pkt.v \
+	usb_stats.v \
+	usb_trace.v \
 	usb_trans.v \
 	usb_tx_ll.v \
 	usb_tx_pkt.v \
@@ -20,15 +23,44 @@ PREREQ_no2usb = \
 	$(BUILD_TMP)/usb_trans_mc.hex \
 	$(BUILD_TMP)/usb_ep_status.hex
 
+# Optional microcode paths. The full microcode works with any `usb`
+# instance. Set either to 0 only if the instance is built without that
+# feature, to drop its checks from the handshake paths (see
+# doc/microcode.md). NO_XFER also needs DESC off.
+NO2USB_XFER ?= 1
+NO2USB_DESC ?= 1
+
 TESTBENCHES_no2usb := \
+	$(if $(filter 0,$(NO2USB_DESC)),,usb_desc_tb) \
+	usb_dma_tb \
 	usb_ep_buf_tb \
+	usb_eps_tdp_tb \
+	usb_evt_ram_tb \
+	usb_notify_tb \
+	usb_osr_tb \
+	usb_rearm_tb \
+	usb_ring_tb \
+	usb_rto_tb \
+	usb_rx_tb \
+	usb_stats_tb \
 	usb_tb \
-	usb_tx_tb
+	usb_trace_tb \
+	usb_tx_tb \
+	usb_wb32_tb \
+	$(if $(filter 0,$(NO2USB_XFER)),,usb_xfer_tb)
 
 include $(NO2BUILD_DIR)/core-magic.mk
 
+# Microcode features removed
+NO2USB_MC_DEFS := \
+	$(if $(filter 0,$(NO2USB_XFER)),$(if $(filter 0,$(NO2USB_DESC)),-DNO_XFER)) \
+	$(if $(filter 0,$(NO2USB_DESC)),-DNO_DESC)
+
+# Extra microcode assembler options (e.g. `opt -DNO_ISOC`)
+NO2USB_MC_OPTS ?=
+
 $(BUILD_TMP)/usb_trans_mc.hex: $(CORE_no2usb_DIR)/utils/microcode.py
-	$(CORE_no2usb_DIR)/utils/microcode.py > $@
+	$(CORE_no2usb_DIR)/utils/microcode.py $(NO2USB_MC_OPTS) $(NO2USB_MC_DEFS) > $@
 
 $(BUILD_TMP)/usb_ep_status.hex: $(CORE_no2usb_DIR)/data/usb_ep_status.hex
 	cp -a $< $@
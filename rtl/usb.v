@@ -12,11 +12,25 @@
 module usb #(
 	parameter         TARGET = "ICE40",
 	parameter integer EPDW = 16,
+	parameter integer CLK_FREQ = 48_000_000,	// Multiple of 12 MHz, 36 MHz or more
 	parameter integer EVT_DEPTH = 0,
+	parameter integer EVT_RAM = 0,
 	parameter integer IRQ = 0,
+	parameter integer BD_RING = 0,
+	parameter integer XFER = 0,
+	parameter integer AUTO_REARM = 0,
+	parameter integer NOTIFY_CTRL = 0,
+	parameter integer EPS_TDP = 0,	// True dual-port EP status RAM (ignored on iCE40)
+	parameter integer WB_DW = 16,	// Bus width, 32 enables combined accesses
+	parameter integer DESC = 0,		// Hardware GET_DESCRIPTOR responder
+	parameter integer STATS = 0,	// Bus statistics counters
+	parameter integer TRACE = 0,	// Packet trace entries (0 = off, power of 2, 4 to 256)
 
 	/* Auto-set */
-	parameter integer EPAW = 11 - $clog2(EPDW / 8)
+	parameter integer OSR = CLK_FREQ / 12_000_000,
+	parameter integer EPS_TDP_I = (TARGET == "ICE40") ? 0 : EPS_TDP,
+	parameter integer EPAW = 11 - $clog2(EPDW / 8),
+	parameter integer EPSAW = BD_RING ? 9 : 8
 )(
 	// Pads
 	inout  wire pad_dp,
@@ -36,8 +50,8 @@ module usb #(
 
 	// Bus interface
 	input  wire [11:0] wb_addr,
-	output wire [15:0] wb_rdata,
-	input  wire [15:0] wb_wdata,
+	output wire [WB_DW-1:0] wb_rdata,
+	input  wire [WB_DW-1:0] wb_wdata,
 	input  wire        wb_we,
 	input  wire        wb_cyc,
 	output wire        wb_ack,
@@ -48,6 +62,10 @@ module usb #(
 	// SOF indication
 	output wire sof,
 
+	// BD completion (DMA trigger) : { EP, dir, BD }
+	output wire bd_done_stb,
+	output wire [5:0] bd_done_id,
+
 	// Common
 	input  wire clk,
 	input  wire rst
@@ -119,7 +137,7 @@ module usb #(
 	wire eps_read_0;
 	wire eps_zero_0;
 	wire eps_write_0;
-	wire [ 7:0] eps_addr_0;
+	wire [ 8:0] eps_addr_0;
 	wire [15:0] eps_wrdata_0;
 	wire [15:0] eps_rddata_3;
 
@@ -128,16 +146,25 @@ module usb #(
 	wire eps_bus_zero;
 	reg  eps_bus_write;
 	wire [15:0] eps_bus_dout;
+	wire eps_bus_ack;
+	wire [EPSAW-1:0] eps_bus_addr;
+	wire [15:0] eps_bus_din;
 
 	// Config / Status registers
 	reg  cr_pu_ena;
 	reg  cr_cel_ena;
 	reg  cr_addr_chk;
 	reg  [ 6:0] cr_addr;
+	reg  [15:0] cr_rto;
+	reg  cr_dsc_ena;
+	reg  [ 1:0] cr_dsc_mps;
+	reg  [10:0] cr_dsc_base;
 
 	wire cel_state;
 	reg  cel_rel;
 
+	wire ntf_clr;
+
 	// Interrupt register
 	reg  ir_sfp;
 	reg  ir_evt;
@@ -155,6 +182,8 @@ module usb #(
 	wire [15:0] ir_readout;
 
 	reg  cr_bus_we;
+	reg  rto_bus_we;
+	reg  dsc_bus_we;
 	reg  ir_bus_we;
 
 	reg  eps_bus_req;
@@ -168,16 +197,44 @@ module usb #(
 	reg  evt_rd_ack;
 	wire evt_pending;
 
+	reg  [10:0] evt_ts_frameno;
+	reg  [15:0] evt_ts_subcnt;
+
 	// Events
 	wire [11:0] evt_data;
 	wire evt_stb;
 
+	// Statistics
+	wire stat_rx_to;
+	wire stat_tx_nak;
+	wire stat_tx_stall;
+	wire stat_no_ep;
+	wire [4:0] stat_ep;
+
+	reg  stats_bus_we;
+	wire [15:0] stats_ctl;
+	wire [15:0] stats_dat;
+
+	// Trace
+	reg  trace_ctl_we;
+	reg  trace_flt_we;
+	reg  trace_rd_ack;
+	wire [15:0] trace_ctl;
+	wire [15:0] trace_flt;
+	wire [15:0] trace_dat;
+
 	// Out-of-band conditions
 	wire oob_se0;
 	wire oob_sof;
 
-	reg  [19:0] timeout_suspend;	//  3 ms with no activity
-	reg  [19:0] timeout_reset;		// 10 ms SE0
+	localparam integer CYC_1MS  = CLK_FREQ / 1000;
+	localparam integer CYC_3MS  = CLK_FREQ / 1000 * 3;
+	localparam integer CYC_10MS = CLK_FREQ / 100;
+	localparam integer TW       = $clog2(CYC_10MS) + 1;
+	localparam integer SW       = $clog2(CYC_1MS);	// Sub-frame counter, 16 bits visible
+
+	reg  [TW-1:0] timeout_suspend;	//  3 ms with no activity
+	reg  [TW-1:0] timeout_reset;	// 10 ms SE0
 
 	wire usb_suspend;
 	wire usb_reset;
@@ -189,6 +246,30 @@ module usb #(
 	reg  sof_pending;
 	reg  sof_clear;
 
+	reg         sof_valid;
+	reg  [10:0] sof_frameno;
+	reg  [SW-1:0] sof_subcnt_i;
+	wire [15:0] sof_subcnt;
+	wire [10:0] sof_gap;
+	reg  [15:0] sof_missed;
+	reg         sof_missed_clear;
+
+
+	// Parameter checks
+	// ----------------
+
+	// Unsupported configurations instantiate a module that doesn't exist
+	// so they fail at elaboration with a meaningful name
+	generate
+		// Integer OSR >= 3
+		if (((CLK_FREQ % 12_000_000) != 0) || (CLK_FREQ < 36_000_000))
+			usb_error_CLK_FREQ_must_be_a_multiple_of_12MHz_from_36MHz err_clk_I ();
+
+		// Trace buffer entries, power of 2 from 4 to 256 (or 0)
+		if ((TRACE != 0) && ((TRACE < 4) || (TRACE > 256) || ((TRACE & (TRACE - 1)) != 0)))
+			usb_error_TRACE_must_be_a_power_of_2_from_4_to_256 err_trace_I ();
+	endgenerate
+
 
 	// PHY
 	// ---
@@ -216,7 +297,9 @@ module usb #(
 	// TX
 	// --
 
-	usb_tx_ll tx_ll_I (
+	usb_tx_ll #(
+		.OSR(OSR)
+	) tx_ll_I (
 		.phy_tx_dp(phy_tx_dp),
 		.phy_tx_dn(phy_tx_dn),
 		.phy_tx_en(phy_tx_en),
@@ -247,7 +330,9 @@ module usb #(
 	// RX
 	// --
 
-	usb_rx_ll rx_ll_I (
+	usb_rx_ll #(
+		.OSR(OSR)
+	) rx_ll_I (
 		.phy_rx_dp(phy_rx_dp),
 		.phy_rx_dn(phy_rx_dn),
 		.phy_rx_chg(phy_rx_chg),
@@ -292,7 +377,14 @@ module usb #(
 	// Transaction control
 	// -------------------
 
-	usb_trans trans_I (
+	usb_trans #(
+		.TARGET(TARGET),
+		.BD_RING(BD_RING),
+		.XFER(XFER),
+		.AUTO_REARM(AUTO_REARM),
+		.NOTIFY_CTRL(NOTIFY_CTRL),
+		.DESC(DESC)
+	) trans_I (
 		.txpkt_start(txpkt_start),
 		.txpkt_done(txpkt_done),
 		.txpkt_pid(txpkt_pid),
@@ -326,11 +418,24 @@ module usb #(
 		.eps_rddata_3(eps_rddata_3),
 		.cr_addr_chk(cr_addr_chk),
 		.cr_addr(cr_addr),
+		.cr_rto(cr_rto),
+		.cr_dsc_ena(cr_dsc_ena),
+		.cr_dsc_mps(cr_dsc_mps),
+		.cr_dsc_base(cr_dsc_base),
 		.evt_data(evt_data),
 		.evt_stb(evt_stb),
+		.bd_done_stb(bd_done_stb),
+		.stat_rx_to(stat_rx_to),
+		.stat_tx_nak(stat_tx_nak),
+		.stat_tx_stall(stat_tx_stall),
+		.stat_no_ep(stat_no_ep),
+		.stat_ep(stat_ep),
 		.cel_state(cel_state),
 		.cel_rel(cel_rel),
 		.cel_ena(cr_cel_ena),
+		.ntf_rst(usb_reset),
+		.ntf_clr(ntf_clr),
+		.ntf_clr_ep(eps_bus_addr[7:3]),
 		.clk(clk),
 		.rst(rst)
 	);
@@ -373,18 +478,22 @@ module usb #(
 	// EP Status / Buffer Descriptors
 	// ------------------------------
 
-	usb_ep_status ep_status_I (
-		.p_addr_0(eps_addr_0),
+	usb_ep_status #(
+		.TARGET(TARGET),
+		.AW(EPSAW),
+		.TDP(EPS_TDP_I)
+	) ep_status_I (
+		.p_addr_0(eps_addr_0[EPSAW-1:0]),
 		.p_read_0(eps_read_0),
 		.p_zero_0(eps_zero_0),
 		.p_write_0(eps_write_0),
 		.p_din_0(eps_wrdata_0),
 		.p_dout_3(eps_rddata_3),
-		.s_addr_0(wb_addr[7:0]),
+		.s_addr_0(eps_bus_addr),
 		.s_read_0(eps_bus_ready),
 		.s_zero_0(eps_bus_zero),
 		.s_write_0(eps_bus_write),
-		.s_din_0(wb_wdata),
+		.s_din_0(eps_bus_din),
 		.s_dout_3(eps_bus_dout),
 		.s_ready_0(eps_bus_ready),
 		.clk(clk),
@@ -405,14 +514,28 @@ module usb #(
 			sof_clear   <= 1'b0;
 			evt_rd_ack  <= 1'b0;
 			ir_bus_we   <= 1'b0;
+			sof_missed_clear <= 1'b0;
+			rto_bus_we  <= 1'b0;
+			dsc_bus_we  <= 1'b0;
+			stats_bus_we <= 1'b0;
+			trace_ctl_we <= 1'b0;
+			trace_flt_we <= 1'b0;
+			trace_rd_ack <= 1'b0;
 		end else begin
 			csr_bus_req <= 1'b1;
-			cr_bus_we   <= (wb_addr[1:0] == 2'b00) &  wb_we;
-			cel_rel     <= (wb_addr[1:0] == 2'b01) &  wb_we & wb_wdata[13];
-			rst_clear   <= (wb_addr[1:0] == 2'b01) &  wb_we & wb_wdata[ 9];
-			sof_clear   <= (wb_addr[1:0] == 2'b01) &  wb_we & wb_wdata[ 8];
-			evt_rd_ack  <= (wb_addr[1:0] == 2'b10) & ~wb_we & evt_rd_rdy;
-			ir_bus_we   <= (wb_addr[1:0] == 2'b11) &  wb_we;
+			cr_bus_we   <= (wb_addr[3:0] == 4'h0) &  wb_we;
+			cel_rel     <= (wb_addr[3:0] == 4'h1) &  wb_we & wb_wdata[13];
+			rst_clear   <= (wb_addr[3:0] == 4'h1) &  wb_we & wb_wdata[ 9];
+			sof_clear   <= (wb_addr[3:0] == 4'h1) &  wb_we & wb_wdata[ 8];
+			evt_rd_ack  <= (wb_addr[3:0] == 4'h2) & ~wb_we & evt_rd_rdy;
+			ir_bus_we   <= (wb_addr[3:0] == 4'h3) &  wb_we;
+			sof_missed_clear <= (wb_addr[3:0] == 4'h8) & wb_we;
+			rto_bus_we  <= (wb_addr[3:0] == 4'h9) &  wb_we;
+			dsc_bus_we  <= (wb_addr[3:0] == 4'ha) &  wb_we;
+			stats_bus_we <= (wb_addr[3:0] == 4'hb) & wb_we;
+			trace_ctl_we <= (wb_addr[3:0] == 4'hd) & wb_we;
+			trace_flt_we <= (wb_addr[3:0] == 4'he) & wb_we;
+			trace_rd_ack <= (wb_addr[3:0] == 4'hf) & ~wb_we;
 		end
 
 	// Read mux for CSR
@@ -441,10 +564,22 @@ module usb #(
 
 	always @(*)
 		if (csr_bus_ack)
-			case (wb_addr[1:0])
-				2'b00:   csr_bus_dout = csr_readout;
-				2'b10:   csr_bus_dout = evt_rd_data;
-				2'b11:   csr_bus_dout = ir_readout;
+			case (wb_addr[3:0])
+				4'h0:    csr_bus_dout = csr_readout;
+				4'h2:    csr_bus_dout = evt_rd_data;
+				4'h3:    csr_bus_dout = ir_readout;
+				4'h4:    csr_bus_dout = { 5'd0, evt_ts_frameno };
+				4'h5:    csr_bus_dout = evt_ts_subcnt;
+				4'h6:    csr_bus_dout = { sof_valid, 4'd0, sof_frameno };
+				4'h7:    csr_bus_dout = sof_subcnt;
+				4'h8:    csr_bus_dout = sof_missed;
+				4'h9:    csr_bus_dout = cr_rto;
+				4'ha:    csr_bus_dout = DESC ? { cr_dsc_ena, 2'b00, cr_dsc_mps, cr_dsc_base } : 16'h0000;
+				4'hb:    csr_bus_dout = stats_ctl;
+				4'hc:    csr_bus_dout = stats_dat;
+				4'hd:    csr_bus_dout = trace_ctl;
+				4'he:    csr_bus_dout = trace_flt;
+				4'hf:    csr_bus_dout = trace_dat;
 				default: csr_bus_dout = 16'h0000;
 			endcase
 		else
@@ -468,6 +603,23 @@ module usb #(
 			cr_addr    <= wb_wdata[6:0];
 		end
 
+	always @(posedge clk or posedge rst)
+		if (rst)
+			cr_rto <= (70 * OSR) / 4;	// ~1.5 us
+		else if (rto_bus_we)
+			cr_rto <= wb_wdata[15:0];
+
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			cr_dsc_ena  <= 1'b0;
+			cr_dsc_mps  <= 2'b00;
+			cr_dsc_base <= 11'h000;
+		end else if (dsc_bus_we) begin
+			cr_dsc_ena  <= wb_wdata[15] & (DESC != 0);
+			cr_dsc_mps  <= wb_wdata[12:11];
+			cr_dsc_base <= wb_wdata[10:0];
+		end
+
 	always @(posedge clk or posedge rst)
 		if (IRQ) begin
 			if (rst) begin
@@ -487,42 +639,121 @@ module usb #(
 			end
 		end
 
-	// Request lines for EP Status access
-	always @(posedge clk)
-		if (eps_bus_clear) begin
-			eps_bus_read  <= 1'b0;
-			eps_bus_write <= 1'b0;
-			eps_bus_req   <= 1'b0;
+	// EP Status access
+	generate
+		if (EPS_TDP_I) begin
+			// Dedicated RAM port: data is ready the next cycle, unless the
+			// access collides with the transaction engine one and has to wait
+			reg eps_bus_ack_i;
+
+			always @(posedge clk)
+				eps_bus_ack_i <= wb_cyc & wb_addr[11] & ~eps_bus_ack_i & eps_bus_ready;
+
+			always @(*)
+			begin
+				eps_bus_read  = wb_cyc & wb_addr[11] & ~wb_we & ~eps_bus_ack_i;
+				eps_bus_write = wb_cyc & wb_addr[11] &  wb_we & ~eps_bus_ack_i;
+			end
+
+			assign eps_bus_zero = ~eps_bus_read;
+			assign eps_bus_ack  = eps_bus_ack_i;
+
 		end else begin
-			eps_bus_read  <= wb_addr[11] & ~wb_we;
-			eps_bus_write <= wb_addr[11] &  wb_we;
-			eps_bus_req   <= wb_addr[11];
+			// Request lines for EP Status access
+			always @(posedge clk)
+				if (eps_bus_clear) begin
+					eps_bus_read  <= 1'b0;
+					eps_bus_write <= 1'b0;
+					eps_bus_req   <= 1'b0;
+				end else begin
+					eps_bus_read  <= wb_addr[11] & ~wb_we;
+					eps_bus_write <= wb_addr[11] &  wb_we;
+					eps_bus_req   <= wb_addr[11];
+				end
+
+			assign eps_bus_zero = ~eps_bus_read;
+
+			// EPS Clear
+			assign eps_bus_clear = ~wb_cyc | eps_bus_ack_wait | (eps_bus_req & eps_bus_ready);
+
+			// Track when request are accepted by the RAM
+			assign eps_bus_req_ok = (eps_bus_req & eps_bus_ready);
+
+			always @(posedge clk)
+				eps_bus_req_ok_dly <= { eps_bus_req_ok_dly[1:0], eps_bus_req_ok & ~wb_we };
+
+			// ACK wait state tracking
+			always @(posedge clk or posedge rst)
+				if (rst)
+					eps_bus_ack_wait <= 1'b0;
+				else
+					eps_bus_ack_wait <= ((eps_bus_ack_wait & ~wb_we) | eps_bus_req_ok) & ~eps_bus_req_ok_dly[2];
+
+			// Bus Ack
+			assign eps_bus_ack = eps_bus_ack_wait & (wb_we | eps_bus_req_ok_dly[2]);
 		end
+	endgenerate
 
-	assign eps_bus_zero = ~eps_bus_read;
+	// EP config writes restart the notify control of that EP
+	assign ntf_clr = eps_bus_write & (eps_bus_addr[2:0] == 3'b011) & ((BD_RING == 0) | ~eps_bus_addr[EPSAW-1]);
 
-	// EPS Clear
-	assign eps_bus_clear = ~wb_cyc | eps_bus_ack_wait | (eps_bus_req & eps_bus_ready);
+	// Bus width
+	generate
+		if (WB_DW == 32) begin
+			// Combined accesses (addr[10] set) are split in two EP status
+			// accesses, upper half first. Only the second one is acked.
+			reg  eps_beat;
+			reg  [15:0] eps_bus_hold;
+			wire eps_comb;
+			wire eps_comb_st;
 
-	// Track when request are accepted by the RAM
-	assign eps_bus_req_ok = (eps_bus_req & eps_bus_ready);
+			assign eps_comb    = wb_addr[10];
+			assign eps_comb_st = ~wb_addr[8] & (wb_addr[2:0] == 3'b000);
 
-	always @(posedge clk)
-		eps_bus_req_ok_dly <= { eps_bus_req_ok_dly[1:0], eps_bus_req_ok & ~wb_we };
+			always @(posedge clk or posedge rst)
+				if (rst)
+					eps_beat <= 1'b0;
+				else if (~wb_cyc)
+					eps_beat <= 1'b0;
+				else if (eps_bus_ack & eps_comb)
+					eps_beat <= ~eps_beat;
+
+			// Status : { status, BD0 word 0 }, Others : { word 1, word 0 }
+			assign eps_bus_addr = ~eps_comb ? wb_addr[EPSAW-1:0] : (
+				eps_comb_st ?
+					(eps_beat ? { wb_addr[EPSAW-1:3], 3'b100 } : wb_addr[EPSAW-1:0]) :
+					{ wb_addr[EPSAW-1:1], ~eps_beat }
+			);
 
-	// ACK wait state tracking
-	always @(posedge clk or posedge rst)
-		if (rst)
-			eps_bus_ack_wait <= 1'b0;
-		else
-			eps_bus_ack_wait <= ((eps_bus_ack_wait & ~wb_we) | eps_bus_req_ok) & ~eps_bus_req_ok_dly[2];
+			assign eps_bus_din = (eps_comb & ~eps_beat) ? wb_wdata[31:16] : wb_wdata[15:0];
+
+			always @(posedge clk)
+				if (eps_bus_ack & ~eps_beat)
+					eps_bus_hold <= eps_bus_dout;
 
-	// Bus Ack
-	assign wb_ack = csr_bus_ack | (eps_bus_ack_wait & (wb_we | eps_bus_req_ok_dly[2]));
+			// Bus Ack
+			assign wb_ack = csr_bus_ack | (eps_bus_ack & (~eps_comb | eps_beat));
 
-	// Output is simply the OR of all local units since we force them to zero if
-	// they're not accessed
-	assign wb_rdata = csr_bus_dout | eps_bus_dout;
+			// Output is simply the OR of all local units since we force them to
+			// zero if they're not accessed
+			assign wb_rdata = {
+				(eps_bus_ack & eps_comb & eps_beat) ? eps_bus_hold : 16'h0000,
+				csr_bus_dout | eps_bus_dout
+			};
+
+		end else begin
+			// Direct
+			assign eps_bus_addr = wb_addr[EPSAW-1:0];
+			assign eps_bus_din  = wb_wdata;
+
+			// Bus Ack
+			assign wb_ack = csr_bus_ack | eps_bus_ack;
+
+			// Output is simply the OR of all local units since we force them to
+			// zero if they're not accessed
+			assign wb_rdata = csr_bus_dout | eps_bus_dout;
+		end
+	endgenerate
 
 
 	// Event handling
@@ -565,9 +796,12 @@ module usb #(
 			assign evt_pending = (evt_cnt != 4'h0);
 
 		end else if (EVT_DEPTH > 1) begin
-			// Small shift-reg FIFO
-			wire [11:0] ef_wdata;
-			wire [11:0] ef_rdata;
+			// Event FIFO (either a small shift-reg one, or a RAM based one
+			// where each entry is also timestamped)
+			localparam integer EFW = EVT_RAM ? 39 : 12;
+
+			wire [EFW-1:0] ef_wdata;
+			wire [EFW-1:0] ef_rdata;
 			wire ef_wren;
 			wire ef_full;
 			wire ef_rden;
@@ -575,7 +809,6 @@ module usb #(
 
 			reg  ef_overflow;
 
-			assign ef_wdata = evt_data;
 			assign ef_wren  = evt_stb & ~ef_full;
 
 			always @(posedge clk or posedge rst)
@@ -585,25 +818,127 @@ module usb #(
 					ef_overflow <= (ef_overflow & ~evt_rd_ack) | (evt_stb & ef_full);
 
 			assign evt_rd_rdy = ~ef_empty;
-			assign evt_rd_data = { ~ef_empty, ef_overflow, 2'b00, ef_rdata };
+			assign evt_rd_data = { ~ef_empty, ef_overflow, 2'b00, ef_rdata[11:0] };
 			assign ef_rden = evt_rd_ack;
 
 			assign evt_pending = ~ef_empty;
 
-			fifo_sync_shift #(
-				.DEPTH(EVT_DEPTH),
-				.WIDTH(12)
-			) evt_fifo_I (
-				.wr_data(ef_wdata),
-				.wr_ena(ef_wren),
-				.wr_full(ef_full),
-				.rd_data(ef_rdata),
-				.rd_ena(ef_rden),
-				.rd_empty(ef_empty),
+			if (EVT_RAM) begin
+				// Timestamp on the way in
+				assign ef_wdata = { sof_subcnt, sof_frameno, evt_data };
+
+				// And keep the one of the last event read
+				always @(posedge clk)
+					if (evt_rd_ack)
+						{ evt_ts_subcnt, evt_ts_frameno } <= ef_rdata[38:12];
+
+				fifo_sync_ram #(
+					.DEPTH(EVT_DEPTH),
+					.WIDTH(EFW)
+				) evt_fifo_I (
+					.wr_data(ef_wdata),
+					.wr_ena(ef_wren),
+					.wr_full(ef_full),
+					.rd_data(ef_rdata),
+					.rd_ena(ef_rden),
+					.rd_empty(ef_empty),
+					.clk(clk),
+					.rst(rst)
+				);
+
+			end else begin
+				assign ef_wdata = evt_data;
+
+				fifo_sync_shift #(
+					.DEPTH(EVT_DEPTH),
+					.WIDTH(EFW)
+				) evt_fifo_I (
+					.wr_data(ef_wdata),
+					.wr_ena(ef_wren),
+					.wr_full(ef_full),
+					.rd_data(ef_rdata),
+					.rd_ena(ef_rden),
+					.rd_empty(ef_empty),
+					.clk(clk),
+					.rst(rst)
+				);
+
+			end
+
+		end
+	endgenerate
+
+	// No timestamps without the RAM FIFO
+	generate
+		if ((EVT_DEPTH <= 1) || !EVT_RAM)
+			always @(posedge clk)
+				{ evt_ts_subcnt, evt_ts_frameno } <= 27'd0;
+	endgenerate
+
+
+	// Statistics
+	// ----------
+
+	generate
+		if (STATS) begin
+			usb_stats stats_I (
+				.evt_bs_err(rxll_valid & rxll_bs_err),
+				.evt_rx_err(rxpkt_done_err),
+				.evt_rx_to(stat_rx_to),
+				.evt_tx_nak(stat_tx_nak),
+				.evt_tx_stall(stat_tx_stall),
+				.evt_no_ep(stat_no_ep),
+				.evt_ep(stat_ep),
+				.ctl_wdata(wb_wdata[15:0]),
+				.ctl_we(stats_bus_we),
+				.ctl_rdata(stats_ctl),
+				.dat_rdata(stats_dat),
 				.clk(clk),
 				.rst(rst)
 			);
+		end else begin
+			assign stats_ctl = 16'h0000;
+			assign stats_dat = 16'h0000;
+		end
+	endgenerate
+
+
+	// Packet trace
+	// ------------
 
+	generate
+		if (TRACE) begin
+			usb_trace #(
+				.DEPTH(TRACE)
+			) trace_I (
+				.rxpkt_start(rxpkt_start),
+				.rxpkt_done_ok(rxpkt_done_ok),
+				.rxpkt_done_err(rxpkt_done_err),
+				.rxpkt_pid(rxpkt_pid),
+				.rxpkt_is_sof(rxpkt_is_sof),
+				.rxpkt_is_token(rxpkt_is_token),
+				.rxpkt_token(rxpkt_frameno),
+				.rxpkt_data_stb(rxpkt_data_stb),
+				.txpkt_start(txpkt_start),
+				.txpkt_done(txpkt_done),
+				.txpkt_pid(txpkt_pid),
+				.txpkt_len(txpkt_len),
+				.ts_frameno(sof_frameno),
+				.ts_subcnt(sof_subcnt),
+				.bus_wdata(wb_wdata[15:0]),
+				.ctl_we(trace_ctl_we),
+				.ctl_rdata(trace_ctl),
+				.flt_we(trace_flt_we),
+				.flt_rdata(trace_flt),
+				.dat_rdata(trace_dat),
+				.dat_ack(trace_rd_ack),
+				.clk(clk),
+				.rst(rst)
+			);
+		end else begin
+			assign trace_ctl = 16'h0000;
+			assign trace_flt = 16'h0000;
+			assign trace_dat = 16'h0000;
 		end
 	endgenerate
 
@@ -618,20 +953,20 @@ module usb #(
 	// Suspend timeout counter
 	always @(posedge clk)
 		if (oob_sof | usb_reset)
-			timeout_suspend <= 20'hdcd80;	// 3 ms
+			timeout_suspend <= (1 << TW) - CYC_3MS;	// 3 ms
 		else
-			timeout_suspend <= timeout_suspend + timeout_suspend[19];
+			timeout_suspend <= timeout_suspend + timeout_suspend[TW-1];
 
-	assign usb_suspend = ~timeout_suspend[19];
+	assign usb_suspend = ~timeout_suspend[TW-1];
 
 	// Reset timeout counter
 	always @(posedge clk)
 		if (~oob_se0)
-			timeout_reset <= 20'h8ad00;
+			timeout_reset <= (1 << TW) - CYC_10MS;	// 10 ms
 		else
-			timeout_reset <= timeout_reset + timeout_reset[19];
+			timeout_reset <= timeout_reset + timeout_reset[TW-1];
 
-	assign usb_reset = ~timeout_reset[19];
+	assign usb_reset = ~timeout_reset[TW-1];
 
 	always @(posedge clk or posedge rst)
 		if (rst)
@@ -658,6 +993,48 @@ module usb #(
 
 	assign sof = sof_ind;
 
+	// BD completion, for a BD triggered DMA (strobe comes from `usb_trans`)
+	assign bd_done_id = { evt_data[7:3], evt_data[1] };
+
+	// Frame number (from the last valid SOF)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			sof_frameno <= 11'd0;
+		else if (rxpkt_done_ok & rxpkt_is_sof)
+			sof_frameno <= rxpkt_frameno;
+
+	// Only valid if we got one since the last reset / suspend
+	always @(posedge clk or posedge rst)
+		if (rst)
+			sof_valid <= 1'b0;
+		else
+			sof_valid <= (sof_valid & ~usb_reset & ~usb_suspend) | (rxpkt_done_ok & rxpkt_is_sof);
+
+	// Missed SOFs (gaps in the frame numbers, saturating)
+	assign sof_gap = rxpkt_frameno - sof_frameno - 11'd1;
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			sof_missed <= 16'h0000;
+		else if (sof_missed_clear)
+			sof_missed <= 16'h0000;
+		else if (rxpkt_done_ok & rxpkt_is_sof & sof_valid)
+			sof_missed <= ({1'b0, sof_missed} + {6'd0, sof_gap} > 17'h0ffff) ?
+				16'hffff : (sof_missed + {5'd0, sof_gap});
+
+	// Sub-frame counter (cycles since start of last SOF, saturating)
+	// Sized to cover a frame, only the 16 MSBs are visible (so in
+	// units of 2^(SW-16) cycles : 2 above 65.536 MHz, 4 above 131.072 MHz)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			sof_subcnt_i <= {SW{1'b1}};
+		else if (rxpkt_start & rxpkt_is_sof)
+			sof_subcnt_i <= 0;
+		else
+			sof_subcnt_i <= sof_subcnt_i + { {(SW-1){1'b0}}, ~&sof_subcnt_i };
+
+	assign sof_subcnt = sof_subcnt_i[SW-1:SW-16];
+
 
 	// IRQ
 	// ---
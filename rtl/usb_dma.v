@@ -0,0 +1,440 @@
+/*
+ * usb_dma.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+
+module usb_dma #(
+	parameter integer EPAW = 9,		// EP buffer address width (32 bits words)
+	parameter integer WAW  = 30,	// System bus address width (32 bits words)
+	parameter integer SLOTS = 0		// BD triggered copy slots (0 to 4)
+)(
+	// EP buffer interface - CPU side (pass-through when DMA is idle)
+	//  While 'cpu_stall' is asserted, the CPU accesses are not performed
+	//  and must be held (i.e. don't ack the bus cycle) until it's released
+	input  wire [EPAW-1:0] cpu_tx_addr_0,
+	input  wire [    31:0] cpu_tx_data_0,
+	input  wire            cpu_tx_we_0,
+
+	input  wire [EPAW-1:0] cpu_rx_addr_0,
+	output wire [    31:0] cpu_rx_data_1,
+	input  wire            cpu_rx_re_0,
+
+	output wire            cpu_stall,
+
+	// EP buffer interface - Core side (to `usb` with EPDW=32)
+	output wire [EPAW-1:0] ep_tx_addr_0,
+	output wire [    31:0] ep_tx_data_0,
+	output wire            ep_tx_we_0,
+
+	output wire [EPAW-1:0] ep_rx_addr_0,
+	input  wire [    31:0] ep_rx_data_1,
+	output wire            ep_rx_re_0,
+
+	// BD completion trigger (from `usb`)
+	input  wire       trig_stb,
+	input  wire [5:0] trig_bd,		// { EP, dir, BD }
+
+	// Control bus interface
+	input  wire [ 4:0] wb_addr,
+	output reg  [31:0] wb_rdata,
+	input  wire [31:0] wb_wdata,
+	input  wire        wb_we,
+	input  wire        wb_cyc,
+	output reg         wb_ack,
+
+	// System bus master interface
+	output wire [WAW-1:0] wbm_addr,
+	input  wire [   31:0] wbm_rdata,
+	output wire [   31:0] wbm_wdata,
+	output wire [    3:0] wbm_wmsk,
+	output wire           wbm_we,
+	output wire           wbm_cyc,
+	input  wire           wbm_ack,
+
+	// Completion interrupt
+	output wire irq,
+
+	// Common
+	input  wire clk,
+	input  wire rst
+);
+
+	// Signals
+	// -------
+
+	// FSM
+	localparam
+		ST_IDLE		= 0,
+		ST_BUF_RD	= 1,
+		ST_BUF_LAT	= 2,
+		ST_BUS		= 3,
+		ST_GAP		= 4;
+
+	reg  [2:0] state;
+	reg  [2:0] state_nxt;
+
+	// Config
+	reg  cfg_dir;		// 0 = Memory -> TX buffer, 1 = RX buffer -> Memory
+	reg  cfg_irq_ena;
+
+	// Manual copy
+	reg  [WAW-1:0] man_sys;
+	reg  [EPAW-1:0] man_buf;
+	reg  [EPAW:0] man_len;
+	reg  [EPAW:0] man_cnt;
+	reg  man_pend;
+	wire man_busy;
+	reg  done;
+
+	// Slots
+	localparam integer SN = (SLOTS > 0) ? SLOTS : 1;
+
+	reg  [SN-1:0] s_arm;		// Waiting for its BD to complete
+	reg  [SN-1:0] s_trig;		// Pending or being copied
+	reg  [SN-1:0] s_done;
+	reg  [5:0] s_bd[0:SN-1];		// { EP, dir, BD }
+	reg  [EPAW:0] s_len[0:SN-1];
+	reg  [WAW-1:0] s_sys[0:SN-1];
+	reg  [EPAW-1:0] s_buf[0:SN-1];
+	reg  slot_ie;
+
+	wire [SN-1:0] s_we_ctl;
+	wire [SN-1:0] s_we_sys;
+	wire [SN-1:0] s_we_buf;
+	wire [SN-1:0] s_hit;
+	wire [  31:0] s_rdata[0:SN];	// Read-out, OR-ed through the slots
+	wire [   3:0] s_trig4;
+	integer n;
+
+	// Transfer state
+	wire [1:0] go_sel;
+	wire go_man;
+	wire go_slot;
+	wire go_dir;
+	wire fin;
+
+	reg  cur_man;
+	reg  [1:0] cur_slot;
+	reg  cur_dir;
+
+	reg  [WAW-1:0] sys_addr;
+	reg  [EPAW-1:0] buf_addr;
+	reg  [EPAW:0] cnt;
+	wire cnt_last;
+
+	reg  [31:0] data;
+
+	reg  [EPAW-1:0] tx_addr;
+	reg  tx_we;
+
+	// Bus
+	wire bus_we_csr;
+	wire bus_we_sys;
+	wire bus_we_buf;
+	wire bus_we_sie;
+	wire start;
+
+
+	// Parameters check
+	// ----------------
+
+	generate
+		if ((SLOTS < 0) || (SLOTS > 4))
+			usb_dma_error_SLOTS_must_be_from_0_to_4 err_slots_I ();
+	endgenerate
+
+
+	// Control bus
+	// -----------
+
+	// Ack
+	always @(posedge clk)
+		wb_ack <= wb_cyc & ~wb_ack;
+
+	// Write strobes
+	assign bus_we_csr = wb_cyc & ~wb_ack & wb_we & (wb_addr == 5'h00);
+	assign bus_we_sys = wb_cyc & ~wb_ack & wb_we & (wb_addr == 5'h01);
+	assign bus_we_buf = wb_cyc & ~wb_ack & wb_we & (wb_addr == 5'h02);
+	assign bus_we_sie = wb_cyc & ~wb_ack & wb_we & (wb_addr == 5'h03);
+
+	// Slots are at 4 * (i + 1)
+	genvar i;
+
+	assign s_rdata[0] = 32'h00000000;
+
+	generate
+		for (i=0; i<SN; i=i+1)
+		begin : slot
+			wire sel = (i < SLOTS) & (wb_addr[4:2] == (i + 1));
+
+			assign s_we_ctl[i] = wb_cyc & ~wb_ack & wb_we & sel & (wb_addr[1:0] == 2'b00);
+			assign s_we_sys[i] = wb_cyc & ~wb_ack & wb_we & sel & (wb_addr[1:0] == 2'b01);
+			assign s_we_buf[i] = wb_cyc & ~wb_ack & wb_we & sel & (wb_addr[1:0] == 2'b10);
+
+			assign s_rdata[i+1] = s_rdata[i] | (~sel ? 32'h00000000 :
+				(wb_addr[1:0] == 2'b00) ? { s_arm[i], s_trig[i], 1'b0, s_done[i], 6'h00, s_bd[i], {(16-EPAW-1){1'b0}}, s_len[i] } :
+				(wb_addr[1:0] == 2'b01) ? { {(30-WAW){1'b0}}, s_sys[i], 2'b00 } :
+				(wb_addr[1:0] == 2'b10) ? { {(30-EPAW){1'b0}}, s_buf[i], 2'b00 } :
+				32'h00000000);
+
+			// Trigger match
+			assign s_hit[i] = trig_stb & s_arm[i] & (trig_bd == s_bd[i]);
+		end
+	endgenerate
+
+	assign start = bus_we_csr & wb_wdata[31] & ~man_busy;
+
+	// Read mux
+	always @(posedge clk)
+		if (~wb_cyc | wb_ack | wb_we)
+			wb_rdata <= 32'h00000000;
+		else
+			case (wb_addr)
+				5'h00:   wb_rdata <= { man_busy, cfg_dir, cfg_irq_ena, done, 12'h000, {(15-EPAW){1'b0}}, man_cnt };
+				5'h01:   wb_rdata <= { {(30-WAW){1'b0}}, man_sys, 2'b00 };
+				5'h02:   wb_rdata <= { {(30-EPAW){1'b0}}, man_buf, 2'b00 };
+				5'h03:   wb_rdata <= { slot_ie, {(31-SN){1'b0}}, s_done };
+				default: wb_rdata <= s_rdata[SN];
+			endcase
+
+	// Config
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			cfg_dir     <= 1'b0;
+			cfg_irq_ena <= 1'b0;
+		end else if (bus_we_csr & ~man_busy) begin
+			cfg_dir     <= wb_wdata[30];
+			cfg_irq_ena <= wb_wdata[29];
+		end
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			slot_ie <= 1'b0;
+		else if (bus_we_sie)
+			slot_ie <= wb_wdata[31];
+
+	// Completion flag
+	always @(posedge clk or posedge rst)
+		if (rst)
+			done <= 1'b0;
+		else
+			done <= (done & ~(bus_we_csr & wb_wdata[28]) & ~start) |
+				(fin & cur_man) |
+				(start & (wb_wdata[EPAW:0] == 0));
+
+	assign irq = (done & cfg_irq_ena) | (slot_ie & |s_done);
+
+
+	// Manual copy
+	// -----------
+
+	// Started copies wait for the slot copy in progress (if any)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			man_pend <= 1'b0;
+		else
+			man_pend <= (man_pend & ~go_man) | (start & (wb_wdata[EPAW:0] != 0));
+
+	assign man_busy = man_pend | ((state != ST_IDLE) & cur_man);
+
+	// Addresses & Counter (read back the copy progress)
+	always @(posedge clk)
+		if (~man_busy) begin
+			if (bus_we_sys)
+				man_sys <= wb_wdata[WAW+1:2];
+			if (bus_we_buf)
+				man_buf <= wb_wdata[EPAW+1:2];
+		end else if (cur_man & (state == ST_BUS) & wbm_ack) begin
+			man_sys <= man_sys + 1;
+			man_buf <= man_buf + 1;
+		end
+
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			man_len <= 0;
+			man_cnt <= 0;
+		end else if (start) begin
+			man_len <= wb_wdata[EPAW:0];
+			man_cnt <= wb_wdata[EPAW:0];
+		end else if (cur_man & (state == ST_BUS) & wbm_ack)
+			man_cnt <= man_cnt - 1;
+
+
+	// BD triggered slots
+	// ------------------
+
+	// State : armed -> triggered (BD completion or request) -> done
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			s_arm  <= 0;
+			s_trig <= 0;
+			s_done <= 0;
+		end else begin
+			for (n=0; n<SLOTS; n=n+1)
+			begin
+				if (fin & ~cur_man & (cur_slot == n)) begin
+					s_trig[n] <= 1'b0;
+				end else if (s_we_ctl[n] & ~s_trig[n]) begin
+					s_arm[n]  <= wb_wdata[31] & ~wb_wdata[30];
+					s_trig[n] <= wb_wdata[30] & (wb_wdata[EPAW:0] != 0);
+				end else if (s_hit[n]) begin
+					s_arm[n]  <= 1'b0;
+					s_trig[n] <= (s_len[n] != 0);
+				end
+
+				s_done[n] <= (s_done[n] & ~(s_we_ctl[n] & wb_wdata[28])) |
+					(fin & ~cur_man & (cur_slot == n)) |
+					(s_we_ctl[n] & ~s_trig[n] & wb_wdata[30] & (wb_wdata[EPAW:0] == 0)) |
+					(s_hit[n] & ~(s_we_ctl[n] & ~s_trig[n]) & (s_len[n] == 0));
+			end
+		end
+
+	// Config (addresses only while neither armed nor triggered)
+	always @(posedge clk)
+		for (n=0; n<SLOTS; n=n+1)
+		begin
+			if (s_we_ctl[n] & ~s_trig[n]) begin
+				s_bd[n]  <= wb_wdata[21:16];
+				s_len[n] <= wb_wdata[EPAW:0];
+			end
+			if (s_we_sys[n] & ~s_arm[n] & ~s_trig[n])
+				s_sys[n] <= wb_wdata[WAW+1:2];
+			if (s_we_buf[n] & ~s_arm[n] & ~s_trig[n])
+				s_buf[n] <= wb_wdata[EPAW+1:2];
+		end
+
+
+	// Scheduling
+	// ----------
+
+	// Manual copy first, then lowest triggered slot
+	assign s_trig4 = s_trig;
+	assign go_sel  = s_trig4[0] ? 2'd0 : (s_trig4[1] ? 2'd1 : (s_trig4[2] ? 2'd2 : 2'd3));
+
+	assign go_man  = (state == ST_IDLE) & man_pend;
+	assign go_slot = (state == ST_IDLE) & ~man_pend & |s_trig;
+
+	// OUT BDs go from RX buffer to memory, IN ones the other way
+	assign go_dir = man_pend ? cfg_dir : ~s_bd[go_sel][1];
+
+	always @(posedge clk)
+		if (go_man | go_slot) begin
+			cur_man  <= go_man;
+			cur_slot <= go_sel;
+			cur_dir  <= go_dir;
+		end
+
+	assign fin = (state == ST_BUS) & wbm_ack & cnt_last;
+
+
+	// Transfer FSM
+	// ------------
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			state <= ST_IDLE;
+		else
+			state <= state_nxt;
+
+	always @(*)
+	begin
+		// Default is to stay put
+		state_nxt = state;
+
+		// Transitions
+		case (state)
+			ST_IDLE:
+				if (go_man | go_slot)
+					state_nxt = go_dir ? ST_BUF_RD : ST_BUS;
+
+			ST_BUF_RD:
+				state_nxt = ST_BUF_LAT;
+
+			ST_BUF_LAT:
+				state_nxt = ST_BUS;
+
+			ST_BUS:
+				if (wbm_ack)
+					state_nxt = cnt_last ? ST_IDLE : (cur_dir ? ST_BUF_RD : ST_GAP);
+
+			ST_GAP:
+				state_nxt = ST_BUS;
+		endcase
+	end
+
+	// Addresses & Counter
+	always @(posedge clk)
+		if (go_man) begin
+			sys_addr <= man_sys;
+			buf_addr <= man_buf;
+		end else if (go_slot) begin
+			sys_addr <= s_sys[go_sel];
+			buf_addr <= s_buf[go_sel];
+		end else if ((state == ST_BUS) & wbm_ack) begin
+			sys_addr <= sys_addr + 1;
+			buf_addr <= buf_addr + 1;
+		end
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			cnt <= 0;
+		else if (go_man)
+			cnt <= man_len;
+		else if (go_slot)
+			cnt <= s_len[go_sel];
+		else if ((state == ST_BUS) & wbm_ack)
+			cnt <= cnt - 1;
+
+	assign cnt_last = (cnt == 1);
+
+	// Data register
+	always @(posedge clk)
+		if (state == ST_BUF_LAT)
+			data <= ep_rx_data_1;
+		else if ((state == ST_BUS) & wbm_ack & ~cur_dir)
+			data <= wbm_rdata;
+
+
+	// System bus master
+	// -----------------
+
+	assign wbm_addr  = sys_addr;
+	assign wbm_wdata = data;
+	assign wbm_wmsk  = 4'h0;
+	assign wbm_we    = cur_dir;
+	assign wbm_cyc   = (state == ST_BUS);
+
+
+	// EP buffers
+	// ----------
+
+	// TX write (Memory -> TX buffer)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			tx_we <= 1'b0;
+		else
+			tx_we <= (state == ST_BUS) & wbm_ack & ~cur_dir;
+
+	always @(posedge clk)
+		tx_addr <= buf_addr;
+
+	assign ep_tx_addr_0 = tx_we ? tx_addr : cpu_tx_addr_0;
+	assign ep_tx_data_0 = tx_we ? data    : cpu_tx_data_0;
+	assign ep_tx_we_0   = tx_we | (cpu_tx_we_0 & ~cpu_stall);
+
+	// RX read (RX buffer -> Memory)
+	assign ep_rx_addr_0 = (state == ST_IDLE) ? cpu_rx_addr_0 : buf_addr;
+	assign ep_rx_re_0   = (state == ST_IDLE) ? cpu_rx_re_0   : (state == ST_BUF_RD);
+
+	assign cpu_rx_data_1 = ep_rx_data_1;
+
+	// CPU stall: busy, or last TX word still being written after going idle
+	assign cpu_stall = (state != ST_IDLE) | tx_we;
+
+endmodule // usb_dma
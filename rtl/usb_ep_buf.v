@@ -182,89 +182,142 @@ module usb_ep_buf #(
 
 	genvar i;
 	generate
-		// Map address lines for various modes
-		assign ram_raddr[7:0] = rd_addr_0[ARW-1:ARW-8];
-		assign ram_waddr[7:0] = wr_addr_0[AWW-1:AWW-8];
-
-		if (READ_MODE == 3)
-			assign ram_raddr[10:8] = { rd_addr_0[0], rd_addr_0[1], rd_addr_0[2] };
-		else if (READ_MODE == 2)
-			assign ram_raddr[10:8] = { 1'b0, rd_addr_0[0], rd_addr_0[1] };
-		else if (READ_MODE == 1)
-			assign ram_raddr[10:8] = { 2'b00, rd_addr_0[0] };
-		else
-			assign ram_raddr[10:8] = { 3'b000 };
-
-		if (WRITE_MODE == 3)
-			assign ram_waddr[10:8] = { wr_addr_0[0], wr_addr_0[1], wr_addr_0[2] };
-		else if (WRITE_MODE == 2)
-			assign ram_waddr[10:8] = { 1'b0, wr_addr_0[0], wr_addr_0[1] };
-		else if (WRITE_MODE == 1)
-			assign ram_waddr[10:8] = { 2'b00, wr_addr_0[0] };
-		else
-			assign ram_waddr[10:8] = { 3'b000 };
-
-		// Shuffle the bits
-		if (READ_MODE == 0)
-			assign rd_data_1 = ram_rd_shuffle_64(rd_data_1_ram);
-		else if (READ_MODE == 1)
-			assign rd_data_1 = ram_rd_shuffle_32(rd_data_1_ram);
-		else if (READ_MODE == 2)
-			assign rd_data_1 = ram_rd_shuffle_16(rd_data_1_ram);
-		else
-			assign rd_data_1 = rd_data_1_ram;
-
-		if (WRITE_MODE == 0)
-			assign wr_data_0_ram = ram_wr_shuffle_64(wr_data_0);
-		else if (WRITE_MODE == 1)
-			assign wr_data_0_ram = ram_wr_shuffle_32(wr_data_0);
-		else if (WRITE_MODE == 2)
-			assign wr_data_0_ram = ram_wr_shuffle_16(wr_data_0);
-		else
-			assign wr_data_0_ram = wr_data_0;
-
-		// 4 blocks
-		for (i=0; i<4; i=i+1)
-		begin : block
-			wire [15:0] ram_rdata;
-			wire [15:0] ram_wdata;
-
-			// Block
-			SB_RAM40_4K #(
-				.WRITE_MODE(WRITE_MODE),
-				.READ_MODE(READ_MODE)
-			) ram_I (
-				.RDATA(ram_rdata),
-				.RCLK(rd_clk),
-				.RCLKE(rd_en_0),
-				.RE(1'b1),
-				.RADDR(ram_raddr),
-				.WCLK(wr_clk),
-				.WCLKE(wr_en_0),
-				.WE(1'b1),
-				.WADDR(ram_waddr),
-				.MASK(16'h0000),
-				.WDATA(ram_wdata)
-			);
-
-			// Map the right bits
+		if (TARGET == "ICE40") begin
+			// Map address lines for various modes
+			assign ram_raddr[7:0] = rd_addr_0[ARW-1:ARW-8];
+			assign ram_waddr[7:0] = wr_addr_0[AWW-1:AWW-8];
+
 			if (READ_MODE == 3)
-				assign rd_data_1_ram[i*2+:2] = ram_rd_map2(ram_rdata);
+				assign ram_raddr[10:8] = { rd_addr_0[0], rd_addr_0[1], rd_addr_0[2] };
 			else if (READ_MODE == 2)
-				assign rd_data_1_ram[i*4+:4] = ram_rd_map4(ram_rdata);
+				assign ram_raddr[10:8] = { 1'b0, rd_addr_0[0], rd_addr_0[1] };
 			else if (READ_MODE == 1)
-				assign rd_data_1_ram[i*8+:8] = ram_rd_map8(ram_rdata);
+				assign ram_raddr[10:8] = { 2'b00, rd_addr_0[0] };
 			else
-				assign rd_data_1_ram[i*16+:16] = ram_rdata;
+				assign ram_raddr[10:8] = { 3'b000 };
 
 			if (WRITE_MODE == 3)
-				assign ram_wdata = ram_wr_map2(wr_data_0_ram[i*2+:2]);
+				assign ram_waddr[10:8] = { wr_addr_0[0], wr_addr_0[1], wr_addr_0[2] };
 			else if (WRITE_MODE == 2)
-				assign ram_wdata = ram_wr_map4(wr_data_0_ram[i*4+:4]);
+				assign ram_waddr[10:8] = { 1'b0, wr_addr_0[0], wr_addr_0[1] };
+			else if (WRITE_MODE == 1)
+				assign ram_waddr[10:8] = { 2'b00, wr_addr_0[0] };
+			else
+				assign ram_waddr[10:8] = { 3'b000 };
+
+			// Shuffle the bits
+			if (READ_MODE == 0)
+				assign rd_data_1 = ram_rd_shuffle_64(rd_data_1_ram);
+			else if (READ_MODE == 1)
+				assign rd_data_1 = ram_rd_shuffle_32(rd_data_1_ram);
+			else if (READ_MODE == 2)
+				assign rd_data_1 = ram_rd_shuffle_16(rd_data_1_ram);
+			else
+				assign rd_data_1 = rd_data_1_ram;
+
+			if (WRITE_MODE == 0)
+				assign wr_data_0_ram = ram_wr_shuffle_64(wr_data_0);
 			else if (WRITE_MODE == 1)
-				assign ram_wdata = ram_wr_map8(wr_data_0_ram[i*8+:8]);
+				assign wr_data_0_ram = ram_wr_shuffle_32(wr_data_0);
+			else if (WRITE_MODE == 2)
+				assign wr_data_0_ram = ram_wr_shuffle_16(wr_data_0);
 			else
-				assign ram_wdata = wr_data_0_ram[i*16+:16];
+				assign wr_data_0_ram = wr_data_0;
+
+			// 4 blocks
+			for (i=0; i<4; i=i+1)
+			begin : block
+				wire [15:0] ram_rdata;
+				wire [15:0] ram_wdata;
+
+				// Block
+				SB_RAM40_4K #(
+					.WRITE_MODE(WRITE_MODE),
+					.READ_MODE(READ_MODE)
+				) ram_I (
+					.RDATA(ram_rdata),
+					.RCLK(rd_clk),
+					.RCLKE(rd_en_0),
+					.RE(1'b1),
+					.RADDR(ram_raddr),
+					.WCLK(wr_clk),
+					.WCLKE(wr_en_0),
+					.WE(1'b1),
+					.WADDR(ram_waddr),
+					.MASK(16'h0000),
+					.WDATA(ram_wdata)
+				);
+
+				// Map the right bits
+				if (READ_MODE == 3)
+					assign rd_data_1_ram[i*2+:2] = ram_rd_map2(ram_rdata);
+				else if (READ_MODE == 2)
+					assign rd_data_1_ram[i*4+:4] = ram_rd_map4(ram_rdata);
+				else if (READ_MODE == 1)
+					assign rd_data_1_ram[i*8+:8] = ram_rd_map8(ram_rdata);
+				else
+					assign rd_data_1_ram[i*16+:16] = ram_rdata;
+
+				if (WRITE_MODE == 3)
+					assign ram_wdata = ram_wr_map2(wr_data_0_ram[i*2+:2]);
+				else if (WRITE_MODE == 2)
+					assign ram_wdata = ram_wr_map4(wr_data_0_ram[i*4+:4]);
+				else if (WRITE_MODE == 1)
+					assign ram_wdata = ram_wr_map8(wr_data_0_ram[i*8+:8]);
+				else
+					assign ram_wdata = wr_data_0_ram[i*16+:16];
+			end
+
+		end else begin
+			// Generic inferred RAM
+			// --------------------
+
+			// Storage is organized with words of the wider port. The narrow
+			// port accesses one lane of the word (little endian ordering)
+			localparam integer DW  = (RWIDTH > WWIDTH) ? RWIDTH : WWIDTH;
+			localparam integer DAW = AWIDTH - $clog2(DW / 8);
+			localparam integer RLW = $clog2(DW / RWIDTH);
+			localparam integer WLW = $clog2(DW / WWIDTH);
+
+			reg  [DW-1:0] mem [0:(1<<DAW)-1];
+			reg  [DW-1:0] rd_word_1;
+
+			// Write port
+			if (WWIDTH == DW) begin
+				always @(posedge wr_clk)
+					if (wr_en_0)
+						mem[wr_addr_0] <= wr_data_0;
+			end else begin
+				// Single process with per-lane enables so it's inferred as
+				// one RAM with byte enables
+				integer l;
+
+				always @(posedge wr_clk)
+					if (wr_en_0)
+						for (l=0; l<(DW/WWIDTH); l=l+1)
+							if (wr_addr_0[WLW-1:0] == l)
+								mem[wr_addr_0[AWW-1:WLW]][l*WWIDTH+:WWIDTH] <= wr_data_0;
+			end
+
+			// Read port
+			if (RWIDTH == DW) begin
+				always @(posedge rd_clk)
+					if (rd_en_0)
+						rd_word_1 <= mem[rd_addr_0];
+
+				assign rd_data_1 = rd_word_1;
+			end else begin
+				reg [RLW-1:0] rd_lane_1;
+
+				always @(posedge rd_clk)
+					if (rd_en_0) begin
+						rd_word_1 <= mem[rd_addr_0[ARW-1:RLW]];
+						rd_lane_1 <= rd_addr_0[RLW-1:0];
+					end
+
+				assign rd_data_1 = rd_word_1[rd_lane_1*RWIDTH+:RWIDTH];
+			end
+
 		end
 	endgenerate
 
@@ -9,22 +9,27 @@
 
 `default_nettype none
 
-module usb_ep_status (
+module usb_ep_status #(
+	parameter         TARGET = "ICE40",
+	parameter integer AW = 8,	// 8 = EP status only, 9 = with BD pool
+	parameter integer TDP = 0	// True dual-port RAM (not on iCE40)
+)(
 	// Priority port
-	input  wire [ 7:0] p_addr_0,
+	input  wire [AW-1:0] p_addr_0,
 	input  wire        p_read_0,
 	input  wire        p_zero_0,
 	input  wire        p_write_0,
 	input  wire [15:0] p_din_0,
 	output reg  [15:0] p_dout_3,
 
-	// Aux R/W port
-	input  wire [ 7:0] s_addr_0,
+	// Aux R/W port (1 cycle read latency in TDP mode, only stalled by
+	// priority port accesses to the same word)
+	input  wire [AW-1:0] s_addr_0,
 	input  wire        s_read_0,
 	input  wire        s_zero_0,
 	input  wire        s_write_0,
 	input  wire [15:0] s_din_0,
-	output reg  [15:0] s_dout_3,
+	output wire [15:0] s_dout_3,
 	output wire        s_ready_0,
 
 	// Clock / Reset
@@ -33,7 +38,7 @@ module usb_ep_status (
 );
 	// Signals
 	wire s_ready_0_i;
-	reg  [ 7:0] addr_1;
+	reg  [AW-1:0] addr_1;
 	reg  [15:0] din_1;
 	reg  we_1;
 	reg  p_read_1;
@@ -42,14 +47,19 @@ module usb_ep_status (
 	reg  s_zero_1;
 
 	wire [15:0] dout_2;
+	reg  [15:0] dout_2_i;
 	reg  p_read_2;
 	reg  p_zero_2;
 	reg  s_read_2;
 	reg  s_zero_2;
+	reg  [15:0] s_dout_3_i;
 
-	// "Arbitration"
-	assign s_ready_0_i = ~p_read_0 & ~p_write_0;
-	assign s_ready_0 = s_ready_0_i;
+	// "Arbitration" (aux port has its own RAM port in TDP mode and only
+	// waits when the priority port writes the same word in stage 1, or
+	// reads it while the aux port writes it)
+	assign s_ready_0_i = ~p_read_0 & ~p_write_0 & (TDP == 0);
+	assign s_ready_0 = (TDP == 0) ? s_ready_0_i :
+		~((addr_1 == s_addr_0) & (we_1 | (p_read_1 & s_write_0)));
 
 	// Stage 1 : Address mux and Write delay
 	always @(posedge clk)
@@ -79,27 +89,130 @@ module usb_ep_status (
 
 	always @(posedge clk)
 		if (s_read_2)
-			s_dout_3 <= s_zero_2 ? 16'h0000 : dout_2;
+			s_dout_3_i <= s_zero_2 ? 16'h0000 : dout_2;
+
+	// RAM elements
+	genvar i;
+	generate
+		if (TARGET != "ICE40") begin
+			// Generic inferred RAM
+			reg [15:0] mem [0:(1<<AW)-1];
 
-	// RAM element
-	SB_RAM40_4K #(
 `ifdef SIM
-		.INIT_FILE("usb_ep_status.hex"),
+			integer k;
+
+			initial begin
+				for (k=0; k<(1<<AW); k=k+1)
+					mem[k] = 16'h0000;
+				$readmemh("usb_ep_status.hex", mem, 0, 255);
+			end
 `endif
-		.WRITE_MODE(0),
-		.READ_MODE(0)
-	) ebr_I (
-		.RDATA(dout_2),
-		.RADDR({3'b000, addr_1}),
-		.RCLK(clk),
-		.RCLKE(1'b1),
-		.RE(1'b1),
-		.WDATA(din_1),
-		.WADDR({3'b000, addr_1}),
-		.MASK(16'h0000),
-		.WCLK(clk),
-		.WCLKE(we_1),
-		.WE(1'b1)
-	);
+
+			always @(posedge clk)
+			begin
+				if (we_1)
+					mem[addr_1] <= din_1;
+				dout_2_i <= mem[addr_1];
+			end
+
+			assign dout_2 = dout_2_i;
+
+			if (TDP) begin
+				// Second port directly for the aux side, no pipeline.
+				// Colliding accesses are stalled (s_ready_0 low) : the
+				// priority port always wins.
+				reg [15:0] s_dout_1;
+				reg        s_read_1_tdp;
+				reg        s_zero_1_tdp;
+				reg [15:0] s_dout_hold;
+
+				always @(posedge clk)
+				begin
+					if (s_write_0 & s_ready_0)
+						mem[s_addr_0] <= s_din_0;
+					s_dout_1 <= mem[s_addr_0];
+				end
+
+				always @(posedge clk)
+				begin
+					s_read_1_tdp <= s_read_0 & s_ready_0;
+					s_zero_1_tdp <= s_zero_0;
+				end
+
+				// Hold the last read until the next one, like the
+				// pipelined path does
+				always @(posedge clk)
+					if (s_read_1_tdp)
+						s_dout_hold <= s_zero_1_tdp ? 16'h0000 : s_dout_1;
+
+				assign s_dout_3 = s_read_1_tdp ?
+					(s_zero_1_tdp ? 16'h0000 : s_dout_1) :
+					s_dout_hold;
+			end else begin
+				assign s_dout_3 = s_dout_3_i;
+			end
+
+		end else if (AW == 8) begin
+			// Single block
+			SB_RAM40_4K #(
+`ifdef SIM
+				.INIT_FILE("usb_ep_status.hex"),
+`endif
+				.WRITE_MODE(0),
+				.READ_MODE(0)
+			) ebr_I (
+				.RDATA(dout_2),
+				.RADDR({3'b000, addr_1}),
+				.RCLK(clk),
+				.RCLKE(1'b1),
+				.RE(1'b1),
+				.WDATA(din_1),
+				.WADDR({3'b000, addr_1}),
+				.MASK(16'h0000),
+				.WCLK(clk),
+				.WCLKE(we_1),
+				.WE(1'b1)
+			);
+
+			assign s_dout_3 = s_dout_3_i;
+
+		end else begin
+			// Multiple 256x16 blocks, selected by the address MSBs
+			localparam integer NB = 1 << (AW - 8);
+
+			wire [15:0] dout_blk[0:NB-1];
+			reg  [AW-9:0] bsel_2;
+
+			always @(posedge clk)
+				bsel_2 <= addr_1[AW-1:8];
+
+			assign dout_2 = dout_blk[bsel_2];
+
+			for (i=0; i<NB; i=i+1)
+			begin : blk
+				SB_RAM40_4K #(
+`ifdef SIM
+					.INIT_FILE(i == 0 ? "usb_ep_status.hex" : ""),
+`endif
+					.WRITE_MODE(0),
+					.READ_MODE(0)
+				) ebr_I (
+					.RDATA(dout_blk[i]),
+					.RADDR({3'b000, addr_1[7:0]}),
+					.RCLK(clk),
+					.RCLKE(1'b1),
+					.RE(1'b1),
+					.WDATA(din_1),
+					.WADDR({3'b000, addr_1[7:0]}),
+					.MASK(16'h0000),
+					.WCLK(clk),
+					.WCLKE(we_1 & (addr_1[AW-1:8] == i)),
+					.WE(1'b1)
+				);
+			end
+
+			assign s_dout_3 = s_dout_3_i;
+		end
+	endgenerate
 
 endmodule // usb_ep_status
@@ -74,6 +74,30 @@ module usb_phy #(
 				.D_IN_1(rx_dn_i[1])
 			);
 
+		end else begin
+			// Generic tri-state pads with registered IOs. Without DDR
+			// inputs, both 'half-cycle' samples are the same
+			reg  tx_dp_r;
+			reg  tx_dn_r;
+			reg  tx_en_r;
+			reg  rx_dp_r;
+			reg  rx_dn_r;
+
+			always @(posedge clk)
+			begin
+				tx_dp_r <= tx_dp;
+				tx_dn_r <= tx_dn;
+				tx_en_r <= tx_en;
+				rx_dp_r <= pad_dp;
+				rx_dn_r <= pad_dn;
+			end
+
+			assign pad_dp = tx_en_r ? tx_dp_r : 1'bz;
+			assign pad_dn = tx_en_r ? tx_dn_r : 1'bz;
+
+			assign rx_dp_i = { rx_dp_r, rx_dp_r };
+			assign rx_dn_i = { rx_dn_r, rx_dn_r };
+
 		end
 	endgenerate
 
@@ -9,7 +9,9 @@
 
 `default_nettype none
 
-module usb_rx_ll (
+module usb_rx_ll #(
+	parameter integer OSR = 4	// Clock cycles per bit (i.e. clk / 12 MHz)
+)(
 	// PHY
 	input  wire phy_rx_dp,
 	input  wire phy_rx_dn,
@@ -35,7 +37,7 @@ module usb_rx_ll (
 	// Sampling
 	reg        samp_active;
 	(* keep="true" *) wire samp_sync;
-	reg  [2:0] samp_cnt;
+	wire       samp_now;
 	wire [1:0] samp_sym_0;
 	reg        samp_valid_0;
 
@@ -70,32 +72,71 @@ module usb_rx_ll (
 		else
 			samp_active <= (samp_active | phy_rx_chg) & ~(dec_valid_1 & (dec_eop_1 | dec_bs_err_1));
 
-	// When to resync
-	assign samp_sync = ~samp_active | (~samp_cnt[2] && phy_rx_chg);
+	generate
+		if (OSR == 4) begin
+			// Hand optimized version for 48 MHz
+			reg  [2:0] samp_cnt;
+
+			// When to resync
+			assign samp_sync = ~samp_active | (~samp_cnt[2] && phy_rx_chg);
+
+			// Sampling phase tracking
+			always @(posedge clk)
+				if (samp_sync)
+					samp_cnt <= 3'b101;
+				else
+					/* The following case implements :
+					 * samp_cnt <= (samp_cnt - 1) & { samp_cnt[2], 2'b11 };
+					 * but in a way that synthesis understands well */
+					case (samp_cnt)
+						3'b000:  samp_cnt <= 3'b011;
+						3'b001:  samp_cnt <= 3'b000;
+						3'b010:  samp_cnt <= 3'b001;
+						3'b011:  samp_cnt <= 3'b010;
+						3'b100:  samp_cnt <= 3'b011;
+						3'b101:  samp_cnt <= 3'b100;
+						3'b110:  samp_cnt <= 3'b101;
+						3'b111:  samp_cnt <= 3'b110;
+						default: samp_cnt <= 3'bxxx;
+					endcase
+
+			assign samp_now = (samp_cnt[1:0] == 2'b01);
+
+		end else begin
+			// Generic version for any oversampling ratio >= 3
+			//  - Sample 1/4 bit after the (filtered) edge, like the 4x version
+			//  - Ignore edges for 1/2 bit after a resync
+			localparam integer CW       = $clog2(OSR);
+			localparam integer SAMP_OFS = (OSR >= 8) ? (OSR / 4) : 1;
+			localparam integer HOLD     = OSR / 2;
+
+			reg  [CW-1:0] samp_cnt;
+			reg  [CW-1:0] samp_hold;
+
+			// When to resync
+			assign samp_sync = ~samp_active | ((samp_hold == 0) && phy_rx_chg);
+
+			// Sampling phase tracking
+			always @(posedge clk)
+				if (samp_sync)
+					samp_cnt <= SAMP_OFS - 1;
+				else
+					samp_cnt <= (samp_cnt == 0) ? (OSR - 1) : (samp_cnt - 1);
+
+			always @(posedge clk)
+				if (samp_sync)
+					samp_hold <= HOLD;
+				else
+					samp_hold <= samp_hold - (samp_hold != 0);
+
+			assign samp_now = (samp_cnt == 0);
 
-	// Sampling phase tracking
-	always @(posedge clk)
-		if (samp_sync)
-			samp_cnt <= 3'b101;
-		else
-			/* The following case implements :
-			 * samp_cnt <= (samp_cnt - 1) & { samp_cnt[2], 2'b11 };
-			 * but in a way that synthesis understands well */
-			case (samp_cnt)
-				3'b000:  samp_cnt <= 3'b011;
-				3'b001:  samp_cnt <= 3'b000;
-				3'b010:  samp_cnt <= 3'b001;
-				3'b011:  samp_cnt <= 3'b010;
-				3'b100:  samp_cnt <= 3'b011;
-				3'b101:  samp_cnt <= 3'b100;
-				3'b110:  samp_cnt <= 3'b101;
-				3'b111:  samp_cnt <= 3'b110;
-				default: samp_cnt <= 3'bxxx;
-			endcase
+		end
+	endgenerate
 
 	// Output to next stage
 	always @(posedge clk)
-		samp_valid_0 <= samp_active & (samp_cnt[1:0] == 2'b01) & ~samp_valid_0;
+		samp_valid_0 <= samp_active & samp_now & ~samp_valid_0;
 
 	assign samp_sym_0 = { phy_rx_dp, phy_rx_dn };
 
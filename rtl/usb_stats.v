@@ -0,0 +1,204 @@
+/*
+ * usb_stats.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+
+module usb_stats (
+	// Events
+	input  wire evt_bs_err,		// Bit-stuffing error
+	input  wire evt_rx_err,		// Packet received with error (CRC, PID, ...)
+	input  wire evt_rx_to,		// Handshake / Data RX timeout
+	input  wire evt_tx_nak,		// NAK sent
+	input  wire evt_tx_stall,	// STALL sent
+	input  wire evt_no_ep,		// Token to a non-existent endpoint
+	input  wire [4:0] evt_ep,	// { EP, dir } of the current transaction
+
+	// Control
+	input  wire [15:0] ctl_wdata,
+	input  wire ctl_we,
+	output wire [15:0] ctl_rdata,
+	output wire [15:0] dat_rdata,
+
+	// Common
+	input  wire clk,
+	input  wire rst
+);
+
+	// Signals
+	// -------
+
+	// Control
+	reg  [5:0] sel;
+	reg  snap;
+	reg  fetch;
+	reg  fetch_clr;
+	reg  fetch_dly;
+
+	// Global counters
+	wire [  5:0] g_inc;
+	wire [127:0] g_snap;
+
+	// Per-EP NAK counters
+	reg  [15:0] nak_ram [0:31];
+	reg  [15:0] ram_rd;
+	wire [ 4:0] ram_ra;
+	wire        ram_re;
+	wire [ 4:0] ram_wa;
+	wire [15:0] ram_wd;
+	wire        ram_we;
+
+	reg         fwd;
+	reg  [15:0] fwd_data;
+	wire [15:0] ram_out;
+
+	reg         inc_pend;
+	reg  [ 4:0] inc_idx;
+	wire        inc_rd;
+	reg         inc_wr;
+	reg         clr_wr;
+
+	reg  [15:0] dat;
+
+	integer j;
+
+
+	// Control
+	// -------
+
+	// Selection register
+	always @(posedge clk or posedge rst)
+		if (rst)
+			sel <= 6'd0;
+		else if (ctl_we)
+			sel <= ctl_wdata[5:0];
+
+	// Strobes
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			snap      <= 1'b0;
+			fetch     <= 1'b0;
+			fetch_clr <= 1'b0;
+			fetch_dly <= 1'b0;
+		end else begin
+			snap      <= ctl_we & ctl_wdata[15];
+			fetch     <= ctl_we & ctl_wdata[5];
+			fetch_clr <= ctl_we & ctl_wdata[5] & ctl_wdata[14];
+			fetch_dly <= fetch;
+		end
+
+	assign ctl_rdata = { 10'h000, sel };
+
+
+	// Global counters
+	// ---------------
+
+	// Live counters saturate and are moved to the snapshot (and cleared)
+	// all at once, so a coherent set can be read at leisure.
+
+	assign g_inc = { evt_no_ep, evt_tx_stall, evt_tx_nak, evt_rx_to, evt_rx_err, evt_bs_err };
+
+	genvar i;
+	generate
+		for (i=0; i<6; i=i+1)
+		begin : gcnt
+			reg [15:0] live;
+			reg [15:0] snap_val;
+
+			always @(posedge clk or posedge rst)
+				if (rst) begin
+					live     <= 16'h0000;
+					snap_val <= 16'h0000;
+				end else if (snap) begin
+					live     <= { 15'h0000, g_inc[i] };
+					snap_val <= live;
+				end else begin
+					live     <= live + (g_inc[i] & ~&live);
+				end
+
+			assign g_snap[16*i+:16] = snap_val;
+		end
+	endgenerate
+
+	assign g_snap[127:96] = 32'h00000000;
+
+
+	// Per-EP NAK counters
+	// -------------------
+
+	// Single RAM, one read and one write port. The read port is used either
+	// by a bus fetch (priority, so the data is ready for the next access)
+	// or by the first half of an increment read-modify-write. A fetch with
+	// clear writes zero on the next cycle, before any other read can occur.
+	// Writes landing on the address being read are forwarded.
+
+	initial
+		for (j=0; j<32; j=j+1)
+			nak_ram[j] = 16'h0000;
+
+	// Pending increment (NAKs are at least a packet apart, one is enough)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			inc_pend <= 1'b0;
+		else
+			inc_pend <= (inc_pend & ~inc_rd) | evt_tx_nak;
+
+	always @(posedge clk)
+		if (evt_tx_nak)
+			inc_idx <= evt_ep;
+
+	assign inc_rd = inc_pend & ~fetch & ~clr_wr & ~inc_wr;
+
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			inc_wr <= 1'b0;
+			clr_wr <= 1'b0;
+		end else begin
+			inc_wr <= inc_rd;
+			clr_wr <= fetch_clr;
+		end
+
+	// RAM ports
+	assign ram_ra = fetch ? sel[4:0] : inc_idx;
+	assign ram_re = fetch | inc_rd;
+
+	assign ram_wa = clr_wr ? sel[4:0] : inc_idx;
+	assign ram_wd = clr_wr ? 16'h0000 : (ram_out + ~&ram_out);
+	assign ram_we = clr_wr | inc_wr;
+
+	always @(posedge clk)
+	begin
+		if (ram_we)
+			nak_ram[ram_wa] <= ram_wd;
+		if (ram_re)
+			ram_rd <= nak_ram[ram_ra];
+	end
+
+	// Forwarding
+	always @(posedge clk)
+		if (ram_re) begin
+			fwd      <= ram_we & (ram_wa == ram_ra);
+			fwd_data <= ram_wd;
+		end
+
+	assign ram_out = fwd ? fwd_data : ram_rd;
+
+	// Fetched value
+	always @(posedge clk)
+		if (fetch_dly)
+			dat <= ram_out;
+
+
+	// Data readout
+	// ------------
+
+	assign dat_rdata = sel[5] ?
+		(fetch_dly ? ram_out : dat) :
+		g_snap[16*sel[2:0]+:16];
+
+endmodule // usb_stats
@@ -0,0 +1,271 @@
+/*
+ * usb_trace.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+
+module usb_trace #(
+	parameter integer DEPTH = 64,	// Entries, power of 2, 4 to 256 (checked in usb.v)
+
+	/* Auto-set */
+	parameter integer EAW = $clog2(DEPTH)
+)(
+	// RX Packet
+	input  wire rxpkt_start,
+	input  wire rxpkt_done_ok,
+	input  wire rxpkt_done_err,
+	input  wire [ 3:0] rxpkt_pid,
+	input  wire rxpkt_is_sof,
+	input  wire rxpkt_is_token,
+	input  wire [10:0] rxpkt_token,
+	input  wire rxpkt_data_stb,
+
+	// TX Packet
+	input  wire txpkt_start,
+	input  wire txpkt_done,
+	input  wire [3:0] txpkt_pid,
+	input  wire [9:0] txpkt_len,
+
+	// Timestamp
+	input  wire [10:0] ts_frameno,
+	input  wire [15:0] ts_subcnt,
+
+	// Control
+	input  wire [15:0] bus_wdata,
+	input  wire ctl_we,
+	output wire [15:0] ctl_rdata,
+	input  wire flt_we,
+	output wire [15:0] flt_rdata,
+	output wire [15:0] dat_rdata,
+	input  wire dat_ack,
+
+	// Common
+	input  wire clk,
+	input  wire rst
+);
+
+	// Signals
+	// -------
+
+	// Config / Status
+	reg  cfg_ena;
+	reg  cfg_stop_err;
+	reg  cfg_ep_flt;
+	reg  [ 3:0] cfg_ep;
+	reg  [15:0] cfg_pid_msk;
+
+	reg  st_trig;
+	reg  st_ovf;
+	reg  [EAW-1:0] post_cnt;
+
+	wire clr;
+
+	// Packet tracking
+	reg  [9:0] rx_len;
+	reg  [3:0] tx_pid;
+	reg  [9:0] tx_len;
+	reg  ts_cap;
+	reg  [15:0] ts_sub;
+	reg  tok_match;
+
+	wire rec_done;
+	wire rec_err;
+	wire rec_tx;
+	wire [3:0] rec_pid;
+	wire rec_ep_ok;
+	wire rec_stb;
+
+	// Entry
+	reg  [63:0] ent;
+	reg  wr_busy;
+	reg  [1:0] wr_word;
+	wire wr_last;
+
+	// Ring
+	reg  [15:0] mem [0:(4*DEPTH)-1];
+	reg  [15:0] mem_rd;
+	reg  [EAW:0] wr_ent;
+	reg  [EAW:0] rd_ent;
+	reg  [1:0] rd_word;
+	wire [EAW:0] count;
+	wire full;
+	wire drop;
+	wire pop;
+
+
+	// Control
+	// -------
+
+	assign clr = ctl_we & bus_wdata[14];
+
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			cfg_stop_err <= 1'b0;
+			cfg_ep_flt   <= 1'b0;
+			cfg_ep       <= 4'h0;
+		end else if (ctl_we) begin
+			cfg_stop_err <= bus_wdata[13];
+			cfg_ep_flt   <= bus_wdata[12];
+			cfg_ep       <= bus_wdata[11:8];
+		end
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			cfg_pid_msk <= 16'hffdf;	/* All but SOF */
+		else if (flt_we)
+			cfg_pid_msk <= bus_wdata;
+
+	// Recording enable, cleared after the post-trigger entries
+	always @(posedge clk or posedge rst)
+		if (rst)
+			cfg_ena <= 1'b0;
+		else if (ctl_we)
+			cfg_ena <= bus_wdata[15];
+		else if (wr_busy & wr_last & st_trig & (post_cnt == 0))
+			cfg_ena <= 1'b0;
+
+	assign ctl_rdata = { cfg_ena, st_trig, st_ovf, {(12-EAW){1'b0}}, count };
+	assign flt_rdata = cfg_pid_msk;
+
+
+	// Packet tracking
+	// ---------------
+
+	// RX length (bytes after the PID, including CRC)
+	always @(posedge clk)
+		if (rxpkt_start)
+			rx_len <= 10'd0;
+		else if (rxpkt_data_stb & ~&rx_len)
+			rx_len <= rx_len + 1;
+
+	// TX infos, only valid at start
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_pid <= txpkt_pid;
+			tx_len <= (txpkt_pid[1:0] == 2'b11) ? (txpkt_len + 10'd2) : 10'd0;
+		end
+
+	// Timestamp, taken right after the start of packet so that a SOF
+	// gets a sub-frame count of 0
+	always @(posedge clk)
+	begin
+		ts_cap <= rxpkt_start | txpkt_start;
+		if (ts_cap)
+			ts_sub <= ts_subcnt;
+	end
+
+	// End of packet
+	assign rec_done = rxpkt_done_ok | rxpkt_done_err | txpkt_done;
+	assign rec_err  = rxpkt_done_err;
+	assign rec_tx   = txpkt_done;
+	assign rec_pid  = rec_tx ? tx_pid : rxpkt_pid;
+
+	// EP filter: tokens are matched directly, data and handshakes
+	// follow the last token, SOFs always pass
+	always @(posedge clk)
+		if (rxpkt_done_ok & rxpkt_is_token)
+			tok_match <= (rxpkt_token[10:7] == cfg_ep);
+
+	assign rec_ep_ok = ~cfg_ep_flt | (~rec_tx & rxpkt_is_sof) | (
+		(~rec_tx & rxpkt_is_token) ? (rxpkt_token[10:7] == cfg_ep) : tok_match
+	);
+
+	// Errors bypass the filters (PID can't be trusted anyway)
+	assign rec_stb = cfg_ena & rec_done & (rec_err | (cfg_pid_msk[rec_pid] & rec_ep_ok));
+
+	// Trigger (re-armed by any control write)
+	always @(posedge clk or posedge rst)
+		if (rst)
+			st_trig <= 1'b0;
+		else
+			st_trig <= (st_trig & ~ctl_we) | (rec_stb & rec_err & cfg_stop_err);
+
+	always @(posedge clk)
+		if (rec_stb & rec_err & cfg_stop_err & ~st_trig)
+			post_cnt <= DEPTH / 2;
+		else if (wr_busy & wr_last & (post_cnt != 0))
+			post_cnt <= post_cnt - 1;
+
+
+	// Entry write
+	// -----------
+
+	// Entry is latched and written one word per cycle, packets are
+	// way more than 4 cycles apart
+	always @(posedge clk)
+		if (rec_stb)
+			ent <= {
+				ts_sub,
+				5'd0, (~rec_tx & rxpkt_is_sof) ? rxpkt_token : ts_frameno,
+				5'd0, rec_tx ? 11'd0 : rxpkt_token,
+				rec_err, rec_tx, rec_pid, rec_tx ? tx_len : rx_len
+			};
+		else if (wr_busy)
+			ent <= { 16'h0000, ent[63:16] };
+
+	always @(posedge clk or posedge rst)
+		if (rst)
+			wr_busy <= 1'b0;
+		else
+			wr_busy <= (wr_busy & ~wr_last & ~clr) | rec_stb;
+
+	always @(posedge clk)
+		if (rec_stb)
+			wr_word <= 2'b00;
+		else if (wr_busy)
+			wr_word <= wr_word + 1;
+
+	assign wr_last = (wr_word == 2'b11);
+
+	always @(posedge clk)
+		if (wr_busy)
+			mem[{wr_ent[EAW-1:0], wr_word}] <= ent[15:0];
+
+
+	// Ring management
+	// ---------------
+
+	assign count = wr_ent - rd_ent;
+	assign full  = (count == DEPTH);
+
+	// When full, the oldest entry is dropped to make room
+	assign drop = rec_stb & full;
+	assign pop  = dat_ack & (count != 0);
+
+	always @(posedge clk or posedge rst)
+		if (rst) begin
+			wr_ent  <= 0;
+			rd_ent  <= 0;
+			rd_word <= 2'b00;
+			st_ovf  <= 1'b0;
+		end else if (clr) begin
+			wr_ent  <= 0;
+			rd_ent  <= 0;
+			rd_word <= 2'b00;
+			st_ovf  <= 1'b0;
+		end else begin
+			if (wr_busy & wr_last)
+				wr_ent <= wr_ent + 1;
+
+			if (drop) begin
+				rd_ent  <= rd_ent + 1;
+				rd_word <= 2'b00;
+				st_ovf  <= 1'b1;
+			end else if (pop) begin
+				rd_ent  <= rd_ent + (rd_word == 2'b11);
+				rd_word <= rd_word + 1;
+			end
+		end
+
+	// Readout, always prefetching the next word
+	always @(posedge clk)
+		mem_rd <= mem[{rd_ent[EAW-1:0], rd_word}];
+
+	assign dat_rdata = mem_rd;
+
+endmodule // usb_trace
@@ -10,7 +10,13 @@
 `default_nettype none
 
 module usb_trans #(
-	parameter integer ADDR_MATCH = 1
+	parameter         TARGET = "ICE40",
+	parameter integer ADDR_MATCH = 1,
+	parameter integer BD_RING = 0,		// 0 = disabled, 2/4/8 = BDs per ring
+	parameter integer XFER = 0,			// Multi-packet transfer BD support
+	parameter integer AUTO_REARM = 0,	// Auto-rearm OUT EP support
+	parameter integer NOTIFY_CTRL = 0,	// Per-EP notify masking / coalescing
+	parameter integer DESC = 0			// Hardware GET_DESCRIPTOR responder
 )(
 	// TX Packet interface
 	output wire txpkt_start,
@@ -53,21 +59,38 @@ module usb_trans #(
 	output wire eps_read_0,
 	output wire eps_zero_0,
 	output wire eps_write_0,
-	output wire [ 7:0] eps_addr_0,
+	output wire [ 8:0] eps_addr_0,
 	output wire [15:0] eps_wrdata_0,
 	input  wire [15:0] eps_rddata_3,
 
 	// Config / Status
 	input  wire cr_addr_chk,
 	input  wire [ 6:0] cr_addr,
+	input  wire [15:0] cr_rto,
+	input  wire cr_dsc_ena,
+	input  wire [ 1:0] cr_dsc_mps,
+	input  wire [10:0] cr_dsc_base,
 
 	output wire [11:0] evt_data,
 	output wire evt_stb,
+	output wire bd_done_stb,	// Successful BD completion (not filtered)
+
+	// Statistics
+	output wire stat_rx_to,
+	output wire stat_tx_nak,
+	output wire stat_tx_stall,
+	output wire stat_no_ep,
+	output wire [4:0] stat_ep,
 
 	output wire cel_state,
 	input  wire cel_rel,
 	input  wire cel_ena,
 
+	// Notify control counters reset
+	input  wire ntf_rst,		// All EPs (bus reset)
+	input  wire ntf_clr,		// Only 'ntf_clr_ep' (EP config write)
+	input  wire [4:0] ntf_clr_ep,
+
 	// Common
 	input  wire clk,
 	input  wire rst
@@ -75,6 +98,14 @@ module usb_trans #(
 
 	`include "usb_defs.vh"
 
+	localparam integer RING_LOG2 = (BD_RING > 1) ? $clog2(BD_RING) : 1;
+	localparam [2:0]   RING_MSK  = (1 << RING_LOG2) - 1;
+
+		// Only 128 / BD_RING slots exist in the pool, ignore the upper
+		// 'rslot' bits rather than wrapping into another EP's slot
+	localparam integer SLOT_W    = ((7 - RING_LOG2) < 5) ? (7 - RING_LOG2) : 5;
+	localparam [4:0]   SLOT_MSK  = (1 << SLOT_W) - 1;
+
 	// Signals
 	// -------
 
@@ -106,7 +137,7 @@ module usb_trans #(
 	reg  [3:0] pkt_pid;
 
 	wire rto_now;
-	reg  [9:0] rto_cnt;
+	reg  [17:0] rto_cnt;
 
 	// Transaction / EndPoint / Buffer infos
 	reg        trans_is_setup;
@@ -117,24 +148,62 @@ module usb_trans #(
 	reg  [2:0] ep_type;
 	reg        ep_bd_dual;
 	reg        ep_bd_ctrl;
-	reg        ep_bd_idx_cur;
-	reg        ep_bd_idx_nxt;
+	reg        ep_bd_ring;
+	reg  [4:0] ep_ring_slot;
+	reg  [2:0] ep_bd_idx_cur;
+	reg  [2:0] ep_bd_idx_nxt;
 	reg        ep_data_toggle;
+	reg        ep_auto;
+	reg        ep_ovw;
 
 	reg  [2:0] bd_state;
+	wire       bd_auto_arm;
+	reg        bd_ovr;
+
+	// Multi-packet transfer
+	reg  [9:0] ep_mps;
+	reg        xf_mode;
+	reg        xf_x;
+	reg        xf_zlp;
+	reg  [9:0] xf_len;
+	reg  [9:0] xf_plen;
+	reg [10:0] xf_ptr;
+	wire [9:0] xf_pkt_len;
+	wire [9:0] xf_done;
+	wire       xf_cont;
+	reg        xf_adv;
+
+	wire       xf_ena;
+	wire       xf_bd;
+
+	// Notify control
+	reg        ntf_mask;
+	reg        ntf_short;
+	reg  [2:0] ntf_div;
+	wire       ntf_ena;
 
 	// EP & BD Infos fetch/writeback
 	localparam
 		EPFW_IDLE		= 4'b0000,
 		EPFW_RD_STATUS	= 4'b0100,
+		EPFW_RD_CFG		= 4'b0101,
 		EPFW_RD_BD_W0	= 4'b0110,
 		EPFW_RD_BD_W1	= 4'b0111,
 		EPFW_WR_STATUS	= 4'b1000,
-		EPFW_WR_BD_W0	= 4'b1010;
+		EPFW_WR_BD_W0	= 4'b1010,
+		EPFW_WR_BD_W1	= 4'b1011;
 
 	reg  [3:0] epfw_state;
-	reg  [5:0] epfw_cap_dl;
+	wire [6:0] ring_bd_idx;
+	reg  [8:0] epfw_cap_dl;
 	reg  epfw_issue_wb;
+	wire [15:0] eps_rddata;
+
+	// Descriptor responder
+	wire dsc_hit;
+	wire dsc_ovr;
+	wire dsc_busy;
+	wire [10:0] dsc_raddr;
 
 	// Control Endpoint Lockout
 	reg  cel_state_i;
@@ -179,23 +248,40 @@ module usb_trans #(
 			mc_pc_nxt <= mc_pc + 1;
 
 	// Microcode ROM
-	SB_RAM40_4K #(
-		.INIT_FILE("usb_trans_mc.hex"),
-		.WRITE_MODE(0),
-		.READ_MODE(0)
-	) mc_rom_I (
-		.RDATA(mc_opcode),
-		.RADDR({3'b000, mc_pc}),
-		.RCLK(clk),
-		.RCLKE(1'b1),
-		.RE(1'b1),
-		.WDATA(16'h0000),
-		.WADDR(11'h000),
-		.MASK(16'h0000),
-		.WCLK(1'b0),
-		.WCLKE(1'b0),
-		.WE(1'b0)
-	);
+	generate
+		if (TARGET == "ICE40") begin
+			SB_RAM40_4K #(
+				.INIT_FILE("usb_trans_mc.hex"),
+				.WRITE_MODE(0),
+				.READ_MODE(0)
+			) mc_rom_I (
+				.RDATA(mc_opcode),
+				.RADDR({3'b000, mc_pc}),
+				.RCLK(clk),
+				.RCLKE(1'b1),
+				.RE(1'b1),
+				.WDATA(16'h0000),
+				.WADDR(11'h000),
+				.MASK(16'h0000),
+				.WCLK(1'b0),
+				.WCLKE(1'b0),
+				.WE(1'b0)
+			);
+
+		end else begin
+			// Generic inferred ROM
+			reg [15:0] mc_rom [0:255];
+			reg [15:0] mc_rom_data;
+
+			initial
+				$readmemh("usb_trans_mc.hex", mc_rom);
+
+			always @(posedge clk)
+				mc_rom_data <= mc_rom[mc_pc];
+
+			assign mc_opcode = mc_rom_data;
+		end
+	endgenerate
 
 	// Decode opcodes
 	assign mc_op_ld      = mc_opcode[15:12] == 4'b0001;
@@ -209,11 +295,12 @@ module usb_trans #(
 	// A-register
 	always @(posedge clk)
 		if (mc_op_ld)
-			casez (mc_opcode[2:1])
-				2'b00:   mc_a_reg <= evt;
-				2'b01:   mc_a_reg <= pkt_pid ^ { ep_data_toggle & mc_opcode[0], 3'b000 };
-				2'b10:   mc_a_reg <= { trans_cel, ep_type };
-				2'b11:   mc_a_reg <= { 1'b0, bd_state };
+			casez ({mc_opcode[3], mc_opcode[2:1]})
+				3'b000:  mc_a_reg <= evt;
+				3'b001:  mc_a_reg <= pkt_pid ^ { ep_data_toggle & mc_opcode[0], 3'b000 };
+				3'b010:  mc_a_reg <= { trans_cel, ep_type };
+				3'b011:  mc_a_reg <= { xf_cont, bd_state };
+				3'b1??:  mc_a_reg <= { 3'b000, dsc_hit };
 				default: mc_a_reg <= 4'hx;
 			endcase
 
@@ -246,34 +333,84 @@ module usb_trans #(
 	end
 
 	// RX Timeout counter
+	//  [17:16] 11 = armed (counting down, cancelled by a RX start)
+	//          10 = expired for one cycle (TIMEOUT event)
+	//          0x = idle
 	always @(posedge clk or posedge rst)
 		if (rst)
 			rto_cnt <= 0;
 		else
 			if (mc_op_evt_rto)
-				rto_cnt <= { 2'b01, mc_opcode[7:0] };
+				rto_cnt <= { 2'b11, mc_opcode[8] ? cr_rto : { 8'h00, mc_opcode[7:0] } };
 			else
 				rto_cnt <= {
-					rto_cnt[9] & rto_cnt[8] & ~rxpkt_start,
-					rto_cnt[8:0] - rto_cnt[9]
+					rto_cnt[17] & rto_cnt[16] & ~rxpkt_start,
+					rto_cnt[16:0] - rto_cnt[17]
 				};
 
-	assign rto_now = rto_cnt[9] & ~rto_cnt[8];
+	assign rto_now = rto_cnt[17] & ~rto_cnt[16];
 
 
 	// Host NOTIFY
 	// -----------
 
-	assign evt_stb = mc_op_notify;
+	assign evt_stb = mc_op_notify & ntf_ena & ~dsc_ovr;
+	assign bd_done_stb = mc_op_notify & (mc_opcode[3:0] == 4'h0) & ~trans_is_setup & ~dsc_ovr;
 	assign evt_data = {
 		mc_opcode[3:0], // [11:8] Micro-code return value
 		trans_endp,     // [ 7:4] Endpoint
 		trans_dir,      //    [3] Direction
 		trans_is_setup, //    [2] SETUP transaction
-		ep_bd_idx_cur,  //    [1] BD where it happenned
+		ep_bd_idx_cur[0],//   [1] BD where it happenned (LSB of 'ridx' in ring mode)
 		1'b0
 	};
 
+	// Per-EP filtering
+	generate
+		if (NOTIFY_CTRL) begin
+			reg  [2:0] ntf_cnt[0:31];
+			reg [31:0] ntf_vld;
+			wire [2:0] ntf_cnt_cur;
+			wire       ntf_pkt_short;
+			wire       ntf_cand;
+			wire       ntf_hit;
+
+			// SETUP and errors are always reported (unless masked)
+			// Successful ones can be limited to short packets / end of
+			// transfer and only reported every 'div+1' times
+			assign ntf_pkt_short = xf_mode | (xf_done < ep_mps);
+			assign ntf_cand = (mc_opcode[3:0] == 4'h0) & ~trans_is_setup & (~ntf_short | ntf_pkt_short);
+
+			// Counters read as zero until first used after a reset / EP
+			// reconfiguration, no need to clear the RAM itself
+			assign ntf_cnt_cur = ntf_vld[{trans_endp, trans_dir}] ? ntf_cnt[{trans_endp, trans_dir}] : 3'd0;
+			assign ntf_hit = (ntf_cnt_cur >= ntf_div);
+
+			always @(posedge clk)
+				if (mc_op_notify & ntf_cand)
+					ntf_cnt[{trans_endp, trans_dir}] <= ntf_hit ? 3'd0 : (ntf_cnt_cur + 1);
+
+			always @(posedge clk or posedge rst)
+				if (rst)
+					ntf_vld <= 32'h00000000;
+				else if (ntf_rst)
+					ntf_vld <= 32'h00000000;
+				else begin
+					if (mc_op_notify & ntf_cand)
+						ntf_vld[{trans_endp, trans_dir}] <= 1'b1;
+					if (ntf_clr)
+						ntf_vld[ntf_clr_ep] <= 1'b0;
+				end
+
+			assign ntf_ena = ~ntf_mask & (
+				~((mc_opcode[3:0] == 4'h0) & ~trans_is_setup) |
+				(ntf_cand & ntf_hit)
+			);
+		end else begin
+			assign ntf_ena = 1'b1;
+		end
+	endgenerate
+
 
 	// EP infos
 	// --------
@@ -300,12 +437,15 @@ module usb_trans #(
 						epfw_state <= EPFW_WR_STATUS;
 					else if (rxpkt_done_ok & rxpkt_is_token)
 						epfw_state <= EPFW_RD_STATUS;
-					else if (epfw_cap_dl[1:0] == 2'b01)
+					else if (epfw_cap_dl[2:0] == 3'b001)
 						epfw_state <= EPFW_RD_BD_W0;
 					else
 						epfw_state <= EPFW_IDLE;
 
 				EPFW_RD_STATUS:
+					epfw_state <= (XFER || AUTO_REARM || NOTIFY_CTRL || DESC) ? EPFW_RD_CFG : EPFW_IDLE;
+
+				EPFW_RD_CFG:
 					epfw_state <= EPFW_IDLE;
 
 				EPFW_RD_BD_W0:
@@ -318,6 +458,9 @@ module usb_trans #(
 					epfw_state <= EPFW_WR_BD_W0;
 
 				EPFW_WR_BD_W0:
+					epfw_state <= (xf_mode & xf_adv) ? EPFW_WR_BD_W1 : EPFW_IDLE;
+
+				EPFW_WR_BD_W1:
 					epfw_state <= EPFW_IDLE;
 
 				default:
@@ -327,59 +470,148 @@ module usb_trans #(
 		// Issue command to RAM
 	assign eps_zero_0  = 1'b0;
 	assign eps_read_0  = epfw_state[2];
-	assign eps_write_0 = epfw_state[3];
-
-	assign eps_addr_0  = {
-		trans_endp,
-		trans_dir,
-		epfw_state[1],
-		epfw_state[1] & ep_bd_idx_cur,
-		epfw_state[0]
-	};
+	assign eps_write_0 = epfw_state[3] & ~dsc_ovr;	/* Descriptor responder doesn't touch RAM */
+
+	assign eps_addr_0  = (ep_bd_ring & epfw_state[1]) ?
+		{
+			1'b1,
+			ring_bd_idx,
+			epfw_state[0]
+		} : {
+			1'b0,
+			trans_endp,
+			trans_dir,
+			epfw_state[1],
+			epfw_state[1] ? ep_bd_idx_cur[0] : epfw_state[0],
+			epfw_state[0]
+		};
+
+		// BD index within the shared pool (rings are aligned to their size)
+	assign ring_bd_idx = (ep_ring_slot << RING_LOG2) | (ep_bd_idx_cur & RING_MSK);
 
 	assign eps_wrdata_0 = epfw_state[1] ?
-		{ bd_state, trans_is_setup, 2'b00, xfer_length[9:0] } :
-		{ 8'h00, ep_data_toggle, ep_bd_idx_nxt, ep_bd_ctrl, ep_bd_dual, 1'b0, ep_type };
+		(epfw_state[0] ?
+			{ 5'b00000, xf_ptr + xf_done } :
+			{ bd_state, trans_is_setup, xf_x, ep_auto ? bd_ovr : xf_zlp, xf_mode ? (xf_len - (xf_adv ? xf_done : 10'd0)) : xfer_length[9:0] }
+		) :
+		ep_bd_ring ?
+		{ ep_ring_slot, ep_bd_idx_nxt, ep_data_toggle, 1'b0, 2'b11, ep_auto, ep_type } :
+		{ 8'h00, ep_data_toggle, ep_bd_idx_nxt[0], ep_bd_ctrl, ep_bd_dual, ep_auto, ep_type };
 
 		// Delay line for what to expect on read data
+		//  001 status, 010 BD w0, 011 BD w1, 100 config
 	always @(posedge clk or posedge rst)
 		if (rst)
-			epfw_cap_dl <= 6'b000000;
+			epfw_cap_dl <= 9'b000000000;
 		else
 			epfw_cap_dl <= {
-				epfw_state[1],
+				epfw_state[2] & (epfw_state[1:0] == 2'b01),
+				epfw_state[2] & epfw_state[1],
 				epfw_state[2] & ~^epfw_state[1:0],
-				epfw_cap_dl[5:2]
+				epfw_cap_dl[8:3]
 			};
 
 		// Capture read data
 	always @(posedge clk)
 	begin
 		// EP Status
-		if (epfw_cap_dl[1:0] == 2'b01) begin
-			ep_type        <= eps_rddata_3[2:0];
-			ep_bd_dual     <= eps_rddata_3[4];
-			ep_bd_ctrl     <= eps_rddata_3[5];
-			ep_bd_idx_cur  <= eps_rddata_3[5] ? trans_is_setup : eps_rddata_3[6];
-			ep_bd_idx_nxt  <= eps_rddata_3[6];
-			ep_data_toggle <= eps_rddata_3[7] & ~trans_is_setup; /* For SETUP, DT == 0 */
+		if (epfw_cap_dl[2:0] == 3'b001) begin
+			ep_type        <= eps_rddata[2:0];
+			ep_bd_dual     <= eps_rddata[5:4] == 2'b01;
+			ep_bd_ctrl     <= eps_rddata[5:4] == 2'b10;
+			ep_bd_ring     <= (eps_rddata[5:4] == 2'b11) && (BD_RING != 0);
+			ep_ring_slot   <= eps_rddata[15:11] & SLOT_MSK;
+			ep_data_toggle <= eps_rddata[7] & ~trans_is_setup; /* For SETUP, DT == 0 */
+			ep_auto        <= eps_rddata[3] & (AUTO_REARM != 0) & ~trans_dir & ~trans_is_setup;
+
+			if ((eps_rddata[5:4] == 2'b11) && (BD_RING != 0)) begin
+				ep_bd_idx_cur <= eps_rddata[10:8] & RING_MSK;
+				ep_bd_idx_nxt <= eps_rddata[10:8] & RING_MSK;
+			end else begin
+				ep_bd_idx_cur <= { 2'b00, (eps_rddata[5:4] == 2'b10) ? trans_is_setup : eps_rddata[6] };
+				ep_bd_idx_nxt <= { 2'b00, eps_rddata[6] };
+			end
 		end else begin
 			ep_data_toggle <= ep_data_toggle ^ (mc_op_ep & mc_opcode[0]);
-			ep_bd_idx_nxt  <= ep_bd_idx_nxt  ^ (mc_op_ep & mc_opcode[1] & ep_bd_dual );
+
+			if (mc_op_ep & mc_opcode[1]) begin
+				if (ep_bd_ring)
+					ep_bd_idx_nxt <= (ep_bd_idx_nxt + 1) & RING_MSK;
+				else
+					ep_bd_idx_nxt <= ep_bd_idx_nxt ^ { 2'b00, ep_bd_dual };
+			end
+		end
+
+		// EP Config
+		if (epfw_cap_dl[2:0] == 3'b100) begin
+			ep_mps    <= eps_rddata[9:0];
+			ep_ovw    <= eps_rddata[10];
+			ntf_mask  <= eps_rddata[11];
+			ntf_short <= eps_rddata[12];
+			ntf_div   <= eps_rddata[15:13];
 		end
 
 		// BD Word 0
-		if (epfw_cap_dl[1:0] == 2'b10) begin
-			bd_state <= eps_rddata_3[15:13];
+		if (epfw_cap_dl[2:0] == 3'b010) begin
+			bd_state <= bd_auto_arm ? 3'b010 : eps_rddata[15:13];
+			bd_ovr   <= bd_auto_arm & eps_rddata[15];
+			xf_mode  <= xf_bd & ~bd_auto_arm;
+			xf_x     <= eps_rddata[11] & ~bd_auto_arm;
+			xf_zlp   <= eps_rddata[10];
+			xf_len   <= eps_rddata[9:0];
+			xf_plen  <= xf_pkt_len;
 		end else begin
 			bd_state <= (mc_op_ep & mc_opcode[2]) ? mc_opcode[5:3]: bd_state;
 		end
+
+		// BD Word 1
+		if (epfw_cap_dl[2:0] == 3'b011)
+			xf_ptr <= eps_rddata[10:0];
 	end
 
 		// When do to write backs
 	always @(posedge clk)
 		epfw_issue_wb <= mc_op_ep & mc_opcode[7];
 
+	always @(posedge clk)
+		if (mc_op_ep)
+			xf_adv <= mc_opcode[9];
+
+
+	// Auto-rearm: Empty BDs (and full ones if overwrite is allowed) are
+	// considered ready to receive MPS bytes
+	assign bd_auto_arm = ep_auto & (
+		(eps_rddata[15:13] == 3'b000) |
+		(eps_rddata[15] & ep_ovw)
+	);
+
+
+	// Multi-packet transfer
+	// ---------------------
+
+	// Enabled by the core option, or for the descriptor responder
+	assign xf_ena = (XFER != 0) | dsc_ovr;
+
+	// BD uses the transfer logic : either a real transfer, or an IN
+	// packet that needs to be followed by a ZLP if it's MPS bytes long.
+	// (Not for ISOC)
+	assign xf_bd = (eps_rddata[11] | (eps_rddata[10] & trans_dir)) & xf_ena & (ep_type != 3'b001);
+
+	// IN packet length when loading the BD (MPS bytes max in transfer mode)
+	assign xf_pkt_len = (xf_bd & (eps_rddata[9:0] > ep_mps)) ?
+		ep_mps : eps_rddata[9:0];
+
+	// Bytes moved by this packet (excluding CRC for OUT)
+	assign xf_done = trans_dir ? xf_plen : (xfer_length - 10'd2);
+
+	// Does the transfer continue after this packet ?
+		// IN : More data left, or exactly MPS left and a ZLP is required
+		// OUT: Full packet and still room for another one
+	assign xf_cont = xf_mode & (trans_dir ?
+		((xf_len > ep_mps) | ((xf_len == ep_mps) & xf_zlp)) :
+		((xf_done == ep_mps) & ({1'b0, xf_len} >= {ep_mps, 1'b0}))
+	);
+
 
 	// Control Endpoint Lockout
 	// ------------------------
@@ -393,6 +625,265 @@ module usb_trans #(
 	assign cel_state = cel_state_i;
 
 
+	// Descriptor responder
+	// --------------------
+
+	// Standard GET_DESCRIPTOR requests on EP0 are looked up in a table
+	// stored in the TX buffer. On a hit, the SETUP is ACKed without
+	// involving software and the data / status stages are served from
+	// 'virtual' BDs substituted to the EP0 ones when read from RAM.
+	// Write backs for those go to local registers instead.
+
+	generate
+		if (DESC) begin
+			// Table walk states
+			localparam
+				DS_IDLE		= 3'd0,
+				DS_TYPE		= 3'd1,
+				DS_INDEX	= 3'd2,
+				DS_OFS_LO	= 3'd3,
+				DS_OFS_HI	= 3'd4,
+				DS_BLEN		= 3'd5,
+				DS_TLEN_LO	= 3'd6,
+				DS_TLEN_HI	= 3'd7;
+
+			// SETUP snoop
+			reg  [ 3:0] dsc_byte;
+			reg         dsc_req_ok;
+			reg  [ 7:0] dsc_key_idx;
+			reg  [ 7:0] dsc_key_type;
+			reg  [15:0] dsc_wlen;
+			wire        dsc_tlen;
+			wire        dsc_tok;
+
+			// Table walk
+			reg  [ 2:0] dsc_ws;
+			reg         dsc_wait;
+			wire        dsc_walk_start;
+			wire        dsc_walk_abort;
+			wire        dsc_walk_hit;
+			reg  [10:0] dsc_eptr;
+			reg  [10:0] dsc_raddr_i;
+			reg  [10:0] dsc_ofs;
+			reg  [ 9:0] dsc_dlen;
+			reg         dsc_found;
+
+			// Virtual transfer
+			wire        dsc_xfer_start;
+			reg         dsc_act;
+			reg         dsc_in_done;
+			reg         dsc_ovr_i;
+			reg         dsc_ovr_in;
+			reg         dsc_dt;
+			reg         dsc_zlp;
+			reg  [ 9:0] dsc_len;
+			reg  [10:0] dsc_ptr;
+			wire [ 9:0] dsc_mps;
+
+			// Token for us ?
+			assign dsc_tok = rxpkt_done_ok & rxpkt_is_token & (
+				(ADDR_MATCH == 0) | ~cr_addr_chk | (rxpkt_addr == cr_addr)
+			);
+
+			// Capture the request fields from the SETUP data packet
+			always @(posedge clk)
+				if (rxpkt_start)
+					dsc_byte <= 4'd0;
+				else if (rxpkt_data_stb & ~dsc_byte[3])
+					dsc_byte <= dsc_byte + 1;
+
+			always @(posedge clk)
+				if (rxpkt_data_stb)
+					case (dsc_byte)
+						4'd0: dsc_req_ok <= (rxpkt_data == 8'h80);	/* Standard, Device, IN */
+						4'd1: dsc_req_ok <= (rxpkt_data == 8'h06) & dsc_req_ok;	/* GET_DESCRIPTOR */
+						4'd2: dsc_key_idx  <= rxpkt_data;
+						4'd3: dsc_key_type <= rxpkt_data;
+						4'd6: dsc_wlen[ 7:0] <= rxpkt_data;
+						4'd7: dsc_wlen[15:8] <= rxpkt_data;
+						default: ;
+					endcase
+
+			// Configuration, Other-Speed-Configuration and BOS have a
+			// wTotalLength, the others are just bLength
+			assign dsc_tlen = (dsc_key_type == 8'h02) | (dsc_key_type == 8'h07) | (dsc_key_type == 8'h0f);
+
+			// Walk the table as soon as the descriptor type is known,
+			// it must be done by the end of the packet to be used.
+			assign dsc_walk_start =
+				rxpkt_data_stb & (dsc_byte == 4'd3) & dsc_req_ok & cr_dsc_ena &
+				trans_is_setup & (trans_endp == 4'h0);
+
+			assign dsc_walk_abort = mc_op_tx | (rxpkt_done_ok & rxpkt_is_token);
+
+			// Each read takes two cycles (address, then data). Entries
+			// are 4 bytes : type, index, offset (LE), ended by type 0.
+			always @(posedge clk or posedge rst)
+				if (rst) begin
+					dsc_ws   <= DS_IDLE;
+					dsc_wait <= 1'b0;
+				end else if (dsc_walk_abort) begin
+					dsc_ws   <= DS_IDLE;
+					dsc_wait <= 1'b0;
+				end else if (dsc_walk_start) begin
+					dsc_ws   <= DS_TYPE;
+					dsc_wait <= 1'b1;
+				end else if (dsc_wait) begin
+					dsc_wait <= 1'b0;
+				end else if (dsc_ws != DS_IDLE) begin
+					dsc_wait <= 1'b1;
+
+					case (dsc_ws)
+						DS_TYPE:
+							if (buf_tx_data_1 == 8'h00)
+								dsc_ws <= DS_IDLE;
+							else if (buf_tx_data_1 == dsc_key_type)
+								dsc_ws <= DS_INDEX;
+
+						DS_INDEX:
+							dsc_ws <= (buf_tx_data_1 == dsc_key_idx) ? DS_OFS_LO : DS_TYPE;
+
+						DS_OFS_LO:
+							dsc_ws <= DS_OFS_HI;
+
+						DS_OFS_HI:
+							dsc_ws <= DS_BLEN;
+
+						DS_BLEN:
+							dsc_ws <= dsc_tlen ? DS_TLEN_LO : DS_IDLE;
+
+						DS_TLEN_LO:
+							dsc_ws <= DS_TLEN_HI;
+
+						default:
+							dsc_ws <= DS_IDLE;
+					endcase
+				end
+
+			always @(posedge clk)
+				if (dsc_walk_start) begin
+					dsc_eptr    <= cr_dsc_base;
+					dsc_raddr_i <= cr_dsc_base;
+				end else if (~dsc_wait)
+					case (dsc_ws)
+						DS_TYPE, DS_INDEX:
+							if ((dsc_ws == DS_TYPE) ? (buf_tx_data_1 == dsc_key_type) : (buf_tx_data_1 == dsc_key_idx)) begin
+								dsc_raddr_i <= dsc_eptr + ((dsc_ws == DS_TYPE) ? 11'd1 : 11'd2);
+							end else begin
+								dsc_eptr    <= dsc_eptr + 11'd4;
+								dsc_raddr_i <= dsc_eptr + 11'd4;
+							end
+
+						DS_OFS_LO: begin
+							dsc_ofs[7:0] <= buf_tx_data_1;
+							dsc_raddr_i  <= dsc_eptr + 11'd3;
+						end
+
+						DS_OFS_HI: begin
+							dsc_ofs[10:8] <= buf_tx_data_1[2:0];
+							dsc_raddr_i   <= { buf_tx_data_1[2:0], dsc_ofs[7:0] };
+						end
+
+						DS_BLEN: begin
+							dsc_dlen    <= { 2'b00, buf_tx_data_1 };
+							dsc_raddr_i <= dsc_ofs + 11'd2;
+						end
+
+						DS_TLEN_LO: begin
+							dsc_dlen[7:0] <= buf_tx_data_1;
+							dsc_raddr_i   <= dsc_ofs + 11'd3;
+						end
+
+						DS_TLEN_HI:
+							dsc_dlen[9:8] <= buf_tx_data_1[1:0];
+
+						default: ;
+					endcase
+
+			assign dsc_walk_hit = ~dsc_wait & (
+				((dsc_ws == DS_BLEN) & ~dsc_tlen) |
+				 (dsc_ws == DS_TLEN_HI)
+			);
+
+			always @(posedge clk or posedge rst)
+				if (rst)
+					dsc_found <= 1'b0;
+				else
+					dsc_found <= ((dsc_found & ~rxpkt_start) | dsc_walk_hit) & ~dsc_walk_abort;
+
+			assign dsc_busy  = (dsc_ws != DS_IDLE);
+			assign dsc_raddr = dsc_raddr_i;
+
+			// Result for the microcode (requests with no data stage are
+			// left to software)
+			assign dsc_hit = dsc_found & ~dsc_busy & (dsc_wlen != 16'h0000);
+
+			// Virtual transfer state
+			assign dsc_xfer_start = mc_op_ep & mc_opcode[10];
+
+			always @(posedge clk or posedge rst)
+				if (rst) begin
+					dsc_act     <= 1'b0;
+					dsc_in_done <= 1'b0;
+				end else if (~cr_dsc_ena | (dsc_tok & (rxpkt_pid == PID_SETUP))) begin
+					dsc_act     <= 1'b0;
+					dsc_in_done <= 1'b0;
+				end else if (dsc_xfer_start) begin
+					dsc_act     <= 1'b1;
+					dsc_in_done <= 1'b0;
+				end else if (dsc_ovr_i & (epfw_state == EPFW_WR_BD_W0) & (bd_state == 3'b100)) begin
+					// IN done -> wait for status stage, OUT done -> all done
+					dsc_act     <= dsc_act & dsc_ovr_in;
+					dsc_in_done <= 1'b1;
+				end
+
+			always @(posedge clk)
+				if (rxpkt_done_ok & rxpkt_is_token) begin
+					dsc_ovr_i  <= dsc_tok & dsc_act & (rxpkt_endp == 4'h0) & (
+						(rxpkt_pid == PID_OUT) |
+						((rxpkt_pid == PID_IN) & ~dsc_in_done)
+					);
+					dsc_ovr_in <= (rxpkt_pid == PID_IN);
+				end
+
+			always @(posedge clk)
+				if (dsc_xfer_start) begin
+					dsc_dt  <= 1'b1;
+					dsc_zlp <= dsc_wlen > { 6'd0, dsc_dlen };
+					dsc_len <= (dsc_wlen > { 6'd0, dsc_dlen }) ? dsc_dlen : dsc_wlen[9:0];
+					dsc_ptr <= dsc_ofs;
+				end else if (dsc_ovr_i & dsc_ovr_in) begin
+					if (epfw_state == EPFW_WR_STATUS)
+						dsc_dt  <= eps_wrdata_0[7];
+					if (epfw_state == EPFW_WR_BD_W0)
+						dsc_len <= eps_wrdata_0[9:0];
+					if (epfw_state == EPFW_WR_BD_W1)
+						dsc_ptr <= eps_wrdata_0[10:0];
+				end
+
+			assign dsc_ovr = dsc_ovr_i;
+
+			// Substitute EP0 data: IN is a transfer mode BD with the
+			// descriptor, OUT a zero length BD for the status stage.
+			assign dsc_mps = 10'd8 << cr_dsc_mps;
+
+			assign eps_rddata = ~dsc_ovr_i ? eps_rddata_3 :
+				(epfw_cap_dl[2:0] == 3'b001) ? { eps_rddata_3[15:8], dsc_dt | ~dsc_ovr_in, eps_rddata_3[6:4], 1'b0, eps_rddata_3[2:0] } :
+				(epfw_cap_dl[2:0] == 3'b100) ? { 6'b000000, dsc_mps } :
+				(epfw_cap_dl[2:0] == 3'b010) ? (dsc_ovr_in ? { 3'b010, 1'b0, 1'b1, dsc_zlp, dsc_len } : 16'h4000) :
+				(epfw_cap_dl[2:0] == 3'b011) ? { 5'b00000, dsc_ovr_in ? dsc_ptr : 11'h000 } :
+				eps_rddata_3;
+
+		end else begin
+			assign dsc_hit    = 1'b0;
+			assign dsc_ovr    = 1'b0;
+			assign dsc_busy   = 1'b0;
+			assign dsc_raddr  = 11'h000;
+			assign eps_rddata = eps_rddata_3;
+		end
+	endgenerate
+
+
 	// Packet TX
 	// ---------
 
@@ -407,14 +898,28 @@ module usb_trans #(
 	assign txpkt_len = bd_length[9:0];
 
 
+	// Statistics
+	// ----------
+
+	assign stat_rx_to    = rto_now;
+	assign stat_tx_nak   = txpkt_start_i & (txpkt_pid == PID_NAK);
+	assign stat_tx_stall = txpkt_start_i & (txpkt_pid == PID_STALL);
+
+	// Token addressed to us for an endpoint that doesn't exist
+	assign stat_no_ep = (epfw_cap_dl[2:0] == 3'b001) & (eps_rddata[2:0] == 3'b000) &
+		((pkt_pid == PID_IN) | (pkt_pid == PID_OUT) | (pkt_pid == PID_SETUP));
+
+	assign stat_ep = { trans_endp, trans_dir };
+
+
 	// Data Address/Length shared logic
 	// --------------------------------
 
 	// Address
 	always @(posedge clk)
-		addr <= addr_ld ? eps_rddata_3[10:0] : (addr + addr_inc);
+		addr <= addr_ld ? eps_rddata[10:0] : (addr + addr_inc);
 
-	assign addr_ld  = epfw_cap_dl[1:0] == 2'b11;
+	assign addr_ld  = epfw_cap_dl[2:0] == 3'b011;
 	assign addr_inc = txpkt_data_ack | txpkt_start_i | rxpkt_data_stb;
 
 	// Buffer length (decrements)
@@ -422,14 +927,14 @@ module usb_trans #(
 		if (mc_op_zlen)
 			bd_length <= 0;
 		else
-			bd_length <= len_ld ? { 1'b1, eps_rddata_3[9:0] } : (bd_length -  len_bd_dec);
+			bd_length <= len_ld ? { 1'b1, trans_dir ? xf_pkt_len : (bd_auto_arm ? ep_mps : eps_rddata[9:0]) } : (bd_length -  len_bd_dec);
 
 	// Xfer length (increments)
 	always @(posedge clk)
 		xfer_length <= len_ld ? 10'h000 : (xfer_length + len_xf_inc);
 
 	// Length control
-	assign len_ld = epfw_cap_dl[1:0] == 2'b10;
+	assign len_ld = epfw_cap_dl[2:0] == 3'b010;
 
 	assign len_bd_dec = (rxpkt_data_stb | rxpkt_start) & bd_length[10];
 	assign len_xf_inc =  rxpkt_data_stb;
@@ -438,8 +943,8 @@ module usb_trans #(
 	// Data read logic
 	// ---------------
 
-	assign buf_tx_addr_0 = addr;
-	assign buf_tx_rden_0 = txpkt_data_ack | txpkt_start_i;
+	assign buf_tx_addr_0 = dsc_busy ? dsc_raddr : addr;
+	assign buf_tx_rden_0 = txpkt_data_ack | txpkt_start_i | dsc_busy;
 
 	assign txpkt_data = buf_tx_data_1;
 
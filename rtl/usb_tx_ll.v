@@ -9,7 +9,9 @@
 
 `default_nettype none
 
-module usb_tx_ll (
+module usb_tx_ll #(
+	parameter integer OSR = 4	// Clock cycles per bit (i.e. clk / 12 MHz)
+)(
 	// PHY
 	output wire phy_tx_dp,
 	output wire phy_tx_dn,
@@ -35,7 +37,6 @@ module usb_tx_ll (
 	reg [2:0] state;
 	wire active;
 
-	reg  [2:0] br_cnt;
 	wire br_now;
 
 	// Bit stuffing
@@ -76,10 +77,28 @@ module usb_tx_ll (
 
 	assign active = state[2];
 
-	always @(posedge clk)
-		br_cnt <= { 1'b0, active ? br_cnt[1:0] : 2'b10 } + 1;
+	generate
+		if (OSR == 4) begin
+			reg  [2:0] br_cnt;
+
+			always @(posedge clk)
+				br_cnt <= { 1'b0, active ? br_cnt[1:0] : 2'b10 } + 1;
+
+			assign br_now = br_cnt[2];
+
+		end else begin
+			reg  [$clog2(OSR)-1:0] br_cnt;
 
-	assign br_now = br_cnt[2];
+			always @(posedge clk)
+				if (~active)
+					br_cnt <= OSR - 2;
+				else
+					br_cnt <= br_now ? 0 : (br_cnt + 1);
+
+			assign br_now = (br_cnt == (OSR - 1));
+
+		end
+	endgenerate
 
 
 	// Bit Stuffing
@@ -0,0 +1,140 @@
+/*
+ * cosim_top.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Top level for the Verilator co-simulation: the core with the USB pads
+ * resolved against the host model and everything else exposed as plain
+ * ports for the C++ side.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+
+module cosim_top #(
+	parameter integer CLK_FREQ = 48_000_000,
+	parameter integer EVT_DEPTH = 0,
+	parameter integer EVT_RAM = 0,
+	parameter integer IRQ = 0,
+	parameter integer BD_RING = 0,
+	parameter integer XFER = 0,
+	parameter integer AUTO_REARM = 0,
+	parameter integer NOTIFY_CTRL = 0,
+	parameter integer EPS_TDP = 0,
+	parameter integer WB_DW = 16,
+	parameter integer DESC = 0,
+	parameter integer STATS = 0,
+	parameter integer TRACE = 0
+)(
+	// Host side of the bus
+	input  wire host_oe,
+	input  wire host_dp,
+	input  wire host_dn,
+
+	output wire bus_dp,
+	output wire bus_dn,
+	output wire bus_pu,
+
+	// EP buffer interface
+	input  wire [ 8:0] ep_tx_addr_0,
+	input  wire [31:0] ep_tx_data_0,
+	input  wire ep_tx_we_0,
+
+	input  wire [ 8:0] ep_rx_addr_0,
+	output wire [31:0] ep_rx_data_1,
+	input  wire ep_rx_re_0,
+
+	// Bus interface
+	input  wire [11:0] wb_addr,
+	output wire [31:0] wb_rdata,
+	input  wire [31:0] wb_wdata,
+	input  wire        wb_we,
+	input  wire        wb_cyc,
+	output wire        wb_ack,
+
+	// Misc
+	output wire irq,
+	output wire sof,
+
+	// Common
+	input  wire clk,
+	input  wire rst
+);
+
+	// Signals
+	// -------
+
+	wire pad_dp;
+	wire pad_dn;
+
+	wire [31:0] wb_rdata_i;
+
+
+	// Bus
+	// ---
+
+	// Host driver (the device one is inside usb_phy)
+	assign pad_dp = host_oe ? host_dp : 1'bz;
+	assign pad_dn = host_oe ? host_dn : 1'bz;
+
+	// Idle state is J. The host model only looks at the lines once the
+	// device pull-up is enabled so this is all that's needed.
+	pullup   (pad_dp);
+	pulldown (pad_dn);
+
+	assign bus_dp = pad_dp;
+	assign bus_dn = pad_dn;
+
+
+	// Core
+	// ----
+
+	usb #(
+		.TARGET("GENERIC"),
+		.EPDW(32),
+		.CLK_FREQ(CLK_FREQ),
+		.EVT_DEPTH(EVT_DEPTH),
+		.EVT_RAM(EVT_RAM),
+		.IRQ(IRQ),
+		.BD_RING(BD_RING),
+		.XFER(XFER),
+		.AUTO_REARM(AUTO_REARM),
+		.NOTIFY_CTRL(NOTIFY_CTRL),
+		.EPS_TDP(EPS_TDP),
+		.WB_DW(WB_DW),
+		.DESC(DESC),
+		.STATS(STATS),
+		.TRACE(TRACE)
+	) usb_I (
+		.pad_dp(pad_dp),
+		.pad_dn(pad_dn),
+		.pad_pu(bus_pu),
+		.ep_tx_addr_0(ep_tx_addr_0),
+		.ep_tx_data_0(ep_tx_data_0),
+		.ep_tx_we_0(ep_tx_we_0),
+		.ep_rx_addr_0(ep_rx_addr_0),
+		.ep_rx_data_1(ep_rx_data_1),
+		.ep_rx_re_0(ep_rx_re_0),
+		.ep_clk(clk),
+		.wb_addr(wb_addr),
+		.wb_rdata(wb_rdata_i[WB_DW-1:0]),
+		.wb_wdata(wb_wdata[WB_DW-1:0]),
+		.wb_we(wb_we),
+		.wb_cyc(wb_cyc),
+		.wb_ack(wb_ack),
+		.irq(irq),
+		.sof(sof),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	generate
+		if (WB_DW < 32)
+			assign wb_rdata_i[31:WB_DW] = 0;
+	endgenerate
+
+	assign wb_rdata = wb_rdata_i;
+
+endmodule // cosim_top
@@ -0,0 +1,459 @@
+/*
+ * app.c
+ *
+ * Test device for the co-simulation, built on the v0 stack
+ *
+ *  - Interface 0: Bulk OUT sink (EP 0x01) checking a known pattern and
+ *                 Bulk IN source (EP 0x81) generating it, both with
+ *                 dual buffer descriptors. Interrupt IN (EP 0x83)
+ *                 sending time stamped packets at random intervals.
+ *  - Interface 1: Isochronous IN (EP 0x82) in alt setting 1, one packet
+ *                 per frame.
+ *  - Vendor control requests for stats, an echo buffer and to start /
+ *    stop the interrupt packets.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <no2usb/usb.h>
+#include <no2usb/usb_hw.h>
+#include <no2usb/usb_priv.h>
+#include <no2usb/usb_proto.h>
+
+#include "app.h"
+
+
+/* Descriptors */
+/* ----------- */
+
+static const struct usb_dev_desc _app_dev_desc = {
+	.bLength		= sizeof(struct usb_dev_desc),
+	.bDescriptorType	= USB_DT_DEV,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= 0,
+	.bDeviceSubClass	= 0,
+	.bDeviceProtocol	= 0,
+	.bMaxPacketSize0	= 64,
+	.idVendor		= 0x1209,
+	.idProduct		= 0x0001,
+	.bcdDevice		= 0x0001,
+	.iManufacturer		= 0,
+	.iProduct		= 0,
+	.iSerialNumber		= 0,
+	.bNumConfigurations	= 1,
+};
+
+static const struct {
+	struct usb_conf_desc conf;
+	struct usb_intf_desc if_bulk;
+	struct usb_ep_desc ep_bulk_out;
+	struct usb_ep_desc ep_bulk_in;
+	struct usb_ep_desc ep_int_in;
+	struct usb_intf_desc if_iso_alt0;
+	struct usb_intf_desc if_iso_alt1;
+	struct usb_ep_desc ep_iso_in;
+} __attribute__ ((packed)) _app_conf_desc = {
+	.conf = {
+		.bLength                = sizeof(struct usb_conf_desc),
+		.bDescriptorType        = USB_DT_CONF,
+		.wTotalLength           = sizeof(_app_conf_desc),
+		.bNumInterfaces         = 2,
+		.bConfigurationValue    = 1,
+		.iConfiguration         = 0,
+		.bmAttributes           = 0x80,
+		.bMaxPower              = 0x32,
+	},
+	.if_bulk = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= 0,
+		.bAlternateSetting	= 0,
+		.bNumEndpoints		= 3,
+		.bInterfaceClass	= 0xff,
+		.bInterfaceSubClass	= 0x00,
+		.bInterfaceProtocol	= 0x00,
+		.iInterface		= 0,
+	},
+	.ep_bulk_out = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= APP_EP_BULK_OUT,
+		.bmAttributes		= 0x02,
+		.wMaxPacketSize		= APP_BULK_MPS,
+		.bInterval		= 0x00,
+	},
+	.ep_bulk_in = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= APP_EP_BULK_IN,
+		.bmAttributes		= 0x02,
+		.wMaxPacketSize		= APP_BULK_MPS,
+		.bInterval		= 0x00,
+	},
+	.ep_int_in = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= APP_EP_INT_IN,
+		.bmAttributes		= 0x03,
+		.wMaxPacketSize		= APP_INT_MPS,
+		.bInterval		= 0x01,
+	},
+	.if_iso_alt0 = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= 1,
+		.bAlternateSetting	= 0,
+		.bNumEndpoints		= 0,
+		.bInterfaceClass	= 0xff,
+		.bInterfaceSubClass	= 0x00,
+		.bInterfaceProtocol	= 0x00,
+		.iInterface		= 0,
+	},
+	.if_iso_alt1 = {
+		.bLength		= sizeof(struct usb_intf_desc),
+		.bDescriptorType	= USB_DT_INTF,
+		.bInterfaceNumber	= 1,
+		.bAlternateSetting	= 1,
+		.bNumEndpoints		= 1,
+		.bInterfaceClass	= 0xff,
+		.bInterfaceSubClass	= 0x00,
+		.bInterfaceProtocol	= 0x00,
+		.iInterface		= 0,
+	},
+	.ep_iso_in = {
+		.bLength		= sizeof(struct usb_ep_desc),
+		.bDescriptorType	= USB_DT_EP,
+		.bEndpointAddress	= APP_EP_ISO_IN,
+		.bmAttributes		= 0x01,
+		.wMaxPacketSize		= APP_ISO_MPS,
+		.bInterval		= 0x01,
+	},
+};
+
+static const struct usb_conf_desc * const _app_conf_desc_array[] = {
+	&_app_conf_desc.conf,
+};
+
+static const struct usb_stack_descriptors app_stack_desc = {
+	.dev    = &_app_dev_desc,
+	.conf   = _app_conf_desc_array,
+	.n_conf = num_elem(_app_conf_desc_array),
+	.str    = NULL,
+	.n_str  = 0,
+};
+
+
+/* State */
+/* ----- */
+
+static struct {
+	bool bulk_ena;
+	bool iso_ena;
+	bool int_ena;
+
+	/* Next BD expected to complete / to fill */
+	int bdi_out;
+	int bdi_in;
+	int bdi_iso;
+
+	/* Pattern positions */
+	uint32_t out_idx;
+	uint32_t in_idx;
+	uint8_t  iso_seq;
+
+	/* Interrupt packets */
+	uint32_t int_seq;
+	uint32_t int_next;
+	uint32_t int_lfsr;
+
+	struct app_stats stats;
+
+	uint8_t echo[64] __attribute__((aligned(4)));
+	int echo_len;
+} g_app;
+
+static uint8_t g_app_buf[APP_ISO_MPS] __attribute__((aligned(4)));
+
+
+/* Data path */
+/* --------- */
+
+static void
+_app_bulk_out_poll(void)
+{
+	volatile struct usb_ep *ep = &usb_ep_regs[APP_EP_BULK_OUT & 0xf].out;
+
+	for (;;) {
+		volatile struct usb_bd *bd = &ep->bd[g_app.bdi_out];
+		uint32_t csr = bd->csr;
+		int len;
+
+		if ((csr & USB_BD_STATE_MSK) == USB_BD_STATE_DONE_OK) {
+			/* Check content */
+			len = (csr & USB_BD_LEN_MSK) - 2;
+			usb_data_read(g_app_buf, bd->ptr, len);
+
+			for (int i=0; i<len; i++)
+				if (g_app_buf[i] != app_pattern(g_app.out_idx + i))
+					g_app.stats.out_errors++;
+
+			g_app.out_idx += len;
+			g_app.stats.out_bytes += len;
+		} else if ((csr & USB_BD_STATE_MSK) != USB_BD_STATE_DONE_ERR) {
+			break;
+		}
+
+		/* Re-arm */
+		bd->csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_BULK_MPS);
+		g_app.bdi_out ^= 1;
+	}
+}
+
+static void
+_app_bulk_in_poll(void)
+{
+	volatile struct usb_ep *ep = &usb_ep_regs[APP_EP_BULK_IN & 0xf].in;
+
+	for (;;) {
+		volatile struct usb_bd *bd = &ep->bd[g_app.bdi_in];
+		uint32_t csr = bd->csr;
+
+		if ((csr & USB_BD_STATE_MSK) == USB_BD_STATE_RDY_DATA)
+			break;
+
+		for (int i=0; i<APP_BULK_MPS; i++)
+			g_app_buf[i] = app_pattern(g_app.in_idx + i);
+
+		usb_data_write(bd->ptr, g_app_buf, APP_BULK_MPS);
+		bd->csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_BULK_MPS);
+
+		g_app.in_idx += APP_BULK_MPS;
+		g_app.stats.in_bytes += APP_BULK_MPS;
+		g_app.bdi_in ^= 1;
+	}
+}
+
+static void
+_app_iso_in_poll(void)
+{
+	volatile struct usb_ep *ep = &usb_ep_regs[APP_EP_ISO_IN & 0xf].in;
+
+	for (;;) {
+		volatile struct usb_bd *bd = &ep->bd[g_app.bdi_iso];
+		uint32_t csr = bd->csr;
+
+		if ((csr & USB_BD_STATE_MSK) == USB_BD_STATE_RDY_DATA)
+			break;
+
+		app_iso_fill(g_app_buf, g_app.iso_seq++);
+		usb_data_write(bd->ptr, g_app_buf, APP_ISO_MPS);
+		bd->csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_ISO_MPS);
+
+		g_app.stats.iso_pkts++;
+		g_app.bdi_iso ^= 1;
+	}
+}
+
+static void
+_app_int_in_poll(void)
+{
+	volatile struct usb_ep *ep = &usb_ep_regs[APP_EP_INT_IN & 0xf].in;
+
+	/* Previous packet not picked up yet ? */
+	if ((ep->bd[0].csr & USB_BD_STATE_MSK) == USB_BD_STATE_RDY_DATA)
+		return;
+
+	/* Time for the next one ? */
+	if ((int32_t)(app_now() - g_app.int_next) < 0)
+		return;
+
+	/* Time stamp just before arming the BD */
+	app_int_fill(g_app_buf, g_app.int_seq++);
+	usb_data_write(ep->bd[0].ptr, g_app_buf, APP_INT_MPS);
+	ep->bd[0].csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_INT_MPS);
+
+	g_app.int_next = app_now() + app_int_gap(&g_app.int_lfsr);
+}
+
+
+/* Control */
+/* ------- */
+
+static bool
+_app_echo_write_done_cb(struct usb_xfer *xfer)
+{
+	memcpy(g_app.echo, xfer->data, xfer->len);
+	g_app.echo_len = xfer->len;
+	return true;
+}
+
+static enum usb_fnd_resp
+_app_ctrl_req(struct usb_ctrl_req *req, struct usb_xfer *xfer)
+{
+	if (USB_REQ_TYPE_RCPT(req) != (USB_REQ_TYPE_VENDOR | USB_REQ_RCPT_DEV))
+		return USB_FND_CONTINUE;
+
+	switch (req->bRequest) {
+	case APP_REQ_GET_STATS:
+		memcpy(xfer->data, &g_app.stats, sizeof(struct app_stats));
+		xfer->len = sizeof(struct app_stats);
+		break;
+
+	case APP_REQ_ECHO_WRITE:
+		if (req->wLength > sizeof(g_app.echo))
+			return USB_FND_ERROR;
+		xfer->cb_done = _app_echo_write_done_cb;
+		break;
+
+	case APP_REQ_ECHO_READ:
+		memcpy(xfer->data, g_app.echo, g_app.echo_len);
+		xfer->len = g_app.echo_len;
+		break;
+
+	case APP_REQ_RESET_STATS:
+		memset(&g_app.stats, 0x00, sizeof(struct app_stats));
+		g_app.out_idx = 0;
+		break;
+
+	case APP_REQ_INT_ENABLE:
+		g_app.int_ena  = (req->wValue != 0);
+		g_app.int_seq  = 0;
+		g_app.int_next = app_now();
+		g_app.int_lfsr = 0xace1;
+		if (!g_app.int_ena)
+			usb_ep_regs[APP_EP_INT_IN & 0xf].in.bd[0].csr = 0;
+		break;
+
+	case APP_REQ_NOP:
+		break;
+
+	default:
+		return USB_FND_ERROR;
+	}
+
+	return USB_FND_SUCCESS;
+}
+
+static enum usb_fnd_resp
+_app_set_conf(const struct usb_conf_desc *conf)
+{
+	const struct usb_intf_desc *intf;
+
+	g_app.bulk_ena = false;
+	g_app.iso_ena  = false;
+	g_app.int_ena  = false;
+
+	if (!conf)
+		return USB_FND_SUCCESS;
+
+	/* Bulk */
+	intf = usb_desc_find_intf(conf, 0, 0, NULL);
+	if (!intf)
+		return USB_FND_ERROR;
+
+	usb_ep_boot(intf, APP_EP_BULK_OUT, true);
+	usb_ep_boot(intf, APP_EP_BULK_IN,  true);
+	usb_ep_boot(intf, APP_EP_INT_IN,   false);
+
+	usb_ep_regs[APP_EP_BULK_OUT & 0xf].out.bd[0].csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_BULK_MPS);
+	usb_ep_regs[APP_EP_BULK_OUT & 0xf].out.bd[1].csr = USB_BD_STATE_RDY_DATA | USB_BD_LEN(APP_BULK_MPS);
+
+	g_app.bdi_out = 0;
+	g_app.bdi_in  = 0;
+	g_app.out_idx = 0;
+	g_app.in_idx  = 0;
+	g_app.bulk_ena = true;
+
+	/* Isochronous, buffers allocated now, enabled by alt setting 1 */
+	intf = usb_desc_find_intf(conf, 1, 0, NULL);
+	if (!intf)
+		return USB_FND_ERROR;
+
+	usb_ep_boot(intf, APP_EP_ISO_IN, true);
+
+	return USB_FND_SUCCESS;
+}
+
+static enum usb_fnd_resp
+_app_set_intf(const struct usb_intf_desc *base, const struct usb_intf_desc *sel)
+{
+	volatile struct usb_ep *ep = &usb_ep_regs[APP_EP_ISO_IN & 0xf].in;
+
+	if (base->bInterfaceNumber == 0)
+		return USB_FND_SUCCESS;
+
+	if (base->bInterfaceNumber != 1)
+		return USB_FND_CONTINUE;
+
+	if (sel->bAlternateSetting == 1) {
+		if (!usb_ep_reconf(sel, APP_EP_ISO_IN))
+			return USB_FND_ERROR;
+		g_app.bdi_iso = 0;
+		g_app.iso_seq = 0;
+		g_app.iso_ena = true;
+	} else {
+		g_app.iso_ena = false;
+		ep->status = USB_EP_BD_DUAL | USB_EP_TYPE_NONE;
+		ep->bd[0].csr = 0;
+		ep->bd[1].csr = 0;
+	}
+
+	return USB_FND_SUCCESS;
+}
+
+static enum usb_fnd_resp
+_app_get_intf(const struct usb_intf_desc *base, uint8_t *alt)
+{
+	if (base->bInterfaceNumber != 1)
+		return USB_FND_CONTINUE;
+
+	*alt = g_app.iso_ena ? 1 : 0;
+
+	return USB_FND_SUCCESS;
+}
+
+static struct usb_fn_drv _app_drv = {
+	.ctrl_req	= _app_ctrl_req,
+	.set_conf	= _app_set_conf,
+	.set_intf	= _app_set_intf,
+	.get_intf	= _app_get_intf,
+};
+
+
+/* Exposed API */
+/* ----------- */
+
+void
+app_init(void)
+{
+	memset(&g_app, 0x00, sizeof(g_app));
+
+	usb_init(&app_stack_desc);
+	usb_register_function_driver(&_app_drv);
+	usb_connect();
+}
+
+void
+app_poll(void)
+{
+	usb_poll();
+
+	if (usb_get_state() != USB_DS_CONFIGURED)
+		return;
+
+	if (g_app.bulk_ena) {
+		_app_bulk_out_poll();
+		_app_bulk_in_poll();
+	}
+
+	if (g_app.iso_ena)
+		_app_iso_in_poll();
+
+	if (g_app.int_ena)
+		_app_int_in_poll();
+}
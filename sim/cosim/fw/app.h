@@ -0,0 +1,109 @@
+/*
+ * app.h
+ *
+ * Test device for the co-simulation
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef CLK_FREQ
+# define CLK_FREQ		48000000
+#endif
+
+/* Endpoints */
+#define APP_EP_BULK_OUT		0x01
+#define APP_EP_BULK_IN		0x81
+#define APP_EP_ISO_IN		0x82
+#define APP_EP_INT_IN		0x83
+
+#define APP_BULK_MPS		64
+#define APP_ISO_MPS		512
+#define APP_INT_MPS		8
+
+/* Interrupt IN packets are armed 2 to 3 ms (pseudo random) apart, so the
+ * arm time moves around within the frame and the previous packet was
+ * always picked up by the host (polling every frame) */
+#define APP_INT_GAP_MIN		(2 * (CLK_FREQ / 1000))
+#define APP_INT_GAP_RND		(CLK_FREQ / 1000)
+
+/* Vendor requests (device recipient) */
+#define APP_REQ_GET_STATS	0x01	/* IN,  struct app_stats   */
+#define APP_REQ_ECHO_WRITE	0x02	/* OUT, up to 64 bytes     */
+#define APP_REQ_ECHO_READ	0x03	/* IN,  what was written   */
+#define APP_REQ_RESET_STATS	0x04	/* No data                 */
+#define APP_REQ_INT_ENABLE	0x05	/* No data, wValue = 0/1   */
+#define APP_REQ_NOP		0x06	/* No data                 */
+
+struct app_stats {
+	uint32_t out_bytes;	/* Bulk OUT bytes received */
+	uint32_t out_errors;	/* Bulk OUT pattern mismatches */
+	uint32_t in_bytes;	/* Bulk IN bytes queued */
+	uint32_t iso_pkts;	/* Isochronous packets queued */
+} __attribute__((packed));
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Provided by the firmware */
+void app_init(void);
+void app_poll(void);
+
+/* Provided by the harness: free running core clock cycle counter */
+uint32_t app_now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* Bulk data pattern, continuous across packets */
+static inline uint8_t
+app_pattern(uint32_t idx)
+{
+	return (idx * 7 + (idx >> 8)) & 0xff;
+}
+
+static inline void
+app_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline uint32_t
+app_get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Isochronous payload: sequence number, time it was queued, fixed ramp */
+#define APP_ISO_HDR		5
+
+static inline void
+app_iso_fill(uint8_t *buf, uint8_t seq)
+{
+	buf[0] = seq;
+	app_put_u32(&buf[1], app_now());
+	for (int i=APP_ISO_HDR; i<APP_ISO_MPS; i++)
+		buf[i] = i & 0xff;
+}
+
+/* Interrupt payload: sequence number and time it was armed */
+static inline void
+app_int_fill(uint8_t *buf, uint32_t seq)
+{
+	app_put_u32(&buf[0], seq);
+	app_put_u32(&buf[4], app_now());
+}
+
+/* Delay before arming the next interrupt packet */
+static inline uint32_t
+app_int_gap(uint32_t *lfsr)
+{
+	*lfsr = (*lfsr >> 1) ^ (-(*lfsr & 1) & 0xd0000001u);
+	return APP_INT_GAP_MIN + (*lfsr % APP_INT_GAP_RND);
+}
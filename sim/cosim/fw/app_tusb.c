@@ -0,0 +1,397 @@
+/*
+ * app_tusb.c
+ *
+ * Test device for the co-simulation, built on tinyUSB and the no2usb DCD
+ *
+ * Same device as `app.c` (descriptors, endpoints, vendor requests and data
+ * patterns), implemented as a tinyUSB application class driver so both
+ * stacks run the exact same scenario.
+ *
+ * Experimental : not built against tinyUSB yet.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+
+#include "app.h"
+
+
+/* Bulk transfer size, several packets per tinyUSB transfer */
+#define APP_BULK_XFER		512
+
+
+/* Descriptors */
+/* ----------- */
+
+static const tusb_desc_device_t _app_dev_desc = {
+	.bLength		= sizeof(tusb_desc_device_t),
+	.bDescriptorType	= TUSB_DESC_DEVICE,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= 0,
+	.bDeviceSubClass	= 0,
+	.bDeviceProtocol	= 0,
+	.bMaxPacketSize0	= CFG_TUD_ENDPOINT0_SIZE,
+	.idVendor		= 0x1209,
+	.idProduct		= 0x0001,
+	.bcdDevice		= 0x0001,
+	.iManufacturer		= 0,
+	.iProduct		= 0,
+	.iSerialNumber		= 0,
+	.bNumConfigurations	= 1,
+};
+
+#define APP_CONF_LEN	(9 + 9 + 3 * 7 + 9 + 9 + 7)
+
+static const uint8_t _app_conf_desc[APP_CONF_LEN] = {
+	/* Configuration */
+	9, TUSB_DESC_CONFIGURATION, TU_U16_LOW(APP_CONF_LEN), TU_U16_HIGH(APP_CONF_LEN),
+	2, 1, 0, 0x80, 0x32,
+
+	/* Interface 0: Bulk OUT / IN, Interrupt IN */
+	9, TUSB_DESC_INTERFACE, 0, 0, 3, 0xff, 0x00, 0x00, 0,
+	7, TUSB_DESC_ENDPOINT, APP_EP_BULK_OUT, TUSB_XFER_BULK,
+		TU_U16_LOW(APP_BULK_MPS), TU_U16_HIGH(APP_BULK_MPS), 0,
+	7, TUSB_DESC_ENDPOINT, APP_EP_BULK_IN, TUSB_XFER_BULK,
+		TU_U16_LOW(APP_BULK_MPS), TU_U16_HIGH(APP_BULK_MPS), 0,
+	7, TUSB_DESC_ENDPOINT, APP_EP_INT_IN, TUSB_XFER_INTERRUPT,
+		TU_U16_LOW(APP_INT_MPS), TU_U16_HIGH(APP_INT_MPS), 1,
+
+	/* Interface 1: Isochronous IN in alt setting 1 */
+	9, TUSB_DESC_INTERFACE, 1, 0, 0, 0xff, 0x00, 0x00, 0,
+	9, TUSB_DESC_INTERFACE, 1, 1, 1, 0xff, 0x00, 0x00, 0,
+	7, TUSB_DESC_ENDPOINT, APP_EP_ISO_IN, TUSB_XFER_ISOCHRONOUS,
+		TU_U16_LOW(APP_ISO_MPS), TU_U16_HIGH(APP_ISO_MPS), 1,
+};
+
+uint8_t const *
+tud_descriptor_device_cb(void)
+{
+	return (uint8_t const *)&_app_dev_desc;
+}
+
+uint8_t const *
+tud_descriptor_configuration_cb(uint8_t index)
+{
+	(void)index;
+	return _app_conf_desc;
+}
+
+uint16_t const *
+tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+{
+	/* No strings, the request gets STALLed */
+	(void)index;
+	(void)langid;
+	return NULL;
+}
+
+
+/* State */
+/* ----- */
+
+static struct {
+	bool iso_open;
+	bool iso_ena;
+	bool iso_busy;
+	bool int_ena;
+	bool int_busy;
+	uint8_t alt;
+
+	tusb_desc_endpoint_t const *iso_desc;
+
+	/* Pattern positions */
+	uint32_t out_idx;
+	uint32_t in_idx;
+	uint8_t  iso_seq;
+
+	/* Interrupt packets */
+	uint32_t int_seq;
+	uint32_t int_next;
+	uint32_t int_lfsr;
+
+	struct app_stats stats;
+
+	uint8_t echo[64] __attribute__((aligned(4)));
+	int echo_len;
+} g_app;
+
+/* Transfer buffers, the DCD copies whole words */
+static uint8_t g_app_out_buf[APP_BULK_XFER] __attribute__((aligned(4)));
+static uint8_t g_app_in_buf[APP_BULK_XFER]  __attribute__((aligned(4)));
+static uint8_t g_app_int_buf[APP_INT_MPS]   __attribute__((aligned(4)));
+static uint8_t g_app_iso_buf[APP_ISO_MPS]   __attribute__((aligned(4)));
+
+
+/* Data path */
+/* --------- */
+
+static void
+_app_bulk_out_queue(uint8_t rhport)
+{
+	usbd_edpt_xfer(rhport, APP_EP_BULK_OUT, g_app_out_buf, APP_BULK_XFER);
+}
+
+static void
+_app_bulk_in_queue(uint8_t rhport)
+{
+	for (int i=0; i<APP_BULK_XFER; i++)
+		g_app_in_buf[i] = app_pattern(g_app.in_idx + i);
+
+	usbd_edpt_xfer(rhport, APP_EP_BULK_IN, g_app_in_buf, APP_BULK_XFER);
+
+	g_app.in_idx += APP_BULK_XFER;
+	g_app.stats.in_bytes += APP_BULK_XFER;
+}
+
+static void
+_app_iso_in_queue(uint8_t rhport)
+{
+	app_iso_fill(g_app_iso_buf, g_app.iso_seq++);
+
+	usbd_edpt_xfer(rhport, APP_EP_ISO_IN, g_app_iso_buf, APP_ISO_MPS);
+
+	g_app.iso_busy = true;
+	g_app.stats.iso_pkts++;
+}
+
+static void
+_app_int_in_poll(void)
+{
+	/* Previous packet not done yet, or not time for the next one ? */
+	if (g_app.int_busy || ((int32_t)(app_now() - g_app.int_next) < 0))
+		return;
+
+	/* Time stamp just before handing it to the DCD (which arms the BD) */
+	app_int_fill(g_app_int_buf, g_app.int_seq++);
+	usbd_edpt_xfer(0, APP_EP_INT_IN, g_app_int_buf, APP_INT_MPS);
+
+	g_app.int_busy = true;
+	g_app.int_next = app_now() + app_int_gap(&g_app.int_lfsr);
+}
+
+
+/* Class driver */
+/* ------------ */
+
+static void
+_app_drv_init(void)
+{
+}
+
+static void
+_app_drv_reset(uint8_t rhport)
+{
+	(void)rhport;
+
+	g_app.iso_open = false;
+	g_app.iso_ena  = false;
+	g_app.iso_busy = false;
+	g_app.int_ena  = false;
+	g_app.int_busy = false;
+	g_app.alt      = 0;
+}
+
+static uint16_t
+_app_drv_open(uint8_t rhport, tusb_desc_interface_t const *itf, uint16_t max_len)
+{
+	uint8_t const *p = (uint8_t const *)itf;
+	uint16_t len = 0;
+
+	/* Consume all the alt settings of this interface */
+	while (len < max_len) {
+		if ((tu_desc_type(p) == TUSB_DESC_INTERFACE) &&
+		    (((tusb_desc_interface_t const *)p)->bInterfaceNumber != itf->bInterfaceNumber))
+			break;
+
+		if (tu_desc_type(p) == TUSB_DESC_ENDPOINT) {
+			tusb_desc_endpoint_t const *ep = (tusb_desc_endpoint_t const *)p;
+
+			/* Isochronous EP is only opened by SET_INTERFACE */
+			if (itf->bInterfaceNumber == 1)
+				g_app.iso_desc = ep;
+			else if (!usbd_edpt_open(rhport, ep))
+				return 0;
+		}
+
+		len += tu_desc_len(p);
+		p = tu_desc_next(p);
+	}
+
+	if (itf->bInterfaceNumber == 0) {
+		g_app.out_idx = 0;
+		g_app.in_idx  = 0;
+
+		_app_bulk_out_queue(rhport);
+		_app_bulk_in_queue(rhport);
+	}
+
+	return len;
+}
+
+static bool
+_app_drv_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *req)
+{
+	if ((req->bmRequestType_bit.type != TUSB_REQ_TYPE_STANDARD) ||
+	    (req->bmRequestType_bit.recipient != TUSB_REQ_RCPT_INTERFACE))
+		return false;
+
+	if (stage != CONTROL_STAGE_SETUP)
+		return true;
+
+	if (tu_u16_low(req->wIndex) == 0)
+		return (req->bRequest == TUSB_REQ_SET_INTERFACE) ?
+			tud_control_status(rhport, req) : false;
+
+	switch (req->bRequest) {
+	case TUSB_REQ_SET_INTERFACE:
+		if (req->wValue == 1) {
+			if (!g_app.iso_open && !usbd_edpt_open(rhport, g_app.iso_desc))
+				return false;
+			g_app.iso_open = true;
+			g_app.iso_ena  = true;
+			g_app.iso_seq  = 0;
+			if (!g_app.iso_busy)
+				_app_iso_in_queue(rhport);
+		} else {
+			g_app.iso_ena = false;
+		}
+		g_app.alt = g_app.iso_ena ? 1 : 0;
+		return tud_control_status(rhport, req);
+
+	case TUSB_REQ_GET_INTERFACE:
+		return tud_control_xfer(rhport, req, &g_app.alt, 1);
+	}
+
+	return false;
+}
+
+static bool
+_app_drv_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+	(void)result;
+
+	switch (ep_addr) {
+	case APP_EP_BULK_OUT:
+		for (uint32_t i=0; i<xferred_bytes; i++)
+			if (g_app_out_buf[i] != app_pattern(g_app.out_idx + i))
+				g_app.stats.out_errors++;
+
+		g_app.out_idx += xferred_bytes;
+		g_app.stats.out_bytes += xferred_bytes;
+
+		_app_bulk_out_queue(rhport);
+		break;
+
+	case APP_EP_BULK_IN:
+		_app_bulk_in_queue(rhport);
+		break;
+
+	case APP_EP_INT_IN:
+		g_app.int_busy = false;
+		break;
+
+	case APP_EP_ISO_IN:
+		g_app.iso_busy = false;
+		if (g_app.iso_ena)
+			_app_iso_in_queue(rhport);
+		break;
+	}
+
+	return true;
+}
+
+static const usbd_class_driver_t _app_drv = {
+	.init            = _app_drv_init,
+	.reset           = _app_drv_reset,
+	.open            = _app_drv_open,
+	.control_xfer_cb = _app_drv_control_xfer_cb,
+	.xfer_cb         = _app_drv_xfer_cb,
+};
+
+usbd_class_driver_t const *
+usbd_app_driver_get_cb(uint8_t *driver_count)
+{
+	*driver_count = 1;
+	return &_app_drv;
+}
+
+
+/* Vendor requests */
+/* --------------- */
+
+bool
+tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *req)
+{
+	if (req->bmRequestType_bit.recipient != TUSB_REQ_RCPT_DEVICE)
+		return false;
+
+	/* Echo data is only valid once the data stage is done */
+	if (stage == CONTROL_STAGE_DATA) {
+		if (req->bRequest == APP_REQ_ECHO_WRITE)
+			g_app.echo_len = req->wLength;
+		return true;
+	}
+
+	if (stage != CONTROL_STAGE_SETUP)
+		return true;
+
+	switch (req->bRequest) {
+	case APP_REQ_GET_STATS:
+		return tud_control_xfer(rhport, req, &g_app.stats, sizeof(struct app_stats));
+
+	case APP_REQ_ECHO_WRITE:
+		if (req->wLength > sizeof(g_app.echo))
+			return false;
+		return tud_control_xfer(rhport, req, g_app.echo, req->wLength);
+
+	case APP_REQ_ECHO_READ:
+		return tud_control_xfer(rhport, req, g_app.echo, g_app.echo_len);
+
+	case APP_REQ_RESET_STATS:
+		memset(&g_app.stats, 0x00, sizeof(struct app_stats));
+		g_app.out_idx = 0;
+		return tud_control_status(rhport, req);
+
+	case APP_REQ_INT_ENABLE:
+		g_app.int_ena  = (req->wValue != 0);
+		g_app.int_seq  = 0;
+		g_app.int_next = app_now();
+		g_app.int_lfsr = 0xace1;
+		return tud_control_status(rhport, req);
+
+	case APP_REQ_NOP:
+		return tud_control_status(rhport, req);
+	}
+
+	return false;
+}
+
+
+/* Exposed API */
+/* ----------- */
+
+void
+app_init(void)
+{
+	memset(&g_app, 0x00, sizeof(g_app));
+
+	tusb_init();
+}
+
+void
+app_poll(void)
+{
+	/* No interrupts natively, the handler just polls the core */
+	tud_int_handler(0);
+	tud_task();
+
+	if (g_app.int_ena)
+		_app_int_in_poll();
+}
@@ -0,0 +1,14 @@
+/*
+ * config.h
+ *
+ * Native build of the firmware for the co-simulation
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+/* Both windows are trapped by the MMIO emulation, see mmio.c */
+#define USB_CORE_BASE	0x84000000UL
+#define USB_DATA_BASE	0x85000000UL
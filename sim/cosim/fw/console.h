@@ -0,0 +1,12 @@
+/*
+ * console.h
+ *
+ * Native build of the firmware for the co-simulation
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdio.h>
@@ -0,0 +1,20 @@
+/*
+ * dcd_no2usb_config.h
+ *
+ * no2usb DCD configuration for the co-simulation (`FW=tinyusb`)
+ *
+ * The optional features matching the core parameters are passed on the
+ * command line by the Makefile.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "config.h"
+
+/* Single trapped window for both directions, see Sim::data_ops */
+#define NO2USB_CORE_BASE        USB_CORE_BASE
+#define NO2USB_DATA_RX_BASE     USB_DATA_BASE
+#define NO2USB_DATA_TX_BASE     USB_DATA_BASE
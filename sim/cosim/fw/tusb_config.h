@@ -0,0 +1,30 @@
+/*
+ * tusb_config.h
+ *
+ * tinyUSB configuration for the co-simulation (`FW=tinyusb`)
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+/* Native build, bare metal, device only */
+#define CFG_TUSB_MCU		OPT_MCU_NONE
+#define CFG_TUSB_OS		OPT_OS_NONE
+#define CFG_TUSB_DEBUG		0
+
+#define CFG_TUD_ENABLED		1
+#define CFG_TUSB_RHPORT0_MODE	OPT_MODE_DEVICE
+
+#define CFG_TUSB_MEM_ALIGN	__attribute__ ((aligned(4)))
+
+/* Device */
+#define CFG_TUD_ENDPOINT0_SIZE	64
+
+/* No built-in class, the test device is an application driver */
+#define CFG_TUD_CDC		0
+#define CFG_TUD_MSC		0
+#define CFG_TUD_HID		0
+#define CFG_TUD_MIDI		0
+#define CFG_TUD_VENDOR		0
@@ -0,0 +1,661 @@
+/*
+ * main.cpp
+ *
+ * Co-simulation of the core RTL with a firmware stack (v0 or the tinyUSB
+ * DCD) running natively and a host model driving enumeration, control,
+ * bulk, interrupt and isochronous traffic. Results are checked and
+ * benchmark figures are printed at the end, and optionally written to /
+ * compared against a reference report file.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <getopt.h>
+
+#include <verilated.h>
+
+#include "mmio.h"
+#include "sim.h"
+#include "usb_host.h"
+
+extern "C" {
+#include "fw/config.h"
+}
+#include "fw/app.h"
+
+
+#define DEV_ADDR	1
+
+#ifdef COSIM_FW_TINYUSB
+# define FW_NAME	"tinyusb"
+#else
+# define FW_NAME	"v0"
+#endif
+
+
+/* Options and results */
+/* ------------------- */
+
+struct span {
+	uint64_t n = 0;
+	uint64_t sum = 0;
+	uint64_t min = ~0ULL;
+	uint64_t max = 0;
+
+	void add(uint64_t v) {
+		n++;
+		sum += v;
+		if (v < min) min = v;
+		if (v > max) max = v;
+	}
+};
+
+struct bench {
+	/* Options */
+	unsigned ctrl_iters = 50;
+	unsigned bulk_bytes = 32768;
+	unsigned int_pkts = 100;
+	unsigned iso_frames = 50;
+
+	/* Results */
+	int errors = 0;
+
+	uint64_t enum_cycles = 0;
+	struct span ctrl_echo;
+	uint64_t ctrl_nodata_cycles = 0;
+	uint64_t ctrl_in_cycles = 0;
+	uint64_t bulk_out_cycles = 0;
+	uint64_t bulk_in_cycles = 0;
+	struct span int_lat;
+	unsigned int_missed = 0;
+	struct span iso_lat;
+	unsigned iso_bytes = 0;
+	unsigned iso_missed = 0;
+};
+
+#define CHECK(cond, ...) do {				\
+	if (!(cond)) {					\
+		fprintf(stderr, "[!] FAIL: " __VA_ARGS__);	\
+		fprintf(stderr, "\n");			\
+		b->errors++;				\
+		return;					\
+	}						\
+} while (0)
+
+
+/* Firmware time base */
+/* ------------------ */
+
+static UsbHost *g_host;
+
+extern "C" uint32_t
+app_now(void)
+{
+	return g_host->now();
+}
+
+
+/* Scenario */
+/* -------- */
+
+static void
+scenario_enumerate(UsbHost &h, struct bench *b)
+{
+	uint8_t buf[256];
+	uint64_t t0;
+	int conf_len, rv;
+
+	/* Attach + reset, then a short reset recovery */
+	h.wait_connect();
+	h.wait_us(1000);
+
+	t0 = h.now();
+
+	h.bus_reset();
+	h.wait_us(1000);
+
+	/* First 8 bytes of device descriptor at address 0 */
+	rv = h.get_descriptor(0, 1, 0, buf, 8, 8);
+	CHECK(rv == 8, "GET_DESCRIPTOR(dev, 8) @ 0 returned %d", rv);
+	CHECK((buf[0] == 18) && (buf[1] == 1), "Bad device descriptor header");
+
+	rv = h.control(0, 0x00, 0x05, DEV_ADDR, 0, 0, NULL);
+	CHECK(rv == 0, "SET_ADDRESS failed");
+
+	/* Full device and configuration descriptors */
+	rv = h.get_descriptor(DEV_ADDR, 1, 0, buf, 18);
+	CHECK(rv == 18, "GET_DESCRIPTOR(dev) returned %d", rv);
+	CHECK((buf[8] | (buf[9] << 8)) == 0x1209, "Bad idVendor");
+
+	rv = h.get_descriptor(DEV_ADDR, 2, 0, buf, 9);
+	CHECK(rv == 9, "GET_DESCRIPTOR(conf, 9) returned %d", rv);
+	conf_len = buf[2] | (buf[3] << 8);
+	CHECK(conf_len <= (int)sizeof(buf), "Configuration too large");
+
+	rv = h.get_descriptor(DEV_ADDR, 2, 0, buf, conf_len);
+	CHECK(rv == conf_len, "GET_DESCRIPTOR(conf) returned %d", rv);
+
+	/* Unknown descriptors must STALL */
+	rv = h.get_descriptor(DEV_ADDR, 3, 4, buf, 255);
+	CHECK(rv < 0, "GET_DESCRIPTOR(str 4) didn't STALL");
+
+	rv = h.control(DEV_ADDR, 0x00, 0x09, 1, 0, 0, NULL);
+	CHECK(rv == 0, "SET_CONFIGURATION failed");
+
+	b->enum_cycles = h.now() - t0;
+}
+
+static void
+scenario_control(UsbHost &h, struct bench *b)
+{
+	uint8_t tx[64], rx[64];
+
+	for (unsigned i=0; i<b->ctrl_iters; i++) {
+		int len = 1 + (i * 13) % 64;
+		uint64_t t0;
+		int rv;
+
+		for (int j=0; j<len; j++)
+			tx[j] = i + j * 3;
+
+		t0 = h.now();
+
+		rv = h.control(DEV_ADDR, 0x40, APP_REQ_ECHO_WRITE, 0, 0, len, tx);
+		CHECK(rv == len, "Echo write returned %d", rv);
+
+		rv = h.control(DEV_ADDR, 0xc0, APP_REQ_ECHO_READ, 0, 0, 64, rx);
+		CHECK(rv == len, "Echo read returned %d (expected %d)", rv, len);
+		CHECK(!memcmp(tx, rx, len), "Echo data mismatch");
+
+		b->ctrl_echo.add(h.now() - t0);
+	}
+}
+
+static void
+scenario_control_rate(UsbHost &h, struct bench *b)
+{
+	uint8_t buf[18];
+	uint64_t t0;
+	int rv;
+
+	/* Back to back requests without data stage */
+	t0 = h.now();
+
+	for (unsigned i=0; i<b->ctrl_iters; i++) {
+		rv = h.control(DEV_ADDR, 0x40, APP_REQ_NOP, 0, 0, 0, NULL);
+		CHECK(rv == 0, "NOP request failed");
+	}
+
+	b->ctrl_nodata_cycles = h.now() - t0;
+
+	/* Back to back requests with a single packet IN data stage */
+	t0 = h.now();
+
+	for (unsigned i=0; i<b->ctrl_iters; i++) {
+		rv = h.get_descriptor(DEV_ADDR, 1, 0, buf, sizeof(buf));
+		CHECK(rv == sizeof(buf), "GET_DESCRIPTOR(dev) returned %d", rv);
+	}
+
+	b->ctrl_in_cycles = h.now() - t0;
+}
+
+static void
+scenario_bulk(UsbHost &h, struct bench *b)
+{
+	static uint8_t buf[1 << 20];
+	struct app_stats st;
+	bool tog_out = false, tog_in = false;
+	unsigned len = b->bulk_bytes;
+	uint64_t t0;
+	int rv;
+
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+
+	rv = h.control(DEV_ADDR, 0x40, APP_REQ_RESET_STATS, 0, 0, 0, NULL);
+	CHECK(rv == 0, "Stats reset failed");
+
+	/* OUT */
+	for (unsigned i=0; i<len; i++)
+		buf[i] = app_pattern(i);
+
+	t0 = h.now();
+	rv = h.out(DEV_ADDR, APP_EP_BULK_OUT, buf, len, APP_BULK_MPS, tog_out);
+	b->bulk_out_cycles = h.now() - t0;
+	CHECK(rv == (int)len, "Bulk OUT returned %d", rv);
+
+	rv = h.control(DEV_ADDR, 0xc0, APP_REQ_GET_STATS, 0, 0, sizeof(st), (uint8_t *)&st);
+	CHECK(rv == sizeof(st), "Get stats returned %d", rv);
+	CHECK(st.out_bytes == len, "Device got %u bytes, expected %u", st.out_bytes, len);
+	CHECK(st.out_errors == 0, "Device saw %u corrupted bytes", st.out_errors);
+
+	/* IN */
+	t0 = h.now();
+	rv = h.in(DEV_ADDR, APP_EP_BULK_IN & 0xf, buf, len, APP_BULK_MPS, tog_in);
+	b->bulk_in_cycles = h.now() - t0;
+	CHECK(rv == (int)len, "Bulk IN returned %d", rv);
+
+	for (unsigned i=0; i<len; i++)
+		CHECK(buf[i] == app_pattern(i), "Bulk IN data mismatch @ %u", i);
+}
+
+static void
+scenario_int(UsbHost &h, struct bench *b)
+{
+	uint8_t buf[APP_INT_MPS];
+	uint32_t seq, seq_exp = 0;
+	uint64_t deadline, t_rx;
+	bool toggle = false;
+	int rv;
+
+	rv = h.control(DEV_ADDR, 0x40, APP_REQ_INT_ENABLE, 1, 0, 0, NULL);
+	CHECK(rv == 0, "Interrupt enable failed");
+
+	/* The device arms a packet every 2 to 3 ms, we poll every frame */
+	deadline = h.now() + h.us_to_cycles(1000ULL * (3 * b->int_pkts + 10));
+
+	while (b->int_lat.n < b->int_pkts) {
+		CHECK(h.now() < deadline, "Interrupt IN: only %lu packets received",
+			(unsigned long)b->int_lat.n);
+
+		h.wait_frame();
+
+		rv = h.int_in(DEV_ADDR, APP_EP_INT_IN & 0xf, buf, APP_INT_MPS, toggle, &t_rx);
+		CHECK(rv >= 0, "Interrupt IN failed");
+
+		if (!rv)
+			continue;
+
+		CHECK(rv == APP_INT_MPS, "Interrupt IN returned %d bytes", rv);
+
+		seq = app_get_u32(&buf[0]);
+		b->int_missed += seq - seq_exp;
+		seq_exp = seq + 1;
+
+		/* Latency from the device arming the BD to the end of the packet */
+		b->int_lat.add((uint32_t)t_rx - app_get_u32(&buf[4]));
+	}
+
+	rv = h.control(DEV_ADDR, 0x40, APP_REQ_INT_ENABLE, 0, 0, 0, NULL);
+	CHECK(rv == 0, "Interrupt disable failed");
+}
+
+static void
+scenario_iso(UsbHost &h, struct bench *b)
+{
+	uint8_t buf[APP_ISO_MPS], alt;
+	uint64_t t_rx;
+	int seq = -1;
+	int rv;
+
+	rv = h.control(DEV_ADDR, 0x01, 0x0b, 1, 1, 0, NULL);
+	CHECK(rv == 0, "SET_INTERFACE(1, 1) failed");
+
+	rv = h.control(DEV_ADDR, 0x81, 0x0a, 0, 1, 1, &alt);
+	CHECK((rv == 1) && (alt == 1), "GET_INTERFACE(1) failed");
+
+	/* Give the firmware a frame to queue the first packets */
+	h.wait_us(1000);
+
+	for (unsigned f=0; f<b->iso_frames; f++) {
+		/* One packet per frame, first thing after the SOF */
+		h.wait_frame();
+
+		rv = h.iso_in(DEV_ADDR, APP_EP_ISO_IN & 0xf, buf, APP_ISO_MPS, &t_rx);
+		CHECK(rv >= 0, "Isochronous IN failed");
+
+		if (rv == APP_ISO_MPS) {
+			if ((seq >= 0) && (buf[0] != ((seq + 1) & 0xff)))
+				b->iso_missed++;
+			seq = buf[0];
+			for (int i=APP_ISO_HDR; i<rv; i++)
+				CHECK(buf[i] == (i & 0xff), "Isochronous data mismatch");
+			b->iso_bytes += rv;
+
+			/* Latency from the device queuing the packet to its end */
+			b->iso_lat.add((uint32_t)t_rx - app_get_u32(&buf[1]));
+		} else {
+			b->iso_missed++;
+		}
+	}
+
+	rv = h.control(DEV_ADDR, 0x01, 0x0b, 0, 1, 0, NULL);
+	CHECK(rv == 0, "SET_INTERFACE(1, 0) failed");
+}
+
+static void
+scenario(UsbHost &h, void *arg)
+{
+	struct bench *b = (struct bench *)arg;
+
+	scenario_enumerate(h, b);
+	if (b->errors)
+		return;
+
+	scenario_control(h, b);
+	if (b->errors)
+		return;
+
+	scenario_control_rate(h, b);
+	if (b->errors)
+		return;
+
+	scenario_bulk(h, b);
+	if (b->errors)
+		return;
+
+	if (b->int_pkts)
+		scenario_int(h, b);
+	if (b->errors)
+		return;
+
+	if (b->iso_frames)
+		scenario_iso(h, b);
+}
+
+
+/* Report */
+/* ------ */
+
+struct metric {
+	const char *name;
+	const char *unit;
+	int better;		/* +1 higher is better, -1 lower is better */
+	double val;
+};
+
+static std::vector<struct metric>
+metrics(const UsbHost &h, const struct bench *b)
+{
+	const UsbHost::Stats &s = h.stats();
+	std::vector<struct metric> m;
+
+	auto us = [&](double c) { return h.cycles_to_us(c); };
+	auto per_s = [&](unsigned n, uint64_t c) { return n / us(c) * 1e6; };
+	auto kBps = [&](unsigned n, uint64_t c) { return n / us(c) * 1e3; };
+
+	if (s.lat_n) {
+		m.push_back({ "turnaround_avg",    "bits", -1, (double)s.lat_sum / s.lat_n });
+		m.push_back({ "turnaround_max",    "bits", -1, (double)s.lat_max });
+	}
+
+	if (b->enum_cycles)
+		m.push_back({ "enum_time",         "ms",   -1, us(b->enum_cycles) / 1000.0 });
+
+	if (b->ctrl_echo.n) {
+		m.push_back({ "ctrl_echo_avg",     "us",   -1, us(b->ctrl_echo.sum) / b->ctrl_echo.n });
+		m.push_back({ "ctrl_echo_max",     "us",   -1, us(b->ctrl_echo.max) });
+	}
+
+	if (b->ctrl_nodata_cycles)
+		m.push_back({ "ctrl_nodata_rate",  "/s",   +1, per_s(b->ctrl_iters, b->ctrl_nodata_cycles) });
+
+	if (b->ctrl_in_cycles)
+		m.push_back({ "ctrl_in_rate",      "/s",   +1, per_s(b->ctrl_iters, b->ctrl_in_cycles) });
+
+	if (b->bulk_out_cycles)
+		m.push_back({ "bulk_out",          "kB/s", +1, kBps(b->bulk_bytes, b->bulk_out_cycles) });
+
+	if (b->bulk_in_cycles)
+		m.push_back({ "bulk_in",           "kB/s", +1, kBps(b->bulk_bytes, b->bulk_in_cycles) });
+
+	if (b->int_lat.n) {
+		m.push_back({ "int_lat_min",       "us",   -1, us(b->int_lat.min) });
+		m.push_back({ "int_lat_avg",       "us",   -1, us(b->int_lat.sum) / b->int_lat.n });
+		m.push_back({ "int_lat_max",       "us",   -1, us(b->int_lat.max) });
+		m.push_back({ "int_missed",        "pkts", -1, (double)b->int_missed });
+	}
+
+	if (b->iso_lat.n) {
+		m.push_back({ "iso_lat_avg",       "us",   -1, us(b->iso_lat.sum) / b->iso_lat.n });
+		m.push_back({ "iso_jitter",        "us",   -1, us(b->iso_lat.max - b->iso_lat.min) });
+	}
+
+	if (b->iso_frames)
+		m.push_back({ "iso_missed",        "pkts", -1, (double)b->iso_missed });
+
+	return m;
+}
+
+static void
+report(const UsbHost &h, const struct bench *b)
+{
+	const UsbHost::Stats &s = h.stats();
+	double bus_ms = h.cycles_to_us(h.now()) / 1000.0;
+
+	printf("Firmware            : %s\n", FW_NAME);
+	printf("Bus time            : %.3f ms\n", bus_ms);
+	printf("Transactions        : %lu ACK, %lu NAK, %lu STALL, %lu timeout, %lu error, %lu iso\n",
+		(unsigned long)s.res[UsbHost::RES_ACK],
+		(unsigned long)s.res[UsbHost::RES_NAK],
+		(unsigned long)s.res[UsbHost::RES_STALL],
+		(unsigned long)s.res[UsbHost::RES_TIMEOUT],
+		(unsigned long)s.res[UsbHost::RES_ERROR],
+		(unsigned long)s.res[UsbHost::RES_ISO]);
+	printf("SOFs / CRC errors   : %lu / %lu\n", (unsigned long)s.sof, (unsigned long)s.crc_err);
+
+	if (s.lat_n)
+		printf("Device turnaround   : min %u, avg %.2f, max %u bit times\n",
+			s.lat_min, (double)s.lat_sum / s.lat_n, s.lat_max);
+
+	if (b->enum_cycles)
+		printf("Enumeration         : %.3f ms (from bus reset)\n",
+			h.cycles_to_us(b->enum_cycles) / 1000.0);
+
+	if (b->ctrl_echo.n)
+		printf("Control echo W+R    : min %.1f, avg %.1f, max %.1f us\n",
+			h.cycles_to_us(b->ctrl_echo.min),
+			h.cycles_to_us(b->ctrl_echo.sum) / b->ctrl_echo.n,
+			h.cycles_to_us(b->ctrl_echo.max));
+
+	if (b->ctrl_nodata_cycles && b->ctrl_in_cycles)
+		printf("Control rate        : %.0f/s no data, %.0f/s IN (18 bytes)\n",
+			b->ctrl_iters / h.cycles_to_us(b->ctrl_nodata_cycles) * 1e6,
+			b->ctrl_iters / h.cycles_to_us(b->ctrl_in_cycles) * 1e6);
+
+	if (b->bulk_out_cycles)
+		printf("Bulk OUT throughput : %.1f kB/s\n",
+			b->bulk_bytes / h.cycles_to_us(b->bulk_out_cycles) * 1000.0);
+
+	if (b->bulk_in_cycles)
+		printf("Bulk IN throughput  : %.1f kB/s\n",
+			b->bulk_bytes / h.cycles_to_us(b->bulk_in_cycles) * 1000.0);
+
+	if (b->int_lat.n)
+		printf("Interrupt IN        : %lu packets, %u missed, latency min %.1f, avg %.1f, max %.1f us\n",
+			(unsigned long)b->int_lat.n, b->int_missed,
+			h.cycles_to_us(b->int_lat.min),
+			h.cycles_to_us(b->int_lat.sum) / b->int_lat.n,
+			h.cycles_to_us(b->int_lat.max));
+
+	if (b->iso_frames)
+		printf("Isochronous IN      : %u bytes in %u frames, %u missed\n",
+			b->iso_bytes, b->iso_frames, b->iso_missed);
+
+	if (b->iso_lat.n)
+		printf("Isochronous latency : min %.1f, avg %.1f, max %.1f us (jitter %.1f us)\n",
+			h.cycles_to_us(b->iso_lat.min),
+			h.cycles_to_us(b->iso_lat.sum) / b->iso_lat.n,
+			h.cycles_to_us(b->iso_lat.max),
+			h.cycles_to_us(b->iso_lat.max - b->iso_lat.min));
+}
+
+static int
+report_write(const char *fn, const std::vector<struct metric> &m)
+{
+	FILE *fh = fopen(fn, "w");
+
+	if (!fh) {
+		perror(fn);
+		return -1;
+	}
+
+	fprintf(fh, "# cosim benchmark, firmware %s, CLK_FREQ %u\n", FW_NAME, (unsigned)CLK_FREQ);
+	fprintf(fh, "# name value unit (+ higher / - lower is better)\n");
+
+	for (const struct metric &x : m)
+		fprintf(fh, "%s %.3f %s %c\n", x.name, x.val, x.unit, (x.better > 0) ? '+' : '-');
+
+	fclose(fh);
+
+	return 0;
+}
+
+static int
+report_check(const char *fn, const std::vector<struct metric> &m, double tol)
+{
+	char line[256], name[64];
+	double ref;
+	FILE *fh;
+	int n_regress = 0;
+
+	fh = fopen(fn, "r");
+	if (!fh) {
+		perror(fn);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fh)) {
+		if ((line[0] == '#') || (sscanf(line, "%63s %lf", name, &ref) != 2))
+			continue;
+
+		for (const struct metric &x : m) {
+			bool regress;
+
+			if (strcmp(x.name, name))
+				continue;
+
+			if (x.better > 0)
+				regress = x.val < (ref * (1.0 - tol / 100.0));
+			else
+				regress = x.val > (ref * (1.0 + tol / 100.0));
+
+			if (regress) {
+				printf("REGRESSION %-18s %12.3f %s (reference %.3f)\n",
+					x.name, x.val, x.unit, ref);
+				n_regress++;
+			}
+		}
+	}
+
+	fclose(fh);
+
+	return n_regress;
+}
+
+
+/* Main */
+/* ---- */
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -c N    Control iterations (default 50)\n"
+		"  -b N    Bulk bytes per direction (default 32768)\n"
+		"  -n N    Interrupt packets (default 100, 0 disables)\n"
+		"  -i N    Isochronous frames (default 50, 0 disables)\n"
+		"  -w N    Extra cycles per CPU bus access (default 4)\n"
+		"  -t MS   Abort after MS of bus time (default 10000)\n"
+		"  -o FILE Write the benchmark report\n"
+		"  -r FILE Compare against a reference report\n"
+		"  -T PCT  Tolerance of the comparison (default 2)\n"
+		"  -v FILE Dump a VCD trace (needs TRACE_VCD=1 build)\n",
+		argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench b;
+	unsigned cpu_wait = 4;
+	unsigned max_ms = 10000;
+	const char *vcd = NULL;
+	const char *fn_out = NULL, *fn_ref = NULL;
+	double tol = 2.0;
+	int n_regress = 0;
+	int opt;
+
+	Verilated::commandArgs(argc, argv);
+
+	while ((opt = getopt(argc, argv, "c:b:n:i:w:t:o:r:T:v:h")) != -1) {
+		switch (opt) {
+		case 'c': b.ctrl_iters = strtoul(optarg, NULL, 0); break;
+		case 'b': b.bulk_bytes = strtoul(optarg, NULL, 0); break;
+		case 'n': b.int_pkts   = strtoul(optarg, NULL, 0); break;
+		case 'i': b.iso_frames = strtoul(optarg, NULL, 0); break;
+		case 'w': cpu_wait     = strtoul(optarg, NULL, 0); break;
+		case 't': max_ms       = strtoul(optarg, NULL, 0); break;
+		case 'o': fn_out       = optarg; break;
+		case 'r': fn_ref       = optarg; break;
+		case 'T': tol          = atof(optarg); break;
+		case 'v': vcd          = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* Model */
+	UsbHost host(CLK_FREQ);
+	Sim sim(host, cpu_wait);
+
+	g_host = &host;
+
+	if (vcd)
+		sim.trace(vcd);
+
+	/* Map the core into the firmware address space */
+	if (mmio_init() ||
+	    mmio_map(USB_CORE_BASE, 1 << 14, &Sim::core_ops, &sim) ||
+	    mmio_map(USB_DATA_BASE, 1 << 12, &Sim::data_ops, &sim))
+		return 1;
+
+	/* Run */
+	host.start(scenario, &b);
+
+	app_init();
+
+	while (!host.done()) {
+		app_poll();
+
+		/* Main loop overhead, also keeps time moving when the
+		 * firmware has nothing to access */
+		sim.tick();
+
+		host.resume();
+
+		if (host.cycles_to_us(host.now()) > (max_ms * 1000.0)) {
+			fprintf(stderr, "[!] FAIL: Timeout\n");
+			b.errors++;
+			break;
+		}
+	}
+
+	/* Report */
+	report(host, &b);
+
+	if (!b.errors) {
+		std::vector<struct metric> m = metrics(host, &b);
+
+		if (fn_out && report_write(fn_out, m))
+			return 1;
+
+		if (fn_ref) {
+			n_regress = report_check(fn_ref, m, tol);
+			if (n_regress < 0)
+				return 1;
+		}
+	}
+
+	printf("%s\n", (b.errors || n_regress) ? "FAIL" : "PASS");
+
+	return (b.errors || n_regress) ? 1 : 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * mmio.c
+ *
+ * Trap-and-emulate MMIO to run unmodified firmware natively
+ *
+ * The register windows are mapped without any access rights so that every
+ * load / store to them faults. The SIGSEGV handler decodes the faulting
+ * instruction, forwards the access to the region backend, updates the
+ * register file and skips the instruction.
+ *
+ * Only x86-64 Linux is supported and only plain `mov` / `movzx` / `movsx`
+ * forms are decoded, which is what GCC emits for volatile accesses (it
+ * never folds them into arithmetic instructions, clang might).
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#include "mmio.h"
+
+#if !defined(__x86_64__) || !defined(__linux__)
+# error "MMIO emulation only supports x86-64 Linux"
+#endif
+
+#if !defined(__GNUC__) || defined(__clang__)
+# error "Firmware must be built with GCC, see above"
+#endif
+
+
+#define MMIO_MAX_REGIONS	4
+
+struct mmio_region {
+	uintptr_t base;
+	size_t size;
+	const struct mmio_ops *ops;
+	void *ctx;
+};
+
+static struct {
+	struct mmio_region regions[MMIO_MAX_REGIONS];
+	int n_regions;
+} g_mmio;
+
+/* x86 register number to ucontext index */
+static const int greg_map[16] = {
+	REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+	REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+
+/* Helpers */
+/* ------- */
+
+static struct mmio_region *
+_mmio_find(uintptr_t addr)
+{
+	for (int i=0; i<g_mmio.n_regions; i++) {
+		struct mmio_region *r = &g_mmio.regions[i];
+		if ((addr >= r->base) && (addr < (r->base + r->size)))
+			return r;
+	}
+	return NULL;
+}
+
+static uint64_t
+_mmio_read(struct mmio_region *r, uint32_t ofs, int size)
+{
+	if (size == 8)
+		return  (uint64_t)r->ops->read(r->ctx, ofs, 4) |
+		       ((uint64_t)r->ops->read(r->ctx, ofs + 4, 4) << 32);
+	return r->ops->read(r->ctx, ofs, size) & (0xffffffffULL >> (32 - 8 * size));
+}
+
+static void
+_mmio_write(struct mmio_region *r, uint32_t ofs, uint64_t val, int size)
+{
+	if (size == 8) {
+		r->ops->write(r->ctx, ofs,     val & 0xffffffff, 4);
+		r->ops->write(r->ctx, ofs + 4, val >> 32, 4);
+		return;
+	}
+	r->ops->write(r->ctx, ofs, val & (0xffffffffULL >> (32 - 8 * size)), size);
+}
+
+static uint64_t
+_reg_read(greg_t *gr, int reg, int size, bool rex)
+{
+	/* Legacy high byte registers (AH, CH, DH, BH) */
+	if ((size == 1) && !rex && (reg >= 4) && (reg < 8))
+		return (gr[greg_map[reg - 4]] >> 8) & 0xff;
+
+	return (uint64_t)gr[greg_map[reg]] & (0xffffffffffffffffULL >> (64 - 8 * size));
+}
+
+static void
+_reg_write(greg_t *gr, int reg, int size, uint64_t val, bool rex)
+{
+	uint64_t *p;
+
+	/* Legacy high byte registers (AH, CH, DH, BH) */
+	if ((size == 1) && !rex && (reg >= 4) && (reg < 8)) {
+		p = (uint64_t *)&gr[greg_map[reg - 4]];
+		*p = (*p & ~0xff00ULL) | ((val & 0xff) << 8);
+		return;
+	}
+
+	p = (uint64_t *)&gr[greg_map[reg]];
+
+	switch (size) {
+	case 1: *p = (*p & ~0xffULL)   | (val & 0xff);   break;
+	case 2: *p = (*p & ~0xffffULL) | (val & 0xffff); break;
+	case 4: *p = val & 0xffffffffULL; break;	/* Zero extends */
+	case 8: *p = val; break;
+	}
+}
+
+static uint64_t
+_sext(uint64_t v, int size)
+{
+	int s = 64 - 8 * size;
+	return (uint64_t)(((int64_t)(v << s)) >> s);
+}
+
+static void __attribute__((noreturn))
+_mmio_fatal(const uint8_t *ip, uintptr_t addr)
+{
+	fprintf(stderr, "[!] MMIO: unsupported instruction at %p accessing %#lx:",
+		(const void *)ip, (unsigned long)addr);
+	for (int i=0; i<8; i++)
+		fprintf(stderr, " %02x", ip[i]);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+
+/* Fault handler */
+/* ------------- */
+
+static void
+_mmio_sigsegv(int sig, siginfo_t *si, void *uctx_v)
+{
+	ucontext_t *uc = uctx_v;
+	greg_t *gr = uc->uc_mcontext.gregs;
+	const uint8_t *ip0 = (const uint8_t *)gr[REG_RIP];
+	const uint8_t *ip = ip0;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+	struct mmio_region *r;
+	uint32_t ofs;
+	int opsize = 4;
+	int asize = 8;
+	uint8_t rex = 0;
+	uint8_t op, modrm;
+	int mod, reg, rm;
+	bool two_byte = false;
+
+	/* Is this for us ? */
+	r = _mmio_find(addr);
+	if (!r) {
+		/* Real crash, let it happen with the default handler */
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	ofs = addr - r->base;
+
+	/* Prefixes */
+	for (;;) {
+		if (*ip == 0x66)
+			opsize = 2;
+		else if (*ip == 0x67)
+			asize = 4;
+		else if ((*ip != 0x2e) && (*ip != 0x3e) && (*ip != 0x26) &&
+		         (*ip != 0x36) && (*ip != 0x64) && (*ip != 0x65))
+			break;
+		ip++;
+	}
+
+	if ((*ip & 0xf0) == 0x40)
+		rex = *ip++;
+
+	if (rex & 0x08)
+		opsize = 8;
+
+	/* Opcode */
+	op = *ip++;
+
+	/* Absolute address forms (no ModR/M), used for constant addresses */
+	if ((op >= 0xa0) && (op <= 0xa3)) {
+		int size = (op & 1) ? opsize : 1;
+
+		if (op & 2)
+			_mmio_write(r, ofs, _reg_read(gr, 0, size, true), size);
+		else
+			_reg_write(gr, 0, size, _mmio_read(r, ofs, size), true);
+
+		gr[REG_RIP] = (greg_t)(ip + asize);
+		return;
+	}
+	if (op == 0x0f) {
+		two_byte = true;
+		op = *ip++;
+	}
+
+	/* ModR/M, SIB and displacement (only needed for the length) */
+	modrm = *ip++;
+	mod = modrm >> 6;
+	reg = ((modrm >> 3) & 7) | ((rex & 0x04) ? 8 : 0);
+	rm  = modrm & 7;
+
+	if (mod == 3)
+		_mmio_fatal(ip0, addr);
+
+	if (rm == 4) {
+		uint8_t sib = *ip++;
+		if ((mod == 0) && ((sib & 7) == 5))
+			ip += 4;
+	}
+
+	if ((mod == 0) && (rm == 5))
+		ip += 4;
+	else if (mod == 1)
+		ip += 1;
+	else if (mod == 2)
+		ip += 4;
+
+	/* Execute */
+	if (!two_byte) {
+		switch (op) {
+		case 0x8a:	/* mov r8, m8 */
+			_reg_write(gr, reg, 1, _mmio_read(r, ofs, 1), rex);
+			break;
+
+		case 0x8b:	/* mov r, m */
+			_reg_write(gr, reg, opsize, _mmio_read(r, ofs, opsize), rex);
+			break;
+
+		case 0x88:	/* mov m8, r8 */
+			_mmio_write(r, ofs, _reg_read(gr, reg, 1, rex), 1);
+			break;
+
+		case 0x89:	/* mov m, r */
+			_mmio_write(r, ofs, _reg_read(gr, reg, opsize, rex), opsize);
+			break;
+
+		case 0xc6:	/* mov m8, imm8 */
+			_mmio_write(r, ofs, ip[0], 1);
+			ip += 1;
+			break;
+
+		case 0xc7:	/* mov m, imm16/32 (sign extended for 64) */
+			if (opsize == 2) {
+				_mmio_write(r, ofs, ip[0] | (ip[1] << 8), 2);
+				ip += 2;
+			} else {
+				uint32_t imm;
+				memcpy(&imm, ip, 4);
+				_mmio_write(r, ofs, (opsize == 8) ? _sext(imm, 4) : imm, opsize);
+				ip += 4;
+			}
+			break;
+
+		default:
+			_mmio_fatal(ip0, addr);
+		}
+	} else {
+		switch (op) {
+		case 0xb6:	/* movzx r, m8 */
+			_reg_write(gr, reg, opsize, _mmio_read(r, ofs, 1), rex);
+			break;
+
+		case 0xb7:	/* movzx r, m16 */
+			_reg_write(gr, reg, opsize, _mmio_read(r, ofs, 2), rex);
+			break;
+
+		case 0xbe:	/* movsx r, m8 */
+			_reg_write(gr, reg, opsize, _sext(_mmio_read(r, ofs, 1), 1), rex);
+			break;
+
+		case 0xbf:	/* movsx r, m16 */
+			_reg_write(gr, reg, opsize, _sext(_mmio_read(r, ofs, 2), 2), rex);
+			break;
+
+		default:
+			_mmio_fatal(ip0, addr);
+		}
+	}
+
+	/* Skip the instruction */
+	gr[REG_RIP] = (greg_t)ip;
+}
+
+
+/* Exposed API */
+/* ----------- */
+
+int
+mmio_init(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sa_sigaction = _mmio_sigsegv;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+
+	return sigaction(SIGSEGV, &sa, NULL);
+}
+
+int
+mmio_map(uintptr_t base, size_t size, const struct mmio_ops *ops, void *ctx)
+{
+	struct mmio_region *r;
+	void *p;
+
+	if (g_mmio.n_regions == MMIO_MAX_REGIONS)
+		return -1;
+
+	p = mmap((void *)base, size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)base) {
+		fprintf(stderr, "[!] MMIO: unable to reserve %#lx-%#lx\n",
+			(unsigned long)base, (unsigned long)(base + size - 1));
+		if (p != MAP_FAILED)
+			munmap(p, size);
+		return -1;
+	}
+
+	r = &g_mmio.regions[g_mmio.n_regions++];
+	r->base = base;
+	r->size = size;
+	r->ops  = ops;
+	r->ctx  = ctx;
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * mmio.h
+ *
+ * Trap-and-emulate MMIO to run unmodified firmware natively
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mmio_ops {
+	uint32_t (*read)(void *ctx, uint32_t ofs, int size);
+	void     (*write)(void *ctx, uint32_t ofs, uint32_t val, int size);
+};
+
+int mmio_init(void);
+int mmio_map(uintptr_t base, size_t size, const struct mmio_ops *ops, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
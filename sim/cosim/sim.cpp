@@ -0,0 +1,233 @@
+/*
+ * sim.cpp
+ *
+ * Verilated core model with the CPU side bus / buffer accessors
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <verilated.h>
+#if VM_TRACE
+# include <verilated_vcd_c.h>
+#endif
+
+#include "Vcosim_top.h"
+
+#include "mmio.h"
+#include "sim.h"
+#include "usb_host.h"
+
+
+#define WB_TIMEOUT	64
+
+
+Sim::Sim(UsbHost &host, unsigned cpu_wait) :
+	m_top(new Vcosim_top),
+	m_host(host),
+	m_cpu_wait(cpu_wait)
+{
+	m_top->host_oe = 0;
+	m_top->wb_cyc = 0;
+	m_top->wb_we = 0;
+	m_top->ep_tx_we_0 = 0;
+	m_top->ep_rx_re_0 = 0;
+
+	/* Reset */
+	m_top->rst = 1;
+	for (int i=0; i<16; i++)
+		tick();
+	m_top->rst = 0;
+}
+
+Sim::~Sim()
+{
+#if VM_TRACE
+	if (m_vcd) {
+		m_vcd->close();
+		delete m_vcd;
+	}
+#endif
+	m_top->final();
+	delete m_top;
+}
+
+void
+Sim::trace(const char *filename)
+{
+#if VM_TRACE
+	Verilated::traceEverOn(true);
+	m_vcd = new VerilatedVcdC;
+	m_top->trace(m_vcd, 99);
+	m_vcd->open(filename);
+#else
+	fprintf(stderr, "[!] Tracing not compiled in (build with TRACE_VCD=1)\n");
+	(void)filename;
+#endif
+}
+
+void
+Sim::tick()
+{
+	/* Host drives for this cycle */
+	m_top->host_oe = m_host.oe();
+	m_top->host_dp = m_host.dp();
+	m_top->host_dn = m_host.dn();
+
+	/* Clock */
+	m_top->clk = 0;
+	m_top->eval();
+#if VM_TRACE
+	if (m_vcd)
+		m_vcd->dump(2 * m_cycles);
+#endif
+
+	m_top->clk = 1;
+	m_top->eval();
+#if VM_TRACE
+	if (m_vcd)
+		m_vcd->dump(2 * m_cycles + 1);
+#endif
+
+	m_cycles++;
+
+	/* Host samples the bus */
+	m_host.tick(m_top->bus_dp, m_top->bus_dn, m_top->bus_pu);
+}
+
+void
+Sim::_cpu_wait()
+{
+	for (unsigned i=0; i<m_cpu_wait; i++)
+		tick();
+}
+
+uint32_t
+Sim::wb_read(uint32_t addr)
+{
+	uint32_t v;
+	int to = WB_TIMEOUT;
+
+	_cpu_wait();
+
+	m_top->wb_addr = addr;
+	m_top->wb_we = 0;
+	m_top->wb_cyc = 1;
+
+	do {
+		tick();
+		if (!--to) {
+			fprintf(stderr, "[!] Wishbone read timeout @ %03x\n", addr);
+			abort();
+		}
+	} while (!m_top->wb_ack);
+
+	v = m_top->wb_rdata;
+
+	/* Ack is sampled on the next edge, together with cyc dropping */
+	m_top->wb_cyc = 0;
+	tick();
+
+	return v;
+}
+
+void
+Sim::wb_write(uint32_t addr, uint32_t data)
+{
+	int to = WB_TIMEOUT;
+
+	_cpu_wait();
+
+	m_top->wb_addr = addr;
+	m_top->wb_wdata = data;
+	m_top->wb_we = 1;
+	m_top->wb_cyc = 1;
+
+	do {
+		tick();
+		if (!--to) {
+			fprintf(stderr, "[!] Wishbone write timeout @ %03x\n", addr);
+			abort();
+		}
+	} while (!m_top->wb_ack);
+
+	m_top->wb_cyc = 0;
+	m_top->wb_we = 0;
+	tick();
+}
+
+uint32_t
+Sim::buf_read(uint32_t addr)
+{
+	_cpu_wait();
+
+	m_top->ep_rx_addr_0 = addr;
+	m_top->ep_rx_re_0 = 1;
+	tick();
+	m_top->ep_rx_re_0 = 0;
+
+	return m_top->ep_rx_data_1;
+}
+
+void
+Sim::buf_write(uint32_t addr, uint32_t data)
+{
+	_cpu_wait();
+
+	m_top->ep_tx_addr_0 = addr;
+	m_top->ep_tx_data_0 = data;
+	m_top->ep_tx_we_0 = 1;
+	tick();
+	m_top->ep_tx_we_0 = 0;
+}
+
+
+/* MMIO backends */
+/* ------------- */
+
+	/* Registers: 32 bit aligned words, 16 or 32 bits wide */
+
+static uint32_t
+_core_read(void *ctx, uint32_t ofs, int size)
+{
+	Sim *sim = (Sim *)ctx;
+	uint32_t v = sim->wb_read((ofs >> 2) & 0xfff);
+	return v >> (8 * (ofs & 3));
+}
+
+static void
+_core_write(void *ctx, uint32_t ofs, uint32_t val, int size)
+{
+	Sim *sim = (Sim *)ctx;
+	sim->wb_write((ofs >> 2) & 0xfff, val << (8 * (ofs & 3)));
+}
+
+const struct mmio_ops Sim::core_ops = {
+	.read  = _core_read,
+	.write = _core_write,
+};
+
+	/* Data: writes go to the TX buffer, reads come from the RX buffer */
+
+static uint32_t
+_data_read(void *ctx, uint32_t ofs, int size)
+{
+	Sim *sim = (Sim *)ctx;
+	uint32_t v = sim->buf_read((ofs >> 2) & 0x1ff);
+	return v >> (8 * (ofs & 3));
+}
+
+static void
+_data_write(void *ctx, uint32_t ofs, uint32_t val, int size)
+{
+	Sim *sim = (Sim *)ctx;
+	sim->buf_write((ofs >> 2) & 0x1ff, val << (8 * (ofs & 3)));
+}
+
+const struct mmio_ops Sim::data_ops = {
+	.read  = _data_read,
+	.write = _data_write,
+};
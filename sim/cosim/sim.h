@@ -0,0 +1,51 @@
+/*
+ * sim.h
+ *
+ * Verilated core model with the CPU side bus / buffer accessors
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "mmio.h"
+
+class Vcosim_top;
+class VerilatedVcdC;
+class UsbHost;
+
+
+class Sim {
+public:
+	Sim(UsbHost &host, unsigned cpu_wait);
+	~Sim();
+
+	void tick();
+	uint64_t cycles() const { return m_cycles; }
+
+	void trace(const char *filename);
+
+	/* Wishbone master, one access at a time */
+	uint32_t wb_read(uint32_t addr);
+	void wb_write(uint32_t addr, uint32_t data);
+
+	/* EP buffer ports (32 bit words) */
+	uint32_t buf_read(uint32_t addr);
+	void buf_write(uint32_t addr, uint32_t data);
+
+	/* MMIO region backends */
+	static const struct mmio_ops core_ops;
+	static const struct mmio_ops data_ops;
+
+private:
+	Vcosim_top *m_top;
+	VerilatedVcdC *m_vcd = nullptr;
+	UsbHost &m_host;
+	unsigned m_cpu_wait;
+	uint64_t m_cycles = 0;
+
+	void _cpu_wait();
+};
@@ -0,0 +1,911 @@
+/*
+ * usb_host.cpp
+ *
+ * Cycle level USB Full-Speed host bus functional model
+ *
+ * The bus engine is a state machine clocked with the core, it serializes
+ * packets (NRZI, bit stuffing, EOP), recovers the device packets with a
+ * simple DPLL and sequences full transactions (token, data, handshake)
+ * while inserting SOFs every millisecond.
+ *
+ * The test scenario runs as a coroutine and uses a blocking API. It is
+ * only resumed from the main loop, never from within the clock tick, so
+ * the engine timing doesn't depend on how the scenario is written.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "usb_host.h"
+
+
+#define CO_STACK_SIZE		(256 * 1024)
+
+#define RX_TIMEOUT_BITS		18	/* Host response timeout */
+#define RX_MAX_BITS		(1030 * 8 * 7 / 6 + 64)
+#define IPG_BITS		2	/* Inter packet gap we insert */
+
+
+/* Helpers */
+/* ------- */
+
+static uint8_t
+crc5(uint16_t v)
+{
+	uint8_t crc = 0x1f;
+
+	for (int i=0; i<11; i++) {
+		if ((crc ^ (v >> i)) & 1)
+			crc = (crc >> 1) ^ 0x14;
+		else
+			crc >>= 1;
+	}
+
+	return crc ^ 0x1f;
+}
+
+static uint16_t
+crc16(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xffff;
+
+	for (size_t i=0; i<len; i++) {
+		crc ^= data[i];
+		for (int j=0; j<8; j++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xa001) : (crc >> 1);
+	}
+
+	return crc ^ 0xffff;
+}
+
+
+/* Setup */
+/* ----- */
+
+UsbHost::UsbHost(unsigned clk_freq) :
+	m_clk_freq(clk_freq),
+	m_cpb(clk_freq / 12000000),
+	m_frame_cycles(clk_freq / 1000)
+{
+}
+
+UsbHost::~UsbHost()
+{
+	free(m_co_stack);
+}
+
+
+/* Scenario coroutine */
+/* ------------------ */
+
+static UsbHost *g_co_host;
+
+void
+UsbHost::_co_entry()
+{
+	UsbHost *h = g_co_host;
+
+	h->m_co_fn(*h, h->m_co_arg);
+	h->m_co_done = true;
+
+	/* Return to the main loop for good (uc_link) */
+}
+
+void
+UsbHost::start(scenario_fn fn, void *arg)
+{
+	m_co_fn  = fn;
+	m_co_arg = arg;
+	m_co_done = false;
+
+	if (!m_co_stack)
+		m_co_stack = malloc(CO_STACK_SIZE);
+
+	getcontext(&m_co_ctx);
+	m_co_ctx.uc_stack.ss_sp   = m_co_stack;
+	m_co_ctx.uc_stack.ss_size = CO_STACK_SIZE;
+	m_co_ctx.uc_link = &m_main_ctx;
+
+	g_co_host = this;
+	makecontext(&m_co_ctx, _co_entry, 0);
+}
+
+void
+UsbHost::resume()
+{
+	/* Anything to resume ? */
+	if (m_co_done)
+		return;
+
+	/* Still waiting on something ? */
+	if (m_wait_xact && !m_wait_xact->done)
+		return;
+
+	if (m_cycle < m_wait_until)
+		return;
+
+	if (m_wait_pu && !m_pu)
+		return;
+
+	/* Run until the next blocking call */
+	m_wait_xact = nullptr;
+	m_wait_pu = false;
+
+	swapcontext(&m_main_ctx, &m_co_ctx);
+}
+
+void
+UsbHost::_yield()
+{
+	swapcontext(&m_co_ctx, &m_main_ctx);
+}
+
+
+/* Bus engine */
+/* ---------- */
+
+void
+UsbHost::_drive(int line)
+{
+	m_oe = true;
+	m_dp = (line & 1) != 0;
+	m_dn = (line & 2) != 0;
+}
+
+void
+UsbHost::_release()
+{
+	m_oe = false;
+	m_dp = true;
+	m_dn = false;
+}
+
+void
+UsbHost::_tx_packet(const std::vector<uint8_t> &pkt)
+{
+	int lvl = LINE_J;
+	int ones = 0;
+
+	m_tx_syms.clear();
+
+	auto bit = [&](int b) {
+		if (b) {
+			ones++;
+		} else {
+			lvl ^= 3;
+			ones = 0;
+		}
+		m_tx_syms.push_back(lvl);
+		if (ones == 6) {
+			lvl ^= 3;
+			ones = 0;
+			m_tx_syms.push_back(lvl);
+		}
+	};
+
+	/* SYNC, payload LSB first, EOP */
+	for (int i=0; i<8; i++)
+		bit(i == 7);
+
+	for (uint8_t byte : pkt)
+		for (int i=0; i<8; i++)
+			bit((byte >> i) & 1);
+
+	m_tx_syms.push_back(LINE_SE0);
+	m_tx_syms.push_back(LINE_SE0);
+	m_tx_syms.push_back(LINE_J);
+
+	/* Start */
+	m_tx_pos = 0;
+	m_cnt = m_cpb;
+	m_state = ST_TX;
+	_drive(m_tx_syms[0]);
+}
+
+void
+UsbHost::_tx_token(uint8_t pid, uint16_t v)
+{
+	v = (v & 0x7ff) | (crc5(v) << 11);
+	_tx_packet({ (uint8_t)(pid | ((pid ^ 0xf) << 4)), (uint8_t)(v & 0xff), (uint8_t)(v >> 8) });
+}
+
+void
+UsbHost::_tx_data(uint8_t pid, const std::vector<uint8_t> &data)
+{
+	std::vector<uint8_t> pkt;
+	uint16_t crc = crc16(data.data(), data.size());
+
+	pkt.push_back(pid | ((pid ^ 0xf) << 4));
+	pkt.insert(pkt.end(), data.begin(), data.end());
+	pkt.push_back(crc & 0xff);
+	pkt.push_back(crc >> 8);
+
+	_tx_packet(pkt);
+}
+
+void
+UsbHost::_tx_handshake(uint8_t pid)
+{
+	_tx_packet({ (uint8_t)(pid | ((pid ^ 0xf) << 4)) });
+}
+
+void
+UsbHost::_rx_wait()
+{
+	m_cnt = RX_TIMEOUT_BITS * m_cpb;
+	m_state = ST_RX_WAIT;
+}
+
+void
+UsbHost::_gap(unsigned bits)
+{
+	m_cnt = bits * m_cpb;
+	m_state = ST_GAP;
+}
+
+void
+UsbHost::_rx_decode()
+{
+	std::vector<uint8_t> bits;
+	int prev = LINE_J;
+	int ones = 0;
+
+	m_rx_data.clear();
+	m_rx_status = RX_ERROR;
+
+	/* NRZI decode and bit de-stuffing */
+	for (uint8_t sym : m_rx_syms) {
+		int b;
+
+		if (sym == LINE_SE0)
+			break;
+		if (sym == LINE_SE1)
+			return;
+
+		b = (sym == prev);
+		prev = sym;
+
+		if (ones == 6) {
+			if (b)
+				return;		/* Bit stuffing error */
+			ones = 0;
+			continue;
+		}
+
+		ones = b ? (ones + 1) : 0;
+		bits.push_back(b);
+	}
+
+	/* Need a SYNC + PID, and full bytes */
+	if ((bits.size() < 16) || (bits.size() & 7))
+		return;
+
+	for (int i=0; i<8; i++)
+		if (bits[i] != (i == 7))
+			return;
+
+	for (size_t i=8; i<bits.size(); i+=8) {
+		uint8_t v = 0;
+		for (int j=0; j<8; j++)
+			v |= bits[i+j] << j;
+		m_rx_data.push_back(v);
+	}
+
+	/* PID check */
+	if (((m_rx_data[0] >> 4) ^ m_rx_data[0]) != 0x0f) {
+		m_rx_data.clear();
+		return;
+	}
+
+	/* CRC check for data packets */
+	if ((m_rx_data[0] & 3) == 3) {
+		size_t n = m_rx_data.size();
+		if ((n < 3) || (crc16(&m_rx_data[1], n - 3) != (m_rx_data[n-2] | (m_rx_data[n-1] << 8)))) {
+			m_stats.crc_err++;
+			m_rx_data.clear();
+			return;
+		}
+	} else if (m_rx_data.size() != 1) {
+		m_rx_data.clear();
+		return;
+	}
+
+	m_rx_status = RX_OK;
+}
+
+bool
+UsbHost::_fits(const Xact &x) const
+{
+	unsigned len, bits;
+
+	/* Before SOFs start anything goes */
+	if (!m_sof_ena)
+		return true;
+
+	/* Rough worst case: all packets fully stuffed, all turn-arounds
+	 * at the timeout, plus a margin for the SOF itself */
+	len = 3 + 1 + ((x.type == Xact::IN) ? x.max_len : x.data.size()) + 3 + 1 + 4;
+	bits = (len * 8 * 7) / 6 + 3 * RX_TIMEOUT_BITS + 64;
+
+	return m_sof_cnt > (bits * m_cpb);
+}
+
+void
+UsbHost::_start(Xact &x)
+{
+	m_cur = &x;
+	x.phase = 0;
+
+	switch (x.type) {
+	case Xact::SOF:
+		m_stats.sof++;
+		_tx_token(PID_SOF, m_frame);
+		break;
+
+	case Xact::RESET:
+		m_sof_ena = false;
+		m_sof_due = false;
+		m_cnt = x.cycles;
+		m_state = ST_RESET;
+		_drive(LINE_SE0);
+		break;
+
+	case Xact::SETUP:
+	case Xact::OUT:
+		_tx_token((x.type == Xact::SETUP) ? PID_SETUP : PID_OUT, x.addr | (x.ep << 7));
+		break;
+
+	case Xact::IN:
+		_tx_token(PID_IN, x.addr | (x.ep << 7));
+		break;
+	}
+}
+
+void
+UsbHost::_finish(Result res)
+{
+	Xact *x = m_cur;
+
+	m_cur = nullptr;
+	m_state = ST_IDLE;
+
+	if (x->type != Xact::SOF) {
+		x->res = res;
+		x->done = true;
+		m_stats.res[res]++;
+	}
+}
+
+void
+UsbHost::_next()
+{
+	Xact &x = *m_cur;
+	int phase = x.phase++;
+
+	switch (x.type) {
+	case Xact::SOF:
+		if (phase == 0)
+			_gap(IPG_BITS);
+		else
+			_finish(RES_ACK);
+		break;
+
+	case Xact::RESET:
+		/* Bus is back to idle, start the frames right away */
+		_release();
+		m_sof_ena = true;
+		m_sof_due = true;
+		m_sof_cnt = m_frame_cycles;
+		_finish(RES_ACK);
+		break;
+
+	case Xact::SETUP:
+	case Xact::OUT:
+		switch (phase) {
+		case 0:
+			/* Token sent */
+			_gap(IPG_BITS);
+			break;
+
+		case 1:
+			/* Data */
+			_tx_data(x.data1 ? PID_DATA1 : PID_DATA0, x.data);
+			break;
+
+		case 2:
+			/* Data sent, expect handshake unless isochronous */
+			if (x.iso) {
+				x.phase = 4;
+				x.res = RES_ISO;
+				_gap(IPG_BITS);
+			} else {
+				_rx_wait();
+			}
+			break;
+
+		case 3:
+			/* Handshake */
+			if (m_rx_status == RX_TIMEOUT)
+				x.res = RES_TIMEOUT;
+			else if (m_rx_status != RX_OK)
+				x.res = RES_ERROR;
+			else if ((m_rx_data[0] & 0xf) == PID_ACK)
+				x.res = RES_ACK;
+			else if ((m_rx_data[0] & 0xf) == PID_NAK)
+				x.res = RES_NAK;
+			else if ((m_rx_data[0] & 0xf) == PID_STALL)
+				x.res = RES_STALL;
+			else
+				x.res = RES_ERROR;
+			_gap(IPG_BITS);
+			break;
+
+		default:
+			_finish(x.res);
+		}
+		break;
+
+	case Xact::IN:
+		switch (phase) {
+		case 0:
+			/* Token sent */
+			_rx_wait();
+			break;
+
+		case 1:
+			/* Data or handshake */
+			x.phase = 4;
+
+			if (m_rx_status == RX_TIMEOUT) {
+				x.res = RES_TIMEOUT;
+			} else if (m_rx_status != RX_OK) {
+				x.res = RES_ERROR;
+			} else if ((m_rx_data[0] & 0xf) == PID_NAK) {
+				x.res = RES_NAK;
+			} else if ((m_rx_data[0] & 0xf) == PID_STALL) {
+				x.res = RES_STALL;
+			} else if ((m_rx_data[0] & 3) == 3) {
+				x.rx_pid = m_rx_data[0] & 0xf;
+				x.rx_end = m_cycle;
+				x.data.assign(m_rx_data.begin() + 1, m_rx_data.end() - 2);
+				x.res = x.iso ? RES_ISO : RES_ACK;
+				if (!x.iso)
+					x.phase = 2;
+			} else {
+				x.res = RES_ERROR;
+			}
+
+			_gap(IPG_BITS);
+			break;
+
+		case 2:
+			/* ACK the data. Even on a toggle mismatch, it's up to the
+			 * caller to drop the duplicate */
+			_tx_handshake(PID_ACK);
+			break;
+
+		case 3:
+			_gap(IPG_BITS);
+			break;
+
+		default:
+			_finish(x.res);
+		}
+		break;
+	}
+}
+
+void
+UsbHost::tick(bool dp, bool dn, bool pu)
+{
+	int line = (dp ? 1 : 0) | (dn ? 2 : 0);
+
+	m_cycle++;
+	m_pu = pu;
+
+	/* Frame timer */
+	if (m_sof_ena && !--m_sof_cnt) {
+		m_sof_cnt = m_frame_cycles;
+		m_sof_due = true;
+		m_frame = (m_frame + 1) & 0x7ff;
+	}
+
+	/* Engine */
+	switch (m_state) {
+	case ST_IDLE:
+		if (!m_pu)
+			break;
+
+		if (m_sof_due) {
+			m_sof_due = false;
+			_start(m_sof_xact);
+		} else if (m_pending && ((m_pending->type == Xact::RESET) || _fits(*m_pending))) {
+			Xact *x = m_pending;
+			m_pending = nullptr;
+			_start(*x);
+		}
+		break;
+
+	case ST_RESET:
+		if (!--m_cnt)
+			_next();
+		break;
+
+	case ST_TX:
+		if (--m_cnt)
+			break;
+
+		if (++m_tx_pos < m_tx_syms.size()) {
+			_drive(m_tx_syms[m_tx_pos]);
+			m_cnt = m_cpb;
+		} else {
+			_release();
+			m_tx_end = m_cycle;
+			_next();
+		}
+		break;
+
+	case ST_RX_WAIT:
+		if (line == LINE_K) {
+			unsigned lat = (m_cycle - m_tx_end) / m_cpb;
+
+			m_stats.lat_n++;
+			m_stats.lat_sum += lat;
+			if (lat < m_stats.lat_min) m_stats.lat_min = lat;
+			if (lat > m_stats.lat_max) m_stats.lat_max = lat;
+
+			m_rx_syms.clear();
+			m_rx_line = line;
+			m_rx_se0 = false;
+			m_cnt = m_cpb / 2;
+			m_state = ST_RX;
+		} else if (!--m_cnt) {
+			m_rx_status = RX_TIMEOUT;
+			_next();
+		}
+		break;
+
+	case ST_RX:
+		/* Re-align on every transition, sample mid-bit */
+		if (line != m_rx_line) {
+			m_rx_line = line;
+			m_cnt = m_cpb / 2;
+			break;
+		}
+
+		if (--m_cnt)
+			break;
+
+		m_cnt = m_cpb;
+
+		if (line == LINE_SE0) {
+			m_rx_se0 = true;
+		} else if (m_rx_se0) {
+			/* Back to idle after EOP */
+			_rx_decode();
+			if (m_rx_status != RX_OK)
+				m_stats.rx_err++;
+			_next();
+			break;
+		}
+
+		m_rx_syms.push_back(line);
+
+		if (m_rx_syms.size() > RX_MAX_BITS) {
+			/* Babble, give up and wait for idle */
+			m_stats.rx_err++;
+			m_rx_status = RX_ERROR;
+			_next();
+		}
+		break;
+
+	case ST_GAP:
+		if (!--m_cnt)
+			_next();
+		break;
+	}
+}
+
+
+/* Blocking API */
+/* ------------ */
+
+void
+UsbHost::wait_cycles(uint64_t n)
+{
+	m_wait_until = m_cycle + n;
+	_yield();
+}
+
+void
+UsbHost::wait_frame()
+{
+	/* Resume right as the next SOF is due, so the following transaction
+	 * is the first one after it, where hosts schedule periodic traffic */
+	wait_cycles(m_sof_ena ? m_sof_cnt : 0);
+}
+
+void
+UsbHost::wait_connect()
+{
+	m_wait_pu = true;
+	_yield();
+}
+
+void
+UsbHost::bus_reset(unsigned ms)
+{
+	Xact x(Xact::RESET);
+	x.cycles = ms * m_frame_cycles;
+	transact(x);
+}
+
+UsbHost::Result
+UsbHost::transact(Xact &x)
+{
+	x.done = false;
+	m_pending = &x;
+	m_wait_xact = &x;
+	_yield();
+	return x.res;
+}
+
+int
+UsbHost::in(uint8_t addr, uint8_t ep, uint8_t *buf, int len, int mps,
+            bool &toggle, unsigned timeout_us)
+{
+	uint64_t deadline = m_cycle + us_to_cycles(timeout_us);
+	int got = 0;
+	int errs = 0;
+
+	while (got < len) {
+		Xact x(Xact::IN);
+		x.addr = addr;
+		x.ep = ep;
+		x.max_len = mps;
+
+		switch (transact(x)) {
+		case RES_ACK:
+			errs = 0;
+			break;
+
+		case RES_NAK:
+			if (m_cycle > deadline)
+				return -1;
+			continue;
+
+		case RES_STALL:
+			return -1;
+
+		default:
+			if (++errs == 3)
+				return -1;
+			continue;
+		}
+
+		/* Duplicate of a packet whose ACK got lost ? */
+		if (x.rx_pid != (toggle ? PID_DATA1 : PID_DATA0))
+			continue;
+
+		toggle = !toggle;
+
+		int n = x.data.size();
+		if (n > (len - got))
+			n = len - got;
+
+		memcpy(&buf[got], x.data.data(), n);
+		got += n;
+
+		/* Short packet ends the transfer */
+		if ((int)x.data.size() < mps)
+			break;
+	}
+
+	return got;
+}
+
+int
+UsbHost::out(uint8_t addr, uint8_t ep, const uint8_t *buf, int len, int mps,
+             bool &toggle, bool zlp, unsigned timeout_us)
+{
+	uint64_t deadline = m_cycle + us_to_cycles(timeout_us);
+	int ofs = 0;
+	int errs = 0;
+
+	for (;;) {
+		int n = ((len - ofs) > mps) ? mps : (len - ofs);
+
+		Xact x(Xact::OUT);
+		x.addr = addr;
+		x.ep = ep;
+		x.data1 = toggle;
+		x.data.assign(buf + ofs, buf + ofs + n);
+
+		switch (transact(x)) {
+		case RES_ACK:
+			errs = 0;
+			break;
+
+		case RES_NAK:
+			if (m_cycle > deadline)
+				return -1;
+			continue;
+
+		case RES_STALL:
+			return -1;
+
+		default:
+			if (++errs == 3)
+				return -1;
+			continue;
+		}
+
+		toggle = !toggle;
+		ofs += n;
+
+		if ((ofs == len) && ((n < mps) || !zlp))
+			break;
+	}
+
+	return ofs;
+}
+
+int
+UsbHost::iso_in(uint8_t addr, uint8_t ep, uint8_t *buf, int mps,
+                uint64_t *rx_end)
+{
+	Xact x(Xact::IN);
+	x.addr = addr;
+	x.ep = ep;
+	x.iso = true;
+	x.max_len = mps;
+
+	if (transact(x) != RES_ISO)
+		return -1;
+
+	int n = x.data.size();
+	if (n > mps)
+		n = mps;
+
+	memcpy(buf, x.data.data(), n);
+
+	if (rx_end)
+		*rx_end = x.rx_end;
+
+	return n;
+}
+
+int
+UsbHost::int_in(uint8_t addr, uint8_t ep, uint8_t *buf, int mps,
+                bool &toggle, uint64_t *rx_end)
+{
+	/* Single poll: 0 if nothing new (NAK or duplicate), -1 on error */
+	Xact x(Xact::IN);
+	x.addr = addr;
+	x.ep = ep;
+	x.max_len = mps;
+
+	switch (transact(x)) {
+	case RES_ACK:
+		break;
+
+	case RES_NAK:
+		return 0;
+
+	default:
+		return -1;
+	}
+
+	if (x.rx_pid != (toggle ? PID_DATA1 : PID_DATA0))
+		return 0;
+
+	toggle = !toggle;
+
+	int n = x.data.size();
+	if (n > mps)
+		n = mps;
+
+	memcpy(buf, x.data.data(), n);
+
+	if (rx_end)
+		*rx_end = x.rx_end;
+
+	return n;
+}
+
+int
+UsbHost::_status_in(uint8_t addr, unsigned timeout_us)
+{
+	uint64_t deadline = m_cycle + us_to_cycles(timeout_us);
+	int errs = 0;
+
+	for (;;) {
+		Xact x(Xact::IN);
+		x.addr = addr;
+		x.ep = 0;
+		x.max_len = 0;
+
+		switch (transact(x)) {
+		case RES_ACK:
+			return ((x.rx_pid == PID_DATA1) && x.data.empty()) ? 0 : -1;
+
+		case RES_NAK:
+			if (m_cycle > deadline)
+				return -1;
+			continue;
+
+		case RES_STALL:
+			return -1;
+
+		default:
+			if (++errs == 3)
+				return -1;
+		}
+	}
+}
+
+int
+UsbHost::control(uint8_t addr, uint8_t bmRequestType, uint8_t bRequest,
+                 uint16_t wValue, uint16_t wIndex, uint16_t wLength,
+                 uint8_t *data, int mps0)
+{
+	bool toggle;
+	int errs = 0;
+	int n = 0;
+
+	/* Setup stage, devices can't NAK it */
+	for (;;) {
+		Xact x(Xact::SETUP);
+		x.addr = addr;
+		x.ep = 0;
+		x.data = {
+			bmRequestType, bRequest,
+			(uint8_t)(wValue  & 0xff), (uint8_t)(wValue  >> 8),
+			(uint8_t)(wIndex  & 0xff), (uint8_t)(wIndex  >> 8),
+			(uint8_t)(wLength & 0xff), (uint8_t)(wLength >> 8),
+		};
+
+		if (transact(x) == RES_ACK)
+			break;
+
+		if (++errs == 3)
+			return -1;
+	}
+
+	/* Data stage */
+	toggle = true;
+
+	if (wLength) {
+		if (bmRequestType & 0x80)
+			n = in(addr, 0, data, wLength, mps0, toggle);
+		else
+			n = out(addr, 0, data, wLength, mps0, toggle);
+
+		if (n < 0)
+			return -1;
+	}
+
+	/* Status stage, opposite direction, always DATA1 */
+	toggle = true;
+
+	if ((bmRequestType & 0x80) && wLength) {
+		if (out(addr, 0, NULL, 0, mps0, toggle) < 0)
+			return -1;
+	} else {
+		if (_status_in(addr, 100000) < 0)
+			return -1;
+	}
+
+	return n;
+}
+
+int
+UsbHost::get_descriptor(uint8_t addr, uint8_t type, uint8_t idx,
+                        uint8_t *buf, int len, int mps0)
+{
+	return control(addr, 0x80, 0x06, (type << 8) | idx, 0, len, buf, mps0);
+}
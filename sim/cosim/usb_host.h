@@ -0,0 +1,205 @@
+/*
+ * usb_host.h
+ *
+ * Cycle level USB Full-Speed host bus functional model
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <ucontext.h>
+
+
+class UsbHost {
+public:
+	enum Pid {
+		PID_OUT   = 0x1,
+		PID_IN    = 0x9,
+		PID_SOF   = 0x5,
+		PID_SETUP = 0xd,
+		PID_DATA0 = 0x3,
+		PID_DATA1 = 0xb,
+		PID_ACK   = 0x2,
+		PID_NAK   = 0xa,
+		PID_STALL = 0xe,
+	};
+
+	enum Result {
+		RES_ACK = 0,
+		RES_NAK,
+		RES_STALL,
+		RES_TIMEOUT,
+		RES_ERROR,
+		RES_ISO,	/* Isochronous, no handshake */
+		RES_COUNT,
+	};
+
+	struct Xact {
+		enum Type { SOF, RESET, SETUP, OUT, IN } type;
+
+		uint8_t addr = 0;
+		uint8_t ep = 0;
+		bool data1 = false;
+		bool iso = false;
+
+		std::vector<uint8_t> data;	/* OUT payload / IN received payload */
+		int max_len = 64;		/* IN only */
+		unsigned cycles = 0;		/* RESET only */
+
+		/* Result */
+		Result res = RES_ERROR;
+		uint8_t rx_pid = 0;
+		uint64_t rx_end = 0;		/* IN only, end of the data packet */
+		bool done = false;
+
+		/* Engine internal */
+		int phase = 0;
+
+		Xact(Type t) : type(t) {}
+	};
+
+	struct Stats {
+		uint64_t res[RES_COUNT] = {};
+		uint64_t sof = 0;
+		uint64_t crc_err = 0;
+		uint64_t rx_err = 0;
+
+		/* Device response delay, from the end of our EOP to the
+		 * start of the device SYNC */
+		uint64_t lat_n = 0;
+		uint64_t lat_sum = 0;
+		unsigned lat_min = ~0u;
+		unsigned lat_max = 0;
+	};
+
+	typedef void (*scenario_fn)(UsbHost &host, void *arg);
+
+	UsbHost(unsigned clk_freq);
+	~UsbHost();
+
+	/* Bus side, called once per clock cycle */
+	void tick(bool dp, bool dn, bool pu);
+
+	bool oe() const { return m_oe; }
+	bool dp() const { return m_dp; }
+	bool dn() const { return m_dn; }
+
+	/* Scenario execution, `resume()` is called from the main loop */
+	void start(scenario_fn fn, void *arg);
+	void resume();
+	bool done() const { return m_co_done; }
+
+	/* Time */
+	uint64_t now() const { return m_cycle; }
+	unsigned clk_freq() const { return m_clk_freq; }
+	uint64_t us_to_cycles(uint64_t us) const { return us * (m_clk_freq / 1000000); }
+	double cycles_to_us(uint64_t c) const { return (double)c * 1e6 / m_clk_freq; }
+	unsigned cycles_per_bit() const { return m_cpb; }
+
+	const Stats &stats() const { return m_stats; }
+
+	/* Blocking API, only valid from within the scenario */
+	void wait_cycles(uint64_t n);
+	void wait_us(uint64_t us) { wait_cycles(us_to_cycles(us)); }
+	void wait_frame();
+	void wait_connect();
+	void bus_reset(unsigned ms = 12);
+
+	Result transact(Xact &x);
+
+	int in(uint8_t addr, uint8_t ep, uint8_t *buf, int len, int mps,
+	       bool &toggle, unsigned timeout_us = 100000);
+	int out(uint8_t addr, uint8_t ep, const uint8_t *buf, int len, int mps,
+	        bool &toggle, bool zlp = false, unsigned timeout_us = 100000);
+	int iso_in(uint8_t addr, uint8_t ep, uint8_t *buf, int mps,
+	           uint64_t *rx_end = nullptr);
+	int int_in(uint8_t addr, uint8_t ep, uint8_t *buf, int mps,
+	           bool &toggle, uint64_t *rx_end = nullptr);
+
+	int control(uint8_t addr, uint8_t bmRequestType, uint8_t bRequest,
+	            uint16_t wValue, uint16_t wIndex, uint16_t wLength,
+	            uint8_t *data, int mps0 = 64);
+
+	int get_descriptor(uint8_t addr, uint8_t type, uint8_t idx,
+	                   uint8_t *buf, int len, int mps0 = 64);
+
+private:
+	enum Line { LINE_SE0 = 0, LINE_J = 1, LINE_K = 2, LINE_SE1 = 3 };
+	enum State { ST_IDLE, ST_RESET, ST_TX, ST_RX_WAIT, ST_RX, ST_GAP };
+	enum RxStatus { RX_OK, RX_TIMEOUT, RX_ERROR };
+
+	/* Config */
+	unsigned m_clk_freq;
+	unsigned m_cpb;
+	unsigned m_frame_cycles;
+
+	/* Bus */
+	uint64_t m_cycle = 0;
+	bool m_oe = false;
+	bool m_dp = true;
+	bool m_dn = false;
+	bool m_pu = false;
+
+	/* Frames */
+	bool m_sof_ena = false;
+	bool m_sof_due = false;
+	unsigned m_sof_cnt = 0;
+	uint16_t m_frame = 0;
+	Xact m_sof_xact{Xact::SOF};
+
+	/* Engine */
+	State m_state = ST_IDLE;
+	Xact *m_cur = nullptr;
+	Xact *m_pending = nullptr;
+	unsigned m_cnt = 0;
+
+	std::vector<uint8_t> m_tx_syms;
+	size_t m_tx_pos = 0;
+	uint64_t m_tx_end = 0;
+
+	int m_rx_line = LINE_J;
+	bool m_rx_se0 = false;
+	std::vector<uint8_t> m_rx_syms;
+	std::vector<uint8_t> m_rx_data;
+	RxStatus m_rx_status = RX_OK;
+
+	Stats m_stats;
+
+	/* Scenario coroutine */
+	ucontext_t m_main_ctx;
+	ucontext_t m_co_ctx;
+	void *m_co_stack = nullptr;
+	bool m_co_done = true;
+	scenario_fn m_co_fn = nullptr;
+	void *m_co_arg = nullptr;
+
+	Xact *m_wait_xact = nullptr;
+	uint64_t m_wait_until = 0;
+	bool m_wait_pu = false;
+
+	static void _co_entry();
+	void _yield();
+
+	/* Engine */
+	void _drive(int line);
+	void _release();
+	bool _fits(const Xact &x) const;
+	void _start(Xact &x);
+	void _next();
+	void _finish(Result res);
+
+	void _tx_packet(const std::vector<uint8_t> &pkt);
+	void _tx_token(uint8_t pid, uint16_t v);
+	void _tx_data(uint8_t pid, const std::vector<uint8_t> &data);
+	void _tx_handshake(uint8_t pid);
+	void _rx_wait();
+	void _rx_decode();
+	void _gap(unsigned bits);
+
+	int _status_in(uint8_t addr, unsigned timeout_us);
+};
@@ -0,0 +1,414 @@
+/*
+ * usb_desc_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ *
+ * Needs the descriptor responder in the microcode (`NO2USB_DESC`, on by default)
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_desc_tb;
+
+	// Config
+	localparam integer BYTE_CYCLES = 32;	// Duration of a byte on the bus
+	localparam integer TX_CYCLES   = 40;	// Device handshake duration
+	localparam integer TA_CYCLES   = 20;	// Host turnaround
+
+	localparam [10:0] TBL_BASE  = 11'h040;
+	localparam [10:0] DEV_OFS   = 11'h080;
+	localparam [10:0] CONF_OFS  = 11'h0a0;
+	localparam integer DEV_LEN  = 18;
+	localparam integer CONF_LEN = 128;
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+	reg  txpkt_data_ack;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_data;
+	reg  rxpkt_is_handshake;
+	reg  [7:0] rxpkt_data;
+	reg  rxpkt_data_stb;
+
+	// TX buffer
+	wire [10:0] buf_tx_addr_0;
+	reg  [ 7:0] buf_tx_data_1;
+	wire buf_tx_rden_0;
+
+	reg  [ 7:0] tx_mem[0:2047];
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+
+	// Events
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	integer evt_cnt;
+	integer eps_wr_cnt;
+
+	// TX capture
+	reg  [3:0] tx_pid;
+	integer    tx_len;
+	reg  [7:0] tx_data[0:1023];
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_desc_tb.vcd");
+		$dumpvars(0,usb_desc_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans #(
+		.DESC(1)
+	) trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(txpkt_data_ack),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(rxpkt_is_data),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(4'h0),
+		.rxpkt_data(rxpkt_data),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.buf_tx_addr_0(buf_tx_addr_0),
+		.buf_tx_data_1(buf_tx_data_1),
+		.buf_tx_rden_0(buf_tx_rden_0),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(16'd70),
+		.cr_dsc_ena(1'b1),
+		.cr_dsc_mps(2'b11),
+		.cr_dsc_base(TBL_BASE),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(1'b0),
+		.ntf_clr(1'b0),
+		.ntf_clr_ep(5'd0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status ep_status_I (
+		.p_addr_0(eps_addr_0[7:0]),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(1'b0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(),
+		.s_ready_0(),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// TX buffer model
+	always @(posedge clk)
+		if (buf_tx_rden_0)
+			buf_tx_data_1 <= tx_mem[buf_tx_addr_0];
+
+	// Device TX model: capture PID / length / payload
+	integer k;
+
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_pid = txpkt_pid;
+			tx_len = txpkt_len;
+
+			if ((txpkt_pid & 4'h3) == 4'h3) begin
+				for (k=0; k<tx_len; k=k+1) begin
+					repeat (BYTE_CYCLES) @(posedge clk);
+					tx_data[k] = txpkt_data;
+					txpkt_data_ack <= 1'b1;
+					@(posedge clk);
+					txpkt_data_ack <= 1'b0;
+				end
+			end
+
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Monitors
+	always @(posedge clk)
+	begin
+		if (evt_stb)
+			evt_cnt = evt_cnt + 1;
+		if (eps_write_0)
+			eps_wr_cnt = eps_wr_cnt + 1;
+	end
+
+	// Helpers
+	task eps_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input [63:0] data;
+		input integer len;	// -1 for token / handshake
+		integer n;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+
+			if (len < 0) begin
+				repeat (BYTE_CYCLES) @(posedge clk);
+			end else begin
+				// Payload + CRC
+				for (n=0; n<len+2; n=n+1) begin
+					repeat (BYTE_CYCLES-1) @(posedge clk);
+					rxpkt_data     <= (n < len) ? data[8*n+:8] : 8'h00;
+					rxpkt_data_stb <= 1'b1;
+					@(posedge clk);
+					rxpkt_data_stb <= 1'b0;
+				end
+			end
+
+			repeat (8) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_is_token     <= (len < 0) & ((pid & 4'h3) == 4'h1);
+			rxpkt_is_handshake <= (len < 0) & ((pid & 4'h3) == 4'h2);
+			rxpkt_is_data      <= (len >= 0);
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// Wait for the device response after a host packet
+	task wait_tx;
+		begin
+			@(posedge txpkt_done);
+			@(posedge clk);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// Full SETUP transaction, returns the device handshake
+	task setup_trans;
+		input [7:0] type_;
+		input [7:0] idx;
+		input [15:0] wlen;
+		output [3:0] hs;
+		begin
+			host_pkt(PID_SETUP, 64'h0, -1);
+			repeat (TA_CYCLES) @(posedge clk);
+			host_pkt(PID_DATA0, { wlen, 16'h0000, type_, idx, 8'h06, 8'h80 }, 8);
+			wait_tx();
+			hs = tx_pid;
+		end
+	endtask
+
+	// Check one IN packet of the data stage
+	integer errors;
+
+	task check_in;
+		input [3:0] pid;
+		input integer len;
+		input [10:0] ofs;
+		integer j;
+		begin
+			host_pkt(PID_IN, 64'h0, -1);
+			wait_tx();
+
+			if ((tx_pid !== pid) || (tx_len != len)) begin
+				$display("IN: got PID %h len %0d, expected PID %h len %0d", tx_pid, tx_len, pid, len);
+				errors = errors + 1;
+			end else begin
+				for (j=0; j<len; j=j+1)
+					if (tx_data[j] !== tx_mem[ofs+j]) begin
+						$display("IN: data mismatch at byte %0d", j);
+						errors = errors + 1;
+						j = len;
+					end
+			end
+
+			host_pkt(PID_ACK, 64'h0, -1);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// Status stage
+	task check_status;
+		begin
+			host_pkt(PID_OUT, 64'h0, -1);
+			repeat (TA_CYCLES) @(posedge clk);
+			host_pkt(PID_DATA1, 64'h0, 0);
+			wait_tx();
+
+			if (tx_pid !== PID_ACK) begin
+				$display("Status: got PID %h, expected ACK", tx_pid);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test sequence
+	reg [3:0] hs;
+	integer i;
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		txpkt_data_ack     <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_data      <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_data         <= 8'h00;
+		rxpkt_data_stb     <= 1'b0;
+		s_addr_0           <= 8'h00;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+
+		evt_cnt    = 0;
+		eps_wr_cnt = 0;
+		errors     = 0;
+
+		// TX buffer : table + device / config descriptors
+		for (i=0; i<2048; i=i+1)
+			tx_mem[i] = i * 7 + 3;
+
+		tx_mem[TBL_BASE + 0] = 8'h01;	/* Device */
+		tx_mem[TBL_BASE + 1] = 8'h00;
+		tx_mem[TBL_BASE + 2] = DEV_OFS[7:0];
+		tx_mem[TBL_BASE + 3] = DEV_OFS[10:8];
+		tx_mem[TBL_BASE + 4] = 8'h02;	/* Config 0 */
+		tx_mem[TBL_BASE + 5] = 8'h00;
+		tx_mem[TBL_BASE + 6] = CONF_OFS[7:0];
+		tx_mem[TBL_BASE + 7] = CONF_OFS[10:8];
+		tx_mem[TBL_BASE + 8] = 8'h00;	/* End */
+
+		tx_mem[DEV_OFS  + 0] = DEV_LEN;
+		tx_mem[DEV_OFS  + 1] = 8'h01;
+		tx_mem[CONF_OFS + 0] = 8'h09;
+		tx_mem[CONF_OFS + 1] = 8'h02;
+		tx_mem[CONF_OFS + 2] = CONF_LEN & 8'hff;
+		tx_mem[CONF_OFS + 3] = CONF_LEN >> 8;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// EP0 OUT: Control, SETUP BD armed
+		eps_write(8'h00, 16'h0026);
+		eps_write(8'h06, 16'h4008);
+		eps_write(8'h07, 16'h0000);
+
+		// EP0 IN: Control, nothing armed
+		eps_write(8'h08, 16'h0006);
+
+		// Device descriptor, truncated to wLength
+		setup_trans(8'h01, 8'h00, 16'd8, hs);
+		if (hs !== PID_ACK) begin $display("SETUP not ACKed"); errors = errors + 1; end
+		check_in(PID_DATA1, 8, DEV_OFS);
+		check_status();
+
+		// Device descriptor, full
+		setup_trans(8'h01, 8'h00, 16'd64, hs);
+		check_in(PID_DATA1, DEV_LEN, DEV_OFS);
+		check_status();
+
+		// Config descriptor, MPS aligned and shorter than wLength -> ZLP
+		setup_trans(8'h02, 8'h00, 16'd255, hs);
+		check_in(PID_DATA1, 64, CONF_OFS);
+		check_in(PID_DATA0, 64, CONF_OFS + 64);
+		check_in(PID_DATA1,  0, CONF_OFS);
+		check_status();
+
+		// Config descriptor, truncated mid-packet
+		setup_trans(8'h02, 8'h00, 16'd100, hs);
+		check_in(PID_DATA1, 64, CONF_OFS);
+		check_in(PID_DATA0, 36, CONF_OFS + 64);
+		check_status();
+
+		// Nothing so far should have reached software or the RAM
+		if (evt_cnt != 0) begin $display("Unexpected events"); errors = errors + 1; end
+		if (eps_wr_cnt != 0) begin $display("Unexpected EP status writes"); errors = errors + 1; end
+
+		// Unknown descriptor -> normal path (event for the SETUP)
+		setup_trans(8'h03, 8'h00, 16'd255, hs);
+		if ((hs !== PID_ACK) || (evt_cnt != 1)) begin
+			$display("Unknown descriptor not passed to software");
+			errors = errors + 1;
+		end
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_desc_tb
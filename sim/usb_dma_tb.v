@@ -0,0 +1,555 @@
+/*
+ * usb_dma_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_dma_tb;
+
+	// Benchmark config
+	localparam integer LEN_BYTES = 1024;	// Bytes to move in each direction
+	localparam integer MEM_WS    = 1;		// System RAM wait states
+	localparam integer CPU_OVH   = 3;		// CPU loop overhead per word (cycles)
+
+	localparam integer LEN_WORDS = LEN_BYTES / 4;
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// EP buffers
+	wire [ 8:0] cpu_tx_addr_0;
+	wire [31:0] cpu_tx_data_0;
+	wire cpu_tx_we_0;
+	wire [ 8:0] cpu_rx_addr_0;
+	wire [31:0] cpu_rx_data_1;
+	wire cpu_rx_re_0;
+	wire cpu_stall;
+
+	wire [ 8:0] ep_tx_addr_0;
+	wire [31:0] ep_tx_data_0;
+	wire ep_tx_we_0;
+	wire [ 8:0] ep_rx_addr_0;
+	wire [31:0] ep_rx_data_1;
+	wire ep_rx_re_0;
+
+	reg  [10:0] buf_tx_addr_0;
+	wire [ 7:0] buf_tx_data_1;
+	reg  [10:0] buf_rx_addr_0;
+	reg  [ 7:0] buf_rx_data_0;
+	reg  buf_rx_wren_0;
+
+	// BD completion trigger
+	reg  trig_stb;
+	reg  [5:0] trig_bd;
+
+	// Control bus
+	reg  [ 4:0] wb_addr;
+	wire [31:0] wb_rdata;
+	reg  [31:0] wb_wdata;
+	reg  wb_we;
+	reg  wb_cyc;
+	wire wb_ack;
+
+	// System bus
+	wire [29:0] wbm_addr;
+	wire [31:0] wbm_rdata;
+	wire [31:0] wbm_wdata;
+	wire [ 3:0] wbm_wmsk;
+	wire wbm_we;
+	wire wbm_cyc;
+	wire wbm_ack;
+
+	reg  [29:0] cpu_addr;
+	reg  [31:0] cpu_wdata;
+	reg  cpu_we;
+	reg  cpu_cyc;
+
+	reg  [31:0] mem_rdata;
+	reg  mem_ack;
+	reg  [3:0] mem_ws;
+
+	wire irq;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_dma_tb.vcd");
+		$dumpvars(0,usb_dma_tb);
+	end
+
+	// Clocks
+	always #10 clk = !clk;
+
+	// DUT
+	usb_dma #(
+		.EPAW(9),
+		.WAW(30),
+		.SLOTS(2)
+	) dut_I (
+		.cpu_tx_addr_0(cpu_tx_addr_0),
+		.cpu_tx_data_0(cpu_tx_data_0),
+		.cpu_tx_we_0(cpu_tx_we_0),
+		.cpu_rx_addr_0(cpu_rx_addr_0),
+		.cpu_rx_data_1(cpu_rx_data_1),
+		.cpu_rx_re_0(cpu_rx_re_0),
+		.cpu_stall(cpu_stall),
+		.ep_tx_addr_0(ep_tx_addr_0),
+		.ep_tx_data_0(ep_tx_data_0),
+		.ep_tx_we_0(ep_tx_we_0),
+		.ep_rx_addr_0(ep_rx_addr_0),
+		.ep_rx_data_1(ep_rx_data_1),
+		.ep_rx_re_0(ep_rx_re_0),
+		.trig_stb(trig_stb),
+		.trig_bd(trig_bd),
+		.wb_addr(wb_addr),
+		.wb_rdata(wb_rdata),
+		.wb_wdata(wb_wdata),
+		.wb_we(wb_we),
+		.wb_cyc(wb_cyc),
+		.wb_ack(wb_ack),
+		.wbm_addr(wbm_addr),
+		.wbm_rdata(wbm_rdata),
+		.wbm_wdata(wbm_wdata),
+		.wbm_wmsk(wbm_wmsk),
+		.wbm_we(wbm_we),
+		.wbm_cyc(wbm_cyc),
+		.wbm_ack(wbm_ack),
+		.irq(irq),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// EP buffers (same config as in `usb` with EPDW=32)
+	usb_ep_buf #(
+		.RWIDTH(8),
+		.WWIDTH(32)
+	) tx_buf_I (
+		.rd_addr_0(buf_tx_addr_0),
+		.rd_data_1(buf_tx_data_1),
+		.rd_en_0(1'b1),
+		.rd_clk(clk),
+		.wr_addr_0(ep_tx_addr_0),
+		.wr_data_0(ep_tx_data_0),
+		.wr_en_0(ep_tx_we_0),
+		.wr_clk(clk)
+	);
+
+	usb_ep_buf #(
+		.RWIDTH(32),
+		.WWIDTH(8)
+	) rx_buf_I (
+		.rd_addr_0(ep_rx_addr_0),
+		.rd_data_1(ep_rx_data_1),
+		.rd_en_0(ep_rx_re_0),
+		.rd_clk(clk),
+		.wr_addr_0(buf_rx_addr_0),
+		.wr_data_0(buf_rx_data_0),
+		.wr_en_0(buf_rx_wren_0),
+		.wr_clk(clk)
+	);
+
+
+	// System RAM model
+	// ----------------
+
+	reg [31:0] mem [0:4095];
+
+	// Shared between DMA and the 'CPU' (never active at the same time)
+	wire        m_cyc   = wbm_cyc | cpu_cyc;
+	wire        m_we    = cpu_cyc ? cpu_we    : wbm_we;
+	wire [29:0] m_addr  = cpu_cyc ? cpu_addr  : wbm_addr;
+	wire [31:0] m_wdata = cpu_cyc ? cpu_wdata : wbm_wdata;
+
+	always @(posedge clk)
+		if (~m_cyc | mem_ack) begin
+			mem_ack <= 1'b0;
+			mem_ws  <= 0;
+		end else if (mem_ws == MEM_WS) begin
+			mem_ack <= 1'b1;
+			mem_rdata <= mem[m_addr[11:0]];
+			if (m_we)
+				mem[m_addr[11:0]] <= m_wdata;
+		end else begin
+			mem_ws <= mem_ws + 1;
+		end
+
+	assign wbm_ack   = mem_ack & ~cpu_cyc;
+	assign wbm_rdata = mem_rdata;
+
+
+	// 'CPU' side of the EP buffers
+	// ----------------------------
+
+	reg  [ 8:0] cpu_buf_addr;
+	reg  [31:0] cpu_buf_data;
+	reg  cpu_buf_we;
+	reg  cpu_buf_re;
+
+	assign cpu_tx_addr_0 = cpu_buf_addr;
+	assign cpu_tx_data_0 = cpu_buf_data;
+	assign cpu_tx_we_0   = cpu_buf_we;
+	assign cpu_rx_addr_0 = cpu_buf_addr;
+	assign cpu_rx_re_0   = cpu_buf_re;
+
+
+	// Helpers
+	// -------
+
+	integer i, errors;
+	integer t0, cyc_cpu_tx, cyc_cpu_rx, cyc_dma_tx, cyc_dma_rx, cyc_dma_setup;
+	reg [31:0] rd;
+
+	integer cycle;
+
+	always @(posedge clk)
+		cycle <= rst ? 0 : (cycle + 1);
+
+	task ctrl_write;
+		input [ 4:0] addr;
+		input [31:0] data;
+		begin
+			wb_addr  <= addr;
+			wb_wdata <= data;
+			wb_we    <= 1'b1;
+			wb_cyc   <= 1'b1;
+			@(posedge clk);
+			while (~wb_ack)
+				@(posedge clk);
+			wb_cyc   <= 1'b0;
+			wb_we    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task ctrl_read;
+		input  [ 4:0] addr;
+		output [31:0] data;
+		begin
+			wb_addr  <= addr;
+			wb_we    <= 1'b0;
+			wb_cyc   <= 1'b1;
+			@(posedge clk);
+			while (~wb_ack)
+				@(posedge clk);
+			data = wb_rdata;
+			wb_cyc   <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task ctrl_expect;
+		input [ 4:0] addr;
+		input [31:0] mask;
+		input [31:0] exp;
+		reg   [31:0] d;
+		begin
+			ctrl_read(addr, d);
+			if ((d & mask) !== exp) begin
+				$display("DMA reg %02x : got %08x, expected %08x (mask %08x)", addr, d, exp, mask);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task mem_access;
+		input  [29:0] addr;
+		input  [31:0] wdata;
+		input         we;
+		output [31:0] rdata;
+		begin
+			cpu_addr  <= addr;
+			cpu_wdata <= wdata;
+			cpu_we    <= we;
+			cpu_cyc   <= 1'b1;
+			@(posedge clk);
+			while (~mem_ack)
+				@(posedge clk);
+			rdata = mem_rdata;
+			cpu_cyc   <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task buf_write;
+		input [ 8:0] addr;
+		input [31:0] data;
+		begin
+			cpu_buf_addr <= addr;
+			cpu_buf_data <= data;
+			cpu_buf_we   <= 1'b1;
+			@(posedge clk);
+			while (cpu_stall)
+				@(posedge clk);
+			cpu_buf_we   <= 1'b0;
+		end
+	endtask
+
+	task dma_start;
+		input [31:0] sys_addr;
+		input [31:0] buf_addr;
+		input        dir;
+		input [15:0] words;
+		begin
+			ctrl_write(2'b01, sys_addr);
+			ctrl_write(2'b10, buf_addr);
+			ctrl_write(2'b00, { 1'b1, dir, 2'b10, 12'h000, words });
+		end
+	endtask
+
+	// BD completion, as `usb` reports it
+	task bd_done;
+		input [5:0] bd;
+		begin
+			trig_bd  <= bd;
+			trig_stb <= 1'b1;
+			@(posedge clk);
+			trig_stb <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task slot_setup;
+		input integer n;
+		input [31:0] sys_addr;
+		input [31:0] buf_addr;
+		input [31:0] ctrl;
+		begin
+			ctrl_write(4*(n+1) + 1, sys_addr);
+			ctrl_write(4*(n+1) + 2, buf_addr);
+			ctrl_write(4*(n+1) + 0, ctrl);
+		end
+	endtask
+
+	task dma_run;
+		input [31:0] sys_addr;
+		input [31:0] buf_addr;
+		input        dir;
+		input [15:0] words;
+		begin
+			ctrl_write(2'b01, sys_addr);
+			ctrl_write(2'b10, buf_addr);
+			ctrl_write(2'b00, { 1'b1, dir, 2'b10, 12'h000, words });
+			cyc_dma_setup = cycle - t0;
+			while (~irq)
+				@(posedge clk);
+			ctrl_write(2'b00, 32'h10000000);
+		end
+	endtask
+
+
+	// Test sequence
+	// -------------
+
+	initial begin
+		// Init
+		wb_addr  = 0;
+		wb_wdata = 0;
+		wb_we    = 0;
+		wb_cyc   = 0;
+		trig_stb = 0;
+		trig_bd  = 0;
+		cpu_addr = 0;
+		cpu_wdata = 0;
+		cpu_we   = 0;
+		cpu_cyc  = 0;
+		cpu_buf_addr = 0;
+		cpu_buf_data = 0;
+		cpu_buf_we = 0;
+		cpu_buf_re = 0;
+		buf_tx_addr_0 = 0;
+		buf_rx_addr_0 = 0;
+		buf_rx_data_0 = 0;
+		buf_rx_wren_0 = 0;
+		errors = 0;
+
+		for (i=0; i<4096; i=i+1)
+			mem[i] = { i[15:0] ^ 16'h5a5a, i[15:0] };
+
+		// Reset
+		#200 rst = 0;
+		@(posedge clk);
+
+		// Fill RX buffer with a pattern (as the core would)
+		for (i=0; i<LEN_BYTES; i=i+1) begin
+			buf_rx_addr_0 <= i;
+			buf_rx_data_0 <= i[7:0] ^ 8'ha5;
+			buf_rx_wren_0 <= 1'b1;
+			@(posedge clk);
+		end
+		buf_rx_wren_0 <= 1'b0;
+		@(posedge clk);
+
+		// CPU copy: Memory -> TX buffer
+		t0 = cycle;
+		for (i=0; i<LEN_WORDS; i=i+1) begin
+			mem_access(i, 32'h0, 1'b0, rd);
+			buf_write(i, rd);
+			repeat (CPU_OVH) @(posedge clk);
+		end
+		cyc_cpu_tx = cycle - t0;
+
+		// CPU copy: RX buffer -> Memory
+		t0 = cycle;
+		for (i=0; i<LEN_WORDS; i=i+1) begin
+			cpu_buf_addr <= i;
+			cpu_buf_re   <= 1'b1;
+			@(posedge clk);
+			cpu_buf_re   <= 1'b0;
+			@(posedge clk);
+			mem_access(1024 + i, cpu_rx_data_1, 1'b1, rd);
+			repeat (CPU_OVH) @(posedge clk);
+		end
+		cyc_cpu_rx = cycle - t0;
+
+		// DMA: Memory -> TX buffer (to the upper half of the buffer)
+		t0 = cycle;
+		dma_run(32'h00000000, 32'h00000400, 1'b0, LEN_WORDS);
+		cyc_dma_tx = cycle - t0;
+
+		// DMA: RX buffer -> Memory
+		t0 = cycle;
+		dma_run(32'h00002000, 32'h00000000, 1'b1, LEN_WORDS);
+		cyc_dma_rx = cycle - t0;
+
+		// Check TX buffer (both CPU and DMA copies)
+		for (i=0; i<2*LEN_BYTES; i=i+1) begin
+			buf_tx_addr_0 <= i;
+			@(posedge clk);
+			@(posedge clk);
+			if (buf_tx_data_1 != ((mem[(i % LEN_BYTES) >> 2] >> (8 * (i & 3))) & 8'hff)) begin
+				if (errors < 10)
+					$display("TX mismatch @%d : %02x", i, buf_tx_data_1);
+				errors = errors + 1;
+			end
+		end
+
+		// Check memory (both CPU and DMA copies)
+		for (i=0; i<LEN_BYTES; i=i+1) begin
+			if (((mem[1024 + (i >> 2)] >> (8 * (i & 3))) & 8'hff) != (i[7:0] ^ 8'ha5) ||
+			    ((mem[2048 + (i >> 2)] >> (8 * (i & 3))) & 8'hff) != (i[7:0] ^ 8'ha5)) begin
+				if (errors < 10)
+					$display("RX mismatch @%d", i);
+				errors = errors + 1;
+			end
+		end
+
+		// CPU writes during a copy are stalled, not dropped : one issued
+		// right as a copy ends and one right after a start
+		dma_start(32'h00000000, 32'h00000400, 1'b0, LEN_WORDS);
+		while (~(wbm_ack & dut_I.cnt_last))
+			@(posedge clk);
+		buf_write(9'h1fe, 32'h600dc0de);
+		while (~irq)
+			@(posedge clk);
+		ctrl_write(2'b00, 32'h10000000);
+
+		dma_start(32'h00000000, 32'h00000400, 1'b0, 1);
+		buf_write(9'h1ff, 32'hcafebabe);
+		while (~irq)
+			@(posedge clk);
+		ctrl_write(2'b00, 32'h10000000);
+
+		for (i=0; i<8; i=i+1) begin
+			buf_tx_addr_0 <= 11'h7f8 + i;
+			@(posedge clk);
+			@(posedge clk);
+			if (buf_tx_data_1 != ((((i < 4) ? 32'h600dc0de : 32'hcafebabe) >> (8 * (i & 3))) & 8'hff)) begin
+				$display("CPU write lost @%d : %02x", 11'h7f8 + i, buf_tx_data_1);
+				errors = errors + 1;
+			end
+		end
+
+		// BD triggered slots
+		ctrl_write(5'h03, 32'h80000000);
+
+		// Slot 0 : EP2 OUT BD1 -> Memory, armed, waits for its BD
+		slot_setup(0, 32'h00003000, 32'h00000040, { 1'b1, 1'b0, 14'h0009, 16'd4 });
+		ctrl_expect(5'h04, 32'hd03fffff, 32'h80090004);
+
+		bd_done(6'h08);		// EP2 OUT BD0
+		bd_done(6'h0b);		// EP2 IN  BD1
+		repeat (20) @(posedge clk);
+		ctrl_expect(5'h04, 32'hd0000000, 32'h80000000);
+		if (irq) begin
+			$display("Slot 0 : IRQ for another BD");
+			errors = errors + 1;
+		end
+
+		bd_done(6'h09);
+		while (~irq)
+			@(posedge clk);
+		ctrl_expect(5'h03, 32'h80000003, 32'h80000001);
+		ctrl_expect(5'h04, 32'hd0000000, 32'h10000000);
+
+		for (i=0; i<16; i=i+1)
+			if (((mem[12'hc00 + (i >> 2)] >> (8 * (i & 3))) & 8'hff) != ((i + 8'h40) ^ 8'ha5)) begin
+				$display("Slot 0 mismatch @%d", i);
+				errors = errors + 1;
+			end
+
+		// Not re-armed : a second completion is ignored
+		ctrl_write(5'h04, 32'h10000000);
+		bd_done(6'h09);
+		repeat (20) @(posedge clk);
+		ctrl_expect(5'h04, 32'hd0000000, 32'h00000000);
+		if (irq) begin
+			$display("Slot 0 : IRQ while not armed");
+			errors = errors + 1;
+		end
+
+		// Slot 1 : Memory -> EP1 IN BD0, triggered right away, with a
+		// manual copy started while it runs (waits for it)
+		slot_setup(1, 32'h00000100, 32'h00000100, { 1'b0, 1'b1, 14'h0006, 16'd8 });
+		dma_start(32'h00000200, 32'h00000200, 1'b0, 2);
+		ctrl_expect(5'h08, 32'h40000000, 32'h40000000);
+		while (~(irq & dut_I.done))
+			@(posedge clk);
+		ctrl_expect(5'h03, 32'h00000003, 32'h00000002);
+		ctrl_expect(5'h00, 32'h900003ff, 32'h10000000);
+		ctrl_write(5'h08, 32'h10000000);
+		ctrl_write(5'h00, 32'h10000000);
+		@(posedge clk);
+		if (irq) begin
+			$display("IRQ still pending");
+			errors = errors + 1;
+		end
+
+		for (i=0; i<32; i=i+1) begin
+			buf_tx_addr_0 <= 11'h100 + i;
+			@(posedge clk);
+			@(posedge clk);
+			if (buf_tx_data_1 != ((mem[12'h040 + (i >> 2)] >> (8 * (i & 3))) & 8'hff)) begin
+				$display("Slot 1 mismatch @%d : %02x", i, buf_tx_data_1);
+				errors = errors + 1;
+			end
+		end
+
+		for (i=0; i<8; i=i+1) begin
+			buf_tx_addr_0 <= 11'h200 + i;
+			@(posedge clk);
+			@(posedge clk);
+			if (buf_tx_data_1 != ((mem[12'h080 + (i >> 2)] >> (8 * (i & 3))) & 8'hff)) begin
+				$display("Manual mismatch @%d : %02x", i, buf_tx_data_1);
+				errors = errors + 1;
+			end
+		end
+
+		// Report
+		$display("Memory wait states: %0d, CPU loop overhead: %0d cycles/word", MEM_WS, CPU_OVH);
+		$display("CPU copy  TX : %0d cycles/KB", cyc_cpu_tx * 1024 / LEN_BYTES);
+		$display("CPU copy  RX : %0d cycles/KB", cyc_cpu_rx * 1024 / LEN_BYTES);
+		$display("DMA       TX : %0d cycles/KB", cyc_dma_tx * 1024 / LEN_BYTES);
+		$display("DMA       RX : %0d cycles/KB", cyc_dma_rx * 1024 / LEN_BYTES);
+		$display("DMA setup    : %0d CPU cycles per transfer", cyc_dma_setup);
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+
+		$finish;
+	end
+
+endmodule // usb_dma_tb
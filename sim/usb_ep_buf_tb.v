@@ -44,7 +44,13 @@ module usb_ep_buf_tb;
 	// Clocks
 	always #10 clk  = !clk;
 
-	// DUT
+	// DUTs (iCE40 and generic must agree)
+	wire [RWIDTH-1:0] rd_data_1_gen;
+	reg  [AWW:0] wr_cnt;
+	reg  [ARW:0] rd_cnt;
+	reg  [WWIDTH-1:0] wr_data;
+	integer errors, k;
+
 	usb_ep_buf #(
 		.RWIDTH(RWIDTH),
 		.WWIDTH(WWIDTH)
@@ -59,10 +65,59 @@ module usb_ep_buf_tb;
 		.wr_clk(clk)
 	);
 
-	assign rd_en_0 = 1'b1;
-	assign wr_en_0 = 1'b1;
-	assign rd_addr_0 = 3;
-	assign wr_addr_0 = 0;
-	assign wr_data_0 = 64'hab89127bbabecafe;
+	usb_ep_buf #(
+		.TARGET("GENERIC"),
+		.RWIDTH(RWIDTH),
+		.WWIDTH(WWIDTH)
+	) gen_I (
+		.rd_addr_0(rd_addr_0),
+		.rd_data_1(rd_data_1_gen),
+		.rd_en_0(rd_en_0),
+		.rd_clk(clk),
+		.wr_addr_0(wr_addr_0),
+		.wr_data_0(wr_data_0),
+		.wr_en_0(wr_en_0),
+		.wr_clk(clk)
+	);
+
+	// Fill the whole buffer, then read it all back
+	always @(posedge clk)
+		if (rst) begin
+			wr_cnt <= 0;
+			rd_cnt <= 0;
+		end else if (~wr_cnt[AWW])
+			wr_cnt <= wr_cnt + 1;
+		else if (~rd_cnt[ARW])
+			rd_cnt <= rd_cnt + 1;
+
+	always @(*)
+		for (k=0; k<WWIDTH/8; k=k+1)
+			wr_data[k*8+:8] = wr_cnt[7:0] * 3 + k * 8'h41;
+
+	assign wr_en_0 = ~rst & ~wr_cnt[AWW];
+	assign wr_addr_0 = wr_cnt[AWW-1:0];
+	assign wr_data_0 = wr_data;
+
+	assign rd_en_0 = wr_cnt[AWW] & ~rd_cnt[ARW];
+	assign rd_addr_0 = rd_cnt[ARW-1:0];
+
+	// Compare
+	reg rd_valid_1;
+
+	always @(posedge clk)
+		rd_valid_1 <= rd_en_0;
+
+	initial
+		errors = 0;
+
+	always @(posedge clk)
+		if (rd_valid_1 && (rd_data_1 !== rd_data_1_gen)) begin
+			$display("Mismatch : %h (ICE40) vs %h (GENERIC)", rd_data_1, rd_data_1_gen);
+			errors = errors + 1;
+		end
+
+	always @(posedge clk)
+		if (rd_valid_1 && ~rd_en_0)
+			$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
 
 endmodule // usb_ep_buf_tb
@@ -0,0 +1,443 @@
+/*
+ * usb_eps_tdp_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * EP status RAM in true dual-port mode (`EPS_TDP`) : collisions between the
+ * two ports, read data hold, and the full core bus with `WB_DW=32` combined
+ * accesses going through the dedicated port.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_eps_tdp_tb;
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// Standalone EP status
+	reg  [ 7:0] p_addr_0;
+	reg  p_read_0;
+	reg  p_write_0;
+	reg  [15:0] p_din_0;
+	wire [15:0] p_dout_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_read_0;
+	reg  s_zero_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+	wire [15:0] s_dout_3;
+	wire s_ready_0;
+
+	// Core
+	wire usb_dp;
+	wire usb_dn;
+
+	reg  [11:0] wb_addr;
+	wire [31:0] wb_rdata;
+	reg  [31:0] wb_wdata;
+	reg  wb_we;
+	reg  wb_cyc;
+	wire wb_ack;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_eps_tdp_tb.vcd");
+		$dumpvars(0,usb_eps_tdp_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUTs
+	usb_ep_status #(
+		.TARGET("GENERIC"),
+		.AW(8),
+		.TDP(1)
+	) eps_I (
+		.p_addr_0(p_addr_0),
+		.p_read_0(p_read_0),
+		.p_zero_0(1'b0),
+		.p_write_0(p_write_0),
+		.p_din_0(p_din_0),
+		.p_dout_3(p_dout_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(s_read_0),
+		.s_zero_0(s_zero_0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(s_dout_3),
+		.s_ready_0(s_ready_0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	pullup   (usb_dp);
+	pulldown (usb_dn);
+
+	usb #(
+		.TARGET("GENERIC"),
+		.EPDW(32),
+		.EPS_TDP(1),
+		.WB_DW(32)
+	) dut_I (
+		.pad_dp(usb_dp),
+		.pad_dn(usb_dn),
+		.pad_pu(),
+		.ep_tx_addr_0(9'h000),
+		.ep_tx_data_0(32'h00000000),
+		.ep_tx_we_0(1'b0),
+		.ep_rx_addr_0(9'h000),
+		.ep_rx_data_1(),
+		.ep_rx_re_0(1'b0),
+		.ep_clk(clk),
+		.wb_addr(wb_addr),
+		.wb_rdata(wb_rdata),
+		.wb_wdata(wb_wdata),
+		.wb_we(wb_we),
+		.wb_cyc(wb_cyc),
+		.wb_ack(wb_ack),
+		.irq(),
+		.sof(),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Core EP status accesses log (address of each accepted access)
+	reg  [7:0] log_addr[0:7];
+	reg  log_we[0:7];
+	integer log_n;
+	integer ack_n;
+
+	always @(posedge clk)
+	begin
+		if ((dut_I.eps_bus_read | dut_I.eps_bus_write) & dut_I.eps_bus_ready) begin
+			if (log_n < 8) begin
+				log_addr[log_n] = dut_I.eps_bus_addr;
+				log_we[log_n]   = dut_I.eps_bus_write;
+			end
+			log_n = log_n + 1;
+		end
+		if (wb_ack)
+			ack_n = ack_n + 1;
+	end
+
+	// Helpers
+	task p_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			p_addr_0  <= addr;
+			p_din_0   <= data;
+			p_write_0 <= 1'b1;
+			@(posedge clk);
+			p_write_0 <= 1'b0;
+		end
+	endtask
+
+	task p_read;
+		input  [ 7:0] addr;
+		output [15:0] data;
+		begin
+			p_addr_0 <= addr;
+			p_read_0 <= 1'b1;
+			@(posedge clk);
+			p_read_0 <= 1'b0;
+			repeat (3) @(posedge clk);
+			data = p_dout_3;
+		end
+	endtask
+
+	// Aux access, held until accepted. Returns the stall cycles and the
+	// read data (sampled the cycle after acceptance)
+	task s_access;
+		input  we;
+		input  [ 7:0] addr;
+		input  [15:0] din;
+		output integer stalls;
+		output [15:0] dout;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= din;
+			s_write_0 <= we;
+			s_read_0  <= 1'b1;
+			s_zero_0  <= we;
+			stalls = 0;
+			@(posedge clk);
+			while (!s_ready_0) begin
+				stalls = stalls + 1;
+				@(posedge clk);
+			end
+			s_write_0 <= 1'b0;
+			s_read_0  <= 1'b0;
+			s_zero_0  <= 1'b0;
+			@(posedge clk);
+			dout = s_dout_3;
+		end
+	endtask
+
+	task s_expect;
+		input [ 7:0] addr;
+		input [15:0] exp;
+		integer stalls;
+		reg [15:0] d;
+		begin
+			repeat (4) @(posedge clk);
+			s_access(1'b0, addr, 16'h0000, stalls, d);
+			if (d !== exp) begin
+				$display("EPS %02x : got %04x, expected %04x", addr, d, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task check_stalls;
+		input [8*24-1:0] what;
+		input integer got;
+		input integer exp;
+		begin
+			if (got != exp) begin
+				$display("%0s : %0d stall cycles, expected %0d", what, got, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task wb_access;
+		input  we;
+		input  [11:0] addr;
+		input  [31:0] wdata;
+		output [31:0] rdata;
+		begin
+			wb_addr  <= addr;
+			wb_wdata <= wdata;
+			wb_we    <= we;
+			wb_cyc   <= 1'b1;
+			@(posedge clk);
+			while (!wb_ack)
+				@(posedge clk);
+			rdata = wb_rdata;
+			wb_cyc   <= 1'b0;
+			wb_we    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	// Checks one combined access : single ack, two EPS accesses in order
+	task wb_comb;
+		input  we;
+		input  [11:0] addr;
+		input  [31:0] wdata;
+		input  [ 7:0] first;
+		input  [ 7:0] second;
+		output [31:0] rdata;
+		begin
+			log_n = 0;
+			ack_n = 0;
+			wb_access(we, addr, wdata, rdata);
+			repeat (2) @(posedge clk);
+			if (ack_n != 1) begin
+				$display("Combined %03x : %0d acks", addr, ack_n);
+				errors = errors + 1;
+			end
+			if ((log_n != 2) ||
+			    (log_addr[0] !== first)  || (log_we[0] !== we) ||
+			    (log_addr[1] !== second) || (log_we[1] !== we)) begin
+				$display("Combined %03x : bad EPS accesses (%0d, %02x then %02x)",
+					addr, log_n, log_addr[0], log_addr[1]);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task wb_expect;
+		input [11:0] addr;
+		input [31:0] exp;
+		reg   [31:0] d;
+		begin
+			wb_access(1'b0, addr, 32'h00000000, d);
+			if (d !== exp) begin
+				$display("Bus %03x : got %08x, expected %08x", addr, d, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+	integer stalls;
+	reg [15:0] d;
+	reg [31:0] d32;
+
+	initial begin
+		// Init
+		p_addr_0  <= 8'h00;
+		p_read_0  <= 1'b0;
+		p_write_0 <= 1'b0;
+		p_din_0   <= 16'h0000;
+		s_addr_0  <= 8'h00;
+		s_read_0  <= 1'b0;
+		s_zero_0  <= 1'b0;
+		s_write_0 <= 1'b0;
+		s_din_0   <= 16'h0000;
+		wb_addr   <= 12'h000;
+		wb_wdata  <= 32'h00000000;
+		wb_we     <= 1'b0;
+		wb_cyc    <= 1'b0;
+
+		errors = 0;
+		log_n  = 0;
+		ack_n  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// Standalone
+		// ----------
+
+		// Plain aux write / read, no stall
+		s_access(1'b1, 8'h40, 16'h1111, stalls, d);
+		check_stalls("Aux write", stalls, 0);
+		s_expect(8'h40, 16'h1111);
+
+		// Read data is held until the next aux read, which can be a zero one
+		repeat (5) @(posedge clk);
+		if (s_dout_3 !== 16'h1111) begin
+			$display("Read data not held : %04x", s_dout_3);
+			errors = errors + 1;
+		end
+
+		s_addr_0 <= 8'h40;
+		s_read_0 <= 1'b1;
+		s_zero_0 <= 1'b1;
+		@(posedge clk);
+		s_read_0 <= 1'b0;
+		s_zero_0 <= 1'b0;
+		repeat (2) @(posedge clk);
+		if (s_dout_3 !== 16'h0000) begin
+			$display("Zero read returned %04x", s_dout_3);
+			errors = errors + 1;
+		end
+
+		// Aux write issued with the priority write : the priority one is
+		// done a cycle later and wins
+		fork
+			p_write(8'h41, 16'haaaa);
+			s_access(1'b1, 8'h41, 16'h5555, stalls, d);
+		join
+		check_stalls("Same cycle write", stalls, 0);
+		s_expect(8'h41, 16'haaaa);
+
+		// Aux write while the priority write is in stage 1 : stalled, then
+		// done on top of it
+		fork
+			p_write(8'h42, 16'haaaa);
+			begin
+				@(posedge clk);
+				s_access(1'b1, 8'h42, 16'h5555, stalls, d);
+			end
+		join
+		check_stalls("Colliding write", stalls, 1);
+		s_expect(8'h42, 16'h5555);
+
+		// Aux read while the priority write is in stage 1 : stalled, then
+		// returns the new value
+		p_write(8'h43, 16'h0123);
+		repeat (4) @(posedge clk);
+		fork
+			p_write(8'h43, 16'h4567);
+			begin
+				@(posedge clk);
+				s_access(1'b0, 8'h43, 16'h0000, stalls, d);
+			end
+		join
+		check_stalls("Colliding read", stalls, 1);
+		if (d !== 16'h4567) begin
+			$display("Colliding read : got %04x, expected 4567", d);
+			errors = errors + 1;
+		end
+
+		// Aux write while the priority read is in stage 1 : stalled, the
+		// priority read gets the old value
+		p_write(8'h44, 16'h0aaa);
+		repeat (4) @(posedge clk);
+		fork
+			p_read(8'h44, d);
+			begin
+				@(posedge clk);
+				s_access(1'b1, 8'h44, 16'h0bbb, stalls, d32[15:0]);
+			end
+		join
+		check_stalls("Write vs read", stalls, 1);
+		if (d !== 16'h0aaa) begin
+			$display("Priority read : got %04x, expected 0aaa", d);
+			errors = errors + 1;
+		end
+		s_expect(8'h44, 16'h0bbb);
+
+		// Aux read while the priority read is in stage 1 : no stall
+		fork
+			p_read(8'h44, d);
+			begin
+				@(posedge clk);
+				s_access(1'b0, 8'h44, 16'h0000, stalls, d32[15:0]);
+			end
+		join
+		check_stalls("Read vs read", stalls, 0);
+
+		// Different words never stall
+		fork
+			p_write(8'h45, 16'hcccc);
+			begin
+				@(posedge clk);
+				s_access(1'b1, 8'h46, 16'hdddd, stalls, d);
+			end
+		join
+		check_stalls("Other word", stalls, 0);
+		s_expect(8'h45, 16'hcccc);
+		s_expect(8'h46, 16'hdddd);
+
+		// Core, 32 bits bus
+		// -----------------
+
+		// Combined status write : status (upper half) then BD0 word 0
+		wb_comb(1'b1, 12'hc20, 32'h1234_5678, 8'h20, 8'h24, d32);
+		wb_expect(12'h820, 32'h0000_1234);
+		wb_expect(12'h824, 32'h0000_5678);
+
+		// Combined BD write : word 1 (upper half) then word 0
+		wb_comb(1'b1, 12'hc26, 32'h9abc_def0, 8'h27, 8'h26, d32);
+		wb_expect(12'h827, 32'h0000_9abc);
+		wb_expect(12'h826, 32'h0000_def0);
+
+		// Combined reads, same order
+		wb_comb(1'b0, 12'hc20, 32'h0000_0000, 8'h20, 8'h24, d32);
+		if (d32 !== 32'h1234_5678) begin
+			$display("Combined status read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		wb_comb(1'b0, 12'hc26, 32'h0000_0000, 8'h27, 8'h26, d32);
+		if (d32 !== 32'h9abc_def0) begin
+			$display("Combined BD read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		// Plain accesses ignore the upper half
+		wb_access(1'b1, 12'h821, 32'hffff_0042, d32);
+		wb_expect(12'h821, 32'h0000_0042);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_eps_tdp_tb
@@ -0,0 +1,358 @@
+/*
+ * usb_evt_ram_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Timestamped event FIFO (`EVT_RAM`) : a bit-level host sends SOFs and
+ * OUTs to the full core, and each event read back must carry the frame
+ * number and sub-frame count of when it happened (not of when it's read).
+ * Also checks the overflow flag when the FIFO fills up.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_evt_ram_tb;
+
+	localparam integer DEPTH   = 4;
+	localparam integer LAT_MIN = 60;	// Host SOF start to sub-frame
+	localparam integer LAT_MAX = 100;	// counter reset (SYNC + PID + RX)
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	wire usb_dp;
+	wire usb_dn;
+
+	reg  [11:0] wb_addr;
+	wire [15:0] wb_rdata;
+	reg  [15:0] wb_wdata;
+	reg  wb_we;
+	reg  wb_cyc;
+	wire wb_ack;
+
+	// Host
+	reg  host_oe;
+	reg  host_dp;
+	reg  host_dn;
+	reg  [7:0] hb[0:2];
+	reg  dt;
+
+	integer cyc;
+	integer sof_cyc;
+	reg [10:0] sof_frame;
+
+	// Event log (time since the SOF start and frame)
+	integer log_t[0:15];
+	reg  [10:0] log_f[0:15];
+	integer log_n;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_evt_ram_tb.vcd");
+		$dumpvars(0,usb_evt_ram_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	pullup   (usb_dp);
+	pulldown (usb_dn);
+
+	assign usb_dp = host_oe ? host_dp : 1'bz;
+	assign usb_dn = host_oe ? host_dn : 1'bz;
+
+	usb #(
+		.TARGET("GENERIC"),
+		.EVT_DEPTH(DEPTH),
+		.EVT_RAM(1)
+	) dut_I (
+		.pad_dp(usb_dp),
+		.pad_dn(usb_dn),
+		.pad_pu(),
+		.ep_tx_addr_0(10'h000),
+		.ep_tx_data_0(16'h0000),
+		.ep_tx_we_0(1'b0),
+		.ep_rx_addr_0(10'h000),
+		.ep_rx_data_1(),
+		.ep_rx_re_0(1'b0),
+		.ep_clk(clk),
+		.wb_addr(wb_addr),
+		.wb_rdata(wb_rdata),
+		.wb_wdata(wb_wdata),
+		.wb_we(wb_we),
+		.wb_cyc(wb_cyc),
+		.wb_ack(wb_ack),
+		.irq(),
+		.sof(),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Event log
+	always @(posedge clk)
+	begin
+		cyc = cyc + 1;
+		if (dut_I.evt_stb) begin
+			if (log_n < 16) begin
+				log_t[log_n] = cyc - sof_cyc;
+				log_f[log_n] = sof_frame;
+			end
+			log_n = log_n + 1;
+		end
+	end
+
+	// Bus helpers
+	task wb_access;
+		input  we;
+		input  [11:0] addr;
+		input  [15:0] wdata;
+		output [15:0] rdata;
+		begin
+			wb_addr  <= addr;
+			wb_wdata <= wdata;
+			wb_we    <= we;
+			wb_cyc   <= 1'b1;
+			@(posedge clk);
+			while (!wb_ack)
+				@(posedge clk);
+			rdata = wb_rdata;
+			wb_cyc   <= 1'b0;
+			wb_we    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task wb_write;
+		input [11:0] addr;
+		input [15:0] data;
+		reg   [15:0] d;
+		begin
+			wb_access(1'b1, addr, data, d);
+		end
+	endtask
+
+	task wb_read;
+		input  [11:0] addr;
+		output [15:0] data;
+		begin
+			wb_access(1'b0, addr, 16'h0000, data);
+		end
+	endtask
+
+	// Host helpers
+	function [4:0] crc5;
+		input [10:0] d;
+		integer i;
+		reg [4:0] c;
+		begin
+			c = 5'h1f;
+			for (i=0; i<11; i=i+1)
+				c = (c[0] ^ d[i]) ? ((c >> 1) ^ 5'h14) : (c >> 1);
+			crc5 = ~c;
+		end
+	endfunction
+
+	task host_sym;
+		input dp;
+		input dn;
+		begin
+			host_oe <= 1'b1;
+			host_dp <= dp;
+			host_dn <= dn;
+			repeat (4) @(posedge clk);
+		end
+	endtask
+
+	// SYNC, 'len' bytes from 'hb' (NRZI, bit stuffed), EOP
+	task host_tx;
+		input integer len;
+		integer i, j, ones;
+		reg lvl, b;
+		begin
+			lvl  = 1'b1;
+			ones = 0;
+
+			for (i=0; i<=len; i=i+1)
+				for (j=0; j<8; j=j+1) begin
+					b = (i == 0) ? (j == 7) : hb[i-1][j];
+					if (b)
+						ones = ones + 1;
+					else begin
+						lvl  = ~lvl;
+						ones = 0;
+					end
+					host_sym(lvl, ~lvl);
+					if (ones == 6) begin
+						lvl  = ~lvl;
+						ones = 0;
+						host_sym(lvl, ~lvl);
+					end
+				end
+
+			host_sym(1'b0, 1'b0);
+			host_sym(1'b0, 1'b0);
+			host_sym(1'b1, 1'b0);
+			host_oe <= 1'b0;
+
+			// Inter packet gap
+			repeat (8) @(posedge clk);
+		end
+	endtask
+
+	task host_token;
+		input [ 3:0] pid;
+		input [10:0] val;
+		begin
+			hb[0] = { ~pid, pid };
+			hb[1] = val[7:0];
+			hb[2] = { crc5(val), val[10:8] };
+			host_tx(3);
+		end
+	endtask
+
+	task host_sof;
+		input [10:0] frame;
+		begin
+			sof_cyc   = cyc;
+			sof_frame = frame;
+			host_token(PID_SOF, frame);
+		end
+	endtask
+
+	// Zero length OUT to EP1, ACKed by the device, then re-armed
+	task host_out;
+		begin
+			host_token(PID_OUT, { 4'h1, 7'h00 });
+
+			hb[0] = dt ? { ~PID_DATA1, PID_DATA1 } : { ~PID_DATA0, PID_DATA0 };
+			hb[1] = 8'h00;	// CRC16 of nothing
+			hb[2] = 8'h00;
+			host_tx(3);
+
+			repeat (200) @(posedge clk);
+			dt = ~dt;
+
+			wb_write(12'h814, 16'h4008);
+		end
+	endtask
+
+	// Reads the next event and its timestamp, checks them against the log
+	task evt_check;
+		input integer k;
+		input ovf;
+		reg [15:0] d, f, s;
+		integer lat;
+		begin
+			wb_read(12'h002, d);
+			wb_read(12'h004, f);
+			wb_read(12'h005, s);
+
+			lat = log_t[k] - s;
+
+			if (d !== { 1'b1, ovf, 2'b00, 12'h010 }) begin
+				$display("Event %0d : got %04x, expected %04x", k, d, { 1'b1, ovf, 2'b00, 12'h010 });
+				errors = errors + 1;
+			end
+
+			if (f !== { 5'd0, log_f[k] }) begin
+				$display("Event %0d : frame %03x, expected %03x", k, f, log_f[k]);
+				errors = errors + 1;
+			end
+
+			if ((lat < LAT_MIN) || (lat > LAT_MAX)) begin
+				$display("Event %0d : sub-frame count %0d, expected %0d - [%0d,%0d]",
+					k, s, log_t[k], LAT_MIN, LAT_MAX);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task evt_empty;
+		reg [15:0] d;
+		begin
+			wb_read(12'h002, d);
+			if (d[15] !== 1'b0) begin
+				$display("Event FIFO not empty : got %04x", d);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+	integer i;
+
+	initial begin
+		// Init
+		wb_addr  <= 12'h000;
+		wb_wdata <= 16'h0000;
+		wb_we    <= 1'b0;
+		wb_cyc   <= 1'b0;
+		host_oe  <= 1'b0;
+		host_dp  <= 1'b1;
+		host_dn  <= 1'b0;
+
+		dt        = 1'b0;
+		cyc       = 0;
+		sof_cyc   = 0;
+		sof_frame = 11'h000;
+		log_n     = 0;
+		errors    = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (100) @(posedge clk);
+
+		// EP1 OUT: Bulk, single buffer
+		wb_write(12'h810, 16'h0004);
+		wb_write(12'h814, 16'h4008);
+		wb_write(12'h815, 16'h0000);
+
+		// Events in two frames, read back a frame later
+		host_sof(11'h123);
+		repeat (300) @(posedge clk);
+		host_out();
+
+		host_sof(11'h124);
+		host_out();
+		repeat (1000) @(posedge clk);
+		host_out();
+
+		host_sof(11'h125);
+		repeat (300) @(posedge clk);
+
+		if (log_n != 3) begin
+			$display("%0d events, expected 3", log_n);
+			errors = errors + 1;
+		end
+
+		for (i=0; i<3; i=i+1)
+			evt_check(i, 1'b0);
+		evt_empty();
+
+		// One event too many : the oldest ones are kept, the first
+		// read reports the overflow
+		log_n = 0;
+		host_sof(11'h7ff);
+		for (i=0; i<=DEPTH; i=i+1)
+			host_out();
+
+		for (i=0; i<DEPTH; i=i+1)
+			evt_check(i, i == 0);
+		evt_empty();
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_evt_ram_tb
@@ -0,0 +1,424 @@
+/*
+ * usb_notify_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Per-EP notification control (`NOTIFY_CTRL`) : coalescing of successful
+ * transactions, count reset on EP config write / bus reset, masking and
+ * short packet only mode. Errors are never coalesced.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_notify_tb;
+
+	localparam integer BYTE_CYCLES = 8;	// Duration of a byte on the bus
+	localparam integer TX_CYCLES   = 40;	// Device packet duration
+	localparam integer TA_CYCLES   = 40;	// Host turnaround
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_data;
+	reg  rxpkt_is_handshake;
+	reg  [3:0] rxpkt_endp;
+	reg  [7:0] rxpkt_data;
+	reg  rxpkt_data_stb;
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_read_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+	wire [15:0] s_dout_3;
+	wire s_ready_0;
+
+	// Events
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	integer evt_cnt;
+	reg  [11:0] evt_last;
+
+	// Notify control (driven by usb.v in the full core)
+	reg  ntf_rst;
+	reg  ntf_clr;
+	reg  [4:0] ntf_clr_ep;
+
+	// Device TX capture
+	reg  tx_seen;
+	reg  [3:0] tx_pid;
+	integer    tx_len;
+
+	reg dt;
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_notify_tb.vcd");
+		$dumpvars(0,usb_notify_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans #(
+		.NOTIFY_CTRL(1)
+	) trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(1'b0),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(rxpkt_is_data),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(rxpkt_endp),
+		.rxpkt_data(rxpkt_data),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.buf_tx_addr_0(),
+		.buf_tx_data_1(8'h00),
+		.buf_tx_rden_0(),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(16'd70),
+		.cr_dsc_ena(1'b0),
+		.cr_dsc_mps(2'b00),
+		.cr_dsc_base(11'h000),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.stat_rx_to(),
+		.stat_tx_nak(),
+		.stat_tx_stall(),
+		.stat_no_ep(),
+		.stat_ep(),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(ntf_rst),
+		.ntf_clr(ntf_clr),
+		.ntf_clr_ep(ntf_clr_ep),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status ep_status_I (
+		.p_addr_0(eps_addr_0[7:0]),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(s_read_0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(s_dout_3),
+		.s_ready_0(s_ready_0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Device TX model: fixed duration packets
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_seen <= 1'b1;
+			tx_pid  <= txpkt_pid;
+			tx_len   = txpkt_len;
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Event capture
+	always @(posedge clk)
+		if (evt_stb) begin
+			evt_cnt  = evt_cnt + 1;
+			evt_last = evt_data;
+		end
+
+	// Helpers
+	task eps_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task eps_read;
+		input  [ 7:0] addr;
+		output [15:0] data;
+		begin
+			s_addr_0 <= addr;
+			s_read_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_read_0 <= 1'b0;
+			repeat (3) @(posedge clk);
+			data = s_dout_3;
+		end
+	endtask
+
+	task eps_check;
+		input [ 7:0] addr;
+		input [15:0] exp;
+		reg   [15:0] val;
+		begin
+			eps_read(addr, val);
+			if (val !== exp) begin
+				$display("EPS %02x : got %04x, expected %04x", addr, val, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input [3:0] endp;
+		input integer len;	// -1 for token / handshake
+		integer n;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+
+			if (len < 0) begin
+				repeat (BYTE_CYCLES) @(posedge clk);
+			end else begin
+				// Payload + CRC
+				for (n=0; n<len+2; n=n+1) begin
+					repeat (BYTE_CYCLES-1) @(posedge clk);
+					rxpkt_data     <= n;
+					rxpkt_data_stb <= 1'b1;
+					@(posedge clk);
+					rxpkt_data_stb <= 1'b0;
+				end
+			end
+
+			repeat (8) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_endp         <= endp;
+			rxpkt_is_token     <= (len < 0) & ((pid & 4'h3) == 4'h1);
+			rxpkt_is_handshake <= (len < 0) & ((pid & 4'h3) == 4'h2);
+			rxpkt_is_data      <= (len >= 0);
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// Wait for the device response (if any) to a host packet
+	task wait_tx;
+		integer n;
+		begin
+			n = 0;
+			while (!tx_seen && (n < 200)) begin
+				@(posedge clk);
+				n = n + 1;
+			end
+			if (tx_seen)
+				@(posedge txpkt_done);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// EP1 IN config write, resets the EP notify count like usb.v does
+	task ep1_cfg;
+		input [15:0] data;
+		begin
+			eps_write(8'h1b, data);
+			ntf_clr_ep <= 5'b00011;
+			ntf_clr    <= 1'b1;
+			@(posedge clk);
+			ntf_clr    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	// Bus reset, resets all the notify counts
+	task bus_reset;
+		begin
+			ntf_rst <= 1'b1;
+			@(posedge clk);
+			ntf_rst <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	// IN transaction on EP1 from a freshly armed 'len' bytes BD, ACKed
+	// by the host or not. Checks the packet and the notification (if any)
+	task in_ntf;
+		input integer len;
+		input ack;
+		input [11:0] evt;	// 0 for none
+		integer n0;
+		begin
+			n0 = evt_cnt;
+			eps_write(8'h1c, 16'h4000 | len);
+
+			tx_seen <= 1'b0;
+			host_pkt(PID_IN, 4'h1, -1);
+			wait_tx();
+
+			if (ack)
+				host_pkt(PID_ACK, 4'h1, -1);
+			repeat (64) @(posedge clk);
+
+			if (!tx_seen || (tx_pid !== (dt ? PID_DATA1 : PID_DATA0)) || (tx_len != len)) begin
+				$display("IN EP1 : device sent PID %x len %0d, expected %x len %0d",
+					tx_seen ? tx_pid : PID_INVAL, tx_len, dt ? PID_DATA1 : PID_DATA0, len);
+				errors = errors + 1;
+			end
+
+			if ((evt_cnt != n0 + (evt ? 1 : 0)) || (evt && (evt_last !== evt))) begin
+				$display("IN EP1 : %0d events (last %03x), expected %03x", evt_cnt - n0, evt_last, evt);
+				errors = errors + 1;
+			end
+
+			if (ack)
+				dt = ~dt;
+		end
+	endtask
+
+	// Test
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_data      <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_endp         <= 4'h0;
+		rxpkt_data         <= 8'h00;
+		rxpkt_data_stb     <= 1'b0;
+		s_addr_0           <= 8'h00;
+		s_read_0           <= 1'b0;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+		tx_seen            <= 1'b0;
+		tx_pid             <= 4'h0;
+		tx_len              = 0;
+		ntf_rst            <= 1'b0;
+		ntf_clr            <= 1'b0;
+		ntf_clr_ep         <= 5'd0;
+
+		evt_cnt = 0;
+		dt      = 0;
+		errors  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// EP1 IN: Bulk, single buffer, MPS 8, every 3rd success reported
+		eps_write(8'h18, 16'h0004);
+		eps_write(8'h1d, 16'h0040);
+		ep1_cfg(16'h4008);
+
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+
+		// Config write restarts the count
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		ep1_cfg(16'h4008);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+
+		// Errors are always reported and don't count
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 0, 12'h818);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+
+		// So does a bus reset
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		bus_reset();
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+
+		// Masked : nothing, errors included
+		ep1_cfg(16'h0808);
+		in_ntf(0, 1, 12'h000);
+		in_ntf(0, 0, 12'h000);
+		in_ntf(8, 1, 12'h000);
+
+		// Short packets only : full ones are silent, errors still reported
+		ep1_cfg(16'h1008);
+		in_ntf(8, 1, 12'h000);
+		in_ntf(3, 1, 12'h018);
+		in_ntf(8, 0, 12'h818);
+		in_ntf(8, 1, 12'h000);
+		in_ntf(0, 1, 12'h018);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_notify_tb
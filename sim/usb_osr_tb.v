@@ -0,0 +1,505 @@
+/*
+ * usb_osr_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Checks the RX and TX low-level paths at the supported core clock
+ * frequencies (48 / 60 / 72 / 96 MHz) :
+ *  - RX: Raw capture replay, all clocks must decode the same packets
+ *  - RX: Jittered packets from a modeled host with a bit rate offset
+ *  - TX: Packets sent by the core, decoded by a 48 MHz reference RX
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/1ps
+
+module usb_osr_tb;
+
+	// Config
+	localparam integer N_PKT     = 16;		// Packets in each direction
+	localparam real    JITTER_NS = 4.0;		// Max edge jitter (+/-)
+	localparam real    RATE_OFS  = 0.0025;	// Host bit rate offset (max allowed)
+	localparam integer N_INST    = 4;
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk_ref  = 0;	// 48 MHz reference
+	reg clk_samp = 0;	// Capture samplerate
+
+	reg host_dp;
+	reg host_dn;
+
+	reg  [7:0] in_file_data;
+	reg  in_file_valid;
+	reg  in_file_done;
+	reg  cap_phase;
+
+	wire usb_dp;
+	wire usb_dn;
+
+	reg  tx_go;
+	reg  sim_done;
+
+	wire [N_INST-1:0] inst_ok;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_osr_tb.vcd");
+		$dumpvars(0,usb_osr_tb);
+	end
+
+	// Clocks
+	always #10.41667 clk_ref  = !clk_ref;
+	always #3.247    clk_samp = !clk_samp;
+
+	// Bus is driven by the capture first, then the host model
+	assign usb_dp = cap_phase ? (in_file_data[1] & in_file_valid) : host_dp;
+	assign usb_dn = cap_phase ? (in_file_data[0] & in_file_valid) : host_dn;
+
+
+	// Capture replay
+	// --------------
+
+	integer fh_in, rv;
+
+	initial
+		fh_in = $fopen("../data/capture_usb_raw_short.bin", "rb");
+
+	always @(posedge clk_samp)
+	begin
+		if (rst) begin
+			in_file_data  <= 8'h00;
+			in_file_valid <= 1'b0;
+			in_file_done  <= 1'b0;
+		end else begin
+			if (!in_file_done) begin
+				rv = $fread(in_file_data, fh_in);
+				in_file_valid <= (rv == 1);
+				in_file_done  <= (rv != 1);
+			end else begin
+				in_file_data  <= 8'h00;
+				in_file_valid <= 1'b0;
+				in_file_done  <= 1'b1;
+			end
+		end
+	end
+
+
+	// Host model
+	// ----------
+
+	// Test packets (SETUP token, GET_DESCRIPTOR data, ACK)
+	reg [7:0] pkt_setup[0:2];
+	reg [7:0] pkt_data[0:10];
+	reg [7:0] pkt_ack[0:0];
+
+	initial begin
+		pkt_setup[0] = 8'h2d; pkt_setup[1] = 8'h00; pkt_setup[2] = 8'h10;
+
+		pkt_data[ 0] = 8'hc3;
+		pkt_data[ 1] = 8'h80; pkt_data[ 2] = 8'h06; pkt_data[ 3] = 8'h00; pkt_data[ 4] = 8'h01;
+		pkt_data[ 5] = 8'h00; pkt_data[ 6] = 8'h00; pkt_data[ 7] = 8'h40; pkt_data[ 8] = 8'h00;
+		pkt_data[ 9] = 8'hdd; pkt_data[10] = 8'h94;
+
+		pkt_ack[0] = 8'hd2;
+	end
+
+	// Line state
+	real    t_bit;		// Bit time (with rate offset)
+	real    t_base;		// Nominal time of next edge
+	real    t_edge;		// Jittered time of next edge
+	reg     lvl;		// 1 = J, 0 = K
+	integer ones;
+
+	task line_sym;
+		input [1:0] sym;
+		begin
+			if (t_edge > $realtime)
+				#(t_edge - $realtime);
+			{ host_dp, host_dn } = sym;
+			t_base = t_base + t_bit;
+			t_edge = t_base + JITTER_NS * (($random % 1001) / 1000.0);
+		end
+	endtask
+
+	task line_bit;
+		input b;
+		begin
+			// NRZI
+			if (!b)
+				lvl = ~lvl;
+			line_sym(lvl ? SYM_J : SYM_K);
+
+			// Bit stuffing
+			ones = b ? (ones + 1) : 0;
+			if (ones == 6) begin
+				lvl = ~lvl;
+				line_sym(lvl ? SYM_J : SYM_K);
+				ones = 0;
+			end
+		end
+	endtask
+
+	task line_byte;
+		input [7:0] v;
+		integer i;
+		begin
+			for (i=0; i<8; i=i+1)
+				line_bit(v[i]);
+		end
+	endtask
+
+	task host_pkt;
+		input integer which;
+		integer i, len;
+		begin
+			// Start of packet
+			t_base = $realtime + t_bit;
+			t_edge = t_base;
+			lvl  = 1'b1;
+			ones = 0;
+
+			// SYNC
+			line_byte(8'h80);
+
+			// Content
+			len = (which == 0) ? 3 : ((which == 1) ? 11 : 1);
+			for (i=0; i<len; i=i+1)
+				case (which)
+					0: line_byte(pkt_setup[i]);
+					1: line_byte(pkt_data[i]);
+					2: line_byte(pkt_ack[i]);
+				endcase
+
+			// EOP
+			line_sym(SYM_SE0);
+			line_sym(SYM_SE0);
+			line_sym(SYM_J);
+
+			// Inter-packet gap
+			#(t_bit * 8);
+		end
+	endtask
+
+
+	// Instances
+	// ---------
+
+	genvar n;
+	generate
+		for (n=0; n<N_INST; n=n+1)
+		begin : inst
+			localparam integer OSR  = (n == 0) ? 4 : ((n == 1) ? 5 : ((n == 2) ? 6 : 8));
+			localparam real    HALF = 500.0 / (12.0 * OSR);
+
+			reg clk = 0;
+
+			always #(HALF) clk = !clk;
+
+			// RX path at test frequency
+			wire rx_dp, rx_dn, rx_chg;
+			wire [1:0] rxll_sym;
+			wire rxll_bit, rxll_valid, rxll_eop, rxll_sync, rxll_bs_skip, rxll_bs_err;
+			wire rxpkt_start, rxpkt_done_ok, rxpkt_done_err;
+			wire [3:0] rxpkt_pid;
+			wire [7:0] rxpkt_data;
+			wire rxpkt_data_stb;
+
+			usb_phy phy_I (
+				.pad_dp(usb_dp),
+				.pad_dn(usb_dn),
+				.rx_dp(rx_dp),
+				.rx_dn(rx_dn),
+				.rx_chg(rx_chg),
+				.tx_dp(1'b0),
+				.tx_dn(1'b0),
+				.tx_en(1'b0),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			usb_rx_ll #(
+				.OSR(OSR)
+			) rx_ll_I (
+				.phy_rx_dp(rx_dp),
+				.phy_rx_dn(rx_dn),
+				.phy_rx_chg(rx_chg),
+				.ll_sym(rxll_sym),
+				.ll_bit(rxll_bit),
+				.ll_valid(rxll_valid),
+				.ll_eop(rxll_eop),
+				.ll_sync(rxll_sync),
+				.ll_bs_skip(rxll_bs_skip),
+				.ll_bs_err(rxll_bs_err),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			usb_rx_pkt rx_pkt_I (
+				.ll_sym(rxll_sym),
+				.ll_bit(rxll_bit),
+				.ll_valid(rxll_valid),
+				.ll_eop(rxll_eop),
+				.ll_sync(rxll_sync),
+				.ll_bs_skip(rxll_bs_skip),
+				.ll_bs_err(rxll_bs_err),
+				.pkt_start(rxpkt_start),
+				.pkt_done_ok(rxpkt_done_ok),
+				.pkt_done_err(rxpkt_done_err),
+				.pkt_pid(rxpkt_pid),
+				.pkt_is_sof(),
+				.pkt_is_token(),
+				.pkt_is_data(),
+				.pkt_is_handshake(),
+				.pkt_frameno(),
+				.pkt_addr(),
+				.pkt_endp(),
+				.pkt_data(rxpkt_data),
+				.pkt_data_stb(rxpkt_data_stb),
+				.inhibit(1'b0),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			integer cap_ok, cap_err;
+			integer rx_ok, rx_err, rx_bad, rx_idx;
+
+			always @(posedge clk)
+				if (rst) begin
+					cap_ok  <= 0;
+					cap_err <= 0;
+					rx_ok   <= 0;
+					rx_err  <= 0;
+					rx_bad  <= 0;
+				end else if (cap_phase) begin
+					if (rxpkt_done_ok)
+						cap_ok <= cap_ok + 1;
+					if (rxpkt_done_err)
+						cap_err <= cap_err + 1;
+				end else begin
+					if (rxpkt_start)
+						rx_idx <= 1;
+					if (rxpkt_data_stb) begin
+						rx_idx <= rx_idx + 1;
+						if ((rx_idx <= 8) && (rxpkt_data != pkt_data[rx_idx]))
+							rx_bad <= rx_bad + 1;
+					end
+					if (rxpkt_done_ok)
+						rx_ok <= rx_ok + 1;
+					if (rxpkt_done_err)
+						rx_err <= rx_err + 1;
+				end
+
+			// TX path at test frequency
+			wire txll_start, txll_bit, txll_last, txll_ack;
+			wire tx_dp, tx_dn, tx_en;
+			reg  txpkt_start;
+			wire txpkt_done;
+			reg  [7:0] txpkt_data;
+			wire txpkt_data_ack;
+			reg  tx_busy;
+			integer tx_cnt;
+
+			usb_tx_ll #(
+				.OSR(OSR)
+			) tx_ll_I (
+				.phy_tx_dp(tx_dp),
+				.phy_tx_dn(tx_dn),
+				.phy_tx_en(tx_en),
+				.ll_start(txll_start),
+				.ll_bit(txll_bit),
+				.ll_last(txll_last),
+				.ll_ack(txll_ack),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			usb_tx_pkt tx_pkt_I (
+				.ll_start(txll_start),
+				.ll_bit(txll_bit),
+				.ll_last(txll_last),
+				.ll_ack(txll_ack),
+				.pkt_start(txpkt_start),
+				.pkt_done(txpkt_done),
+				.pkt_pid(PID_DATA1),
+				.pkt_len(10'd8),
+				.pkt_data(txpkt_data),
+				.pkt_data_ack(txpkt_data_ack),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			// Send the same payload as the host DATA packet
+			always @(posedge clk)
+				if (rst) begin
+					txpkt_start <= 1'b0;
+					tx_busy     <= 1'b0;
+					tx_cnt      <= 0;
+				end else begin
+					txpkt_start <= tx_go & ~tx_busy & ~txpkt_start & (tx_cnt < N_PKT);
+					if (txpkt_start) begin
+						tx_busy <= 1'b1;
+						tx_cnt  <= tx_cnt + 1;
+					end else if (txpkt_done)
+						tx_busy <= 1'b0;
+				end
+
+			integer tx_idx;
+
+			always @(posedge clk)
+				if (txpkt_start)
+					tx_idx <= 1;
+				else if (txpkt_data_ack)
+					tx_idx <= tx_idx + 1;
+
+			always @(*)
+				txpkt_data = pkt_data[(tx_idx > 8) ? 8 : tx_idx];
+
+			// Reference RX at 48 MHz (idle is J)
+			wire ref_pad_dp = tx_en ? tx_dp : 1'b1;
+			wire ref_pad_dn = tx_en ? tx_dn : 1'b0;
+			wire ref_dp, ref_dn, ref_chg;
+			wire [1:0] refll_sym;
+			wire refll_bit, refll_valid, refll_eop, refll_sync, refll_bs_skip, refll_bs_err;
+			wire refpkt_done_ok, refpkt_done_err, refpkt_start;
+			wire [7:0] refpkt_data;
+			wire refpkt_data_stb;
+
+			usb_phy ref_phy_I (
+				.pad_dp(ref_pad_dp),
+				.pad_dn(ref_pad_dn),
+				.rx_dp(ref_dp),
+				.rx_dn(ref_dn),
+				.rx_chg(ref_chg),
+				.tx_dp(1'b0),
+				.tx_dn(1'b0),
+				.tx_en(1'b0),
+				.clk(clk_ref),
+				.rst(rst)
+			);
+
+			usb_rx_ll ref_ll_I (
+				.phy_rx_dp(ref_dp),
+				.phy_rx_dn(ref_dn),
+				.phy_rx_chg(ref_chg),
+				.ll_sym(refll_sym),
+				.ll_bit(refll_bit),
+				.ll_valid(refll_valid),
+				.ll_eop(refll_eop),
+				.ll_sync(refll_sync),
+				.ll_bs_skip(refll_bs_skip),
+				.ll_bs_err(refll_bs_err),
+				.clk(clk_ref),
+				.rst(rst)
+			);
+
+			usb_rx_pkt ref_pkt_I (
+				.ll_sym(refll_sym),
+				.ll_bit(refll_bit),
+				.ll_valid(refll_valid),
+				.ll_eop(refll_eop),
+				.ll_sync(refll_sync),
+				.ll_bs_skip(refll_bs_skip),
+				.ll_bs_err(refll_bs_err),
+				.pkt_start(refpkt_start),
+				.pkt_done_ok(refpkt_done_ok),
+				.pkt_done_err(refpkt_done_err),
+				.pkt_pid(),
+				.pkt_is_sof(),
+				.pkt_is_token(),
+				.pkt_is_data(),
+				.pkt_is_handshake(),
+				.pkt_frameno(),
+				.pkt_addr(),
+				.pkt_endp(),
+				.pkt_data(refpkt_data),
+				.pkt_data_stb(refpkt_data_stb),
+				.inhibit(1'b0),
+				.clk(clk_ref),
+				.rst(rst)
+			);
+
+			integer ref_ok, ref_err, ref_bad, ref_idx;
+
+			always @(posedge clk_ref)
+				if (rst) begin
+					ref_ok  <= 0;
+					ref_err <= 0;
+					ref_bad <= 0;
+				end else begin
+					if (refpkt_start)
+						ref_idx <= 1;
+					if (refpkt_data_stb) begin
+						ref_idx <= ref_idx + 1;
+						if ((ref_idx <= 8) && (refpkt_data != pkt_data[ref_idx]))
+							ref_bad <= ref_bad + 1;
+					end
+					if (refpkt_done_ok)
+						ref_ok <= ref_ok + 1;
+					if (refpkt_done_err)
+						ref_err <= ref_err + 1;
+				end
+
+			// Report
+			assign inst_ok[n] =
+				(cap_ok == inst[0].cap_ok) && (cap_err == inst[0].cap_err) && (cap_ok > 0) &&
+				(rx_ok  == 3 * N_PKT) && (rx_err  == 0) && (rx_bad  == 0) &&
+				(ref_ok ==     N_PKT) && (ref_err == 0) && (ref_bad == 0);
+
+			always @(posedge sim_done)
+				$display("%2d MHz : Capture %0d ok / %0d err - RX %0d ok / %0d err / %0d bad bytes - TX %0d ok / %0d err / %0d bad bytes",
+					12 * OSR, cap_ok, cap_err, rx_ok, rx_err, rx_bad, ref_ok, ref_err, ref_bad);
+		end
+	endgenerate
+
+
+	// Test sequence
+	// -------------
+
+	integer i;
+
+	initial begin
+		// Idle bus (J)
+		host_dp  = 1'b1;
+		host_dn  = 1'b0;
+		tx_go     = 1'b0;
+		sim_done  = 1'b0;
+		cap_phase = 1'b1;
+
+		// Host runs slightly fast
+		t_bit = 1000.0 / (12.0 * (1.0 + RATE_OFS));
+
+		// Reset
+		# 200 rst = 0;
+
+		// Capture replay
+		wait (in_file_done);
+		# 1000;
+		cap_phase = 1'b0;
+		# 1000;
+
+		// RX
+		for (i=0; i<N_PKT; i=i+1) begin
+			host_pkt(0);
+			host_pkt(1);
+			host_pkt(2);
+		end
+
+		// TX
+		tx_go = 1'b1;
+		# (N_PKT * 12000);
+
+		// Results
+		sim_done = 1'b1;
+		# 10;
+
+		$display("%s", (&inst_ok) ? "PASS" : "FAIL");
+		$finish;
+	end
+
+endmodule // usb_osr_tb
@@ -0,0 +1,399 @@
+/*
+ * usb_rearm_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Auto-rearm OUT endpoints (`AUTO_REARM`) : empty BDs are used as if armed
+ * with MPS bytes, done ones NAK unless overwriting is allowed, in which case
+ * they're reused with the overrun flag set. Explicitly armed BDs behave as
+ * usual.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_rearm_tb;
+
+	localparam integer BYTE_CYCLES = 8;	// Duration of a byte on the bus
+	localparam integer TX_CYCLES   = 40;	// Device packet duration
+	localparam integer TA_CYCLES   = 40;	// Host turnaround
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+
+	// RX buffer
+	wire buf_rx_wren_0;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_data;
+	reg  rxpkt_is_handshake;
+	reg  [3:0] rxpkt_endp;
+	reg  [7:0] rxpkt_data;
+	reg  rxpkt_data_stb;
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_read_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+	wire [15:0] s_dout_3;
+	wire s_ready_0;
+
+	// Events
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	integer evt_cnt;
+	reg  [11:0] evt_last;
+	integer wr_cnt;
+
+	// Device TX capture
+	reg  tx_seen;
+	reg  [3:0] tx_pid;
+	integer    tx_len;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_rearm_tb.vcd");
+		$dumpvars(0,usb_rearm_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans #(
+		.AUTO_REARM(1)
+	) trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(1'b0),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(rxpkt_is_data),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(rxpkt_endp),
+		.rxpkt_data(rxpkt_data),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.buf_tx_addr_0(),
+		.buf_tx_data_1(8'h00),
+		.buf_tx_rden_0(),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(buf_rx_wren_0),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(16'd70),
+		.cr_dsc_ena(1'b0),
+		.cr_dsc_mps(2'b00),
+		.cr_dsc_base(11'h000),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.stat_rx_to(),
+		.stat_tx_nak(),
+		.stat_tx_stall(),
+		.stat_no_ep(),
+		.stat_ep(),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(1'b0),
+		.ntf_clr(1'b0),
+		.ntf_clr_ep(5'd0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status ep_status_I (
+		.p_addr_0(eps_addr_0[7:0]),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(s_read_0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(s_dout_3),
+		.s_ready_0(s_ready_0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Device TX model: fixed duration packets
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_seen <= 1'b1;
+			tx_pid  <= txpkt_pid;
+			tx_len   = txpkt_len;
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Monitors
+	always @(posedge clk)
+	begin
+		if (evt_stb) begin
+			evt_cnt  = evt_cnt + 1;
+			evt_last = evt_data;
+		end
+		if (buf_rx_wren_0)
+			wr_cnt = wr_cnt + 1;
+	end
+
+	// Helpers
+	task eps_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task eps_read;
+		input  [ 7:0] addr;
+		output [15:0] data;
+		begin
+			s_addr_0 <= addr;
+			s_read_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_read_0 <= 1'b0;
+			repeat (3) @(posedge clk);
+			data = s_dout_3;
+		end
+	endtask
+
+	task eps_check;
+		input [ 7:0] addr;
+		input [15:0] exp;
+		reg   [15:0] val;
+		begin
+			eps_read(addr, val);
+			if (val !== exp) begin
+				$display("EPS %02x : got %04x, expected %04x", addr, val, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input [3:0] endp;
+		input integer len;	// -1 for token / handshake
+		integer n;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+
+			if (len < 0) begin
+				repeat (BYTE_CYCLES) @(posedge clk);
+			end else begin
+				// Payload + CRC
+				for (n=0; n<len+2; n=n+1) begin
+					repeat (BYTE_CYCLES-1) @(posedge clk);
+					rxpkt_data     <= n;
+					rxpkt_data_stb <= 1'b1;
+					@(posedge clk);
+					rxpkt_data_stb <= 1'b0;
+				end
+			end
+
+			repeat (8) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_endp         <= endp;
+			rxpkt_is_token     <= (len < 0) & ((pid & 4'h3) == 4'h1);
+			rxpkt_is_handshake <= (len < 0) & ((pid & 4'h3) == 4'h2);
+			rxpkt_is_data      <= (len >= 0);
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// Wait for the device response (if any) to a host packet
+	task wait_tx;
+		integer n;
+		begin
+			n = 0;
+			while (!tx_seen && (n < 200)) begin
+				@(posedge clk);
+				n = n + 1;
+			end
+			if (tx_seen)
+				@(posedge txpkt_done);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// OUT transaction with 'len' bytes of payload. Checks the device
+	// handshake
+	task out_check;
+		input [3:0] endp;
+		input [3:0] pid;
+		input integer len;
+		input [3:0] exp;
+		begin
+			tx_seen <= 1'b0;
+			host_pkt(PID_OUT, endp, -1);
+			repeat (TA_CYCLES) @(posedge clk);
+			host_pkt(pid, endp, len);
+			wait_tx();
+			repeat (64) @(posedge clk);
+
+			if ((tx_seen ? tx_pid : PID_INVAL) !== exp) begin
+				$display("OUT EP%0d : device sent PID %x, expected %x", endp, tx_seen ? tx_pid : PID_INVAL, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// OUT transaction on EP2, then checks the handshake, BD word 0, status
+	// word, bytes written to the buffer and the event (if any)
+	task out_rearm;
+		input [3:0] pid;
+		input integer len;
+		input [3:0] hs;
+		input [ 7:0] bd_addr;
+		input [15:0] bd_w0;
+		input [15:0] status;
+		input integer nwr;
+		input [11:0] evt;	// 0 for none
+		integer n0;
+		begin
+			n0 = evt_cnt;
+			wr_cnt = 0;
+			out_check(4'h2, pid, len, hs);
+			eps_check(bd_addr, bd_w0);
+			eps_check(8'h20, status);
+
+			if (wr_cnt != nwr) begin
+				$display("BD %02x : %0d bytes written, expected %0d", bd_addr, wr_cnt, nwr);
+				errors = errors + 1;
+			end
+
+			if ((evt_cnt != n0 + (evt ? 1 : 0)) || (evt && (evt_last !== evt))) begin
+				$display("BD %02x : %0d events (last %03x), expected %03x", bd_addr, evt_cnt - n0, evt_last, evt);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_data      <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_endp         <= 4'h0;
+		rxpkt_data         <= 8'h00;
+		rxpkt_data_stb     <= 1'b0;
+		s_addr_0           <= 8'h00;
+		s_read_0           <= 1'b0;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+		tx_seen            <= 1'b0;
+		tx_pid             <= 4'h0;
+		tx_len              = 0;
+
+		evt_cnt = 0;
+		wr_cnt  = 0;
+		errors  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// EP2 OUT: Bulk, double buffered, auto-rearm, MPS 8, both BDs empty
+		eps_write(8'h20, 16'h001c);
+		eps_write(8'h23, 16'h0008);
+		eps_write(8'h24, 16'h0000);
+		eps_write(8'h25, 16'h0100);
+		eps_write(8'h26, 16'h0000);
+		eps_write(8'h27, 16'h0140);
+
+		// Both empty BDs are used in turn (length includes the CRC)
+		out_rearm(PID_DATA0, 5, PID_ACK, 8'h24, 16'h8007, 16'h00dc, 7, 12'h020);
+		out_rearm(PID_DATA1, 8, PID_ACK, 8'h26, 16'h800a, 16'h001c, 8, 12'h022);
+
+		// BD0 not consumed yet : NAK, nothing touched
+		out_rearm(PID_DATA0, 4, PID_NAK, 8'h24, 16'h8007, 16'h001c, 0, 12'h000);
+
+		// Allow overwriting : BD0 reused, with the overrun flag
+		eps_write(8'h23, 16'h0408);
+		out_rearm(PID_DATA0, 4, PID_ACK, 8'h24, 16'h8406, 16'h00dc, 6, 12'h020);
+
+		// BD1 given back by software : no overrun, and an auto-armed BD
+		// only takes MPS bytes (the length still reports what was sent)
+		eps_write(8'h26, 16'h0000);
+		out_rearm(PID_DATA1, 10, PID_ACK, 8'h26, 16'h800c, 16'h001c, 8, 12'h022);
+
+		// Explicitly armed BD : its own length, no overrun flag
+		eps_write(8'h24, 16'h4010);
+		out_rearm(PID_DATA0, 12, PID_ACK, 8'h24, 16'h800e, 16'h00dc, 14, 12'h020);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_rearm_tb
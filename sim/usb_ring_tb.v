@@ -0,0 +1,401 @@
+/*
+ * usb_ring_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * BD ring mode (`BD_RING = 4`) : an IN endpoint using the last slot of the
+ * BD pool goes around its ring, checking the BD order, the `ridx` / data
+ * toggle write back, the event BD bit and that neighbour slots are left
+ * alone.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_ring_tb;
+
+	localparam integer BYTE_CYCLES = 8;	// Duration of a byte on the bus
+	localparam integer TX_CYCLES   = 40;	// Device packet duration
+	localparam integer TA_CYCLES   = 16;	// Host turnaround
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_data;
+	reg  rxpkt_is_handshake;
+	reg  [3:0] rxpkt_endp;
+	reg  [7:0] rxpkt_data;
+	reg  rxpkt_data_stb;
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 8:0] s_addr_0;
+	reg  s_read_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+	wire [15:0] s_dout_3;
+	wire s_ready_0;
+
+	// Events
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	integer evt_cnt;
+	reg  [11:0] evt_last;
+
+	// Device TX capture
+	reg  tx_seen;
+	reg  [3:0] tx_pid;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_ring_tb.vcd");
+		$dumpvars(0,usb_ring_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans #(
+		.BD_RING(4)
+	) trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(1'b0),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(rxpkt_is_data),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(rxpkt_endp),
+		.rxpkt_data(rxpkt_data),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.buf_tx_addr_0(),
+		.buf_tx_data_1(8'h00),
+		.buf_tx_rden_0(),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(16'd70),
+		.cr_dsc_ena(1'b0),
+		.cr_dsc_mps(2'b00),
+		.cr_dsc_base(11'h000),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.stat_rx_to(),
+		.stat_tx_nak(),
+		.stat_tx_stall(),
+		.stat_no_ep(),
+		.stat_ep(),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(1'b0),
+		.ntf_clr(1'b0),
+		.ntf_clr_ep(5'd0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status #(
+		.AW(9)
+	) ep_status_I (
+		.p_addr_0(eps_addr_0),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(s_read_0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(s_dout_3),
+		.s_ready_0(s_ready_0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Device TX model: fixed duration packets
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_seen <= 1'b1;
+			tx_pid  <= txpkt_pid;
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Event capture
+	always @(posedge clk)
+		if (evt_stb) begin
+			evt_cnt  = evt_cnt + 1;
+			evt_last = evt_data;
+		end
+
+	// Helpers
+	task eps_write;
+		input [ 8:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task eps_read;
+		input  [ 8:0] addr;
+		output [15:0] data;
+		begin
+			s_addr_0 <= addr;
+			s_read_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_read_0 <= 1'b0;
+			repeat (3) @(posedge clk);
+			data = s_dout_3;
+		end
+	endtask
+
+	task eps_check;
+		input [ 8:0] addr;
+		input [15:0] exp;
+		reg   [15:0] val;
+		begin
+			eps_read(addr, val);
+			if (val !== exp) begin
+				$display("EPS %03x : got %04x, expected %04x", addr, val, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input [3:0] endp;
+		input integer len;	// -1 for token / handshake
+		integer n;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+
+			if (len < 0) begin
+				repeat (BYTE_CYCLES) @(posedge clk);
+			end else begin
+				// Payload + CRC
+				for (n=0; n<len+2; n=n+1) begin
+					repeat (BYTE_CYCLES-1) @(posedge clk);
+					rxpkt_data     <= n;
+					rxpkt_data_stb <= 1'b1;
+					@(posedge clk);
+					rxpkt_data_stb <= 1'b0;
+				end
+			end
+
+			repeat (8) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_endp         <= endp;
+			rxpkt_is_token     <= (len < 0) & ((pid & 4'h3) == 4'h1);
+			rxpkt_is_handshake <= (len < 0) & ((pid & 4'h3) == 4'h2);
+			rxpkt_is_data      <= (len >= 0);
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// Wait for the device response (if any) to a host packet
+	task wait_tx;
+		integer n;
+		begin
+			n = 0;
+			while (!tx_seen && (n < 200)) begin
+				@(posedge clk);
+				n = n + 1;
+			end
+			if (tx_seen)
+				@(posedge txpkt_done);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// IN transaction, ACKed if the device sends data. Checks the PID the
+	// device answered with (PID_INVAL if none)
+	task in_check;
+		input [3:0] endp;
+		input [3:0] exp;
+		begin
+			tx_seen <= 1'b0;
+			host_pkt(PID_IN, endp, -1);
+			wait_tx();
+
+			if (tx_seen && ((tx_pid & 4'h3) == 4'h3))
+				host_pkt(PID_ACK, endp, -1);
+			repeat (64) @(posedge clk);
+
+			if ((tx_seen ? tx_pid : PID_INVAL) !== exp) begin
+				$display("IN EP%0d : device sent PID %x, expected %x", endp, tx_seen ? tx_pid : PID_INVAL, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// EP1 IN uses the last slot of the pool : BDs 124 to 127
+	localparam [4:0] SLOT = 5'd31;
+
+	function [8:0] pool_addr;
+		input [1:0] ridx;
+		input w;
+		pool_addr = { 1'b1, SLOT, ridx, w };
+	endfunction
+
+	function [15:0] ep1_status;
+		input [1:0] ridx;
+		input dt;
+		ep1_status = { SLOT, 1'b0, ridx, dt, 1'b0, 2'b11, 1'b0, 3'b100 };
+	endfunction
+
+	// Test
+	integer k, n0;
+	reg [1:0] ridx;
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_data      <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_endp         <= 4'h0;
+		rxpkt_data         <= 8'h00;
+		rxpkt_data_stb     <= 1'b0;
+		s_addr_0           <= 9'h000;
+		s_read_0           <= 1'b0;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+		tx_seen            <= 1'b0;
+		tx_pid             <= 4'h0;
+
+		evt_cnt = 0;
+		errors  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// Markers in the neighbour slots (30 and 0)
+		for (k=0; k<4; k=k+1) begin
+			eps_write({ 1'b1, 5'd30, k[1:0], 1'b0 }, 16'h1234);
+			eps_write({ 1'b1, 5'd0,  k[1:0], 1'b0 }, 16'h5678);
+		end
+
+		// EP1 IN: Bulk, ring mode, slot 31, starting at ridx 3
+		eps_write(9'h018, ep1_status(2'd3, 1'b0));
+
+		// Arm the whole ring with ZLPs
+		for (k=0; k<4; k=k+1) begin
+			eps_write(pool_addr(k[1:0], 1'b0), 16'h4000);
+			eps_write(pool_addr(k[1:0], 1'b1), 16'h0000);
+		end
+
+		// Go around the ring : BDs 3, 0, 1, 2
+		ridx = 2'd3;
+
+		for (k=0; k<4; k=k+1) begin
+			n0 = evt_cnt;
+			in_check(4'h1, k[0] ? PID_DATA1 : PID_DATA0);
+
+			eps_check(pool_addr(ridx, 1'b0), 16'h8000);
+			eps_check(9'h018, ep1_status(ridx + 2'd1, ~k[0]));
+
+			if ((evt_cnt != n0 + 1) || (evt_last !== { 4'h0, 4'h1, 1'b1, 1'b0, ridx[0], 1'b0 })) begin
+				$display("Ring BD %0d : %0d events, last %03x", ridx, evt_cnt - n0, evt_last);
+				errors = errors + 1;
+			end
+
+			ridx = ridx + 2'd1;
+		end
+
+		// Back to BD 3, still done : NAK, nothing written back
+		n0 = evt_cnt;
+		in_check(4'h1, PID_NAK);
+		eps_check(9'h018, ep1_status(2'd3, 1'b0));
+
+		if (evt_cnt != n0) begin
+			$display("NAK generated an event");
+			errors = errors + 1;
+		end
+
+		// Software hands it back, the ring resumes there
+		eps_write(pool_addr(2'd3, 1'b0), 16'h4000);
+		in_check(4'h1, PID_DATA0);
+		eps_check(pool_addr(2'd3, 1'b0), 16'h8000);
+		eps_check(9'h018, ep1_status(2'd0, 1'b1));
+
+		// Neighbour slots untouched
+		for (k=0; k<4; k=k+1) begin
+			eps_check({ 1'b1, 5'd30, k[1:0], 1'b0 }, 16'h1234);
+			eps_check({ 1'b1, 5'd0,  k[1:0], 1'b0 }, 16'h5678);
+		end
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_ring_tb
@@ -0,0 +1,293 @@
+/*
+ * usb_rto_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_rto_tb;
+
+	// Sweep config
+	localparam integer TX_CYCLES  = 140;	// Device ZLP DATAx packet duration
+	localparam integer HS_CYCLES  =  64;	// Host handshake packet duration
+	localparam integer DLY_MAX    = 400;	// Max host turnaround to model
+	localparam integer DLY_STEP   =   2;
+	localparam integer MARGIN     =   8;	// Allowed microcode latency slack
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_handshake;
+	reg  [3:0] rxpkt_endp;
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+
+	// Config / Events
+	reg  [15:0] cr_rto;
+
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	reg  evt_seen;
+	reg  [3:0] evt_code;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_rto_tb.vcd");
+		$dumpvars(0,usb_rto_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(1'b0),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(1'b0),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(rxpkt_endp),
+		.rxpkt_data(8'h00),
+		.rxpkt_data_stb(1'b0),
+		.buf_tx_addr_0(),
+		.buf_tx_data_1(8'h00),
+		.buf_tx_rden_0(),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(cr_rto),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(1'b0),
+		.ntf_clr(1'b0),
+		.ntf_clr_ep(5'd0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status ep_status_I (
+		.p_addr_0(eps_addr_0[7:0]),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(1'b0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(),
+		.s_ready_0(),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Device TX model: fixed duration packets
+	always @(posedge clk)
+		if (txpkt_start) begin
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Event capture
+	always @(posedge clk)
+		if (evt_stb) begin
+			evt_seen <= 1'b1;
+			evt_code <= evt_data[11:8];
+		end
+
+	// Helpers
+	task eps_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input is_token;
+		input integer len;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+			repeat (len) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_is_token     <= is_token;
+			rxpkt_is_handshake <= ~is_token;
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// One IN transaction on EP1 with the host ACKing after 'dly' cycles
+	task in_trans;
+		input integer dly;
+		output ok;
+		begin
+			// Arm BD0 of EP1 IN with a ZLP
+			eps_write(8'h1c, 16'h4000);
+
+			evt_seen <= 1'b0;
+
+			// IN token
+			host_pkt(PID_IN, 1'b1, 32);
+
+			// Wait for the device to be done with its data
+			@(posedge txpkt_done);
+			@(posedge clk);
+
+			// Host turnaround then ACK
+			repeat (dly) @(posedge clk);
+			host_pkt(PID_ACK, 1'b0, HS_CYCLES);
+
+			// Let the microcode conclude
+			repeat (64) @(posedge clk);
+
+			ok = evt_seen & (evt_code == 4'h0);
+		end
+	endtask
+
+	// Sweep
+	integer rto_i, rto, dly, max_ok, errors;
+	reg ok, was_ok;
+	reg [15:0] rto_vals[0:4];
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_endp         <= 4'h1;
+		s_addr_0           <= 8'h00;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+		evt_seen           <= 1'b0;
+		evt_code           <= 4'h0;
+
+		rto_vals[0] =  20;
+		rto_vals[1] =  70;
+		rto_vals[2] = 120;
+		rto_vals[3] = 180;
+		rto_vals[4] = 320;	// Past the old 8 bits CSR
+
+		errors = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// EP1 IN: Bulk, single buffered
+		eps_write(8'h18, 16'h0004);
+		eps_write(8'h1d, 16'h0000);
+
+		for (rto_i=0; rto_i<5; rto_i=rto_i+1)
+		begin
+			rto    = rto_vals[rto_i];
+			cr_rto = rto;
+			max_ok = -1;
+			was_ok = 1'b1;
+
+			for (dly=0; dly<=DLY_MAX; dly=dly+DLY_STEP)
+			begin
+				in_trans(dly, ok);
+
+				// Once it failed, longer delays must fail too
+				if (ok & ~was_ok) begin
+					$display("RTO %3d : unexpected success at turnaround %0d", rto, dly);
+					errors = errors + 1;
+				end
+
+				if (ok)
+					max_ok = dly;
+				was_ok = ok;
+			end
+
+			// The longest turnaround must hit the timeout
+			if (was_ok) begin
+				$display("RTO %3d : timeout never fired", rto);
+				errors = errors + 1;
+			end
+
+			$display("RTO %3d : host turnaround accepted up to %3d cycles (%0d ns)",
+				rto, max_ok, max_ok * 20833 / 1000);
+
+			if ((max_ok < rto - MARGIN) || (max_ok > rto + MARGIN)) begin
+				$display("RTO %3d : limit out of expected range", rto);
+				errors = errors + 1;
+			end
+		end
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_rto_tb
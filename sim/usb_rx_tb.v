@@ -0,0 +1,332 @@
+/*
+ * usb_rx_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Capture replay regression and robustness benchmark of the RX path
+ * (`usb_phy` / `usb_rx_ll` / `usb_rx_pkt` at 48 MHz).
+ *
+ * The raw capture is replayed into several instances, each with its own
+ * line impairments :
+ *  - Host clock drift (the capture is replayed faster / slower)
+ *  - Edge jitter (each transition randomly delayed)
+ *  - Glitches (short random pulses on D+ or D-)
+ *
+ * The decoded packets (PID, token data, data bytes with CRC, ok / error)
+ * are compared against the golden reference produced by the software
+ * decoder (`utils/usbcap.py golden`). Packets are matched by their position
+ * in the capture (sample index when the PID was received). For each
+ * instance, the number of good, bad (error or different content), missed
+ * and extra packets and the packet error rate are reported. Instances flagged MUST_PASS (no impairment, or within the
+ * USB spec) fail the test on any difference.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/1ps
+
+module usb_rx_tb;
+
+	// Config
+	localparam integer N_INST    = 10;
+	localparam integer GOLD_MAX  = 4096;	// Golden file words
+	localparam integer MATCH_TOL = 64;		// Samples after the golden EOP
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	reg [31:0] gold[0:GOLD_MAX-1];
+
+	wire [N_INST-1:0] inst_done;
+	wire [N_INST-1:0] inst_ok;
+	reg  sim_done;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_rx_tb.vcd");
+		$dumpvars(0,usb_rx_tb);
+	end
+
+	// Clock
+	always #10.41667 clk = !clk;
+
+	// Golden reference
+	initial
+		$readmemh("../data/capture_usb_raw_short_pkt.hex", gold);
+
+
+	// Instances
+	// ---------
+
+	genvar n;
+	generate
+		for (n=0; n<N_INST; n=n+1)
+		begin : inst
+			// Impairments
+			localparam real DRIFT_PPM =
+				((n == 1) || (n == 4) || (n == 7)) ?  2500.0 :
+				((n == 2) || (n == 5) || (n == 9)) ? -2500.0 :
+				(n == 8) ? 5000.0 : 0.0;
+
+			localparam real JITTER_NS =
+				((n == 3) || (n == 4) || (n == 5)) ? 4.0 :
+				((n == 6) || (n == 7) || (n == 9)) ? 8.0 : 0.0;
+
+			localparam integer GLITCH_N  = (n == 9) ? 100 : 0;	// Per ms
+			localparam real    GLITCH_NS = 5.0;
+
+			localparam MUST_PASS = (n <= 5);
+
+			// Capture replay with drift
+			localparam real HALF = 3.247 / (1.0 + DRIFT_PPM * 1e-6);
+
+			reg clk_samp = 0;
+
+			always #(HALF) clk_samp = !clk_samp;
+
+			reg  [7:0] in_file_data;
+			reg  in_file_valid;
+			reg  in_file_done;
+			integer fh_in, rv, samp_idx;
+
+			initial
+				fh_in = $fopen("../data/capture_usb_raw_short.bin", "rb");
+
+			always @(posedge clk_samp)
+			begin
+				if (rst) begin
+					in_file_data  <= 8'h00;
+					in_file_valid <= 1'b0;
+					in_file_done  <= 1'b0;
+					samp_idx      <= -1;
+				end else begin
+					if (!in_file_done) begin
+						rv = $fread(in_file_data, fh_in);
+						in_file_valid <= (rv == 1);
+						in_file_done  <= (rv != 1);
+						samp_idx      <= samp_idx + 1;
+					end else begin
+						in_file_data  <= 8'h00;
+						in_file_valid <= 1'b0;
+						in_file_done  <= 1'b1;
+					end
+				end
+			end
+
+			assign inst_done[n] = in_file_done;
+
+			// Jitter : each transition is delayed by 0 to 2 x JITTER_NS
+			wire [1:0] cap_sym = in_file_data[1:0] & {2{in_file_valid}};
+			reg  [1:0] jit_sym = 2'b00;
+			integer jit_seed = 1 + n;
+			real    jit_dly;
+
+			always @(cap_sym)
+			begin
+				jit_dly = JITTER_NS * (({$random(jit_seed)} % 2001) / 1000.0);
+				jit_sym <= #(jit_dly) cap_sym;
+			end
+
+			// Glitches : GLITCH_N per ms on average, random line
+			reg glitch_dp = 1'b0;
+			reg glitch_dn = 1'b0;
+			integer glitch_seed = 1001 + n;
+
+			initial
+				if (GLITCH_N > 0)
+					forever begin
+						#((1.0e6 / GLITCH_N) * (({$random(glitch_seed)} % 2001) / 1000.0));
+						if ($random(glitch_seed) & 1) begin
+							glitch_dp = 1'b1;
+							#(GLITCH_NS) glitch_dp = 1'b0;
+						end else begin
+							glitch_dn = 1'b1;
+							#(GLITCH_NS) glitch_dn = 1'b0;
+						end
+					end
+
+			wire usb_dp = jit_sym[1] ^ glitch_dp;
+			wire usb_dn = jit_sym[0] ^ glitch_dn;
+
+			// RX path
+			wire rx_dp, rx_dn, rx_chg;
+			wire [1:0] rxll_sym;
+			wire rxll_bit, rxll_valid, rxll_eop, rxll_sync, rxll_bs_skip, rxll_bs_err;
+			wire rxpkt_start, rxpkt_done_ok, rxpkt_done_err;
+			wire [3:0] rxpkt_pid;
+			wire [10:0] rxpkt_frameno;
+			wire [7:0] rxpkt_data;
+			wire rxpkt_data_stb;
+
+			usb_phy phy_I (
+				.pad_dp(usb_dp),
+				.pad_dn(usb_dn),
+				.rx_dp(rx_dp),
+				.rx_dn(rx_dn),
+				.rx_chg(rx_chg),
+				.tx_dp(1'b0),
+				.tx_dn(1'b0),
+				.tx_en(1'b0),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			usb_rx_ll rx_ll_I (
+				.phy_rx_dp(rx_dp),
+				.phy_rx_dn(rx_dn),
+				.phy_rx_chg(rx_chg),
+				.ll_sym(rxll_sym),
+				.ll_bit(rxll_bit),
+				.ll_valid(rxll_valid),
+				.ll_eop(rxll_eop),
+				.ll_sync(rxll_sync),
+				.ll_bs_skip(rxll_bs_skip),
+				.ll_bs_err(rxll_bs_err),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			usb_rx_pkt rx_pkt_I (
+				.ll_sym(rxll_sym),
+				.ll_bit(rxll_bit),
+				.ll_valid(rxll_valid),
+				.ll_eop(rxll_eop),
+				.ll_sync(rxll_sync),
+				.ll_bs_skip(rxll_bs_skip),
+				.ll_bs_err(rxll_bs_err),
+				.pkt_start(rxpkt_start),
+				.pkt_done_ok(rxpkt_done_ok),
+				.pkt_done_err(rxpkt_done_err),
+				.pkt_pid(rxpkt_pid),
+				.pkt_is_sof(),
+				.pkt_is_token(),
+				.pkt_is_data(),
+				.pkt_is_handshake(),
+				.pkt_frameno(rxpkt_frameno),
+				.pkt_addr(),
+				.pkt_endp(),
+				.pkt_data(rxpkt_data),
+				.pkt_data_stb(rxpkt_data_stb),
+				.inhibit(1'b0),
+				.clk(clk),
+				.rst(rst)
+			);
+
+			// Received data bytes (max payload + CRC) and position of the
+			// packet in the capture (at PID, or at the error if no valid PID)
+			reg [7:0] rx_buf[0:1024];
+			integer rx_len, rx_pos;
+			reg     rx_started;
+
+			always @(posedge clk)
+				if (rxpkt_start) begin
+					rx_len <= 0;
+					rx_pos <= samp_idx;
+				end else if (rxpkt_data_stb) begin
+					if (rx_len <= 1024)
+						rx_buf[rx_len] <= rxpkt_data;
+					rx_len <= rx_len + 1;
+				end
+
+			always @(posedge clk)
+				if (rst)
+					rx_started <= 1'b0;
+				else
+					rx_started <= (rx_started | rxpkt_start) & ~(rxpkt_done_ok | rxpkt_done_err);
+
+			// Compare against golden
+			integer g_ptr, g_len, g_seen, pos, i;
+			integer n_pkt, n_good, n_bad, n_extra;
+			reg     match;
+
+			initial begin
+				n_pkt = 0;
+				#1;
+				for (i=0; gold[i] !== 32'hffffffff; i=i+3+gold[i+2][15:0])
+					n_pkt = n_pkt + gold[i+2][31];
+			end
+
+			always @(posedge clk)
+				if (rst) begin
+					g_ptr   = 0;
+					g_seen  = 0;
+					n_good  = 0;
+					n_bad   = 0;
+					n_extra = 0;
+				end else begin
+					pos = rx_started ? rx_pos : samp_idx;
+
+					// Move past the golden packets that are over
+					while ((gold[g_ptr] !== 32'hffffffff) && (pos > gold[g_ptr+1] + MATCH_TOL)) begin
+						g_ptr  = g_ptr + 3 + gold[g_ptr+2][15:0];
+						g_seen = 0;
+					end
+
+					if (rxpkt_done_ok | rxpkt_done_err) begin
+						if ((gold[g_ptr] === 32'hffffffff) || (pos < gold[g_ptr])) begin
+							// Nothing on the line there
+							n_extra = n_extra + 1;
+						end else if (gold[g_ptr+2][31]) begin
+							// Golden packet is valid, must match
+							if (g_seen) begin
+								n_extra = n_extra + 1;
+							end else begin
+								g_len = gold[g_ptr+2][15:0];
+								match = rxpkt_done_ok && (rxpkt_pid == gold[g_ptr+2][19:16]);
+								if (rxpkt_pid[1:0] == 2'b01)
+									match = match && (rxpkt_frameno == gold[g_ptr+3][10:0]);
+								else if (rxpkt_pid[1:0] == 2'b11) begin
+									match = match && (rx_len == g_len);
+									for (i=0; match && (i<g_len); i=i+1)
+										match = (rx_buf[i] == gold[g_ptr+3+i][7:0]);
+								end
+								if (match)
+									n_good = n_good + 1;
+								else
+									n_bad = n_bad + 1;
+							end
+							g_seen = 1;
+						end
+						// else: Golden packet is invalid, anything goes
+					end
+				end
+
+			// Report
+			assign inst_ok[n] = MUST_PASS ?
+				((n_pkt > 0) && (n_good == n_pkt) && (n_extra == 0)) :
+				1'b1;
+
+			always @(posedge sim_done)
+				$display("drift %6.0f ppm, jitter %3.1f ns, glitch %3d/ms : %4d pkts, %4d good, %3d bad, %3d missed, %3d extra, PER %7.3f %% %s",
+					DRIFT_PPM, JITTER_NS, GLITCH_N,
+					n_pkt, n_good, n_bad, n_pkt - n_good - n_bad, n_extra,
+					100.0 * (n_pkt - n_good) / n_pkt,
+					MUST_PASS ? (inst_ok[n] ? "ok" : "FAIL") : "");
+		end
+	endgenerate
+
+
+	// Test sequence
+	// -------------
+
+	initial begin
+		sim_done = 1'b0;
+
+		// Reset
+		# 200 rst = 0;
+
+		// Wait for all the replays
+		wait (&inst_done);
+		# 10000;
+
+		// Results
+		sim_done = 1'b1;
+		# 10;
+		$display("%s", (&inst_ok) ? "PASS" : "FAIL");
+		$finish;
+	end
+
+endmodule // usb_rx_tb
@@ -0,0 +1,230 @@
+/*
+ * usb_stats_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_stats_tb;
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	reg  evt_bs_err;
+	reg  evt_rx_err;
+	reg  evt_rx_to;
+	reg  evt_tx_nak;
+	reg  evt_tx_stall;
+	reg  evt_no_ep;
+	reg  [4:0] evt_ep;
+
+	reg  [15:0] ctl_wdata;
+	reg  ctl_we;
+	wire [15:0] ctl_rdata;
+	wire [15:0] dat_rdata;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_stats_tb.vcd");
+		$dumpvars(0,usb_stats_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_stats dut_I (
+		.evt_bs_err(evt_bs_err),
+		.evt_rx_err(evt_rx_err),
+		.evt_rx_to(evt_rx_to),
+		.evt_tx_nak(evt_tx_nak),
+		.evt_tx_stall(evt_tx_stall),
+		.evt_no_ep(evt_no_ep),
+		.evt_ep(evt_ep),
+		.ctl_wdata(ctl_wdata),
+		.ctl_we(ctl_we),
+		.ctl_rdata(ctl_rdata),
+		.dat_rdata(dat_rdata),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Helpers
+	task ctl_write;
+		input [15:0] val;
+		begin
+			ctl_wdata <= val;
+			ctl_we    <= 1'b1;
+			@(posedge clk);
+			ctl_we    <= 1'b0;
+		end
+	endtask
+
+	// Read as early as the CSR bus allows after the control write
+	task check;
+		input [15:0] sel;
+		input [15:0] exp;
+		begin
+			ctl_write(sel);
+			@(posedge clk);
+			#1;
+			if (dat_rdata !== exp) begin
+				$display("Counter %02x : got %0d, expected %0d", sel[5:0], dat_rdata, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task nak;
+		input [4:0] ep;
+		begin
+			evt_ep     <= ep;
+			evt_tx_nak <= 1'b1;
+			@(posedge clk);
+			evt_tx_nak <= 1'b0;
+			repeat (7) @(posedge clk);
+		end
+	endtask
+
+	task pulse_bs_err;
+		begin
+			evt_bs_err <= 1'b1;
+			@(posedge clk);
+			evt_bs_err <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	// Test
+	integer k, total;
+
+	initial begin
+		// Init
+		evt_bs_err   <= 1'b0;
+		evt_rx_err   <= 1'b0;
+		evt_rx_to    <= 1'b0;
+		evt_tx_nak   <= 1'b0;
+		evt_tx_stall <= 1'b0;
+		evt_no_ep    <= 1'b0;
+		evt_ep       <= 5'd0;
+		ctl_wdata    <= 16'h0000;
+		ctl_we       <= 1'b0;
+
+		errors = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// Global counters
+		for (k=0; k<5; k=k+1)
+			pulse_bs_err;
+
+		evt_rx_err <= 1'b1;
+		repeat (3) @(posedge clk);
+		evt_rx_err <= 1'b0;
+
+		evt_tx_stall <= 1'b1;
+		repeat (70000) @(posedge clk);
+		evt_tx_stall <= 1'b0;
+
+		evt_no_ep <= 1'b1;
+		@(posedge clk);
+		evt_no_ep <= 1'b0;
+
+		// NAKs : EP1 IN x 10, EP2 OUT x 4
+		for (k=0; k<10; k=k+1)
+			nak(5'h03);
+		for (k=0; k<4; k=k+1)
+			nak(5'h04);
+
+		// Snapshot & read (events during the snapshot go to the new period)
+		ctl_write(16'h8000);
+		evt_bs_err <= 1'b1;
+		@(posedge clk);
+		evt_bs_err <= 1'b0;
+
+		check(16'h0000, 5);
+		check(16'h0001, 3);
+		check(16'h0002, 0);
+		check(16'h0003, 14);
+		check(16'h0004, 16'hffff);
+		check(16'h0005, 1);
+
+		// Second snapshot only has the event that occurred during the first
+		ctl_write(16'h8000);
+		check(16'h0000, 1);
+		check(16'h0004, 0);
+
+		// Per-EP, non clearing fetch, twice
+		check(16'h0023, 10);
+		check(16'h0023, 10);
+		check(16'h0024, 4);
+		check(16'h0025, 0);
+
+		// Fetched value is held while NAKs are counted
+		check(16'h0024, 4);
+		nak(5'h03);
+		#1;
+		if (dat_rdata !== 4) begin
+			$display("Fetched value not held");
+			errors = errors + 1;
+		end
+
+		// Fetch & clear, with a NAK on the same EP right before / after
+		evt_ep     <= 5'h03;
+		evt_tx_nak <= 1'b1;
+		@(posedge clk);
+		evt_tx_nak <= 1'b0;
+		check(16'h4023, 12);
+		nak(5'h03);
+		check(16'h4023, 1);
+		check(16'h0023, 0);
+
+		// Fetch & clear racing a NAK on the same EP at every offset, none
+		// may be lost or counted twice
+		check(16'h4024, 4);
+
+		total = 0;
+		for (k=0; k<8; k=k+1) begin
+			fork
+				begin
+					repeat (k) @(posedge clk);
+					evt_ep     <= 5'h04;
+					evt_tx_nak <= 1'b1;
+					@(posedge clk);
+					evt_tx_nak <= 1'b0;
+				end
+				begin
+					repeat (4) @(posedge clk);
+					ctl_write(16'h4024);
+					@(posedge clk);
+					#1 total = total + dat_rdata;
+				end
+			join
+			repeat (8) @(posedge clk);
+		end
+
+		ctl_write(16'h4024);
+		@(posedge clk);
+		#1 total = total + dat_rdata;
+
+		if (total != 8) begin
+			$display("Race : %0d NAKs counted, expected 8", total);
+			errors = errors + 1;
+		end
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_stats_tb
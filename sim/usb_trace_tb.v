@@ -0,0 +1,285 @@
+/*
+ * usb_trace_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_trace_tb;
+
+	localparam integer DEPTH = 8;
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  rxpkt_done_err;
+	reg  [ 3:0] rxpkt_pid;
+	reg  rxpkt_is_sof;
+	reg  rxpkt_is_token;
+	reg  [10:0] rxpkt_token;
+	reg  rxpkt_data_stb;
+
+	reg  txpkt_start;
+	reg  txpkt_done;
+	reg  [3:0] txpkt_pid;
+	reg  [9:0] txpkt_len;
+
+	reg  [10:0] ts_frameno;
+	reg  [15:0] ts_subcnt;
+
+	reg  [15:0] bus_wdata;
+	reg  ctl_we;
+	wire [15:0] ctl_rdata;
+	reg  flt_we;
+	wire [15:0] flt_rdata;
+	wire [15:0] dat_rdata;
+	reg  dat_ack;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_trace_tb.vcd");
+		$dumpvars(0,usb_trace_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trace #(
+		.DEPTH(DEPTH)
+	) dut_I (
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(rxpkt_done_err),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(rxpkt_is_sof),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_token(rxpkt_token),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.ts_frameno(ts_frameno),
+		.ts_subcnt(ts_subcnt),
+		.bus_wdata(bus_wdata),
+		.ctl_we(ctl_we),
+		.ctl_rdata(ctl_rdata),
+		.flt_we(flt_we),
+		.flt_rdata(flt_rdata),
+		.dat_rdata(dat_rdata),
+		.dat_ack(dat_ack),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Free running sub-frame counter
+	always @(posedge clk)
+		ts_subcnt <= ts_subcnt + 1;
+
+	// Helpers
+	task rx_pkt;
+		input [3:0] pid;
+		input [10:0] token;
+		input integer len;
+		input err;
+		integer n;
+		begin
+			rxpkt_pid      <= pid;
+			rxpkt_is_sof   <= (pid == PID_SOF);
+			rxpkt_is_token <= (pid[1:0] == 2'b01) & (pid != PID_SOF);
+			rxpkt_token    <= token;
+			rxpkt_start    <= 1'b1;
+			@(posedge clk);
+			rxpkt_start    <= 1'b0;
+			for (n=0; n<len; n=n+1) begin
+				repeat (3) @(posedge clk);
+				rxpkt_data_stb <= 1'b1;
+				@(posedge clk);
+				rxpkt_data_stb <= 1'b0;
+			end
+			repeat (8) @(posedge clk);
+			rxpkt_done_ok  <= ~err;
+			rxpkt_done_err <= err;
+			@(posedge clk);
+			rxpkt_done_ok  <= 1'b0;
+			rxpkt_done_err <= 1'b0;
+			repeat (16) @(posedge clk);
+		end
+	endtask
+
+	task tx_pkt;
+		input [3:0] pid;
+		input [9:0] len;
+		begin
+			txpkt_pid   <= pid;
+			txpkt_len   <= len;
+			txpkt_start <= 1'b1;
+			@(posedge clk);
+			txpkt_start <= 1'b0;
+			repeat (32) @(posedge clk);
+			txpkt_done  <= 1'b1;
+			@(posedge clk);
+			txpkt_done  <= 1'b0;
+			repeat (16) @(posedge clk);
+		end
+	endtask
+
+	task ctl_write;
+		input [15:0] val;
+		begin
+			bus_wdata <= val;
+			ctl_we    <= 1'b1;
+			@(posedge clk);
+			ctl_we    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task check_count;
+		input [8:0] exp;
+		begin
+			if (ctl_rdata[8:0] !== exp) begin
+				$display("Count : got %0d, expected %0d", ctl_rdata[8:0], exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Reads a full entry and checks word 0 / 1
+	task check_entry;
+		input [15:0] exp_w0;
+		input [15:0] exp_w1;
+		reg [15:0] w[0:3];
+		integer n;
+		begin
+			for (n=0; n<4; n=n+1) begin
+				@(posedge clk);
+				#1 w[n] = dat_rdata;
+				dat_ack <= 1'b1;
+				@(posedge clk);
+				dat_ack <= 1'b0;
+			end
+			if ((w[0] !== exp_w0) || (w[1] !== exp_w1)) begin
+				$display("Entry : got %04x %04x, expected %04x %04x", w[0], w[1], exp_w0, exp_w1);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+	integer k;
+
+	initial begin
+		// Init
+		rxpkt_start    <= 1'b0;
+		rxpkt_done_ok  <= 1'b0;
+		rxpkt_done_err <= 1'b0;
+		rxpkt_pid      <= 4'h0;
+		rxpkt_is_sof   <= 1'b0;
+		rxpkt_is_token <= 1'b0;
+		rxpkt_token    <= 11'h000;
+		rxpkt_data_stb <= 1'b0;
+		txpkt_start    <= 1'b0;
+		txpkt_done     <= 1'b0;
+		txpkt_pid      <= 4'h0;
+		txpkt_len      <= 10'd0;
+		ts_frameno     <= 11'd42;
+		ts_subcnt      <= 16'h0000;
+		bus_wdata      <= 16'h0000;
+		ctl_we         <= 1'b0;
+		flt_we         <= 1'b0;
+		dat_ack        <= 1'b0;
+
+		errors = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// Nothing recorded while disabled
+		rx_pkt(PID_IN, 11'h081, 2, 1'b0);
+		check_count(0);
+
+		// IN transaction on EP1, SOF filtered out by default
+		ctl_write(16'h8000);
+
+		rx_pkt(PID_SOF, 11'h123, 2, 1'b0);
+		rx_pkt(PID_IN, 11'h081, 2, 1'b0);
+		tx_pkt(PID_DATA1, 10'd8);
+		rx_pkt(PID_ACK, 11'h000, 0, 1'b0);
+		check_count(3);
+
+		check_entry({ 2'b00, PID_IN,    10'd2  }, 16'h0081);
+		check_entry({ 2'b01, PID_DATA1, 10'd10 }, 16'h0000);
+		check_entry({ 2'b00, PID_ACK,   10'd0  }, 16'h0000);
+		check_count(0);
+
+		// EP filter on EP2 : EP1 transaction skipped, EP2 recorded
+		ctl_write(16'h9200);
+
+		rx_pkt(PID_IN, 11'h081, 2, 1'b0);
+		tx_pkt(PID_NAK, 10'd0);
+		rx_pkt(PID_OUT, 11'h101, 2, 1'b0);
+		rx_pkt(PID_DATA0, 11'h000, 4, 1'b0);
+		tx_pkt(PID_ACK, 10'd0);
+		check_count(3);
+
+		check_entry({ 2'b00, PID_OUT,   10'd2  }, 16'h0101);
+		check_entry({ 2'b00, PID_DATA0, 10'd4  }, 16'h0000);
+		check_entry({ 2'b01, PID_ACK,   10'd0  }, 16'h0000);
+
+		// Overflow : only the last DEPTH entries are kept
+		ctl_write(16'hc000);
+
+		for (k=0; k<DEPTH+3; k=k+1)
+			rx_pkt(PID_IN, k, 2, 1'b0);
+		check_count(DEPTH);
+
+		if (~ctl_rdata[13]) begin
+			$display("Overflow flag not set");
+			errors = errors + 1;
+		end
+
+		check_entry({ 2'b00, PID_IN, 10'd2 }, 16'h0003);
+
+		// Stop on error : error + DEPTH/2 entries are kept
+		ctl_write(16'he000);
+
+		for (k=0; k<4; k=k+1)
+			rx_pkt(PID_IN, k, 2, 1'b0);
+		rx_pkt(PID_DATA0, 11'h000, 3, 1'b1);
+		for (k=0; k<DEPTH; k=k+1)
+			rx_pkt(PID_IN, 11'h010 + k, 2, 1'b0);
+
+		if (ctl_rdata[15:14] !== 2'b01) begin
+			$display("Trigger : recording not stopped");
+			errors = errors + 1;
+		end
+
+		check_count(DEPTH);
+		for (k=0; k<DEPTH/2-1; k=k+1)
+			check_entry({ 2'b00, PID_IN, 10'd2 }, k + 1);
+		check_entry({ 2'b10, PID_DATA0, 10'd3 }, 16'h0000);
+		for (k=0; k<DEPTH/2; k=k+1)
+			check_entry({ 2'b00, PID_IN, 10'd2 }, 11'h010 + k);
+		check_count(0);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_trace_tb
@@ -0,0 +1,229 @@
+/*
+ * usb_wb32_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * 32 bits bus (`WB_DW=32`) with the default EP status RAM : combined
+ * accesses are split in two EP status accesses, upper half first, with a
+ * single ack. Plain accesses and CSRs only use the lower half.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_wb32_tb;
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	wire usb_dp;
+	wire usb_dn;
+
+	reg  [11:0] wb_addr;
+	wire [31:0] wb_rdata;
+	reg  [31:0] wb_wdata;
+	reg  wb_we;
+	reg  wb_cyc;
+	wire wb_ack;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_wb32_tb.vcd");
+		$dumpvars(0,usb_wb32_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	pullup   (usb_dp);
+	pulldown (usb_dn);
+
+	usb #(
+		.TARGET("GENERIC"),
+		.EPDW(32),
+		.WB_DW(32)
+	) dut_I (
+		.pad_dp(usb_dp),
+		.pad_dn(usb_dn),
+		.pad_pu(),
+		.ep_tx_addr_0(9'h000),
+		.ep_tx_data_0(32'h00000000),
+		.ep_tx_we_0(1'b0),
+		.ep_rx_addr_0(9'h000),
+		.ep_rx_data_1(),
+		.ep_rx_re_0(1'b0),
+		.ep_clk(clk),
+		.wb_addr(wb_addr),
+		.wb_rdata(wb_rdata),
+		.wb_wdata(wb_wdata),
+		.wb_we(wb_we),
+		.wb_cyc(wb_cyc),
+		.wb_ack(wb_ack),
+		.irq(),
+		.sof(),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// EP status accesses log (address of each one accepted by the RAM)
+	reg  [7:0] log_addr[0:7];
+	reg  log_we[0:7];
+	integer log_n;
+	integer ack_n;
+
+	always @(posedge clk)
+	begin
+		if (dut_I.eps_bus_req & dut_I.eps_bus_ready) begin
+			if (log_n < 8) begin
+				log_addr[log_n] = dut_I.eps_bus_addr;
+				log_we[log_n]   = dut_I.eps_bus_write;
+			end
+			log_n = log_n + 1;
+		end
+		if (wb_ack)
+			ack_n = ack_n + 1;
+	end
+
+	// Helpers
+	task wb_access;
+		input  we;
+		input  [11:0] addr;
+		input  [31:0] wdata;
+		output [31:0] rdata;
+		begin
+			wb_addr  <= addr;
+			wb_wdata <= wdata;
+			wb_we    <= we;
+			wb_cyc   <= 1'b1;
+			@(posedge clk);
+			while (!wb_ack)
+				@(posedge clk);
+			rdata = wb_rdata;
+			wb_cyc   <= 1'b0;
+			wb_we    <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	// Checks one access : number of acks and EP status accesses in order
+	// ('second' unused for plain accesses)
+	task wb_split;
+		input  we;
+		input  [11:0] addr;
+		input  [31:0] wdata;
+		input  [ 7:0] first;
+		input  [ 7:0] second;
+		output [31:0] rdata;
+		integer n;
+		begin
+			n     = addr[10] ? 2 : 1;
+			log_n = 0;
+			ack_n = 0;
+			wb_access(we, addr, wdata, rdata);
+			repeat (4) @(posedge clk);
+			if (ack_n != 1) begin
+				$display("Access %03x : %0d acks", addr, ack_n);
+				errors = errors + 1;
+			end
+			if ((log_n != n) ||
+			    (log_addr[0] !== first) || (log_we[0] !== we) ||
+			    ((n == 2) && ((log_addr[1] !== second) || (log_we[1] !== we)))) begin
+				$display("Access %03x : bad EPS accesses (%0d, %02x then %02x)",
+					addr, log_n, log_addr[0], log_addr[1]);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task wb_expect;
+		input [11:0] addr;
+		input [31:0] exp;
+		reg   [31:0] d;
+		begin
+			wb_access(1'b0, addr, 32'h00000000, d);
+			if (d !== exp) begin
+				$display("Bus %03x : got %08x, expected %08x", addr, d, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+	reg [31:0] d32;
+
+	initial begin
+		// Init
+		wb_addr  <= 12'h000;
+		wb_wdata <= 32'h00000000;
+		wb_we    <= 1'b0;
+		wb_cyc   <= 1'b0;
+
+		errors = 0;
+		log_n  = 0;
+		ack_n  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// Combined status write : status (upper half) then BD0 word 0
+		wb_split(1'b1, 12'hc20, 32'h1234_5678, 8'h20, 8'h24, d32);
+		wb_expect(12'h820, 32'h0000_1234);
+		wb_expect(12'h824, 32'h0000_5678);
+
+		// Combined BD writes : word 1 (upper half) then word 0, from
+		// either word address
+		wb_split(1'b1, 12'hc26, 32'h9abc_def0, 8'h27, 8'h26, d32);
+		wb_expect(12'h827, 32'h0000_9abc);
+		wb_expect(12'h826, 32'h0000_def0);
+
+		wb_split(1'b1, 12'hc2d, 32'h0bad_cafe, 8'h2d, 8'h2c, d32);
+		wb_expect(12'h82d, 32'h0000_0bad);
+		wb_expect(12'h82c, 32'h0000_cafe);
+
+		// Combined reads, same order, back to back
+		wb_split(1'b0, 12'hc20, 32'h0000_0000, 8'h20, 8'h24, d32);
+		if (d32 !== 32'h1234_5678) begin
+			$display("Combined status read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		wb_split(1'b0, 12'hc26, 32'h0000_0000, 8'h27, 8'h26, d32);
+		if (d32 !== 32'h9abc_def0) begin
+			$display("Combined BD read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		wb_split(1'b0, 12'hc2c, 32'h0000_0000, 8'h2d, 8'h2c, d32);
+		if (d32 !== 32'h0bad_cafe) begin
+			$display("Combined BD read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		// Plain accesses : a single EP status access, upper half ignored
+		// on write and zero on read
+		wb_split(1'b1, 12'h821, 32'hffff_0042, 8'h21, 8'h00, d32);
+		wb_split(1'b0, 12'h821, 32'h0000_0000, 8'h21, 8'h00, d32);
+		if (d32 !== 32'h0000_0042) begin
+			$display("Plain read : got %08x", d32);
+			errors = errors + 1;
+		end
+
+		// CSRs too (RX timeout, ~1.5 us by default)
+		wb_expect(12'h009, 32'h0000_0046);
+		wb_access(1'b1, 12'h009, 32'hffff_0050, d32);
+		wb_expect(12'h009, 32'h0000_0050);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_wb32_tb
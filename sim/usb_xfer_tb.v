@@ -0,0 +1,454 @@
+/*
+ * usb_xfer_tb.v
+ *
+ * vim: ts=4 sw=4
+ *
+ * Multi-packet transfer BDs (`XFER`) : IN transfers with and without ZLP,
+ * single packet BDs with a ZLP, OUT transfers ending on a short packet or
+ * on a full buffer. Checks the packet lengths, the length / pointer write
+ * back after each packet and that only the end of the transfer is
+ * notified.
+ *
+ * Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+ * SPDX-License-Identifier: CERN-OHL-P-2.0
+ *
+ * Needs the transfer continuation in the microcode (`NO2USB_XFER`, on by default)
+ */
+
+`default_nettype none
+`timescale 1ns/100ps
+
+module usb_xfer_tb;
+
+	localparam integer BYTE_CYCLES = 8;	// Duration of a byte on the bus
+	localparam integer TX_CYCLES   = 40;	// Device packet duration
+	localparam integer TA_CYCLES   = 40;	// Host turnaround
+
+	`include "usb_defs.vh"
+
+	// Signals
+	reg rst = 1;
+	reg clk = 0;
+
+	// TX Packet
+	wire txpkt_start;
+	reg  txpkt_done;
+	wire [3:0] txpkt_pid;
+	wire [9:0] txpkt_len;
+	wire [7:0] txpkt_data;
+
+	// RX Packet
+	reg  rxpkt_start;
+	reg  rxpkt_done_ok;
+	reg  [3:0] rxpkt_pid;
+	reg  rxpkt_is_token;
+	reg  rxpkt_is_data;
+	reg  rxpkt_is_handshake;
+	reg  [3:0] rxpkt_endp;
+	reg  [7:0] rxpkt_data;
+	reg  rxpkt_data_stb;
+
+	// EP Status
+	wire eps_read_0;
+	wire eps_zero_0;
+	wire eps_write_0;
+	wire [ 8:0] eps_addr_0;
+	wire [15:0] eps_wrdata_0;
+	wire [15:0] eps_rddata_3;
+
+	reg  [ 7:0] s_addr_0;
+	reg  s_read_0;
+	reg  s_write_0;
+	reg  [15:0] s_din_0;
+	wire [15:0] s_dout_3;
+	wire s_ready_0;
+
+	// Events
+	wire [11:0] evt_data;
+	wire evt_stb;
+
+	integer evt_cnt;
+	reg  [11:0] evt_last;
+
+	// Device TX capture
+	reg  tx_seen;
+	reg  [3:0] tx_pid;
+	integer    tx_len;
+
+	integer errors;
+
+	// Setup recording
+	initial begin
+		$dumpfile("usb_xfer_tb.vcd");
+		$dumpvars(0,usb_xfer_tb);
+	end
+
+	// Clocks
+	always #10.416 clk = !clk;
+
+	// DUT
+	usb_trans #(
+		.XFER(1)
+	) trans_I (
+		.txpkt_start(txpkt_start),
+		.txpkt_done(txpkt_done),
+		.txpkt_pid(txpkt_pid),
+		.txpkt_len(txpkt_len),
+		.txpkt_data(txpkt_data),
+		.txpkt_data_ack(1'b0),
+		.rxpkt_start(rxpkt_start),
+		.rxpkt_done_ok(rxpkt_done_ok),
+		.rxpkt_done_err(1'b0),
+		.rxpkt_pid(rxpkt_pid),
+		.rxpkt_is_sof(1'b0),
+		.rxpkt_is_token(rxpkt_is_token),
+		.rxpkt_is_data(rxpkt_is_data),
+		.rxpkt_is_handshake(rxpkt_is_handshake),
+		.rxpkt_frameno(11'h000),
+		.rxpkt_addr(7'h00),
+		.rxpkt_endp(rxpkt_endp),
+		.rxpkt_data(rxpkt_data),
+		.rxpkt_data_stb(rxpkt_data_stb),
+		.buf_tx_addr_0(),
+		.buf_tx_data_1(8'h00),
+		.buf_tx_rden_0(),
+		.buf_rx_addr_0(),
+		.buf_rx_data_0(),
+		.buf_rx_wren_0(),
+		.eps_read_0(eps_read_0),
+		.eps_zero_0(eps_zero_0),
+		.eps_write_0(eps_write_0),
+		.eps_addr_0(eps_addr_0),
+		.eps_wrdata_0(eps_wrdata_0),
+		.eps_rddata_3(eps_rddata_3),
+		.cr_addr_chk(1'b0),
+		.cr_addr(7'h00),
+		.cr_rto(16'd70),
+		.cr_dsc_ena(1'b0),
+		.cr_dsc_mps(2'b00),
+		.cr_dsc_base(11'h000),
+		.evt_data(evt_data),
+		.evt_stb(evt_stb),
+		.stat_rx_to(),
+		.stat_tx_nak(),
+		.stat_tx_stall(),
+		.stat_no_ep(),
+		.stat_ep(),
+		.cel_state(),
+		.cel_rel(1'b0),
+		.cel_ena(1'b0),
+		.ntf_rst(1'b0),
+		.ntf_clr(1'b0),
+		.ntf_clr_ep(5'd0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	usb_ep_status ep_status_I (
+		.p_addr_0(eps_addr_0[7:0]),
+		.p_read_0(eps_read_0),
+		.p_zero_0(eps_zero_0),
+		.p_write_0(eps_write_0),
+		.p_din_0(eps_wrdata_0),
+		.p_dout_3(eps_rddata_3),
+		.s_addr_0(s_addr_0),
+		.s_read_0(s_read_0),
+		.s_zero_0(1'b0),
+		.s_write_0(s_write_0),
+		.s_din_0(s_din_0),
+		.s_dout_3(s_dout_3),
+		.s_ready_0(s_ready_0),
+		.clk(clk),
+		.rst(rst)
+	);
+
+	// Device TX model: fixed duration packets
+	always @(posedge clk)
+		if (txpkt_start) begin
+			tx_seen <= 1'b1;
+			tx_pid  <= txpkt_pid;
+			tx_len   = txpkt_len;
+			repeat (TX_CYCLES) @(posedge clk);
+			txpkt_done <= 1'b1;
+			@(posedge clk);
+			txpkt_done <= 1'b0;
+		end
+
+	// Event capture
+	always @(posedge clk)
+		if (evt_stb) begin
+			evt_cnt  = evt_cnt + 1;
+			evt_last = evt_data;
+		end
+
+	// Helpers
+	task eps_write;
+		input [ 7:0] addr;
+		input [15:0] data;
+		begin
+			s_addr_0  <= addr;
+			s_din_0   <= data;
+			s_write_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_write_0 <= 1'b0;
+			@(posedge clk);
+		end
+	endtask
+
+	task eps_read;
+		input  [ 7:0] addr;
+		output [15:0] data;
+		begin
+			s_addr_0 <= addr;
+			s_read_0 <= 1'b1;
+			@(posedge clk);
+			while (!s_ready_0)
+				@(posedge clk);
+			s_read_0 <= 1'b0;
+			repeat (3) @(posedge clk);
+			data = s_dout_3;
+		end
+	endtask
+
+	task eps_check;
+		input [ 7:0] addr;
+		input [15:0] exp;
+		reg   [15:0] val;
+		begin
+			eps_read(addr, val);
+			if (val !== exp) begin
+				$display("EPS %02x : got %04x, expected %04x", addr, val, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	task host_pkt;
+		input [3:0] pid;
+		input [3:0] endp;
+		input integer len;	// -1 for token / handshake
+		integer n;
+		begin
+			rxpkt_start <= 1'b1;
+			@(posedge clk);
+			rxpkt_start <= 1'b0;
+
+			if (len < 0) begin
+				repeat (BYTE_CYCLES) @(posedge clk);
+			end else begin
+				// Payload + CRC
+				for (n=0; n<len+2; n=n+1) begin
+					repeat (BYTE_CYCLES-1) @(posedge clk);
+					rxpkt_data     <= n;
+					rxpkt_data_stb <= 1'b1;
+					@(posedge clk);
+					rxpkt_data_stb <= 1'b0;
+				end
+			end
+
+			repeat (8) @(posedge clk);
+			rxpkt_pid          <= pid;
+			rxpkt_endp         <= endp;
+			rxpkt_is_token     <= (len < 0) & ((pid & 4'h3) == 4'h1);
+			rxpkt_is_handshake <= (len < 0) & ((pid & 4'h3) == 4'h2);
+			rxpkt_is_data      <= (len >= 0);
+			rxpkt_done_ok      <= 1'b1;
+			@(posedge clk);
+			rxpkt_done_ok      <= 1'b0;
+		end
+	endtask
+
+	// Wait for the device response (if any) to a host packet
+	task wait_tx;
+		integer n;
+		begin
+			n = 0;
+			while (!tx_seen && (n < 200)) begin
+				@(posedge clk);
+				n = n + 1;
+			end
+			if (tx_seen)
+				@(posedge txpkt_done);
+			repeat (TA_CYCLES) @(posedge clk);
+		end
+	endtask
+
+	// IN transaction, ACKed if the device sends data. Checks the PID and
+	// length the device answered with
+	task in_check;
+		input [3:0] endp;
+		input [3:0] exp_pid;
+		input integer exp_len;
+		begin
+			tx_seen <= 1'b0;
+			host_pkt(PID_IN, endp, -1);
+			wait_tx();
+
+			if (tx_seen && ((tx_pid & 4'h3) == 4'h3))
+				host_pkt(PID_ACK, endp, -1);
+			repeat (64) @(posedge clk);
+
+			if (!tx_seen || (tx_pid !== exp_pid) || (tx_len != exp_len)) begin
+				$display("IN EP%0d : device sent PID %x len %0d, expected %x len %0d",
+					endp, tx_seen ? tx_pid : PID_INVAL, tx_len, exp_pid, exp_len);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// OUT transaction with 'len' bytes of payload. Checks the device
+	// handshake
+	task out_check;
+		input [3:0] endp;
+		input [3:0] pid;
+		input integer len;
+		input [3:0] exp;
+		begin
+			tx_seen <= 1'b0;
+			host_pkt(PID_OUT, endp, -1);
+			repeat (TA_CYCLES) @(posedge clk);
+			host_pkt(pid, endp, len);
+			wait_tx();
+			repeat (64) @(posedge clk);
+
+			if ((tx_seen ? tx_pid : PID_INVAL) !== exp) begin
+				$display("OUT EP%0d : device sent PID %x, expected %x", endp, tx_seen ? tx_pid : PID_INVAL, exp);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Checks a BD and the number of events since 'n0'
+	task bd_check;
+		input [ 7:0] addr;
+		input [15:0] w0;
+		input [15:0] w1;
+		input integer n0;
+		input integer nevt;
+		begin
+			eps_check(addr, w0);
+			eps_check(addr | 8'h01, w1);
+			if (evt_cnt != n0 + nevt) begin
+				$display("BD %02x : %0d events, expected %0d", addr, evt_cnt - n0, nevt);
+				errors = errors + 1;
+			end
+		end
+	endtask
+
+	// Test
+	integer n0;
+
+	initial begin
+		// Init
+		txpkt_done         <= 1'b0;
+		rxpkt_start        <= 1'b0;
+		rxpkt_done_ok      <= 1'b0;
+		rxpkt_pid          <= 4'h0;
+		rxpkt_is_token     <= 1'b0;
+		rxpkt_is_data      <= 1'b0;
+		rxpkt_is_handshake <= 1'b0;
+		rxpkt_endp         <= 4'h0;
+		rxpkt_data         <= 8'h00;
+		rxpkt_data_stb     <= 1'b0;
+		s_addr_0           <= 8'h00;
+		s_read_0           <= 1'b0;
+		s_write_0          <= 1'b0;
+		s_din_0            <= 16'h0000;
+		tx_seen            <= 1'b0;
+		tx_pid             <= 4'h0;
+		tx_len              = 0;
+
+		evt_cnt = 0;
+		errors  = 0;
+
+		// Reset
+		repeat (10) @(posedge clk);
+		rst <= 1'b0;
+		repeat (10) @(posedge clk);
+
+		// EP1 IN / EP2 OUT: Bulk, single buffered, MPS 8
+		eps_write(8'h18, 16'h0004);
+		eps_write(8'h1b, 16'h0008);
+		eps_write(8'h20, 16'h0004);
+		eps_write(8'h23, 16'h0008);
+
+		// IN, 16 bytes with ZLP : 8, 8, 0
+		eps_write(8'h1d, 16'h0040);
+		eps_write(8'h1c, 16'h4c10);
+		n0 = evt_cnt;
+
+		in_check(4'h1, PID_DATA0, 8);
+		bd_check(8'h1c, 16'h4c08, 16'h0048, n0, 0);
+		in_check(4'h1, PID_DATA1, 8);
+		bd_check(8'h1c, 16'h4c00, 16'h0050, n0, 0);
+		in_check(4'h1, PID_DATA0, 0);
+		bd_check(8'h1c, 16'h8c00, 16'h0050, n0, 1);
+		eps_check(8'h18, 16'h0084);
+
+		if (evt_last !== 12'h018) begin
+			$display("IN transfer end : event %03x", evt_last);
+			errors = errors + 1;
+		end
+
+		// IN, 12 bytes without ZLP : 8, 4
+		eps_write(8'h1d, 16'h0080);
+		eps_write(8'h1c, 16'h480c);
+		n0 = evt_cnt;
+
+		in_check(4'h1, PID_DATA1, 8);
+		bd_check(8'h1c, 16'h4804, 16'h0088, n0, 0);
+		in_check(4'h1, PID_DATA0, 4);
+		bd_check(8'h1c, 16'h8800, 16'h008c, n0, 1);
+
+		// Single MPS packet BD with ZLP (no 'x') : 8, 0
+		eps_write(8'h1d, 16'h00c0);
+		eps_write(8'h1c, 16'h4408);
+		n0 = evt_cnt;
+
+		in_check(4'h1, PID_DATA1, 8);
+		bd_check(8'h1c, 16'h4400, 16'h00c8, n0, 0);
+		in_check(4'h1, PID_DATA0, 0);
+		bd_check(8'h1c, 16'h8400, 16'h00c8, n0, 1);
+
+		// Nothing left : NAK
+		in_check(4'h1, PID_NAK, 0);
+
+		// OUT, 24 bytes of space, ends on a short packet : 8, 8, 3
+		eps_write(8'h25, 16'h0100);
+		eps_write(8'h24, 16'h4818);
+		n0 = evt_cnt;
+
+		out_check(4'h2, PID_DATA0, 8, PID_ACK);
+		bd_check(8'h24, 16'h4810, 16'h0108, n0, 0);
+		out_check(4'h2, PID_DATA1, 8, PID_ACK);
+		bd_check(8'h24, 16'h4808, 16'h0110, n0, 0);
+		out_check(4'h2, PID_DATA0, 3, PID_ACK);
+		bd_check(8'h24, 16'h8805, 16'h0113, n0, 1);
+		eps_check(8'h20, 16'h0084);
+
+		if (evt_last !== 12'h020) begin
+			$display("OUT transfer end : event %03x", evt_last);
+			errors = errors + 1;
+		end
+
+		// OUT, 16 bytes of space, ends when less than MPS is left : 8, 8
+		eps_write(8'h25, 16'h0140);
+		eps_write(8'h24, 16'h4810);
+		n0 = evt_cnt;
+
+		out_check(4'h2, PID_DATA1, 8, PID_ACK);
+		bd_check(8'h24, 16'h4808, 16'h0148, n0, 0);
+		out_check(4'h2, PID_DATA0, 8, PID_ACK);
+		bd_check(8'h24, 16'h8800, 16'h0150, n0, 1);
+
+		// Done BD : NAK
+		out_check(4'h2, PID_DATA1, 8, PID_NAK);
+		bd_check(8'h24, 16'h8800, 16'h0150, n0, 1);
+
+		$display("%s (%0d errors)", errors ? "FAIL" : "PASS", errors);
+		$finish;
+	end
+
+endmodule // usb_xfer_tb
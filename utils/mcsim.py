@@ -0,0 +1,704 @@
+#!/usr/bin/env python3
+#
+# Cycle level simulator / profiler of the USB transaction microcode
+#
+# Runs the assembled microcode ROM (see microcode.py) on a model of the
+# `usb_trans` execution engine : one instruction per cycle, registered
+# A-register / events / RX timeout counter, EP status and BD words becoming
+# valid a fixed number of cycles after the token like the EP fetch state
+# machine does. A simple host model provides the bus side (token, data,
+# handshake packets with their on-the-wire duration).
+#
+# Each line of the script describes one transaction and the state of the
+# endpoint it targets. For each one, the response, the notify code, the EP
+# operations, the number of cycles from the end of the last host packet to
+# the TX instruction (the microcode part of the bus turnaround) and how
+# long the engine stays busy are reported. Transactions are run with all
+# the possible phases of the IDLE polling loop, worst case is what counts.
+#
+# A transaction is flagged if :
+#  - the turnaround (microcode + PHY latency) exceeds the USB budget
+#  - a LD reads EP / BD infos before the fetch state machine provided them
+#  - the engine doesn't get back to IDLE (stuck waiting for an event)
+#  - the response / notify doesn't match the `expect` / `ntf` keys
+#
+# Script format (one transaction per line, '#' for comments) :
+#
+#   <name> <IN|OUT|SETUP> <ep> [key[=value] ...]
+#
+#     type=none|isoc|int|bulk|ctrl   EP type (default bulk)
+#     halt                           EP is halted
+#     cel                            Control Endpoint Lockout active
+#     dt=0|1                         EP data toggle (default 0)
+#     bd=none|data|stall|done        Active BD state (default data)
+#     xfcont                         Transfer continues after this packet
+#     dsc                            Descriptor responder hit (SETUP)
+#     len=N                          Data payload length (default 8)
+#     data=DATA0|DATA1|err|none      Host data packet (OUT/SETUP)
+#     hs=ACK|err|none                Host handshake (IN, default ACK)
+#     expect=<PID>|none              Expected device response
+#     ntf=<code>|none                Expected notify
+#     if=DEF / ifn=DEF               Only if DEF is (not) defined
+#
+# Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+# SPDX-License-Identifier: MIT
+#
+
+import argparse
+import sys
+
+import microcode as mc
+
+
+#
+# Constants
+#
+
+PID_NAMES = {
+	mc.PID_OUT:   'OUT',   mc.PID_IN:    'IN',    mc.PID_SETUP: 'SETUP',
+	mc.PID_DATA0: 'DATA0', mc.PID_DATA1: 'DATA1',
+	mc.PID_ACK:   'ACK',   mc.PID_NAK:   'NAK',   mc.PID_STALL: 'STALL',
+}
+
+PID_VALS = dict([(v, k) for k, v in PID_NAMES.items()])
+
+PID_INVAL = 0b0000
+
+NOTIFY_NAMES = {
+	mc.NOTIFY_SUCCESS: 'SUCCESS',
+	mc.NOTIFY_TX_FAIL: 'TX_FAIL',
+	mc.NOTIFY_RX_FAIL: 'RX_FAIL',
+}
+
+NOTIFY_VALS = dict([(v, k) for k, v in NOTIFY_NAMES.items()])
+
+EP_TYPES = {
+	'none': mc.EP_TYPE_NONE,
+	'isoc': mc.EP_TYPE_ISOC,
+	'int':  mc.EP_TYPE_INT,
+	'bulk': mc.EP_TYPE_BULK,
+	'ctrl': mc.EP_TYPE_CTRL,
+}
+
+BD_STATES = {
+	'none':  mc.BD_NONE,
+	'data':  mc.BD_RDY_DATA,
+	'stall': mc.BD_RDY_STALL,
+	'done':  mc.BD_DONE_OK,
+}
+
+BD_NAMES = {
+	mc.BD_NONE:      'NONE',
+	mc.BD_RDY_DATA:  'RDY_DATA',
+	mc.BD_RDY_STALL: 'RDY_STALL',
+	mc.BD_DONE_OK:   'DONE_OK',
+	mc.BD_DONE_ERR:  'DONE_ERR',
+}
+
+# Cycles after the token 'done' strobe where the EP fetch state machine
+# has captured the EP status (ep_type) and the BD word 0 (bd_state).
+# A LD executed at cycle N sees values captured at the end of cycle N-1.
+RDY_EP_TYPE  = 4
+RDY_BD_STATE = 7
+
+# Packet sizes in bits (SYNC + PID + payload + CRC + EOP), no bit stuffing
+BITS_HANDSHAKE = 8 + 8 + 3
+BITS_TOKEN     = 8 + 8 + 16 + 3
+
+def bits_data(l):
+	return 8 + 8 + 8 * l + 16 + 3
+
+
+#
+# Script
+#
+
+DEFAULT_SCRIPT = """
+# IN, Bulk / Control / Interrupt
+in_bci             IN     1  bd=data len=64 expect=DATA0 ntf=SUCCESS
+in_bci_dt1         IN     1  bd=data len=64 dt=1 expect=DATA1 ntf=SUCCESS
+in_bci_zlp         IN     1  bd=data len=0 expect=DATA0 ntf=SUCCESS
+in_bci_xf_cont     IN     1  bd=data len=64 xfcont expect=DATA0 ntf=none ifn=NO_XFER
+in_bci_no_hs       IN     1  bd=data len=64 hs=none expect=DATA0 ntf=TX_FAIL
+in_bci_hs_err      IN     1  bd=data len=64 hs=err expect=DATA0 ntf=TX_FAIL
+in_bci_nak         IN     1  bd=none expect=NAK ntf=none
+in_bci_stall_bd    IN     1  bd=stall expect=STALL ntf=SUCCESS
+in_bci_halt        IN     1  halt expect=STALL ntf=none
+in_ctrl            IN     0  type=ctrl bd=data len=64 expect=DATA0 ntf=SUCCESS
+in_ctrl_cel        IN     0  type=ctrl cel bd=data expect=NAK ntf=none
+in_no_ep           IN     3  type=none expect=none ntf=none
+
+# IN, Isochronous
+in_isoc            IN     2  type=isoc bd=data len=192 expect=DATA0 ntf=SUCCESS ifn=NO_ISOC
+in_isoc_empty      IN     2  type=isoc bd=none expect=DATA0 ntf=none ifn=NO_ISOC
+
+# OUT, Bulk / Control / Interrupt
+out_bci            OUT    1  bd=data data=DATA0 len=64 expect=ACK ntf=SUCCESS
+out_bci_dt1        OUT    1  bd=data data=DATA1 dt=1 len=64 expect=ACK ntf=SUCCESS
+out_bci_dt_err     OUT    1  bd=data data=DATA1 len=64 expect=ACK ntf=none
+out_bci_xf_cont    OUT    1  bd=data data=DATA0 len=64 xfcont expect=ACK ntf=none ifn=NO_XFER
+out_bci_nak        OUT    1  bd=none data=DATA0 len=64 expect=NAK ntf=none
+out_bci_stall_bd   OUT    1  bd=stall data=DATA0 expect=STALL ntf=SUCCESS
+out_bci_halt       OUT    1  halt data=DATA0 expect=STALL ntf=none
+out_ctrl_cel       OUT    0  type=ctrl cel bd=data data=DATA1 expect=NAK ntf=none
+out_bci_rx_err     OUT    1  bd=data data=err len=64 expect=none ntf=RX_FAIL ifn=IGNORE_RX_ERR
+out_bci_no_data    OUT    1  bd=data data=none expect=none ntf=RX_FAIL ifn=IGNORE_RX_ERR
+out_no_ep          OUT    3  type=none data=DATA0 expect=none ntf=none
+
+# OUT, Isochronous
+out_isoc           OUT    2  type=isoc bd=data data=DATA0 len=192 expect=none ntf=SUCCESS ifn=NO_ISOC
+out_isoc_no_space  OUT    2  type=isoc bd=none data=DATA0 len=192 expect=none ntf=none ifn=NO_ISOC
+out_isoc_rx_err    OUT    2  type=isoc bd=data data=err len=192 expect=none ntf=RX_FAIL ifn=NO_ISOC ifn=IGNORE_RX_ERR
+
+# SETUP
+setup              SETUP  0  type=ctrl bd=data data=DATA0 expect=ACK ntf=SUCCESS
+setup_dsc          SETUP  0  type=ctrl bd=data data=DATA0 dsc expect=ACK ntf=none ifn=NO_DESC
+setup_cel          SETUP  0  type=ctrl cel bd=data data=DATA0 expect=none ntf=none
+setup_no_bd        SETUP  0  type=ctrl bd=none data=DATA0 expect=none ntf=none
+setup_data1        SETUP  0  type=ctrl bd=data data=DATA1 expect=none ntf=RX_FAIL ifn=IGNORE_RX_ERR
+"""
+
+
+class ScriptError(Exception):
+	pass
+
+
+def parse_script(text, defs):
+	xacts = []
+
+	for lnum, line in enumerate(text.splitlines(), 1):
+		line = line.split('#', 1)[0].strip()
+		if not line:
+			continue
+
+		tok = line.split()
+		if len(tok) < 3:
+			raise ScriptError('line %d: expected <name> <token> <ep>' % lnum)
+
+		x = {
+			'name':   tok[0],
+			'token':  tok[1].upper(),
+			'ep':     int(tok[2], 0),
+			'type':   'bulk',
+			'halt':   False,
+			'cel':    False,
+			'dt':     0,
+			'bd':     'data',
+			'xfcont': False,
+			'dsc':    False,
+			'len':    8,
+			'data':   'DATA0',
+			'hs':     'ACK',
+			'expect': None,
+			'ntf':    None,
+		}
+
+		if x['token'] not in ('IN', 'OUT', 'SETUP'):
+			raise ScriptError('line %d: invalid token %s' % (lnum, tok[1]))
+
+		skip = False
+
+		for kv in tok[3:]:
+			k, _, v = kv.partition('=')
+			if k in ('halt', 'cel', 'xfcont', 'dsc'):
+				x[k] = True
+			elif k in ('dt', 'len'):
+				x[k] = int(v, 0)
+			elif k in ('type', 'bd'):
+				if v not in (EP_TYPES if k == 'type' else BD_STATES):
+					raise ScriptError('line %d: invalid %s value %s' % (lnum, k, v))
+				x[k] = v
+			elif k in ('data', 'hs', 'expect', 'ntf'):
+				x[k] = v
+			elif k == 'if':
+				skip |= v not in defs
+			elif k == 'ifn':
+				skip |= v in defs
+			else:
+				raise ScriptError('line %d: unknown key %s' % (lnum, k))
+
+		if not skip:
+			xacts.append(x)
+
+	return xacts
+
+
+#
+# Engine model
+#
+
+class Engine:
+
+	def __init__(self, rom, opts):
+		# Unprogrammed locations read as 0 (NOP)
+		self.rom  = list(rom) + [0x0000] * (256 - len(rom))
+		self.opts = opts
+
+		# Micro-code state
+		self.pc    = 0
+		self.a     = 0
+		self.evt   = 0
+		self.rto   = 0
+		self.cyc   = 0
+
+		# Packet / Transaction / EP infos
+		self.pkt_pid  = PID_INVAL
+		self.ep_type  = 0
+		self.cel      = False
+		self.dt       = 0
+		self.bd_state = 0
+		self.xf_cont  = False
+		self.dsc_hit  = False
+
+		# Bus side, pending for the current cycle
+		self.bus_set   = 0
+		self.bus_start = False
+		self.bus_pid   = None
+
+		# Log
+		self.trace = []
+		self.log   = []
+
+	def ld(self, src):
+		if src == 0:
+			return self.evt
+		elif src == 2:
+			return self.pkt_pid
+		elif src == 3:
+			return self.pkt_pid ^ (self.dt << 3)
+		elif src == 4:
+			return (8 if self.cel else 0) | self.ep_type
+		elif src == 6:
+			return (8 if self.xf_cont else 0) | self.bd_state
+		elif src & 8:
+			return 1 if self.dsc_hit else 0
+		raise ValueError('Invalid LD source %d' % src)
+
+	def step(self):
+		op  = self.rom[self.pc]
+		pc  = self.pc
+		nxt = (self.pc + 1) & 0xff
+		a   = self.a
+		clr = 0
+		rto_ld = None
+
+		self.trace.append((self.cyc, pc))
+
+		if op & 0x8000:
+			# Jumps (condition on the current A)
+			match = ((self.a & (op >> 4)) ^ op) & 0xf == 0
+			if match ^ bool(op & 0x4000):
+				nxt = (op >> 6) & 0xfc
+
+		else:
+			kind = op >> 12
+
+			if kind == 0x1:
+				# LD
+				a = self.ld(op & 0xf)
+				self.log.append((self.cyc, 'ld', op & 0xf))
+
+			elif kind == 0x2:
+				# EP
+				if op & (1 << 0):
+					self.dt ^= 1
+				if op & (1 << 2):
+					self.bd_state = (op >> 3) & 7
+				if op & (1 << 8):
+					self.cel = True
+				self.log.append((self.cyc, 'ep', op))
+
+			elif kind == 0x3:
+				# ZL
+				self.log.append((self.cyc, 'zl', None))
+
+			elif kind == 0x4:
+				# TX
+				pid = op & 0xf
+				if op & (1 << 4):
+					pid |= self.dt << 3
+				self.log.append((self.cyc, 'tx', pid))
+
+			elif kind == 0x5:
+				# NOTIFY
+				self.log.append((self.cyc, 'notify', op & 0xf))
+
+			elif kind == 0x6:
+				# EVT_CLR
+				clr = op & 0xf
+
+			elif kind == 0x7:
+				# EVT_RTO
+				rto_ld = (self.opts.rto & 0xffff) if (op & (1 << 8)) else (op & 0xff)
+
+		# RX timeout counter (same as RTL)
+		b17 = (self.rto >> 17) & 1
+		b16 = (self.rto >> 16) & 1
+		rto_now = b17 & (b16 ^ 1)
+
+		if rto_ld is not None:
+			self.rto = 0x30000 | rto_ld
+		else:
+			self.rto = ((b17 & b16 & (0 if self.bus_start else 1)) << 17) | \
+				(((self.rto & 0x1ffff) - b17) & 0x1ffff)
+
+		# Update state
+		self.evt = (self.evt & ~clr) | self.bus_set | (rto_now << 3)
+		self.a   = a
+		self.pc  = nxt
+		self.cyc += 1
+
+		if self.bus_pid is not None:
+			self.pkt_pid = self.bus_pid
+
+		self.bus_set   = 0
+		self.bus_start = False
+		self.bus_pid   = None
+
+		return op
+
+
+#
+# Transaction runner
+#
+
+class Result:
+
+	def __init__(self, x):
+		self.x        = x
+		self.resp     = None
+		self.notify   = None
+		self.ep_ops   = []
+		self.turn     = []	# Per phase
+		self.busy     = []	# Per phase
+		self.instr    = []	# Per phase
+		self.hazards  = set()
+		self.stuck    = False
+		self.errors   = []
+		self.pcs      = set()
+
+
+def _ep_op_str(op):
+	s = []
+	if op & (1 << 2):
+		s.append(BD_NAMES.get((op >> 3) & 7, '%d' % ((op >> 3) & 7)))
+	if op & (1 << 1):
+		s.append('bdi')
+	if op & (1 << 0):
+		s.append('dt')
+	if op & (1 << 7):
+		s.append('wb')
+	if op & (1 << 8):
+		s.append('cel')
+	if op & (1 << 9):
+		s.append('xf')
+	if op & (1 << 10):
+		s.append('dsc')
+	return '+'.join(s) or '-'
+
+
+def run_xact(rom, idle_pc, x, phase, opts, trace_fh=None):
+	osr = opts.osr
+	e = Engine(rom, opts)
+
+	# EP state
+	e.ep_type  = EP_TYPES[x['type']] | (1 if x['halt'] else 0)
+	e.cel      = x['cel']
+	e.dt       = 0 if x['token'] == 'SETUP' else x['dt']
+	e.bd_state = BD_STATES[x['bd']]
+	e.xf_cont  = x['xfcont']
+	e.dsc_hit  = x['dsc']
+
+	# Host side schedule: cycle -> (start, set, pid)
+	sched = {}
+
+	def host_pkt(t_end, bits, pid=None, err=False):
+		# RX start is flagged once the SYNC is received
+		t_start = t_end - (bits - 8) * osr
+		if t_start >= e.cyc:
+			sched.setdefault(t_start, []).append(('start', None))
+		sched.setdefault(t_end, []).append(('err', None) if err else ('ok', pid))
+
+	# Let the engine settle in the IDLE loop, then align the token
+	while (e.cyc < 8) or ((e.pc != idle_pc) ^ bool(phase)):
+		e.step()
+
+	t0 = e.cyc
+	host_pkt(t0, BITS_TOKEN, PID_VALS[x['token']])
+
+	# Data packet following OUT / SETUP
+	if x['token'] != 'IN':
+		if x['data'] != 'none':
+			bits = bits_data(x['len'])
+			t_data = t0 + (opts.host_gap + bits) * osr
+			if x['data'] == 'err':
+				host_pkt(t_data, bits, err=True)
+			else:
+				host_pkt(t_data, bits, PID_VALS[x['data']])
+
+	res = Result(x)
+	last_rx = None
+	tx_done = None
+	tx_seen = 0
+	limit   = t0 + opts.max_cycles
+	hs_sent = False
+
+	while True:
+		# Bus events
+		for ev, pid in sched.pop(e.cyc, []):
+			if ev == 'start':
+				e.bus_start = True
+			elif ev == 'ok':
+				e.bus_set |= mc.EVT_RX_OK
+				e.bus_pid = pid
+				last_rx = e.cyc
+			elif ev == 'err':
+				e.bus_set |= mc.EVT_RX_ERR
+				last_rx = e.cyc
+
+		if tx_done == e.cyc:
+			e.bus_set |= mc.EVT_TX_DONE
+			tx_done = None
+
+			# Host handshake after an IN data packet (not for isochronous)
+			if (x['token'] == 'IN') and (x['type'] != 'isoc') and (res.resp in (mc.PID_DATA0, mc.PID_DATA1)) and not hs_sent:
+				hs_sent = True
+				if x['hs'] != 'none':
+					t_hs = e.cyc + (opts.host_gap + BITS_HANDSHAKE) * osr
+					host_pkt(t_hs, BITS_HANDSHAKE, mc.PID_ACK, err=(x['hs'] == 'err'))
+
+		# Execute
+		pc = e.pc
+		op = e.step()
+
+		if trace_fh:
+			trace_fh.write('  %5d  %02x %04x\n' % (e.cyc - 1 - t0, pc, op))
+
+		# Hazards
+		if (op >> 12) == 0x1:
+			rel = e.cyc - 1 - t0
+			src = op & 0xf
+			if (src == 4) and (rel < RDY_EP_TYPE):
+				res.hazards.add('ep_type@%d' % rel)
+			if (src == 6) and (rel < RDY_BD_STATE):
+				res.hazards.add('bd_state@%d' % rel)
+
+		# TX
+		if (op >> 12) == 0x4:
+			kind, pid = e.log[-1][1], e.log[-1][2]
+			if tx_seen == 0:
+				res.resp = pid
+				res.turn.append(e.cyc - 1 - last_rx)
+			tx_seen += 1
+			zl = any(l[1] == 'zl' for l in e.log if l[0] >= t0)
+			if pid in (mc.PID_ACK, mc.PID_NAK, mc.PID_STALL):
+				bits = BITS_HANDSHAKE
+			else:
+				bits = bits_data(0 if zl else x['len'])
+			tx_done = e.cyc + opts.tx_latency + bits * osr
+
+		# Done ?
+		if (e.pc == idle_pc) and not (sched or e.evt or e.bus_set or (e.rto & 0x20000)) and (tx_done is None) and (e.cyc > t0 + 1):
+			res.busy.append(e.cyc - t0)
+			break
+
+		if e.cyc >= limit:
+			res.stuck = True
+			res.busy.append(None)
+			break
+
+	if tx_seen == 0:
+		res.turn.append(None)
+
+	# Collect
+	for cyc, kind, val in e.log:
+		if cyc < t0:
+			continue
+		if kind == 'notify':
+			res.notify = val
+		elif kind == 'ep':
+			res.ep_ops.append(val)
+
+	res.pcs = set(pc for cyc, pc in e.trace if cyc >= t0)
+
+	# Executed instructions, not counting wait loop iterations
+	# (a jump taken back to the instruction right before it)
+	tr = [pc for cyc, pc in e.trace if cyc >= t0]
+	n = len(tr)
+	for i in range(len(tr) - 1):
+		if (tr[i+1] == tr[i] - 1) and (e.rom[tr[i]] & 0x8000):
+			n -= 2
+	res.instr.append(n)
+
+	return res
+
+
+def run_all(rom, labels, xacts, opts):
+	results = []
+	idle_pc = labels['IDLE']
+
+	for x in xacts:
+		res = None
+		for phase in range(2):
+			if opts.trace:
+				sys.stdout.write('%s (phase %d)\n' % (x['name'], phase))
+			r = run_xact(rom, idle_pc, x, phase, opts, sys.stdout if opts.trace else None)
+			if res is None:
+				res = r
+			else:
+				res.turn     += r.turn
+				res.busy     += r.busy
+				res.instr    += r.instr
+				res.hazards  |= r.hazards
+				res.stuck    |= r.stuck
+				res.pcs      |= r.pcs
+				if (r.resp != res.resp) or (r.notify != res.notify):
+					res.errors.append('phase dependent result')
+		results.append(res)
+
+	return results
+
+
+#
+# Checks / Report
+#
+
+def check(res, opts):
+	x = res.x
+	budget = opts.turnaround * opts.osr - opts.rx_latency - opts.tx_latency
+
+	if res.stuck:
+		res.errors.append('stuck')
+
+	if res.hazards:
+		res.errors.append('hazard ' + ','.join(sorted(res.hazards)))
+
+	turn = [t for t in res.turn if t is not None]
+	if turn and max(turn) > budget:
+		res.errors.append('turnaround %d > %d' % (max(turn), budget))
+
+	if x['expect'] is not None:
+		exp = None if x['expect'] == 'none' else PID_VALS.get(x['expect'])
+		if res.resp != exp:
+			res.errors.append('response %s != %s' % (PID_NAMES.get(res.resp, 'none') if res.resp is not None else 'none', x['expect']))
+
+	if x['ntf'] is not None:
+		exp = None if x['ntf'] == 'none' else NOTIFY_VALS.get(x['ntf'])
+		if res.notify != exp:
+			res.errors.append('notify %s != %s' % (NOTIFY_NAMES.get(res.notify, 'none') if res.notify is not None else 'none', x['ntf']))
+
+	return budget
+
+
+def fmt_range(v):
+	v = [x for x in v if x is not None]
+	if not v:
+		return '-'
+	if min(v) == max(v):
+		return '%d' % v[0]
+	return '%d-%d' % (min(v), max(v))
+
+
+def report(results, code, labels, opts, fh=sys.stdout):
+	budget = None
+	n_err = 0
+
+	fh.write('%-18s %-5s %-6s %-8s %-22s %7s %7s  %s\n' % (
+		'transaction', 'tok', 'resp', 'notify', 'ep ops', 'turn', 'busy', 'status'))
+
+	for res in results:
+		budget = check(res, opts)
+		n_err += bool(res.errors)
+		fh.write('%-18s %-5s %-6s %-8s %-22s %7s %7s  %s\n' % (
+			res.x['name'],
+			res.x['token'],
+			PID_NAMES.get(res.resp, '%x' % res.resp) if res.resp is not None else '-',
+			NOTIFY_NAMES.get(res.notify, '%x' % res.notify) if res.notify is not None else '-',
+			' '.join(_ep_op_str(op) for op in res.ep_ops) or '-',
+			fmt_range(res.turn),
+			fmt_range(res.busy) if not res.stuck else 'stuck',
+			'; '.join(res.errors) or 'ok',
+		))
+
+	fh.write('\n')
+	fh.write('Turnaround budget : %d cycles of microcode (%.1f bits x %d - %d RX - %d TX latency)\n' % (
+		budget if budget is not None else 0, opts.turnaround, opts.osr, opts.rx_latency, opts.tx_latency))
+	fh.write('ROM size          : %d / 256 words\n' % len(code))
+
+	# Coverage
+	if opts.coverage:
+		ilabel = dict([(v, k) for k, v in labels.items()])
+		used = set()
+		for res in results:
+			used |= res.pcs
+		unused = [
+			i for i, op in enumerate(code)
+			if (i not in used) and not ((i & 3) and (op == mc.JMP((i | 3) + 1)))
+		]
+		fh.write('Unexecuted words  : %d\n' % len(unused))
+		for i in unused:
+			fh.write('  %02x %04x\t%s\n' % (i, code[i], ilabel.get(i, '')))
+
+	fh.write('%d / %d transactions ok\n' % (len(results) - n_err, len(results)))
+
+	return n_err
+
+
+#
+# Main
+#
+
+def _parser(argv0=None):
+	parser = argparse.ArgumentParser(prog=argv0, description='Simulate and profile the USB transaction microcode')
+	parser.add_argument('script', nargs='?', help='Transaction script (default: built-in paths)')
+	parser.add_argument('-D', dest='defs', action='append', default=[], help='Microcode define (e.g. NO_ISOC)')
+	parser.add_argument('--mini', action='store_true', help='Same defines as `microcode.py mini`')
+	parser.add_argument('-O', dest='opt', action='store_true', help='Use the optimizing assembler (`microcode.py opt`)')
+	parser.add_argument('--osr', type=int, default=4, help='Core clock cycles per bit (default 4, 48 MHz)')
+	parser.add_argument('--rto', type=int, default=70, help='RX timeout CSR value, 16 bits (default 70)')
+	parser.add_argument('--turnaround', type=float, default=6.5, help='Device turnaround budget in bit times (default 6.5)')
+	parser.add_argument('--rx-latency', type=int, default=4, help='Cycles from the EOP on the wire to the RX done strobe (default 4)')
+	parser.add_argument('--tx-latency', type=int, default=6, help='Cycles from the TX instruction to the SYNC on the wire (default 6)')
+	parser.add_argument('--host-gap', type=int, default=4, help='Host inter-packet gap in bit times (default 4)')
+	parser.add_argument('--max-cycles', type=int, default=20000, help='Cycles before declaring the engine stuck')
+	parser.add_argument('--coverage', action='store_true', help='List the ROM words never executed')
+	parser.add_argument('--trace', action='store_true', help='Print the executed instructions')
+	return parser
+
+
+def default_opts():
+	return _parser().parse_args([])
+
+
+def main(argv0, *args):
+	opts = _parser(argv0).parse_args(args)
+
+	defs = set(opts.defs)
+	if opts.mini:
+		defs |= set(mc.DEFS_MINI)
+	if defs - set(mc.DEFS_ALL):
+		sys.stderr.write('Unknown define(s): %s\n' % ', '.join(sorted(defs - set(mc.DEFS_ALL))))
+		return 2
+
+	if opts.script:
+		with open(opts.script, 'r') as fh:
+			text = fh.read()
+	else:
+		text = DEFAULT_SCRIPT
+
+	try:
+		xacts = parse_script(text, defs)
+	except ScriptError as e:
+		sys.stderr.write('%s\n' % e)
+		return 2
+
+	code, labels = mc.assemble(mc.mc, defs, opt=opts.opt)
+
+	results = run_all(code, labels, xacts, opts)
+	n_err = report(results, code, labels, opts)
+
+	return 1 if n_err else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(*sys.argv))
@@ -7,7 +7,6 @@
 #
 
 import sys
-import types
 
 
 #
@@ -24,16 +23,19 @@ def LD(src):
 		'pkt_pid_chk': 3,
 		'ep_type': 4,
 		'bd_state': 6,
+		'dsc': 8,
 	}
 	return 0x1000 | srcs[src]
 
-def EP(bd_state=None, bdi_flip=False, dt_flip=False, wb=False, cel_set=False):
+def EP(bd_state=None, bdi_flip=False, dt_flip=False, wb=False, cel_set=False, xf_adv=False, dsc_start=False):
 	return 0x2000 | \
 		((1 << 0) if dt_flip else 0) | \
 		((1 << 1) if bdi_flip else 0) | \
 		(((bd_state << 3) | (1 << 2)) if bd_state is not None else 0) | \
 		((1 << 7) if wb else 0) | \
-		((1 << 8) if cel_set else 0)
+		((1 << 8) if cel_set else 0) | \
+		((1 << 9) if xf_adv else 0) | \
+		((1 << 10) if dsc_start else 0)
 
 def ZL():
 	return 0x3000
@@ -47,12 +49,32 @@ def NOTIFY(code):
 def EVT_CLR(evts):
 	return 0x6000 | evts
 
-def EVT_RTO(timeout):
-	return 0x7000 | timeout
+def EVT_RTO(timeout=None):
+	# Without explicit timeout, use the value from the RX timeout CSR
+	return 0x7000 | ((1 << 8) if timeout is None else timeout)
+
+class LabelRef:
+	"""Jump to a label, resolved at assembly time"""
+
+	def __init__(self, tgt, cond_val, cond_mask, cond_invert):
+		self.tgt         = tgt
+		self.cond_val    = cond_val
+		self.cond_mask   = cond_mask
+		self.cond_invert = cond_invert
+
+	def __call__(self, resolve):
+		return JMP(resolve(self.tgt), self.cond_val, self.cond_mask, self.cond_invert)
+
+	def retarget(self, tgt):
+		return LabelRef(tgt, self.cond_val, self.cond_mask, self.cond_invert)
+
+	@property
+	def uncond(self):
+		return (self.cond_val is None) and not self.cond_invert
 
 def JMP(tgt, cond_val=None, cond_mask=0xf, cond_invert=False):
 	if isinstance(tgt, str):
-		return lambda resolve: JMP(resolve(tgt), cond_val, cond_mask, cond_invert)
+		return LabelRef(tgt, cond_val, cond_mask, cond_invert)
 	assert tgt & 3 == 0
 	return (
 		(1 << 15) |
@@ -87,19 +109,16 @@ def ENDIF():
 # "Assembler"
 #
 
-def assemble(code, defs={}):
-	flat_code = []
-	labels    = {}
+def _preprocess(code, defs):
+	# Resolve the conditionals, keep labels and instructions
+	flat = []
 	condstack = []
 	for elem in code:
 		active = all(condstack)
 		if isinstance(elem, tuple):
 			if elem[0] == 'label':
 				if active:
-					assert elem[1] not in labels
-					while len(flat_code) & 3:
-						flat_code.append(JMP(elem[1]))
-					labels[elem[1]] = len(flat_code)
+					flat.append(elem)
 			elif elem[0] == 'ifdef':
 				condstack.append(elem[1] in defs)
 			elif elem[0] == 'ifndef':
@@ -109,11 +128,266 @@ def assemble(code, defs={}):
 			elif elem[0] == 'endif':
 				condstack.pop()
 		elif active:
-			flat_code.append(elem)
+			flat.append(elem)
+	return flat
+
+def _is_uncond(op):
+	if isinstance(op, LabelRef):
+		return op.uncond
+	return (op & 0xc0ff) == 0x8000
+
+def _link(flat_code, labels):
 	for offset, elem in enumerate(flat_code):
-		if isinstance(elem, types.LambdaType):
+		if isinstance(elem, LabelRef):
 			flat_code[offset] = elem(lambda label: labels[label])
-	return flat_code, labels
+	return flat_code
+
+def assemble(code, defs={}, opt=False, stats=None):
+	if opt:
+		return assemble_opt(code, defs, stats=stats)
+
+	flat_code = []
+	labels    = {}
+	for elem in _preprocess(code, defs):
+		if isinstance(elem, tuple):
+			assert elem[1] not in labels
+			while len(flat_code) & 3:
+				flat_code.append(JMP(elem[1]))
+			labels[elem[1]] = len(flat_code)
+		else:
+			flat_code.append(elem)
+	if stats is not None:
+		stats.update(_stats(flat_code, labels))
+	return _link(flat_code, labels), labels
+
+
+#
+# Optimizing "Assembler"
+#
+# Only changes the layout, never the instructions executed on any path
+# (besides removing / duplicating jumps) :
+#
+#  - Jumps to a block that starts with an unconditional JMP are threaded
+#    directly to the final target
+#  - Labels nobody jumps to don't need alignment (no padding) and code
+#    that can't be reached is removed
+#  - Small blocks ending with an unconditional JMP (like the handshake
+#    TX tails) are duplicated in place of a JMP to them, or of a padded
+#    fall-through into them
+#  - Chains of blocks ending with an unconditional JMP are placed right
+#    before their target when it doesn't need padding, removing the JMP
+#
+
+class _Block:
+
+	def __init__(self, labels=None, code=None):
+		self.labels = labels or []
+		self.code   = code or []
+
+	def falls_through(self):
+		return not self.code or not _is_uncond(self.code[-1])
+
+
+def _refs(blocks):
+	refs = {}
+	for b in blocks:
+		for op in b.code:
+			if isinstance(op, LabelRef):
+				refs[op.tgt] = refs.get(op.tgt, 0) + 1
+	return refs
+
+def _label_map(blocks):
+	return dict([(l, b) for b in blocks for l in b.labels])
+
+def _loops(b):
+	# Does this block jump to itself ? (wait loops, not worth duplicating)
+	return any(isinstance(op, LabelRef) and (op.tgt in b.labels) for op in b.code)
+
+def _aligned(b, refs, entry):
+	# Does this block need to start on a 4 words boundary ?
+	return (b is entry) or any(refs.get(l, 0) for l in b.labels)
+
+def _seg_len(blocks, i, refs):
+	# Words from the last aligned block start up to the end of block i
+	n = 0
+	while True:
+		n += len(blocks[i].code)
+		if (i == 0) or _aligned(blocks[i], refs, blocks[0]) or not blocks[i-1].falls_through():
+			return n
+		i -= 1
+
+def _opt_thread(blocks):
+	changed = False
+	lmap = _label_map(blocks)
+	for b in blocks:
+		for j, op in enumerate(b.code):
+			if not isinstance(op, LabelRef):
+				continue
+			seen = set()
+			tgt = op.tgt
+			while tgt not in seen:
+				seen.add(tgt)
+				tb = lmap[tgt]
+				if tb.code and isinstance(tb.code[0], LabelRef) and tb.code[0].uncond:
+					tgt = tb.code[0].tgt
+				else:
+					break
+			if tgt != op.tgt:
+				b.code[j] = op.retarget(tgt)
+				changed = True
+	return changed
+
+def _opt_prune(blocks):
+	changed = False
+	refs = _refs(blocks)
+	out = [blocks[0]]
+	for b in blocks[1:]:
+		live = [l for l in b.labels if refs.get(l, 0)]
+		changed |= len(live) != len(b.labels)
+		b.labels = live
+		if not b.labels:
+			changed = True
+			if out[-1].falls_through():
+				out[-1].code += b.code
+			# else: Unreachable
+			continue
+		out.append(b)
+	blocks[:] = out
+	return changed
+
+def _opt_dup(blocks, dup_max):
+	changed = False
+	lmap = _label_map(blocks)
+	refs = _refs(blocks)
+	for i, b in enumerate(blocks):
+		if not b.code:
+			continue
+
+		# JMP to a small block
+		op = b.code[-1]
+		if isinstance(op, LabelRef) and op.uncond:
+			tb = lmap[op.tgt]
+			if (tb is not b) and (len(tb.code) <= dup_max) and not tb.falls_through() and not _loops(tb):
+				b.code = b.code[:-1] + list(tb.code)
+				changed = True
+				continue
+
+		# Padded fall-through into a small block
+		if (i + 1 < len(blocks)) and b.falls_through():
+			nb = blocks[i+1]
+			if _aligned(nb, refs, blocks[0]) and (_seg_len(blocks, i, refs) & 3) and \
+			   (len(nb.code) <= dup_max) and not nb.falls_through() and not _loops(nb):
+				b.code = b.code + list(nb.code)
+				changed = True
+	return changed
+
+def _opt_chains(blocks):
+	# Split in fall-through chains, first one is the entry
+	chains = []
+	for b in blocks:
+		if not chains or not chains[-1][-1].falls_through():
+			chains.append([])
+		chains[-1].append(b)
+
+	# Place chains ending in an unconditional JMP before their target
+	refs = _refs(blocks)
+	heads = dict([(l, c) for c in chains[1:] for l in c[0].labels])
+	nxt  = {}
+	prev = {}
+
+	def root(c):
+		while id(c) in prev:
+			c = prev[id(c)]
+		return c
+
+	for c in chains:
+		op = c[-1].code[-1] if c[-1].code else None
+		if not isinstance(op, LabelRef) or not op.uncond or (op.tgt not in heads):
+			continue
+		tc = heads[op.tgt]
+		if (id(tc) in prev) or (root(c) is tc):
+			continue
+
+		# Would the target still need padding ?
+		others = sum(refs.get(l, 0) for l in tc[0].labels) - 1
+		seg = 0
+		for b in reversed(c):
+			seg += len(b.code)
+			if _aligned(b, refs, blocks[0]):
+				break
+		if others and ((seg - 1) & 3):
+			continue
+
+		c[-1].code.pop()
+		refs[op.tgt] -= 1
+		nxt[id(c)]   = tc
+		prev[id(tc)] = c
+
+	# Flatten
+	out = []
+	for c in chains:
+		if id(c) in prev:
+			continue
+		while c is not None:
+			out.extend(c)
+			c = nxt.get(id(c))
+	blocks[:] = out
+
+def _stats(flat_code, labels):
+	# Padding = JMPs to the next label inserted for alignment
+	tgt = set(labels.values())
+	pad_dead = pad_exec = 0
+	dead = False
+	for i, op in enumerate(flat_code):
+		is_pad = isinstance(op, LabelRef) and op.uncond and \
+			(labels.get(op.tgt) == ((i | 3) + 1)) and (((i | 3) + 1) in tgt)
+		if is_pad:
+			if dead:
+				pad_dead += 1
+			else:
+				pad_exec += 1
+		dead = _is_uncond(op)
+	return {
+		'words':    len(flat_code),
+		'pad_dead': pad_dead,
+		'pad_exec': pad_exec,
+	}
+
+def assemble_opt(code, defs={}, dup_max=3, stats=None):
+	# Split in basic blocks (at labels)
+	blocks = [_Block()]
+	for elem in _preprocess(code, defs):
+		if isinstance(elem, tuple):
+			if blocks[-1].code:
+				blocks.append(_Block())
+			blocks[-1].labels.append(elem[1])
+		else:
+			blocks[-1].code.append(elem)
+
+	# Iterate until nothing changes (bounded, duplication could ping-pong)
+	for i in range(16):
+		if not (_opt_thread(blocks) | _opt_prune(blocks) | _opt_dup(blocks, dup_max)):
+			break
+
+	_opt_chains(blocks)
+	_opt_prune(blocks)
+
+	# Emit
+	refs = _refs(blocks)
+	flat_code = []
+	labels    = {}
+	for b in blocks:
+		if b.labels and _aligned(b, refs, blocks[0]):
+			while len(flat_code) & 3:
+				flat_code.append(JMP(b.labels[0]))
+		for l in b.labels:
+			labels[l] = len(flat_code)
+		flat_code.extend(b.code)
+
+	if stats is not None:
+		stats.update(_stats(flat_code, labels))
+
+	return _link(flat_code, labels), labels
 
 
 #
@@ -156,13 +430,15 @@ BD_RDY_MSK   = 0b110
 BD_RDY_VAL   = 0b010
 BD_DONE_OK   = 0b100
 BD_DONE_ERR  = 0b101
+BD_STATE_MSK = 0b0111
+BD_XF_CONT   = 0b1000	# Multi-packet transfer continues after this packet
+
+DSC_HIT      = 0b0001	# GET_DESCRIPTOR found in the descriptor table
 
 NOTIFY_SUCCESS = 0x00
 NOTIFY_TX_FAIL = 0x08
 NOTIFY_RX_FAIL = 0x09
 
-TIMEOUT = 70	# Default timeout value for waiting for a packet from the host
-
 
 #
 # Microcode
@@ -201,9 +477,11 @@ ENDIF(),
 		# Check endpoint type
 		LD('ep_type'),
 IFNDEF('NO_ISOC'),
-		JEQ('DO_IN_ISOC', EP_TYPE_ISOC, EP_TYPE_MSK1),	# isochronous is special
+		JEQ('_DO_IN_NO_BCI', EP_TYPE_NONE, EP_TYPE_MSK2),	# no endpoint or isochronous
 ENDIF(),
+IFDEF('NO_ISOC'),
 		JEQ('IDLE', EP_TYPE_NONE, EP_TYPE_MSK1),		# endpoint doesn't exist, ignore packet
+ENDIF(),
 
 
 		# Bulk/Control/Interrupt
@@ -217,8 +495,8 @@ ENDIF(),
 
 		# Anything valid in the active BD ?
 		LD('bd_state'),
-		JEQ('TX_STALL_BD', BD_RDY_STALL),
-		JNE('TX_NAK', BD_RDY_DATA),
+		JEQ('TX_STALL_BD', BD_RDY_STALL, BD_STATE_MSK),
+		JNE('TX_NAK', BD_RDY_DATA, BD_STATE_MSK),
 
 		# TX packet from BD
 		TX(PID_DATA0, set_dt=True),
@@ -230,7 +508,7 @@ ENDIF(),
 		EVT_CLR(EVT_TX_DONE),
 
 		# Wait for ACK
-		EVT_RTO(TIMEOUT),
+		EVT_RTO(),
 
 	L('_DO_IN_BCI_WAIT_ACK'),
 		LD('evt'),
@@ -241,11 +519,23 @@ ENDIF(),
 		LD('pkt_pid'),
 		JNE('_DO_IN_BCI_FAIL', PID_ACK),
 
-		# Success !
-		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=True, wb=True),
+		# Success ! Unless the transfer continues, we're done with the BD
+IFNDEF('NO_XFER'),
+		LD('bd_state'),
+		JEQ('_DO_IN_BCI_XF_NEXT', BD_XF_CONT, BD_XF_CONT),
+ENDIF(),
+
+		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=True, wb=True, xf_adv=True),
 		NOTIFY(NOTIFY_SUCCESS),
 		JMP('IDLE'),
 
+		# Transfer continues: Advance ptr/len and keep the BD
+IFNDEF('NO_XFER'),
+	L('_DO_IN_BCI_XF_NEXT'),
+		EP(dt_flip=True, wb=True, xf_adv=True),
+		JMP('IDLE'),
+ENDIF(),
+
 		# TX Fail handler, notify the host
 	L('_DO_IN_BCI_FAIL'),
 		NOTIFY(NOTIFY_TX_FAIL),
@@ -256,10 +546,13 @@ ENDIF(),
 		# - - - - - -
 
 IFNDEF('NO_ISOC'),
+	L('_DO_IN_NO_BCI'),
+		JEQ('IDLE', EP_TYPE_NONE, EP_TYPE_MSK1),		# endpoint doesn't exist, ignore packet
+
 	L('DO_IN_ISOC'),
 		# Anything to TX ?
 		LD('bd_state'),
-		JNE('_DO_IN_ISOC_NO_DATA', BD_RDY_DATA),
+		JNE('_DO_IN_ISOC_NO_DATA', BD_RDY_DATA, BD_STATE_MSK),
 
 		# Transmit packet (with DATA0, always)
 		TX(PID_DATA0),
@@ -293,10 +586,10 @@ ENDIF(),
 
 		# For Setup, if no-space, don't NAK, just ignore
 		LD('bd_state'),
-		JNE('RX_DISCARD_NEXT', BD_RDY_DATA),
+		JNE('RX_DISCARD_NEXT', BD_RDY_DATA, BD_STATE_MSK),
 
 		# Wait for packet
-		EVT_RTO(TIMEOUT),
+		EVT_RTO(),
 
 	L('_DO_SETUP_WAIT_DATA'),
 		LD('evt'),
@@ -307,10 +600,26 @@ ENDIF(),
 		LD('pkt_pid'),
 		JNE('_DO_SETUP_FAIL', PID_DATA0),
 
-		# Success !
+		# Success ! Unless the hardware can answer it by itself
+IFNDEF('NO_DESC'),
+		LD('dsc'),
+		JEQ('_DO_SETUP_DSC', DSC_HIT, DSC_HIT),
+ENDIF(),
+
+		ZL(),
+		TX(PID_ACK),
 		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=True, wb=True, cel_set=True),
 		NOTIFY(NOTIFY_SUCCESS),
+		JMP('IDLE'),
+
+		# Descriptor responder: Data and status stages are handled
+		# without the BDs / software. Must start before the TX, it
+		# aborts the descriptor lookup
+IFNDEF('NO_DESC'),
+	L('_DO_SETUP_DSC'),
+		EP(dsc_start=True),
 		JMP('TX_ACK'),
+ENDIF(),
 
 		# Setup RX handler
 IFNDEF('IGNORE_RX_ERR'),
@@ -328,9 +637,11 @@ ENDIF(),
 		# Check endpoint type
 		LD('ep_type'),
 IFNDEF('NO_ISOC'),
-		JEQ('DO_OUT_ISOC', EP_TYPE_ISOC, EP_TYPE_MSK1),	# isochronous is special
+		JEQ('_DO_OUT_NO_BCI', EP_TYPE_NONE, EP_TYPE_MSK2),	# no endpoint or isochronous
 ENDIF(),
+IFDEF('NO_ISOC'),
 		JEQ('IDLE', EP_TYPE_NONE, EP_TYPE_MSK1),		# endpoint doesn't exist, ignore packet
+ENDIF(),
 
 
 		# Bulk/Control/Interrupt
@@ -344,16 +655,54 @@ ENDIF(),
 
 		# Check we have space, if not prevent data writes
 		LD('bd_state'),
-		JNE('_DO_OUT_BCI_DROP_DATA', BD_RDY_DATA),
+		JNE('_DO_OUT_BCI_DROP_DATA', BD_RDY_DATA, BD_STATE_MSK),
 
 		# Wait for packet
-		EVT_RTO(TIMEOUT),
+		EVT_RTO(),
 
 	L('_DO_OUT_BCI_WAIT_DATA'),
 		LD('evt'),
 		JEQ('_DO_OUT_BCI_WAIT_DATA', 0, EVT_TIMEOUT | EVT_RX_ERR | EVT_RX_OK),
 
-		# We got a packet (and possibly stored the data), now we need to respond !
+		# We got a packet and stored the data, now we need to respond !
+			# Not a valid packet at all, or timeout, or not DATAx -> No response
+		JEQ('_DO_OUT_BCI_FAIL', 0, EVT_RX_OK),
+		LD('pkt_pid_chk'),
+		JNE('_DO_OUT_BCI_FAIL', PID_DATA_VAL, PID_DATA_MSK),	# Accept DATA0/DATA1 only
+
+			# Wrong Data Toggle -> Ignore new data, just re-tx a ACK
+		JEQ('TX_ACK', PID_DATA1),								# With pid_chk, DATA1 means wrong DT
+
+			# Transfer continues ? Advance ptr/len and keep the BD
+IFNDEF('NO_XFER'),
+		LD('bd_state'),
+		JEQ('_DO_OUT_BCI_XF_NEXT', BD_XF_CONT, BD_XF_CONT),
+ENDIF(),
+
+		# We're all good ! ACK first, the BD update doesn't need to hold it
+		ZL(),
+		TX(PID_ACK),
+		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=True, wb=True, xf_adv=True),
+		NOTIFY(NOTIFY_SUCCESS),
+		JMP('IDLE'),
+
+IFNDEF('NO_XFER'),
+	L('_DO_OUT_BCI_XF_NEXT'),
+		ZL(),
+		TX(PID_ACK),
+		EP(dt_flip=True, wb=True, xf_adv=True),
+		JMP('IDLE'),
+ENDIF(),
+
+		# Fail handler: Drop data, then respond once the packet is in
+	L('_DO_OUT_BCI_DROP_DATA'),
+		ZL(),
+		EVT_RTO(),
+
+	L('_DO_OUT_BCI_DROP_WAIT'),
+		LD('evt'),
+		JEQ('_DO_OUT_BCI_DROP_WAIT', 0, EVT_TIMEOUT | EVT_RX_ERR | EVT_RX_OK),
+
 			# Not a valid packet at all, or timeout, or not DATAx -> No response
 		JEQ('_DO_OUT_BCI_FAIL', 0, EVT_RX_OK),
 		LD('pkt_pid_chk'),
@@ -370,22 +719,10 @@ ENDIF(),
 		LD('pkt_pid_chk'),
 		JEQ('TX_ACK', PID_DATA1),								# With pid_chk, DATA1 means wrong DT
 
-			# We didn't have space -> NAK
+			# We didn't have space -> NAK, else it's a STALL BD
 		LD('bd_state'),
 		JNE('TX_NAK', BD_RDY_VAL, BD_RDY_MSK),
-
-			# Explicitely asked for stall ?
-		JEQ('TX_STALL_BD', BD_RDY_STALL),
-
-		# We're all good !
-		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=True, wb=True),
-		NOTIFY(NOTIFY_SUCCESS),
-		JMP('TX_ACK'),
-
-		# Fail handler: Prepare to drop data
-	L('_DO_OUT_BCI_DROP_DATA'),
-		ZL(),
-		JMP('_DO_OUT_BCI_WAIT_DATA'),
+		JMP('TX_STALL_BD'),
 
 		# Fail hander: Packet reception failed
 IFNDEF('IGNORE_RX_ERR'),
@@ -405,13 +742,16 @@ ENDIF(),
 		# - - - - - -
 
 IFNDEF('NO_ISOC'),
+	L('_DO_OUT_NO_BCI'),
+		JEQ('IDLE', EP_TYPE_NONE, EP_TYPE_MSK1),		# endpoint doesn't exist, ignore packet
+
 	L('DO_OUT_ISOC'),
 		# Do we have space to RX ?
 		LD('bd_state'),
-		JNE('_DO_OUT_ISOC_NO_SPACE', BD_RDY_DATA),
+		JNE('_DO_OUT_ISOC_NO_SPACE', BD_RDY_DATA, BD_STATE_MSK),
 
 		# Wait for packet RX
-		EVT_RTO(TIMEOUT),
+		EVT_RTO(),
 
 	L('_DO_OUT_ISOC_WAIT_DATA'),
 		LD('evt'),
@@ -446,11 +786,13 @@ ENDIF(),
 	# Common shared utility
 	# ---------------------
 
-	# Transmit STALL as asked in a Buffer Descriptor
+	# Transmit STALL as asked in a Buffer Descriptor, then retire it
 	L('TX_STALL_BD'),
+		ZL(),
+		TX(PID_STALL),
 		EP(bd_state=BD_DONE_OK, bdi_flip=True, dt_flip=False, wb=True),
 		NOTIFY(NOTIFY_SUCCESS),
-		# fall-thru
+		JMP('IDLE'),
 
 	# Transmit STALL because of halted End Point
 	L('TX_STALL_HALT'),
@@ -476,7 +818,7 @@ ENDIF(),
 		ZL(),
 
 		# Wait for a packet
-		EVT_RTO(TIMEOUT),
+		EVT_RTO(),
 
 	L('_RX_DISCARD_WAIT'),
 		LD('evt'),
@@ -487,11 +829,80 @@ ENDIF(),
 ]
 
 
+#
+# Main
+#
+
+# Feature defines
+#  NO_ISOC        : No isochronous endpoint support
+#  IGNORE_RX_ERR  : Don't report RX errors (no DONE_ERR BD / RX_FAIL notify)
+#  NO_XFER        : No multi-packet transfer continuation. Only for cores
+#                   built with neither XFER nor DESC
+#  NO_DESC        : No descriptor responder. Only for cores built without DESC
+DEFS_ALL  = ['NO_ISOC', 'IGNORE_RX_ERR', 'NO_XFER', 'NO_DESC']
+DEFS_MINI = ['NO_ISOC', 'IGNORE_RX_ERR']
+
+def report(defs, fh=sys.stdout):
+	import mcsim
+
+	opts = mcsim.default_opts()
+	xacts = mcsim.parse_script(mcsim.DEFAULT_SCRIPT, defs)
+
+	res = {}
+	st  = {}
+	for opt in (False, True):
+		st[opt] = {}
+		code, labels = assemble(mc, defs, opt=opt, stats=st[opt])
+		res[opt] = mcsim.run_all(code, labels, xacts, opts)
+		for r in res[opt]:
+			mcsim.check(r, opts)
+
+	fh.write('Microcode ROM report (defines: %s)\n\n' % (', '.join(sorted(defs)) or 'none'))
+	fh.write('%-22s %8s %8s\n' % ('', 'plain', 'opt'))
+	fh.write('%-22s %4d/256 %4d/256\n' % ('words used', st[False]['words'], st[True]['words']))
+	fh.write('%-22s %8d %8d\n' % ('padding (dead)', st[False]['pad_dead'], st[True]['pad_dead']))
+	fh.write('%-22s %8d %8d\n' % ('padding (executed)', st[False]['pad_exec'], st[True]['pad_exec']))
+	fh.write('\n')
+
+	fh.write('%-22s %11s %11s   %11s %11s\n' % ('', 'plain', '', 'opt', ''))
+	fh.write('%-22s %11s %11s   %11s %11s\n' % ('path', 'turn', 'instr', 'turn', 'instr'))
+	for rp, ro in zip(res[False], res[True]):
+		fh.write('%-22s %11s %11s   %11s %11s%s\n' % (
+			rp.x['name'],
+			mcsim.fmt_range(rp.turn), mcsim.fmt_range(rp.instr),
+			mcsim.fmt_range(ro.turn), mcsim.fmt_range(ro.instr),
+			'  ' + '; '.join(ro.errors) if ro.errors else '',
+		))
+
+	fh.write('\n')
+	fh.write('turn : cycles from the end of the last host packet to the TX instruction\n')
+	fh.write('instr: instructions executed from the token to IDLE, wait loops excluded\n')
+
+
 if __name__ == '__main__':
-	opt_debug = 'debug' in sys.argv[1:]
-	opt_mini  = 'mini'  in sys.argv[1:]
-	defs = {'NO_ISOC', 'IGNORE_RX_ERR'} if opt_mini else {}
-	code, labels = assemble(mc, defs)
+	args = sys.argv[1:]
+	opt_debug  = 'debug'  in args
+	opt_mini   = 'mini'   in args
+	opt_opt    = 'opt'    in args
+	opt_report = 'report' in args
+
+	defs = set(DEFS_MINI) if opt_mini else set()
+	for a in args:
+		if a.startswith('-D'):
+			if a[2:] not in DEFS_ALL:
+				sys.stderr.write('Unknown define %s\n' % a[2:])
+				sys.exit(1)
+			defs.add(a[2:])
+
+	if opt_report:
+		report(defs)
+		sys.exit(0)
+
+	code, labels = assemble(mc, defs, opt=opt_opt)
+	if len(code) > 256:
+		sys.stderr.write('Microcode too large (%d words)\n' % len(code))
+		sys.exit(1)
+
 	ilabel = dict([(v,k) for k,v in labels.items()])
 	for i, v in enumerate(code):
 		if opt_debug:
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+#
+# Convert a dump of the packet trace buffer to a pcap file
+#
+# Input is the raw content of the trace data register as hex words (any
+# whitespace separation, 4 words per entry, anything that isn't a 4 digits
+# hex word is ignored).
+# Output uses the LINKTYPE_USB_2_0 format which wireshark can decode.
+#
+# Payload bytes are not captured by the hardware, so data packets only
+# contain the PID and are marked as truncated to their original length.
+#
+# Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+# SPDX-License-Identifier: MIT
+#
+
+import argparse
+import re
+import struct
+import sys
+
+
+LINKTYPE_USB_2_0 = 288
+
+PID_NAMES = {
+	0x1: 'OUT',   0x9: 'IN',    0x5: 'SOF',   0xd: 'SETUP',
+	0x3: 'DATA0', 0xb: 'DATA1', 0x7: 'DATA2', 0xf: 'MDATA',
+	0x2: 'ACK',   0xa: 'NAK',   0xe: 'STALL', 0x6: 'NYET',
+	0xc: 'PRE',   0x8: 'SPLIT', 0x4: 'PING',  0x0: 'RSVD',
+}
+
+
+def crc5(v, n=11):
+	crc = 0x1f
+	for i in range(n):
+		if (crc ^ (v >> i)) & 1:
+			crc = (crc >> 1) ^ 0x14
+		else:
+			crc >>= 1
+	return crc ^ 0x1f
+
+
+def parse_words(fh):
+	words = []
+	for tok in fh.read().split():
+		if re.fullmatch(r'(0x)?[0-9a-fA-F]{4}', tok):
+			words.append(int(tok, 16))
+	return words
+
+
+def parse_entries(words, clk_freq):
+	frame_base = 0
+	frame_prev = None
+
+	# Sub-frame counter is clog2(cycles per frame) bits, 16 MSBs visible
+	sub_cyc = 1 << max(0, (clk_freq // 1000 - 1).bit_length() - 16)
+
+	for i in range(0, len(words) - 3, 4):
+		w0, w1, w2, w3 = words[i:i+4]
+
+		e = {
+			'err':   bool(w0 & 0x8000),
+			'tx':    bool(w0 & 0x4000),
+			'pid':   (w0 >> 10) & 0xf,
+			'len':   w0 & 0x3ff,
+			'token': w1 & 0x7ff,
+			'frame': w2 & 0x7ff,
+			'sub':   w3,
+		}
+
+		# Unwrap frame numbers
+		if frame_prev is not None and e['frame'] < frame_prev and (frame_prev - e['frame']) > 1024:
+			frame_base += 2048
+		frame_prev = e['frame']
+
+		e['time_us'] = (frame_base + e['frame']) * 1000 + (e['sub'] * sub_cyc * 1e6) / clk_freq
+
+		yield e
+
+
+def packet_bytes(e):
+	pid = e['pid']
+	data = bytes([pid | ((pid ^ 0xf) << 4)])
+
+	if ((pid & 3) == 1) and not e['err']:
+		# Token / SOF : full packet
+		v = e['token'] | (crc5(e['token']) << 11)
+		data += struct.pack('<H', v)
+		return data, len(data)
+
+	return data, 1 + e['len']
+
+
+def write_pcap(fh, entries):
+	fh.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, LINKTYPE_USB_2_0))
+
+	for e in entries:
+		data, orig_len = packet_bytes(e)
+		t = int(round(e['time_us']))
+		fh.write(struct.pack('<IIII', t // 1000000, t % 1000000, len(data), orig_len))
+		fh.write(data)
+
+
+def print_entries(entries):
+	for e in entries:
+		desc = ''
+		if e['pid'] == 0x5:
+			desc = 'frame %d' % e['token']
+		elif (e['pid'] & 3) == 1:
+			desc = 'addr %d ep %d' % (e['token'] & 0x7f, e['token'] >> 7)
+		elif (e['pid'] & 3) == 3:
+			desc = '%d bytes' % max(e['len'] - 2, 0)
+
+		print('%12.3f us  %s  %-5s %s%s' % (
+			e['time_us'],
+			'TX' if e['tx'] else 'RX',
+			PID_NAMES[e['pid']],
+			desc,
+			'  [ERROR]' if e['err'] else '',
+		))
+
+
+def main(argv0, *args):
+	parser = argparse.ArgumentParser(prog=argv0, description='Convert a no2usb trace dump to pcap')
+	parser.add_argument('input', help='Text file with the hex words read from the trace buffer')
+	parser.add_argument('output', nargs='?', help='pcap file to write (omit to print a listing)')
+	parser.add_argument('--clk-freq', type=int, default=48000000, help='Core clock frequency (default 48 MHz)')
+	opts = parser.parse_args(args)
+
+	with open(opts.input, 'r') as fh:
+		entries = list(parse_entries(parse_words(fh), opts.clk_freq))
+
+	if opts.output:
+		with open(opts.output, 'wb') as fh:
+			write_pcap(fh, entries)
+	else:
+		print_entries(entries)
+
+
+if __name__ == '__main__':
+	main(*sys.argv)
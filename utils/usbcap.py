@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+#
+# Reference decoder for raw USB line captures
+#
+# Captures are one byte per sample, bit 1 is D+ and bit 0 is D-, like
+# `data/capture_usb_raw_short.bin` (sampled at ~154 MHz) that the RX test
+# benches replay.
+#
+# The decoder is a straightforward software implementation of the full
+# speed line coding (NRZI, bit stuffing, SYNC / EOP, PID check, CRC5 /
+# CRC16), independent of the RTL. It's used to produce the golden packet
+# stream that `sim/usb_rx_tb.v` compares the `usb_rx_ll` / `usb_rx_pkt`
+# output against.
+#
+#   usbcap.py decode <capture.bin>              Print the packets
+#   usbcap.py golden <capture.bin> <out.hex>    Write the golden file
+#
+# Golden file format (`$readmemh`, one 32 bits word per line), for each
+# packet :
+#
+#   start   Sample index of the first SYNC symbol
+#   end     Sample index of the first J symbol after the EOP
+#   info    [31] ok, [19:16] PID, [15:0] number of data words following
+#   data    Token / SOF : 11 bits token data
+#           Data        : payload bytes, then the 2 CRC bytes
+#
+# The list is terminated by a `ffffffff` word.
+#
+# Copyright (C) 2019-2021  Sylvain Munaut <tnt@246tNt.com>
+# SPDX-License-Identifier: MIT
+#
+
+import argparse
+import itertools
+import sys
+
+
+#
+# Constants
+#
+
+SAMPLE_RATE = 1e9 / (2 * 3.247)		# Matches `clk_samp` in the test benches
+BIT_RATE    = 12e6
+
+SYM_SE0 = 0
+SYM_K   = 1
+SYM_J   = 2
+SYM_SE1 = 3
+
+PID_NAMES = {
+	0x1: 'OUT',   0x9: 'IN',    0x5: 'SOF',   0xd: 'SETUP',
+	0x3: 'DATA0', 0xb: 'DATA1',
+	0x2: 'ACK',   0xa: 'NAK',   0xe: 'STALL',
+}
+
+PID_TOKEN     = (0x1, 0x9, 0x5, 0xd)
+PID_DATA      = (0x3, 0xb)
+PID_HANDSHAKE = (0x2, 0xa, 0xe)
+
+
+#
+# CRCs
+#
+
+def crc5(v, n=11):
+	crc = 0x1f
+	for i in range(n):
+		if (crc ^ (v >> i)) & 1:
+			crc = (crc >> 1) ^ 0x14
+		else:
+			crc >>= 1
+	return crc ^ 0x1f
+
+def crc16(data):
+	crc = 0xffff
+	for b in data:
+		for i in range(8):
+			if (crc ^ (b >> i)) & 1:
+				crc = (crc >> 1) ^ 0xa001
+			else:
+				crc >>= 1
+	return crc ^ 0xffff
+
+
+#
+# Line decoding
+#
+
+def runs(samples, min_len):
+	# Run length encoding : (symbol, start, length)
+	# Runs shorter than `min_len` samples are the D+ / D- skew at the
+	# transitions (or glitches) and are merged in the following run
+	out = []
+	pos = 0
+	for sym, grp in itertools.groupby(samples):
+		l = sum(1 for _ in grp)
+		if out and (out[-1][2] < min_len):
+			out[-1] = (sym, out[-1][1], out[-1][2] + l)
+		elif out and (out[-1][0] == sym):
+			out[-1] = (sym, out[-1][1], out[-1][2] + l)
+		else:
+			out.append((sym, pos, l))
+		pos += l
+	return out
+
+
+class Packet:
+
+	def __init__(self, start):
+		self.start = start
+		self.end   = None
+		self.pid   = None
+		self.data  = []
+		self.token = None
+		self.err   = None
+
+	@property
+	def ok(self):
+		return self.err is None
+
+	def __str__(self):
+		s = '%9d %9d  %-5s' % (self.start, self.end, PID_NAMES.get(self.pid, '?') if self.pid is not None else '-')
+		if self.token is not None:
+			if self.pid == 0x5:
+				s += ' frame=%d' % self.token
+			else:
+				s += ' addr=%d endp=%d' % (self.token & 0x7f, self.token >> 7)
+		if self.pid in PID_DATA:
+			s += ' len=%d %s' % (len(self.data) - 2, ' '.join('%02x' % b for b in self.data[:-2]))
+		if self.err:
+			s += ' ERR(%s)' % self.err
+		return s
+
+
+def decode_bits(pkt, bits):
+	# SYNC
+	if bits[0:8] != [0, 0, 0, 0, 0, 0, 0, 1]:
+		pkt.err = 'sync'
+		return
+
+	# Bit unstuffing
+	data = []
+	ones = 0
+	for b in bits[8:]:
+		if ones == 6:
+			if b:
+				pkt.err = 'stuffing'
+				return
+			ones = 0
+			continue
+		data.append(b)
+		ones = (ones + 1) if b else 0
+
+	# Bytes
+	if len(data) & 7:
+		pkt.err = 'alignment'
+	data = data[:len(data) & ~7]
+	by = [sum(b << i for i, b in enumerate(data[j:j+8])) for j in range(0, len(data), 8)]
+
+	if not by:
+		pkt.err = pkt.err or 'empty'
+		return
+
+	# PID
+	pid = by[0]
+	if ((pid & 0xf) ^ (pid >> 4)) != 0xf or (pid & 0xf) not in PID_NAMES:
+		pkt.err = pkt.err or 'pid'
+		return
+	pkt.pid = pid & 0xf
+
+	# Content
+	if pkt.pid in PID_TOKEN:
+		if len(by) != 3:
+			pkt.err = pkt.err or 'length'
+			return
+		v = by[1] | (by[2] << 8)
+		pkt.token = v & 0x7ff
+		if crc5(pkt.token) != (v >> 11):
+			pkt.err = pkt.err or 'crc5'
+
+	elif pkt.pid in PID_DATA:
+		if len(by) < 3:
+			pkt.err = pkt.err or 'length'
+			return
+		pkt.data = by[1:]
+		if crc16(by[1:-2]) != (by[-2] | (by[-1] << 8)):
+			pkt.err = pkt.err or 'crc16'
+
+	elif len(by) != 1:
+		pkt.err = pkt.err or 'length'
+
+
+def decode(samples, sample_rate=SAMPLE_RATE):
+	spb = sample_rate / BIT_RATE
+	pkts = []
+	pkt  = None
+	bits = None
+	prev = SYM_SE0
+
+	for sym, start, l in runs(samples, int(spb / 3)):
+		nb = int(round(l / spb))
+
+		if pkt is None:
+			# Idle -> K is the start of the SYNC
+			if (prev == SYM_J) and (sym == SYM_K):
+				pkt  = Packet(start)
+				bits = [0] + [1] * (nb - 1)
+
+		elif sym in (SYM_J, SYM_K):
+			# NRZI: transition is a 0, no transition a 1
+			bits += [0] + [1] * (nb - 1)
+
+			# Idle for too long without EOP
+			if nb > 7:
+				pkt.end = start + l
+				pkt.err = 'no eop'
+				pkts.append(pkt)
+				pkt = None
+
+		else:
+			# SE0 (EOP) or SE1 (error) terminates the packet
+			pkt.end = start + l
+			if sym == SYM_SE0:
+				decode_bits(pkt, bits)
+			else:
+				pkt.err = 'se1'
+			pkts.append(pkt)
+			pkt = None
+
+		prev = sym
+
+	return pkts
+
+
+def load(fn):
+	with open(fn, 'rb') as fh:
+		return [b & 3 for b in fh.read()]
+
+
+#
+# Golden file
+#
+
+def golden_words(pkts):
+	w = []
+	for p in pkts:
+		if p.token is not None:
+			data = [p.token]
+		elif p.pid in PID_DATA:
+			data = p.data
+		else:
+			data = []
+		w.append(p.start)
+		w.append(p.end)
+		w.append((0x80000000 if p.ok else 0) | ((p.pid or 0) << 16) | len(data))
+		w.extend(data)
+	w.append(0xffffffff)
+	return w
+
+
+#
+# Main
+#
+
+def main(argv0, *args):
+	parser = argparse.ArgumentParser(prog=argv0, description='Reference decoder for raw USB line captures')
+	sub = parser.add_subparsers(dest='cmd', required=True)
+
+	p = sub.add_parser('decode', help='Print the decoded packets')
+	p.add_argument('capture')
+
+	p = sub.add_parser('golden', help='Write the golden file for the RX test bench')
+	p.add_argument('capture')
+	p.add_argument('output')
+
+	opts = parser.parse_args(args)
+
+	pkts = decode(load(opts.capture))
+
+	if opts.cmd == 'decode':
+		for p in pkts:
+			print(p)
+		n_err = sum(not p.ok for p in pkts)
+		print('%d packets, %d errors' % (len(pkts), n_err))
+
+	elif opts.cmd == 'golden':
+		with open(opts.output, 'w') as fh:
+			for v in golden_words(pkts):
+				fh.write('%08x\n' % v)
+
+	return 0
+
+
+if __name__ == '__main__':
+	sys.exit(main(*sys.argv))